@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+
+// What symbolizing one frame of a stack costs.
+static void BM_dlfcn_dladdr(benchmark::State& state) {
+  void* addr = reinterpret_cast<void*>(&strtoul);
+  while (state.KeepRunning()) {
+    Dl_info info;
+    benchmark::DoNotOptimize(dladdr(addr, &info));
+  }
+}
+BENCHMARK(BM_dlfcn_dladdr);
+
+// What an unwinder does for each frame it can't find in its cache.
+static void BM_dlfcn_dl_iterate_phdr(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    dl_iterate_phdr([](dl_phdr_info*, size_t, void* data) {
+      ++*static_cast<size_t*>(data);
+      return 0;
+    }, &count);
+    benchmark::DoNotOptimize(count);
+  }
+}
+BENCHMARK(BM_dlfcn_dl_iterate_phdr)->ThreadRange(1, 8);
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#if defined(__BIONIC__)
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Private resolver API used by netd.
+// Mirrors struct __res_params in bionic/libc/dns/include/resolv_params.h.
+struct __res_params {
+  uint16_t sample_validity;
+  uint8_t success_threshold;
+  uint8_t min_samples;
+  uint8_t max_samples;
+  uint16_t max_cache_entries;
+  uint8_t concurrent_servers;
+};
+extern "C" int _resolv_set_nameservers_for_net(unsigned netid, const char** servers,
+                                               unsigned numservers, const char* domains,
+                                               const __res_params* params);
+extern "C" int android_getaddrinfofornet(const char* hostname, const char* servname,
+                                         const addrinfo* hints, unsigned netid, unsigned mark,
+                                         addrinfo** result);
+extern "C" void _resolv_flush_cache_for_net(unsigned netid);
+
+struct FakeDnsConfig {
+  // How long to wait before each reply.
+  int latency_ms = 0;
+  // Drop every nth UDP query; 0 means never.
+  int drop_every = 0;
+  // Reply to UDP queries with TC set and no answers, so the resolver retries over TCP.
+  bool truncate = false;
+};
+
+// A trivial DNS server on port 53 of a loopback address, over both UDP and
+// TCP. It answers every A query with 192.0.2.1 and every AAAA query with
+// 2001:db8::1, except that names whose first label starts with "nx" don't
+// exist: those get NXDOMAIN with an SOA record, which the resolver caches.
+// The resolver always talks to port 53, so this needs to run as root, but it
+// needs no network: every server gets its own address in 127.0.0.0/8.
+class FakeDnsServer {
+ public:
+  FakeDnsServer(const char* addr, const FakeDnsConfig& config) : addr_(addr), config_(config) {}
+
+  bool Start() {
+    udp_fd_ = Bind(SOCK_DGRAM);
+    tcp_fd_ = Bind(SOCK_STREAM);
+    if (udp_fd_ == -1 || tcp_fd_ == -1 || listen(tcp_fd_, 64) == -1) return false;
+    std::thread([this]() { ServeUdp(); }).detach();
+    std::thread([this]() { ServeTcp(); }).detach();
+    return true;
+  }
+
+ private:
+  int Bind(int type) {
+    int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(NAMESERVER_PORT);
+    inet_pton(AF_INET, addr_, &sin.sin_addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  void ServeUdp() {
+    uint8_t buf[PACKETSZ];
+    while (true) {
+      sockaddr_storage from;
+      socklen_t fromlen = sizeof(from);
+      ssize_t n = recvfrom(udp_fd_, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from),
+                           &fromlen);
+      if (n < HFIXEDSZ) continue;
+      if (config_.drop_every > 0 && ++queries_ % config_.drop_every == 0) continue;
+      size_t len = Answer(buf, n, sizeof(buf), config_.truncate);
+      if (len == 0) continue;
+      if (config_.latency_ms == 0) {
+        sendto(udp_fd_, buf, len, 0, reinterpret_cast<sockaddr*>(&from), fromlen);
+        continue;
+      }
+      // Delay the reply without holding up the queries behind it.
+      std::vector<uint8_t> reply(buf, buf + len);
+      std::thread([this, reply, from, fromlen]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config_.latency_ms));
+        sendto(udp_fd_, reply.data(), reply.size(), 0,
+               reinterpret_cast<const sockaddr*>(&from), fromlen);
+      }).detach();
+    }
+  }
+
+  void ServeTcp() {
+    while (true) {
+      int fd = accept4(tcp_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd == -1) continue;
+      std::thread([this, fd]() { ServeTcpConnection(fd); }).detach();
+    }
+  }
+
+  // Serves length-prefixed queries until the resolver closes the connection.
+  void ServeTcpConnection(int fd) {
+    uint8_t buf[2 + PACKETSZ];
+    while (true) {
+      if (!ReadFully(fd, buf, 2)) break;
+      size_t len = (buf[0] << 8) | buf[1];
+      if (len < HFIXEDSZ || len > PACKETSZ || !ReadFully(fd, buf + 2, len)) break;
+      len = Answer(buf + 2, len, PACKETSZ, false);
+      if (len == 0) break;
+      buf[0] = len >> 8;
+      buf[1] = len & 0xff;
+      if (config_.latency_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config_.latency_ms));
+      }
+      if (write(fd, buf, 2 + len) != static_cast<ssize_t>(2 + len)) break;
+    }
+    close(fd);
+  }
+
+  static bool ReadFully(int fd, uint8_t* buf, size_t len) {
+    while (len > 0) {
+      ssize_t n = read(fd, buf, len);
+      if (n <= 0) return false;
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  static uint8_t* PutRecordHeader(uint8_t* p, uint16_t type, size_t rdlen) {
+    *p++ = 0xc0;  // Compressed name pointing at the question.
+    *p++ = HFIXEDSZ;
+    *p++ = type >> 8;
+    *p++ = type & 0xff;
+    *p++ = 0;
+    *p++ = ns_c_in;
+    *p++ = 0;  // TTL of one hour.
+    *p++ = 0;
+    *p++ = 0x0e;
+    *p++ = 0x10;
+    *p++ = 0;
+    *p++ = rdlen;
+    return p;
+  }
+
+  // Turns the query in 'buf' into its answer in place, returning the answer's length.
+  static size_t Answer(uint8_t* buf, size_t len, size_t size, bool truncate) {
+    HEADER* hp = reinterpret_cast<HEADER*>(buf);
+    if (ntohs(hp->qdcount) != 1) return 0;
+
+    // Find the end of the question.
+    size_t pos = HFIXEDSZ;
+    while (pos < len && buf[pos] != 0) pos += buf[pos] + 1;
+    pos += 1 + QFIXEDSZ;
+    if (pos > len) return 0;
+    uint16_t type = (buf[pos - 4] << 8) | buf[pos - 3];
+    bool nx = buf[HFIXEDSZ] >= 2 && buf[HFIXEDSZ + 1] == 'n' && buf[HFIXEDSZ + 2] == 'x';
+
+    hp->qr = 1;
+    hp->ra = 1;
+    hp->tc = 0;
+    hp->rcode = NOERROR;
+    hp->ancount = 0;
+    hp->nscount = 0;
+    hp->arcount = 0;
+    if (truncate) {
+      hp->tc = 1;
+      return pos;
+    }
+
+    if (nx) {
+      // An SOA with empty names and a minimum of one hour, for negative caching.
+      if (pos + 12 + 22 > size) return 0;
+      uint8_t* p = PutRecordHeader(buf + pos, ns_t_soa, 22);
+      memset(p, 0, 22);
+      p[20] = 0x0e;
+      p[21] = 0x10;
+      hp->rcode = NXDOMAIN;
+      hp->nscount = htons(1);
+      return pos + 12 + 22;
+    }
+
+    uint8_t rdata[16];
+    size_t rdlen;
+    if (type == ns_t_a) {
+      rdlen = 4;
+      inet_pton(AF_INET, "192.0.2.1", rdata);
+    } else if (type == ns_t_aaaa) {
+      rdlen = 16;
+      inet_pton(AF_INET6, "2001:db8::1", rdata);
+    } else {
+      return pos;
+    }
+    if (pos + 12 + rdlen > size) return 0;
+
+    uint8_t* p = PutRecordHeader(buf + pos, type, rdlen);
+    memcpy(p, rdata, rdlen);
+    hp->ancount = htons(1);
+    return pos + 12 + rdlen;
+  }
+
+  const char* addr_;
+  const FakeDnsConfig config_;
+  int udp_fd_ = -1;
+  int tcp_fd_ = -1;
+  std::atomic<unsigned> queries_{0};
+};
+
+// Points network 'netid' at fake servers on each of 'addrs', starting them the
+// first time. Every network needs its own addresses.
+static bool SetUpFakeNetwork(unsigned netid, const std::vector<const char*>& addrs,
+                             const FakeDnsConfig& config = FakeDnsConfig(),
+                             uint8_t concurrent_servers = 0) {
+  static std::mutex lock;
+  static std::map<unsigned, bool> networks;
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = networks.find(netid);
+  if (it != networks.end()) return it->second;
+
+  // Resolve in-process rather than through netd, with the cache enabled, and
+  // don't wait the default five seconds for a lost query.
+  setenv("ANDROID_DNS_MODE", "local", 1);
+  setenv("RES_OPTIONS", "timeout:1", 1);
+  bool ok = true;
+  for (const char* addr : addrs) {
+    FakeDnsServer* server = new FakeDnsServer(addr, config);
+    if (!server->Start()) {
+      fprintf(stderr, "couldn't start fake DNS server on %s:53: %s\n", addr, strerror(errno));
+      delete server;
+      ok = false;
+      break;
+    }
+  }
+  if (ok) {
+    __res_params params = {};
+    params.sample_validity = 1800;
+    params.success_threshold = 75;
+    params.concurrent_servers = concurrent_servers;
+    std::vector<const char*> servers(addrs);
+    ok = _resolv_set_nameservers_for_net(netid, servers.data(), servers.size(), "",
+                                         &params) == 0;
+  }
+  networks[netid] = ok;
+  return ok;
+}
+
+static constexpr unsigned kBenchmarkNetId = 30099;
+static constexpr unsigned kSlowNetId = 30100;
+static constexpr unsigned kTruncatingNetId = 30101;
+static constexpr unsigned kLossyNetId = 30102;
+static constexpr unsigned kLossyRacingNetId = 30103;
+
+static bool SetUpFakeNetwork() {
+  return SetUpFakeNetwork(kBenchmarkNetId, { "127.0.0.1" });
+}
+
+static bool SetUpSlowNetwork() {
+  FakeDnsConfig config;
+  config.latency_ms = 1;
+  return SetUpFakeNetwork(kSlowNetId, { "127.0.0.2" }, config);
+}
+
+static bool SetUpTruncatingNetwork() {
+  FakeDnsConfig config;
+  config.truncate = true;
+  return SetUpFakeNetwork(kTruncatingNetId, { "127.0.0.3" }, config);
+}
+
+static bool SetUpLossyNetwork(bool racing) {
+  FakeDnsConfig config;
+  config.drop_every = 10;
+  if (racing) return SetUpFakeNetwork(kLossyRacingNetId, { "127.0.0.5", "127.0.0.6" }, config, 2);
+  return SetUpFakeNetwork(kLossyNetId, { "127.0.0.4" }, config);
+}
+
+static int Lookup(const char* name, unsigned netid, int family = AF_INET) {
+  addrinfo hints = {};
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result;
+  int error = android_getaddrinfofornet(name, nullptr, &hints, netid, 0, &result);
+  if (error == 0) freeaddrinfo(result);
+  return error;
+}
+
+static void Resolve(benchmark::State& state, const char* name, unsigned netid = kBenchmarkNetId,
+                    int family = AF_INET) {
+  if (Lookup(name, netid, family) != 0) {
+    state.SkipWithError("getaddrinfo failed");
+  }
+}
+
+// Returns a name that has never been looked up before.
+static std::string FreshName(const char* prefix = "miss") {
+  static std::atomic<unsigned> serial{0};
+  return prefix + std::to_string(serial++) + ".example.";
+}
+
+// Every thread looks up the same cached name.
+static void BM_resolv_cache_hit(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  Resolve(state, "cached.example.");
+  while (state.KeepRunning()) {
+    Resolve(state, "cached.example.");
+  }
+}
+BENCHMARK(BM_resolv_cache_hit)->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+
+// Every thread looks up its own cached name.
+static void BM_resolv_cache_hit_distinct(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  std::string name = "cached" + std::to_string(state.thread_index) + ".example.";
+  Resolve(state, name.c_str());
+  while (state.KeepRunning()) {
+    Resolve(state, name.c_str());
+  }
+}
+BENCHMARK(BM_resolv_cache_hit_distinct)->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+
+// Every lookup misses the cache and goes to the server, so threads contend on
+// the cache's pending request list and on insertion.
+static void BM_resolv_cache_miss(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str());
+  }
+}
+BENCHMARK(BM_resolv_cache_miss)->Threads(1)->Threads(4)->Threads(16)->UseRealTime();
+
+// Threads share a small set of names that keeps being evicted and fetched
+// again: a mix of hits, misses and waits on another thread's pending query.
+static void BM_resolv_cache_contention(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  unsigned i = state.thread_index;
+  while (state.KeepRunning()) {
+    std::string name = "shared" + std::to_string(i++ % 64) + ".example.";
+    Resolve(state, name.c_str());
+    if (i % 256 == 0 && state.thread_index == 0) _resolv_flush_cache_for_net(kBenchmarkNetId);
+  }
+}
+BENCHMARK(BM_resolv_cache_contention)->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+
+// AF_UNSPEC sends an AAAA and an A query for every name, which a miss sends
+// at once.
+static void BM_resolv_unspec_hit(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  Resolve(state, "cached.example.", kBenchmarkNetId, AF_UNSPEC);
+  while (state.KeepRunning()) {
+    Resolve(state, "cached.example.", kBenchmarkNetId, AF_UNSPEC);
+  }
+}
+BENCHMARK(BM_resolv_unspec_hit);
+
+static void BM_resolv_unspec_miss(benchmark::State& state) {
+  if (!SetUpSlowNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str(), kSlowNetId, AF_UNSPEC);
+  }
+}
+BENCHMARK(BM_resolv_unspec_miss)->UseRealTime();
+
+// A name that doesn't exist is answered from the negative cache.
+static void BM_resolv_negative_cache_hit(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  Lookup("nxcached.example.", kBenchmarkNetId);
+  while (state.KeepRunning()) {
+    if (Lookup("nxcached.example.", kBenchmarkNetId) == 0) {
+      state.SkipWithError("getaddrinfo of a nonexistent name succeeded");
+    }
+  }
+}
+BENCHMARK(BM_resolv_negative_cache_hit)->Threads(1)->Threads(16)->UseRealTime();
+
+static void BM_resolv_negative_cache_miss(benchmark::State& state) {
+  if (!SetUpFakeNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    if (Lookup(FreshName("nx").c_str(), kBenchmarkNetId) == 0) {
+      state.SkipWithError("getaddrinfo of a nonexistent name succeeded");
+    }
+  }
+}
+BENCHMARK(BM_resolv_negative_cache_miss);
+
+// Misses against a server with a round-trip time, where concurrent lookups
+// should overlap rather than queue.
+static void BM_resolv_miss_latency(benchmark::State& state) {
+  if (!SetUpSlowNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str(), kSlowNetId);
+  }
+}
+BENCHMARK(BM_resolv_miss_latency)->Threads(1)->Threads(16)->UseRealTime();
+
+// Every UDP answer is truncated, so every miss is retried over TCP.
+static void BM_resolv_miss_truncated(benchmark::State& state) {
+  if (!SetUpTruncatingNetwork()) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str(), kTruncatingNetId, state.range(0));
+  }
+}
+BENCHMARK(BM_resolv_miss_truncated)->Arg(AF_INET)->Arg(AF_UNSPEC);
+
+// One UDP query in ten is lost and has to time out.
+static void BM_resolv_miss_lossy(benchmark::State& state) {
+  if (!SetUpLossyNetwork(false)) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str(), kLossyNetId);
+  }
+}
+BENCHMARK(BM_resolv_miss_lossy)->UseRealTime();
+
+// The same loss, with queries raced across two servers.
+static void BM_resolv_miss_lossy_racing(benchmark::State& state) {
+  if (!SetUpLossyNetwork(true)) {
+    state.SkipWithError("no fake network");
+    return;
+  }
+  while (state.KeepRunning()) {
+    Resolve(state, FreshName().c_str(), kLossyRacingNetId);
+  }
+}
+BENCHMARK(BM_resolv_miss_lossy_racing)->UseRealTime();
+
+#endif
@@ -17,6 +17,9 @@
 #include <stdio.h>
 #include <stdio_ext.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
 
 #include <benchmark/benchmark.h>
 
@@ -86,3 +89,75 @@ void BM_stdio_fopen_fgets_fclose_no_locking(benchmark::State& state) {
   FopenFgetsFclose(state, true);
 }
 BENCHMARK(BM_stdio_fopen_fgets_fclose_no_locking);
+
+// A 1GiB file of 64-byte lines, created on first use and removed at exit.
+static std::string g_big_file;
+
+static void RemoveBigFile() {
+  unlink(g_big_file.c_str());
+}
+
+static const char* BigFile() {
+  if (g_big_file.empty()) {
+    const char* dir = (access("/data/local/tmp", W_OK) == 0) ? "/data/local/tmp" : "/tmp";
+    g_big_file = std::string(dir) + "/stdio_benchmark_XXXXXX";
+    int fd = mkstemp(&g_big_file[0]);
+    if (fd == -1) abort();
+    atexit(RemoveBigFile);
+
+    std::string chunk;
+    while (chunk.size() < 1024*KB) chunk += std::string(63, 'x') + "\n";
+    for (size_t i = 0; i < 1024; ++i) {
+      if (write(fd, chunk.data(), chunk.size()) != static_cast<ssize_t>(chunk.size())) abort();
+    }
+    close(fd);
+  }
+  return g_big_file.c_str();
+}
+
+template <typename Fn>
+static void ReadBigFile(benchmark::State& state, Fn f, const char* mode, bool fixed_buffer) {
+  const char* path = BigFile();
+  char buf[1024];
+  size_t total = 0;
+  while (state.KeepRunning()) {
+    FILE* fp = fopen(path, mode);
+    __fsetlocking(fp, FSETLOCKING_BYCALLER);
+    if (fixed_buffer) setvbuf(fp, nullptr, _IOFBF, BUFSIZ);
+    total += f(buf, fp);
+    fclose(fp);
+  }
+  state.SetBytesProcessed(total);
+}
+
+static size_t FgetsAll(char* buf, FILE* fp) {
+  size_t n = 0;
+  while (fgets(buf, 1024, fp) != nullptr) n += 64;
+  return n;
+}
+
+static size_t FreadRecords(char* buf, FILE* fp) {
+  size_t n = 0;
+  while (fread(buf, 64, 1, fp) == 1) n += 64;
+  return n;
+}
+
+static void BM_stdio_fgets_1GiB(benchmark::State& state) {
+  ReadBigFile(state, FgetsAll, "re", false);
+}
+BENCHMARK(BM_stdio_fgets_1GiB);
+
+static void BM_stdio_fgets_1GiB_fixed_buffer(benchmark::State& state) {
+  ReadBigFile(state, FgetsAll, "re", true);
+}
+BENCHMARK(BM_stdio_fgets_1GiB_fixed_buffer);
+
+static void BM_stdio_fread_64_1GiB(benchmark::State& state) {
+  ReadBigFile(state, FreadRecords, "re", false);
+}
+BENCHMARK(BM_stdio_fread_64_1GiB);
+
+static void BM_stdio_fread_64_1GiB_fixed_buffer(benchmark::State& state) {
+  ReadBigFile(state, FreadRecords, "re", true);
+}
+BENCHMARK(BM_stdio_fread_64_1GiB_fixed_buffer);
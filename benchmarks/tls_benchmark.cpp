@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <link.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <benchmark/benchmark.h>
+
+// These compare the cost of reaching a thread-local variable through native
+// ELF TLS with what emulated TLS and pthread keys cost. This file is built
+// with -fno-emulated-tls, so thread_local is native here; emulated TLS
+// is exercised by calling its runtime directly, as code built with
+// -femulated-tls does.
+
+static thread_local int tls_native;
+
+static void BM_tls_native_static(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    int* p = &tls_native;
+    benchmark::DoNotOptimize(p);
+    ++*p;
+  }
+}
+BENCHMARK(BM_tls_native_static);
+
+#if defined(__BIONIC__)
+// The path a dlopen()ed library takes: a DTV lookup in __tls_get_addr, here
+// for the TLS block of the object this file is linked into, which has one
+// because of tls_native.
+struct TlsIndex {
+  size_t module_id;
+  size_t offset;
+};
+extern "C" void* __tls_get_addr(const TlsIndex* ti);
+
+static int FindOwnTlsModule(dl_phdr_info* info, size_t size, void* data) {
+  if (size < offsetof(dl_phdr_info, dlpi_tls_modid) + sizeof(info->dlpi_tls_modid)) return 0;
+  ElfW(Addr) addr = reinterpret_cast<ElfW(Addr)>(&FindOwnTlsModule);
+  for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    ElfW(Addr) start = info->dlpi_addr + phdr.p_vaddr;
+    if (phdr.p_type == PT_LOAD && addr >= start && addr - start < phdr.p_memsz) {
+      *static_cast<size_t*>(data) = info->dlpi_tls_modid;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void BM_tls_native_dynamic(benchmark::State& state) {
+  TlsIndex ti = { 0, 0 };
+  dl_iterate_phdr(FindOwnTlsModule, &ti.module_id);
+  if (ti.module_id == 0) {
+    state.SkipWithError("no TLS module id");
+    return;
+  }
+  __tls_get_addr(&ti);  // Take the allocating slow path outside the loop.
+  while (state.KeepRunning()) {
+    int* p = static_cast<int*>(__tls_get_addr(&ti));
+    benchmark::DoNotOptimize(p);
+    ++*p;
+  }
+}
+BENCHMARK(BM_tls_native_dynamic);
+#endif
+
+// The control structure the compiler emits for each variable under
+// -femulated-tls.
+struct __emutls_control {
+  size_t size;
+  size_t align;
+  union {
+    uintptr_t index;
+    void* address;
+  } object;
+  void* value;
+};
+extern "C" void* __emutls_get_address(__emutls_control* control);
+
+static __emutls_control tls_emulated = { sizeof(int), alignof(int), { 0 }, nullptr };
+
+static void BM_tls_emulated(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    int* p = static_cast<int*>(__emutls_get_address(&tls_emulated));
+    benchmark::DoNotOptimize(p);
+    ++*p;
+  }
+}
+BENCHMARK(BM_tls_emulated);
+
+static void BM_tls_pthread_key(benchmark::State& state) {
+  pthread_key_t key;
+  pthread_key_create(&key, NULL);
+  int value = 0;
+  pthread_setspecific(key, &value);
+
+  while (state.KeepRunning()) {
+    int* p = static_cast<int*>(pthread_getspecific(key));
+    benchmark::DoNotOptimize(p);
+    ++*p;
+  }
+
+  pthread_key_delete(key);
+}
+BENCHMARK(BM_tls_pthread_key);
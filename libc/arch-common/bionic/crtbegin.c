@@ -66,6 +66,16 @@ __asm__(PRE "movq %rsp,%rdi; andq $~0xf,%rsp; callq _start_main" POST);
 #undef PRE
 #undef POST
 
+// On arm and arm64 the executable's TLS block sits at a fixed offset from the
+// thread pointer, which bionic's TLS slots already occupy unless the block is
+// aligned past them. This empty section raises the alignment of the
+// executable's TLS segment, if it has one, enough to guarantee that.
+#if defined(__aarch64__)
+__asm__(".section .tbss,\"awT\",%nobits; .p2align 7; .previous");
+#elif defined(__arm__)
+__asm__(".section .tbss,\"awT\",%nobits; .p2align 6; .previous");
+#endif
+
 #include "__dso_handle.h"
 #include "atexit.h"
 #include "pthread_atfork.h"
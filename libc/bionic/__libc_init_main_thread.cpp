@@ -29,6 +29,7 @@
 #include "libc_init_common.h"
 
 #include <limits.h>
+#include <string.h>
 #include <sys/mman.h>
 
 #include <async_safe/log.h>
@@ -36,12 +37,20 @@
 #include "private/KernelArgumentBlock.h"
 #include "private/bionic_arc4random.h"
 #include "private/bionic_auxv.h"
+#include "private/bionic_elf_tls.h"
 #include "private/bionic_globals.h"
+#include "private/bionic_prctl.h"
 #include "pthread_internal.h"
 
 extern "C" int __set_tls(void* ptr);
 extern "C" int __set_tid_address(int* tid_address);
 
+#if defined(__i386__)
+#include <asm/ldt.h>
+extern "C" int __set_thread_area(user_desc*);
+void __init_user_desc(struct user_desc*, bool, void*);
+#endif
+
 // Declared in "private/bionic_ssp.h".
 __attribute__((aligned(PAGE_SIZE)))
 uintptr_t __stack_chk_guard[PAGE_SIZE / sizeof(uintptr_t)] = {0};
@@ -78,6 +87,11 @@ void __libc_init_main_thread(KernelArgumentBlock& args) {
 
   static pthread_internal_t main_thread;
 
+  // Until the static TLS layout is known, the main thread makes do with just
+  // the slots (see __libc_init_main_thread_static_tls).
+  static void* bootstrap_tls[BIONIC_TLS_SLOTS];
+  main_thread.tls = bootstrap_tls;
+
   // The -fstack-protector implementation uses TLS, so make sure that's
   // set up before we call any function that might get a stack check inserted.
   // TLS also needs to be set up before errno (and therefore syscalls) can be used.
@@ -114,3 +128,37 @@ void __libc_init_main_thread(KernelArgumentBlock& args) {
 
   __init_alternate_signal_stack(&main_thread);
 }
+
+// Moves the main thread from its bootstrap TLS slots to a static TLS area
+// laid out for the executable and the libraries loaded with it, and freezes
+// that layout: anything loaded later gets dynamic TLS. This has to happen
+// after those have been relocated, since their TLS initialization images may
+// have relocations, and before any of their code runs.
+void __libc_init_main_thread_static_tls() {
+  __bionic_tls_freeze_static_layout();
+
+  pthread_internal_t* thread = __get_thread();
+  size_t size = BIONIC_ALIGN(__bionic_tls_static_area_size(), PAGE_SIZE);
+  void* area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area == MAP_FAILED) async_safe_fatal("failed to allocate static TLS: %s", strerror(errno));
+  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, area, size, "bionic static TLS");
+
+  void** tls = reinterpret_cast<void**>(static_cast<char*>(area) + __bionic_tls_static_tp_offset());
+  memcpy(tls, thread->tls, BIONIC_TLS_SLOTS * sizeof(void*));
+  tls[TLS_SLOT_SELF] = tls;
+  __bionic_tls_init_static_blocks(tls);
+  thread->tls = tls;
+
+#if defined(__i386__)
+  // Repoint the descriptor %gs already uses rather than taking another one.
+  user_desc tls_descriptor;
+  __init_user_desc(&tls_descriptor, false, tls);
+  if (__set_thread_area(&tls_descriptor) == -1) {
+    async_safe_fatal("failed to move the main thread's TLS: %s", strerror(errno));
+  }
+  // Reload %gs so that the new base takes effect.
+  __asm__ __volatile__("movw %%gs, %%ax; movw %%ax, %%gs" : : : "eax");
+#else
+  __set_tls(tls);
+#endif
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "private/bionic_elf_tls.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include <async_safe/log.h>
+
+#include "private/bionic_globals.h"
+#include "private/bionic_macros.h"
+#include "private/bionic_prctl.h"
+#include "pthread_internal.h"
+
+template <bool write> class ScopedRWLock {
+ public:
+  ScopedRWLock(pthread_rwlock_t* rwlock) : rwlock_(rwlock) {
+    (write ? pthread_rwlock_wrlock : pthread_rwlock_rdlock)(rwlock_);
+  }
+
+  ~ScopedRWLock() {
+    pthread_rwlock_unlock(rwlock_);
+  }
+
+ private:
+  pthread_rwlock_t* rwlock_;
+  DISALLOW_IMPLICIT_CONSTRUCTORS(ScopedRWLock);
+};
+
+typedef ScopedRWLock<true> ScopedWriteLock;
+typedef ScopedRWLock<false> ScopedReadLock;
+
+TlsDtv __bionic_tls_empty_dtv = { 0, 0 };
+
+static inline TlsModules& tls_modules() {
+  return *__libc_globals->tls_modules;
+}
+
+bool __bionic_get_tls_segment(const ElfW(Phdr)* phdr_table, size_t phdr_count,
+                              ElfW(Addr) load_bias, TlsSegment* out) {
+  for (size_t i = 0; i < phdr_count; ++i) {
+    const ElfW(Phdr)& phdr = phdr_table[i];
+    if (phdr.p_type == PT_TLS) {
+      out->size = phdr.p_memsz;
+      out->alignment = MAX(phdr.p_align, 1);
+      out->init_ptr = reinterpret_cast<const void*>(load_bias + phdr.p_vaddr);
+      out->init_size = phdr.p_filesz;
+      return true;
+    }
+  }
+  return false;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+
+bool StaticTlsLayout::reserve_exe_segment(const TlsSegment& segment, ptrdiff_t* offset) {
+  // The executable's block ends at the thread pointer.
+  if (cursor_ != 0) return false;
+  *offset = reserve(segment.size, segment.alignment);
+  return true;
+}
+
+ptrdiff_t StaticTlsLayout::reserve(size_t size, size_t alignment) {
+  cursor_ = BIONIC_ALIGN(cursor_ + size, alignment);
+  alignment_ = MAX(alignment_, alignment);
+  return -static_cast<ptrdiff_t>(cursor_);
+}
+
+size_t StaticTlsLayout::size() const {
+  return tp_offset() + BIONIC_TLS_SLOTS * sizeof(void*);
+}
+
+size_t StaticTlsLayout::tp_offset() const {
+  return BIONIC_ALIGN(cursor_, alignment_);
+}
+
+#else
+
+bool StaticTlsLayout::reserve_exe_segment(const TlsSegment& segment, ptrdiff_t* offset) {
+  // The executable's block starts two words past the thread pointer, rounded
+  // up to its alignment. Our TLS slots are there, so that has to be enough to
+  // skip them.
+  size_t exe_offset = BIONIC_ALIGN(2 * sizeof(void*), segment.alignment);
+  if (exe_offset < BIONIC_TLS_SLOTS * sizeof(void*)) return false;
+  cursor_ = exe_offset + segment.size;
+  alignment_ = MAX(alignment_, segment.alignment);
+  *offset = exe_offset;
+  return true;
+}
+
+ptrdiff_t StaticTlsLayout::reserve(size_t size, size_t alignment) {
+  size_t offset = BIONIC_ALIGN(cursor_, alignment);
+  cursor_ = offset + size;
+  alignment_ = MAX(alignment_, alignment);
+  return offset;
+}
+
+size_t StaticTlsLayout::size() const {
+  return BIONIC_ALIGN(cursor_, alignment_);
+}
+
+size_t StaticTlsLayout::tp_offset() const {
+  return 0;
+}
+
+#endif
+
+static bool grow_modules_locked(TlsModules& modules) {
+  // Use mmap rather than malloc: this runs in the linker, and in static
+  // executables before malloc is initialized.
+  size_t capacity = modules.module_capacity == 0 ? PAGE_SIZE / sizeof(TlsModule)
+                                                 : modules.module_capacity * 2;
+  size_t size = BIONIC_ALIGN(capacity * sizeof(TlsModule), PAGE_SIZE);
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return false;
+  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, p, size, "bionic TLS modules");
+
+  TlsModule* new_modules = static_cast<TlsModule*>(p);
+  if (modules.modules != nullptr) {
+    memcpy(new_modules, modules.modules, modules.module_count * sizeof(TlsModule));
+    munmap(modules.modules, BIONIC_ALIGN(modules.module_capacity * sizeof(TlsModule), PAGE_SIZE));
+  }
+  modules.modules = new_modules;
+  modules.module_capacity = size / sizeof(TlsModule);
+  return true;
+}
+
+size_t __bionic_tls_register_module(const TlsSegment& segment, bool is_executable,
+                                    const char** error) {
+#if defined(__mips__)
+  (void) segment;
+  (void) is_executable;
+  *error = "ELF TLS is not supported on MIPS";
+  return 0;
+#else
+  TlsModules& modules = tls_modules();
+  ScopedWriteLock locker(&modules.rwlock);
+
+  TlsModule module;
+  module.segment = segment;
+  module.in_use = true;
+  module.first_generation = modules.generation.load(std::memory_order_relaxed);
+
+  if (!modules.static_layout_frozen) {
+    // Every thread's static TLS area is page-aligned.
+    if (segment.alignment > PAGE_SIZE) {
+      *error = "TLS segment alignment is larger than a page";
+      return 0;
+    }
+    if (is_executable) {
+      if (modules.module_count != 0 ||
+          !modules.static_layout.reserve_exe_segment(segment, &module.static_offset)) {
+#if defined(__arm__)
+        *error = "executable's TLS segment must be aligned to at least 64 bytes "
+                 "so that it doesn't overlap bionic's TLS slots";
+#elif defined(__aarch64__)
+        *error = "executable's TLS segment must be aligned to at least 128 bytes "
+                 "so that it doesn't overlap bionic's TLS slots";
+#else
+        *error = "executable's TLS segment must be registered first";
+#endif
+        return 0;
+      }
+    } else {
+      module.static_offset = modules.static_layout.reserve(segment.size, segment.alignment);
+    }
+    module.is_static = true;
+  }
+
+  // Take the id of an unloaded library if there is one, so that the table
+  // and the DTVs don't grow with every dlopen()/dlclose() cycle.
+  for (size_t i = 0; i < modules.module_count; ++i) {
+    const TlsModule& old = modules.modules[i];
+    if (!old.in_use && !old.is_static) {
+      modules.modules[i] = module;
+      return i + 1;
+    }
+  }
+
+  if (modules.module_count == modules.module_capacity && !grow_modules_locked(modules)) {
+    *error = "out of memory";
+    return 0;
+  }
+  modules.modules[modules.module_count++] = module;
+  return modules.module_count;
+#endif
+}
+
+void __bionic_tls_unregister_module(size_t module_id) {
+  TlsModules& modules = tls_modules();
+  ScopedWriteLock locker(&modules.rwlock);
+  // The static TLS space a module had isn't reused, so neither is its id.
+  TlsModule& module = modules.modules[module_id - 1];
+  bool is_static = module.is_static;
+  module = TlsModule();
+  module.is_static = is_static;
+  // Every thread's DTV is now stale; each drops the module's block the next
+  // time it takes the slow path.
+  modules.generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool __bionic_tls_get_static_offset(size_t module_id, ptrdiff_t* offset) {
+  TlsModules& modules = tls_modules();
+  ScopedReadLock locker(&modules.rwlock);
+  const TlsModule& module = modules.modules[module_id - 1];
+  if (!module.is_static) return false;
+  *offset = module.static_offset;
+  return true;
+}
+
+const std::atomic<size_t>* __bionic_tls_generation() {
+  return &tls_modules().generation;
+}
+
+void __bionic_tls_freeze_static_layout() {
+  TlsModules& modules = tls_modules();
+  ScopedWriteLock locker(&modules.rwlock);
+  modules.static_layout_frozen = true;
+}
+
+size_t __bionic_tls_static_area_size() {
+  // The layout is frozen before there's a second thread, so there's no
+  // need for the lock.
+  return tls_modules().static_layout.size();
+}
+
+size_t __bionic_tls_static_tp_offset() {
+  return tls_modules().static_layout.tp_offset();
+}
+
+void __bionic_tls_init_static_blocks(void** tp) {
+  TlsModules& modules = tls_modules();
+  ScopedReadLock locker(&modules.rwlock);
+  for (size_t i = 0; i < modules.module_count; ++i) {
+    const TlsModule& module = modules.modules[i];
+    if (!module.in_use || !module.is_static) continue;
+    // The rest of the block is zero because the area is freshly mapped.
+    memcpy(reinterpret_cast<char*>(tp) + module.static_offset, module.segment.init_ptr,
+           module.segment.init_size);
+  }
+}
+
+// Dynamic TLS blocks and DTVs are carved out of chunks of memory that belong
+// to the thread and are all unmapped when it exits. Before that, the blocks of
+// unloaded libraries and outgrown DTVs go on a free list, and are handed out
+// again to allocations they're big and aligned enough for. Memory from the
+// free list isn't zeroed.
+struct TlsArenaChunk {
+  TlsArenaChunk* next;
+  size_t size;
+  size_t used;
+};
+
+// Precedes every allocation.
+struct TlsArenaBlock {
+  size_t size;
+  TlsArenaBlock* next_free;
+};
+
+static constexpr size_t kTlsArenaChunkSize = 16 * PAGE_SIZE;
+
+static void* tls_arena_alloc(pthread_internal_t* thread, size_t size, size_t alignment) {
+  alignment = MAX(alignment, alignof(TlsArenaBlock));
+
+  for (TlsArenaBlock** p = &thread->dynamic_tls_free; *p != nullptr; p = &(*p)->next_free) {
+    TlsArenaBlock* block = *p;
+    if (block->size >= size && reinterpret_cast<uintptr_t>(block + 1) % alignment == 0) {
+      *p = block->next_free;
+      return block + 1;
+    }
+  }
+
+  TlsArenaChunk* chunk = thread->dynamic_tls_arena;
+  if (chunk != nullptr) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(chunk);
+    size_t offset = BIONIC_ALIGN(base + chunk->used + sizeof(TlsArenaBlock), alignment) - base;
+    if (offset + size <= chunk->size) {
+      chunk->used = offset + size;
+      TlsArenaBlock* block = reinterpret_cast<TlsArenaBlock*>(base + offset) - 1;
+      block->size = size;
+      return block + 1;
+    }
+  }
+
+  size_t chunk_size = MAX(kTlsArenaChunkSize,
+                          BIONIC_ALIGN(sizeof(TlsArenaChunk) + sizeof(TlsArenaBlock) +
+                                       alignment + size, PAGE_SIZE));
+  void* p = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    async_safe_fatal("failed to allocate %zu bytes of dynamic TLS: %s", chunk_size,
+                     strerror(errno));
+  }
+  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, p, chunk_size, "bionic dynamic TLS");
+
+  chunk = static_cast<TlsArenaChunk*>(p);
+  chunk->next = thread->dynamic_tls_arena;
+  chunk->size = chunk_size;
+  chunk->used = sizeof(TlsArenaChunk);
+  thread->dynamic_tls_arena = chunk;
+  return tls_arena_alloc(thread, size, alignment);
+}
+
+static void tls_arena_free(pthread_internal_t* thread, void* p) {
+  TlsArenaBlock* block = static_cast<TlsArenaBlock*>(p) - 1;
+  block->next_free = thread->dynamic_tls_free;
+  thread->dynamic_tls_free = block;
+}
+
+void __bionic_tls_free_dynamic(pthread_internal_t* thread) {
+  TlsArenaChunk* chunk = thread->dynamic_tls_arena;
+  while (chunk != nullptr) {
+    TlsArenaChunk* next = chunk->next;
+    munmap(chunk, chunk->size);
+    chunk = next;
+  }
+  thread->dynamic_tls_arena = nullptr;
+  thread->dynamic_tls_free = nullptr;
+  thread->tls[TLS_SLOT_DTV] = &__bionic_tls_empty_dtv;
+}
+
+static inline TlsDtv* __get_tls_dtv() {
+  return static_cast<TlsDtv*>(__get_tls()[TLS_SLOT_DTV]);
+}
+
+__attribute__((noinline))
+static void* tls_get_addr_slow_path(const TlsIndex* ti) {
+  TlsModules& modules = tls_modules();
+  ScopedReadLock locker(&modules.rwlock);
+
+  size_t module_id = ti->module_id;
+  if (module_id == 0 || module_id > modules.module_count ||
+      !modules.modules[module_id - 1].in_use) {
+    async_safe_fatal("invalid TLS module id %zu", module_id);
+  }
+
+  pthread_internal_t* thread = __get_thread();
+  TlsDtv* dtv = __get_tls_dtv();
+  if (module_id > dtv->count) {
+    // Make room for every module that exists now, not just this one.
+    size_t count = modules.module_count;
+    TlsDtv* new_dtv = static_cast<TlsDtv*>(
+        tls_arena_alloc(thread, sizeof(TlsDtv) + count * sizeof(void*), alignof(TlsDtv)));
+    new_dtv->count = count;
+    new_dtv->generation = dtv->generation;
+    memcpy(new_dtv->modules, dtv->modules, dtv->count * sizeof(void*));
+    memset(new_dtv->modules + dtv->count, 0, (count - dtv->count) * sizeof(void*));
+    if (dtv != &__bionic_tls_empty_dtv) tls_arena_free(thread, dtv);
+    __get_tls()[TLS_SLOT_DTV] = new_dtv;
+    dtv = new_dtv;
+  }
+
+  size_t generation = modules.generation.load(std::memory_order_relaxed);
+  if (dtv->generation != generation) {
+    // Drop the blocks of modules unloaded since the DTV was last brought up
+    // to date, including those whose id has been given to another module.
+    // Only the ids of dynamic modules are reused, so those blocks are ours.
+    for (size_t i = 0; i < dtv->count; ++i) {
+      if (dtv->modules[i] == nullptr) continue;
+      const TlsModule& m = modules.modules[i];
+      if (m.in_use && m.first_generation <= dtv->generation) continue;
+      if (m.in_use || !m.is_static) tls_arena_free(thread, dtv->modules[i]);
+      dtv->modules[i] = nullptr;
+    }
+    dtv->generation = generation;
+    if (dtv->modules[module_id - 1] != nullptr) {
+      return static_cast<char*>(dtv->modules[module_id - 1]) + ti->offset;
+    }
+  }
+
+  const TlsModule& module = modules.modules[module_id - 1];
+  char* block;
+  if (module.is_static) {
+    block = reinterpret_cast<char*>(__get_tls()) + module.static_offset;
+  } else {
+    block = static_cast<char*>(
+        tls_arena_alloc(thread, module.segment.size, module.segment.alignment));
+    memcpy(block, module.segment.init_ptr, module.segment.init_size);
+    memset(block + module.segment.init_size, 0, module.segment.size - module.segment.init_size);
+  }
+  dtv->modules[module_id - 1] = block;
+  return block + ti->offset;
+}
+
+extern "C" void* __tls_get_addr(const TlsIndex* ti) {
+  TlsDtv* dtv = __get_tls_dtv();
+  // A module id of 0 wraps around and fails the bounds check too. A DTV
+  // that's older than the latest dlclose() may hold blocks of unloaded
+  // modules, so it has to be brought up to date first.
+  if (__predict_true(ti->module_id - 1 < dtv->count &&
+                     dtv->generation ==
+                         tls_modules().generation.load(std::memory_order_relaxed))) {
+    char* block = static_cast<char*>(dtv->modules[ti->module_id - 1]);
+    if (__predict_true(block != nullptr)) {
+      return block + ti->offset;
+    }
+  }
+  return tls_get_addr_slow_path(ti);
+}
+
+#if defined(__i386__)
+// The x86 general-dynamic sequence passes the TlsIndex in %eax.
+extern "C" __attribute__((__regparm__(1))) void* ___tls_get_addr(const TlsIndex* ti) {
+  return __tls_get_addr(ti);
+}
+#endif
@@ -32,6 +32,9 @@
 #include <sys/types.h>
 #include <link.h>
 
+#include "private/bionic_elf_tls.h"
+#include "private/bionic_tls.h"
+
 /* ld provides this to us in the default link script */
 extern "C" void* __executable_start;
 
@@ -47,13 +50,32 @@ int dl_iterate_phdr(int (*cb)(struct dl_phdr_info* info, size_t size, void* data
   // iterate over, since there's really only a single monolithic blob of
   // code/data, plus optionally a VDSO.
 
+  ElfW(Ehdr)* ehdr_vdso = nullptr;
+#if defined(AT_SYSINFO_EHDR)
+  ehdr_vdso = reinterpret_cast<ElfW(Ehdr)*>(getauxval(AT_SYSINFO_EHDR));
+#endif
+  // Nothing is ever loaded or unloaded.
+  unsigned long long adds = (ehdr_vdso != nullptr) ? 2 : 1;
+
   struct dl_phdr_info exe_info;
   exe_info.dlpi_addr = 0;
   exe_info.dlpi_name = NULL;
   exe_info.dlpi_phdr = reinterpret_cast<ElfW(Phdr)*>(reinterpret_cast<uintptr_t>(ehdr) + ehdr->e_phoff);
   exe_info.dlpi_phnum = ehdr->e_phnum;
+  exe_info.dlpi_adds = adds;
+  exe_info.dlpi_subs = 0;
+  exe_info.dlpi_tls_modid = 0;
+  exe_info.dlpi_tls_data = NULL;
+
+  // The executable is the only TLS module, and its block is in static TLS.
+  TlsSegment tls_segment;
+  ptrdiff_t tls_offset;
+  if (__bionic_get_tls_segment(exe_info.dlpi_phdr, exe_info.dlpi_phnum, 0, &tls_segment) &&
+      __bionic_tls_get_static_offset(1, &tls_offset)) {
+    exe_info.dlpi_tls_modid = 1;
+    exe_info.dlpi_tls_data = reinterpret_cast<char*>(__get_tls()) + tls_offset;
+  }
 
-#if defined(AT_SYSINFO_EHDR)
   // Try the executable first.
   int rc = cb(&exe_info, sizeof(exe_info), data);
   if (rc != 0) {
@@ -61,7 +83,6 @@ int dl_iterate_phdr(int (*cb)(struct dl_phdr_info* info, size_t size, void* data
   }
 
   // Try the VDSO if that didn't work.
-  ElfW(Ehdr)* ehdr_vdso = reinterpret_cast<ElfW(Ehdr)*>(getauxval(AT_SYSINFO_EHDR));
   if (ehdr_vdso == nullptr) {
     // There is no VDSO, so there's nowhere left to look.
     return rc;
@@ -72,6 +93,10 @@ int dl_iterate_phdr(int (*cb)(struct dl_phdr_info* info, size_t size, void* data
   vdso_info.dlpi_name = NULL;
   vdso_info.dlpi_phdr = reinterpret_cast<ElfW(Phdr)*>(reinterpret_cast<char*>(ehdr_vdso) + ehdr_vdso->e_phoff);
   vdso_info.dlpi_phnum = ehdr_vdso->e_phnum;
+  vdso_info.dlpi_adds = adds;
+  vdso_info.dlpi_subs = 0;
+  vdso_info.dlpi_tls_modid = 0;
+  vdso_info.dlpi_tls_data = NULL;
   for (size_t i = 0; i < vdso_info.dlpi_phnum; ++i) {
     if (vdso_info.dlpi_phdr[i].p_type == PT_LOAD) {
       vdso_info.dlpi_addr = (ElfW(Addr)) ehdr_vdso - vdso_info.dlpi_phdr[i].p_vaddr;
@@ -79,8 +104,4 @@ int dl_iterate_phdr(int (*cb)(struct dl_phdr_info* info, size_t size, void* data
     }
   }
   return cb(&vdso_info, sizeof(vdso_info), data);
-#else
-  // There's only the executable to try.
-  return cb(&exe_info, sizeof(exe_info), data);
-#endif
 }
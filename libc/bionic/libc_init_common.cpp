@@ -93,6 +93,7 @@ void __libc_init_globals(KernelArgumentBlock& args) {
   __libc_auxv = args.auxv;
   __libc_globals.initialize();
   __libc_globals.mutate([&args](libc_globals* globals) {
+    globals->tls_modules = args.tls_modules;
     __libc_init_vdso(globals, args);
     __libc_init_setjmp_cookie(globals, args);
     if (__libc_arc4random_has_unlimited_entropy()) {
@@ -272,6 +273,8 @@ static bool __is_unsafe_environment_variable(const char* name) {
     "LD_ORIGIN_PATH",
     "LD_PRELOAD",
     "LD_PROFILE",
+    "LD_PROFILE_FILE",
+    "LD_RELRO_CACHE",
     "LD_SHOW_AUXV",
     "LD_USE_LOAD_BIAS",
     "LOCALDOMAIN",
@@ -36,9 +36,12 @@
 #include <sys/auxv.h>
 #include <sys/mman.h>
 
+#include <async_safe/log.h>
+
 #include "libc_init_common.h"
 #include "pthread_internal.h"
 
+#include "private/bionic_elf_tls.h"
 #include "private/bionic_globals.h"
 #include "private/bionic_page.h"
 #include "private/bionic_tls.h"
@@ -70,6 +73,23 @@ static void apply_gnu_relro() {
   }
 }
 
+static TlsModules g_tls_modules;
+
+static void __libc_init_static_tls() {
+  // A static executable is the only module, and there's no dynamic TLS.
+  ElfW(Phdr)* phdr_start = reinterpret_cast<ElfW(Phdr)*>(getauxval(AT_PHDR));
+  unsigned long int phdr_ct = getauxval(AT_PHNUM);
+
+  TlsSegment segment;
+  if (__bionic_get_tls_segment(phdr_start, phdr_ct, 0, &segment)) {
+    const char* error = nullptr;
+    if (__bionic_tls_register_module(segment, true, &error) == 0) {
+      async_safe_fatal("failed to set up TLS: %s", error);
+    }
+  }
+  __libc_init_main_thread_static_tls();
+}
+
 // The program startup function __libc_init() defined here is
 // used for static executables only (i.e. those that don't depend
 // on shared libraries). It is called from arch-$ARCH/bionic/crtbegin_static.S
@@ -83,11 +103,13 @@ __noreturn void __libc_init(void* raw_args,
                             int (*slingshot)(int, char**, char**),
                             structors_array_t const * const structors) {
   KernelArgumentBlock args(raw_args);
+  args.tls_modules = &g_tls_modules;
   __libc_init_main_thread(args);
 
   // Initializing the globals requires TLS to be available for errno.
   __init_thread_stack_guard(__get_thread());
   __libc_init_globals(args);
+  __libc_init_static_tls();
 
   __libc_init_AT_SECURE(args);
   __libc_init_common(args);
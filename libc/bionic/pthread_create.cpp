@@ -38,6 +38,7 @@
 
 #include <async_safe/log.h>
 
+#include "private/bionic_elf_tls.h"
 #include "private/bionic_macros.h"
 #include "private/bionic_prctl.h"
 #include "private/bionic_ssp.h"
@@ -55,6 +56,7 @@ bool __init_tls(pthread_internal_t* thread) {
   // Slot 0 must point to itself. The x86 Linux kernel reads the TLS from %fs:0.
   thread->tls[TLS_SLOT_SELF] = thread->tls;
   thread->tls[TLS_SLOT_THREAD_ID] = thread;
+  thread->tls[TLS_SLOT_DTV] = &__bionic_tls_empty_dtv;
 
   // Add a guard page before and after.
   size_t allocation_size = BIONIC_TLS_SIZE + 2 * PAGE_SIZE;
@@ -223,21 +225,28 @@ static int __allocate_thread(pthread_attr_t* attr, pthread_internal_t** threadp,
   // To safely access the pthread_internal_t and thread stack, we need to find a 16-byte aligned boundary.
   stack_top = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(stack_top) & ~0xf);
 
+  // The pthread_internal_t is followed by the thread's static TLS area.
+  size_t thread_mapping_size = __pthread_internal_mapping_size();
   pthread_internal_t* thread = static_cast<pthread_internal_t*>(
-      mmap(nullptr, sizeof(pthread_internal_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+      mmap(nullptr, thread_mapping_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
            -1, 0));
   if (thread == MAP_FAILED) {
     munmap(attr->stack_base, mmap_size);
     return EAGAIN;
   }
-  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, thread, sizeof(pthread_internal_t), "pthread_internal_t");
+  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, thread, thread_mapping_size, "pthread_internal_t");
   attr->stack_size = stack_top - reinterpret_cast<uint8_t*>(attr->stack_base);
 
+  char* static_tls = reinterpret_cast<char*>(thread) +
+      BIONIC_ALIGN(sizeof(pthread_internal_t), PAGE_SIZE);
+  thread->tls = reinterpret_cast<void**>(static_tls + __bionic_tls_static_tp_offset());
+  __bionic_tls_init_static_blocks(thread->tls);
+
   thread->mmap_size = mmap_size;
   thread->attr = *attr;
   if (!__init_tls(thread)) {
     if (thread->mmap_size != 0) munmap(thread->attr.stack_base, thread->mmap_size);
-    munmap(thread, sizeof(pthread_internal_t));
+    munmap(thread, thread_mapping_size);
     return EAGAIN;
   }
   __init_thread_stack_guard(thread);
@@ -324,7 +333,7 @@ int pthread_create(pthread_t* thread_out, pthread_attr_t const* attr,
     if (thread->mmap_size != 0) {
       munmap(thread->attr.stack_base, thread->mmap_size);
     }
-    munmap(thread, sizeof(pthread_internal_t));
+    munmap(thread, __pthread_internal_mapping_size());
     async_safe_format_log(ANDROID_LOG_WARN, "libc", "pthread_create failed: clone failed: %s",
                           strerror(errno));
     return clone_errno;
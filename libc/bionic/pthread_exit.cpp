@@ -35,6 +35,8 @@
 
 #include "pthread_internal.h"
 
+#include "private/bionic_elf_tls.h"
+
 extern "C" __noreturn void _exit_with_stack_teardown(void*, size_t);
 extern "C" __noreturn void __exit(int);
 extern "C" int __set_tid_address(int*);
@@ -92,6 +94,9 @@ void pthread_exit(void* return_value) {
     thread->alternate_signal_stack = NULL;
   }
 
+  // Nothing can use the thread's dynamic TLS after its TLS destructors have run.
+  __bionic_tls_free_dynamic(thread);
+
   // Unmap the bionic TLS, including guard pages.
   void* allocation = reinterpret_cast<char*>(thread->bionic_tls) - PAGE_SIZE;
   munmap(allocation, BIONIC_TLS_SIZE + 2 * PAGE_SIZE);
@@ -123,10 +128,10 @@ void pthread_exit(void* return_value) {
       sigprocmask(SIG_SETMASK, &mask, NULL);
 
       void* stack_base = thread->attr.stack_base;
-      munmap(thread, sizeof(pthread_internal_t));
+      munmap(thread, __pthread_internal_mapping_size());
       _exit_with_stack_teardown(stack_base, mmap_size);
     } else {
-      munmap(thread, sizeof(pthread_internal_t));
+      munmap(thread, __pthread_internal_mapping_size());
     }
   }
 
@@ -35,6 +35,7 @@
 
 #include <async_safe/log.h>
 
+#include "private/bionic_elf_tls.h"
 #include "private/bionic_futex.h"
 #include "private/bionic_sdk_version.h"
 #include "private/bionic_tls.h"
@@ -86,12 +87,17 @@ void __pthread_internal_remove(pthread_internal_t* thread) {
   }
 }
 
+size_t __pthread_internal_mapping_size() {
+  return BIONIC_ALIGN(sizeof(pthread_internal_t), PAGE_SIZE) +
+      BIONIC_ALIGN(__bionic_tls_static_area_size(), PAGE_SIZE);
+}
+
 static void __pthread_internal_free(pthread_internal_t* thread) {
   if (thread->mmap_size != 0) {
     // Free mapped space, including thread stack and pthread_internal_t.
     munmap(thread->attr.stack_base, thread->mmap_size);
   }
-  munmap(thread, sizeof(pthread_internal_t));
+  munmap(thread, __pthread_internal_mapping_size());
 }
 
 void __pthread_internal_remove_and_free(pthread_internal_t* thread) {
@@ -55,6 +55,8 @@ enum ThreadJoinState {
 };
 
 class thread_local_dtor;
+struct TlsArenaBlock;
+struct TlsArenaChunk;
 
 class pthread_internal_t {
  public:
@@ -102,7 +104,14 @@ class pthread_internal_t {
 
   thread_local_dtor* thread_local_dtors;
 
-  void* tls[BIONIC_TLS_SLOTS];
+  // The thread pointer: BIONIC_TLS_SLOTS slots in the middle of the thread's
+  // static TLS area, which shares a mapping with this pthread_internal_t.
+  void** tls;
+
+  // Backs the blocks of the thread's dynamic TLS (see bionic_elf_tls.cpp).
+  TlsArenaChunk* dynamic_tls_arena;
+  // Blocks and DTVs it no longer needs, for reuse.
+  TlsArenaBlock* dynamic_tls_free;
 
   pthread_key_data_t key_data[BIONIC_PTHREAD_KEY_COUNT];
 
@@ -118,6 +127,7 @@ class pthread_internal_t {
   bionic_tls* bionic_tls;
 };
 
+__LIBC_HIDDEN__ size_t __pthread_internal_mapping_size();
 __LIBC_HIDDEN__ int __init_thread(pthread_internal_t* thread);
 __LIBC_HIDDEN__ bool __init_tls(pthread_internal_t* thread);
 __LIBC_HIDDEN__ void __init_thread_stack_guard(pthread_internal_t* thread);
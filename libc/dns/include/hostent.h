@@ -58,6 +58,14 @@ struct getnamaddr {
 int _hf_gethtbyaddr(void *, void *, va_list);
 int _hf_gethtbyname(void *, void *, va_list);
 
+/*
+ * Indexed /etc/hosts lookup: a stream of just the lines of the file that may
+ * mention the given name or address, for the usual parsers to read.  NULL if
+ * the index is unavailable, in which case the whole file should be read.
+ */
+FILE *_hf_open_byname(const char *);
+FILE *_hf_open_byaddr(const void *, int);
+
 #ifdef YP
 /* NIS lookup */
 int _yp_gethtbyaddr(void *, void *, va_list);
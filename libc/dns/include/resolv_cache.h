@@ -43,7 +43,14 @@ typedef enum {
     RESOLV_CACHE_UNSUPPORTED,  /* the cache can't handle that kind of queries */
                                /* or the answer buffer is too small */
     RESOLV_CACHE_NOTFOUND,     /* the cache doesn't know about this query */
-    RESOLV_CACHE_FOUND         /* the cache found the answer */
+    RESOLV_CACHE_FOUND,        /* the cache found the answer */
+    RESOLV_CACHE_REFRESH,      /* the cache found the answer, but it is popular */
+                               /* and about to expire: the caller should query */
+                               /* again and pass the result to _resolv_cache_add, */
+                               /* or call _resolv_cache_query_failed, and then */
+                               /* call _resolv_cache_refresh_done */
+    RESOLV_CACHE_PENDING       /* someone else is already asking; only returned */
+                               /* by _resolv_cache_lookup_nowait */
 } ResolvCacheStatus;
 
 __LIBC_HIDDEN__
@@ -55,6 +62,20 @@ _resolv_cache_lookup( unsigned              netid,
                       int                   answersize,
                       int                  *answerlen );
 
+/* as _resolv_cache_lookup, but returns RESOLV_CACHE_PENDING instead of waiting
+ * when another request for the same query is in progress. the caller should
+ * look again later; it mustn't call _resolv_cache_add or _resolv_cache_query_failed
+ * for that query.
+ */
+__LIBC_HIDDEN__
+extern ResolvCacheStatus
+_resolv_cache_lookup_nowait( unsigned              netid,
+                             const void*           query,
+                             int                   querylen,
+                             void*                 answer,
+                             int                   answersize,
+                             int                  *answerlen );
+
 /* add a (query,answer) to the cache, only call if _resolv_cache_lookup
  * did return RESOLV_CACHE_NOTFOUND
  */
@@ -66,6 +87,11 @@ _resolv_cache_add( unsigned              netid,
                    const void*           answer,
                    int                   answerlen );
 
+/* Let another lookup be handed RESOLV_CACHE_REFRESH: only one at a time is */
+__LIBC_HIDDEN__
+extern void
+_resolv_cache_refresh_done(void);
+
 /* Notify the cache a request failed */
 __LIBC_HIDDEN__
 extern void
@@ -73,4 +99,22 @@ _resolv_cache_query_failed( unsigned     netid,
                    const void* query,
                    int         querylen);
 
+/* takes the idle TCP connection to name server 'ns' of the network, if there
+ * is one that hasn't timed out or been closed by the server. returns -1 if
+ * there is none; the caller owns the returned socket either way.
+ */
+__LIBC_HIDDEN__
+extern int
+_resolv_cache_take_tcp_socket( unsigned  netid,
+                               int       ns );
+
+/* hands a connected TCP socket to name server 'ns' back to the network, so
+ * that later queries can reuse it. the socket is closed if it can't be kept.
+ */
+__LIBC_HIDDEN__
+extern void
+_resolv_cache_put_tcp_socket( unsigned  netid,
+                              int       ns,
+                              int       sock );
+
 #endif /* _RESOLV_CACHE_H_ */
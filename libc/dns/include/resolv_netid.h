@@ -90,6 +90,28 @@ struct hostent *android_gethostbynamefornetcontext(const char *, int, const stru
 int android_getaddrinfofornetcontext(const char *, const char *, const struct addrinfo *,
     const struct android_net_context *, struct addrinfo **) __used_in_netd;
 
+/*
+ * Asynchronous getaddrinfo. android_getaddrinfo_async() starts a lookup and
+ * returns 0, or an EAI_* error if it couldn't. While the request is in
+ * progress, wait for android_getaddrinfo_async_fd() to become readable, or
+ * for android_getaddrinfo_async_timeout() milliseconds to pass (-1 means
+ * no timeout), then call android_getaddrinfo_async_process(). The fd may
+ * change with every call, and may be -1 while the lookup waits for the timeout
+ * only. None of these calls block. android_getaddrinfo_async_process() returns 1
+ * while the lookup is in progress and 0 once it is complete, at which point
+ * the fd is -1. android_getaddrinfo_async_finish() frees the request and
+ * returns what getaddrinfo() would have; finishing a request that is still
+ * in progress cancels it and returns EAI_SYSTEM with errno ECANCELED.
+ */
+struct android_getaddrinfo_request;
+int android_getaddrinfo_async(const char *, const char *, const struct addrinfo *,
+    const struct android_net_context *, struct android_getaddrinfo_request **) __used_in_netd;
+int android_getaddrinfo_async_fd(const struct android_getaddrinfo_request *) __used_in_netd;
+int android_getaddrinfo_async_timeout(const struct android_getaddrinfo_request *) __used_in_netd;
+int android_getaddrinfo_async_process(struct android_getaddrinfo_request *) __used_in_netd;
+int android_getaddrinfo_async_finish(struct android_getaddrinfo_request *,
+    struct addrinfo **) __used_in_netd;
+
 /* set name servers for a network */
 extern int _resolv_set_nameservers_for_net(unsigned netid, const char** servers,
         unsigned numservers, const char *domains, const struct __res_params* params) __used_in_netd;
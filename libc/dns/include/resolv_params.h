@@ -41,6 +41,9 @@ struct __res_params {
     uint8_t success_threshold; // 0: disable, value / 100 otherwise
     uint8_t min_samples; // min # samples needed for statistics to be considered meaningful
     uint8_t max_samples; // max # samples taken into account for statistics
+    uint16_t max_cache_entries; // max # answers cached, 0: default (CONFIG_MAX_ENTRIES)
+    // # of usable servers a UDP query is sent to at once, best first; 0 or 1: one at a time
+    uint8_t concurrent_servers;
 };
 
 typedef enum { res_goahead, res_nextns, res_modified, res_done, res_error }
@@ -225,11 +225,23 @@ union res_sockaddr_union {
 
 /*
  * Resolver flags (used to be discrete per-module statics ints).
+ *
+ * RES_F_CACHEONLY deliberately takes the bit that was RES_F__UNUSED: nothing
+ * set or tested it, and _flags is private to libc (res_state is opaque
+ * outside it), so no caller can have depended on it.  RES_F_CACHEMISS lies
+ * above RES_F_LASTMASK.  Both are for android_getaddrinfo_async(), which
+ * replays lookups from the cache.
+ *
+ * android_getaddrinfo_async() and the calls that go with it (resolv_netid.h)
+ * are exported deliberately, in the LIBC_PLATFORM version alongside the
+ * android_net_res_stats_* calls, for netd: they aren't part of the NDK API,
+ * and may change along with netd.
  */
 #define	RES_F_VC	0x00000001	/* socket is TCP */
 #define	RES_F_CONN	0x00000002	/* socket is connected */
 #define	RES_F_EDNS0ERR	0x00000004	/* EDNS0 caused errors */
-#define	RES_F__UNUSED	0x00000008	/* (unused) */
+#define	RES_F_CACHEONLY	0x00000008	/* answer from the cache, never send */
+#define	RES_F_CACHEMISS	0x00000100	/* a RES_F_CACHEONLY lookup missed */
 #define	RES_F_LASTMASK	0x000000F0	/* ordinal server of last res_nsend */
 #define	RES_F_LASTSHIFT	4		/* bit position of LASTMASK "flag" */
 #define	RES_GETLAST(res) (((res)._flags & RES_F_LASTMASK) >> RES_F_LASTSHIFT)
@@ -477,6 +489,8 @@ int		res_nmkquery(res_state, int, const char *, int, int,
 				  const u_char *, int, const u_char *,
 				  u_char *, int);
 int		res_nsend(res_state, const u_char *, int, u_char *, int);
+__LIBC_HIDDEN__ int	res_nsend_pair(res_state, const u_char *, int, u_char *, int,
+				    const u_char *, int, u_char *, int, int *);
 int		res_nsendsigned(res_state, const u_char *, int,
 				     ns_tsig_key *, u_char *, int);
 int		res_findzonecut(res_state, const char *, ns_class, int,
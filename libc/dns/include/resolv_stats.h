@@ -61,6 +61,14 @@ _res_stats_set_sample(struct __res_sample* sample, time_t now, int rcode, int rt
 extern bool
 _res_stats_usable_server(const struct __res_params* params, struct __res_stats* stats);
 
+/* Fills "order" with the indices of the usable servers, best first: highest success rate, then
+ * lowest average RTT, then configured order. Servers without samples rank as perfect. Returns the
+ * number of indices stored.
+ */
+extern int
+_res_stats_rank_servers(struct __res_stats stats[], int nscount, const bool usable_servers[],
+        int order[]);
+
 __BEGIN_DECLS
 /* Aggregates the reachability statistics for the given server based on on the stored samples. */
 extern void
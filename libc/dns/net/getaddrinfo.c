@@ -82,9 +82,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <arpa/nameser.h>
@@ -92,21 +95,26 @@
 #include <ctype.h>
 #include <errno.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
 #include "NetdClientDispatch.h"
 #include "resolv_cache.h"
 #include "resolv_netid.h"
 #include "resolv_private.h"
+#include "res_private.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <syslog.h>
 #include <stdarg.h>
 #include "nsswitch.h"
+#include "hostent.h"
 
 typedef union sockaddr_union {
     struct sockaddr     generic;
@@ -243,6 +251,7 @@ static struct addrinfo *_gethtent(FILE **, const char *,
     const struct addrinfo *);
 static int _files_getaddrinfo(void *, void *, va_list);
 static int _find_src_addr(const struct sockaddr *, struct sockaddr *, unsigned , uid_t);
+static int _find_src_addr_uncached(const struct sockaddr *, struct sockaddr *, unsigned , uid_t);
 
 static int res_queryN(const char *, struct res_target *, res_state);
 static int res_searchN(const char *, struct res_target *, res_state);
@@ -318,10 +327,52 @@ gai_strerror(int ecode)
 	return ai_errlist[ecode];
 }
 
+/*
+ * Every addrinfo we return is preceded by a struct ai_prefix saying how it
+ * was allocated.  Most are allocated one at a time by ai_alloc(), along with
+ * their address.  getanswer() returns its addrinfos in one allocation
+ * instead: a struct ai_block followed by the nodes and then the canonical
+ * name.  The block is freed along with the last of its nodes, as
+ * _rfc6724_sort() may have interleaved them with nodes from elsewhere.
+ */
+struct ai_prefix {
+	struct ai_block *block;	/* NULL if allocated by ai_alloc() */
+};
+
+struct ai_block_node {
+	struct ai_prefix prefix;
+	struct addrinfo ai;
+	union {
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} addr;
+};
+
+struct ai_block {
+	size_t refs;		/* nodes not yet freed */
+	struct ai_block_node nodes[];
+};
+
+/* Allocates a zeroed addrinfo, with room for an address of "addrlen" bytes. */
+static struct addrinfo *
+ai_alloc(size_t addrlen)
+{
+	struct ai_prefix *prefix;
+	struct addrinfo *ai;
+
+	prefix = calloc(1, sizeof(*prefix) + sizeof(*ai) + addrlen);
+	if (prefix == NULL)
+		return NULL;
+	ai = (struct addrinfo *)(void *)(prefix + 1);
+	ai->ai_addr = (struct sockaddr *)(void *)(ai + 1);
+	return ai;
+}
+
 void
 freeaddrinfo(struct addrinfo *ai)
 {
 	struct addrinfo *next;
+	struct ai_prefix *prefix;
 
 #if defined(__BIONIC__)
 	if (ai == NULL) return;
@@ -331,10 +382,17 @@ freeaddrinfo(struct addrinfo *ai)
 
 	do {
 		next = ai->ai_next;
-		if (ai->ai_canonname)
-			free(ai->ai_canonname);
-		/* no need to free(ai->ai_addr) */
-		free(ai);
+		prefix = (struct ai_prefix *)(void *)ai - 1;
+		if (prefix->block != NULL) {
+			/* The canonical name lives in the block too. */
+			if (--prefix->block->refs == 0)
+				free(prefix->block);
+		} else {
+			if (ai->ai_canonname)
+				free(ai->ai_canonname);
+			/* no need to free(ai->ai_addr) */
+			free(prefix);
+		}
 		ai = next;
 	} while (ai);
 }
@@ -398,32 +456,23 @@ bool readBE32(FILE* fp, int32_t* result) {
 }
 
 #if defined(__ANDROID__)
-// Returns 0 on success, else returns on error.
-static int
-android_getaddrinfo_proxy(
-    const char *hostname, const char *servname,
-    const struct addrinfo *hints, struct addrinfo **res, unsigned netid)
+// Returns true if the request can be passed to the proxy at all.
+static bool
+android_getaddrinfo_proxy_serializable(const char *hostname, const char *servname)
 {
-	int success = 0;
-
-	// Clear this at start, as we use its non-NULLness later (in the
-	// error path) to decide if we have to free up any memory we
-	// allocated in the process (before failing).
-	*res = NULL;
-
 	// Bogus things we can't serialize.  Don't use the proxy.  These will fail - let them.
-	if ((hostname != NULL &&
+	return !((hostname != NULL &&
 	     strcspn(hostname, " \n\r\t^'\"") != strlen(hostname)) ||
 	    (servname != NULL &&
-	     strcspn(servname, " \n\r\t^'\"") != strlen(servname))) {
-		return EAI_NODATA;
-	}
-
-	FILE* proxy = android_open_proxy();
-	if (proxy == NULL) {
-		return EAI_SYSTEM;
-	}
+	     strcspn(servname, " \n\r\t^'\"") != strlen(servname)));
+}
 
+// Sends a getaddrinfo request to the proxy. Returns 0 on success, -1 on error.
+static int
+android_getaddrinfo_proxy_send(FILE* proxy,
+    const char *hostname, const char *servname,
+    const struct addrinfo *hints, unsigned netid)
+{
 	netid = __netdClientDispatch.netIdForResolv(netid);
 
 	// Send the request.
@@ -435,13 +484,26 @@ android_getaddrinfo_proxy(
 		    hints == NULL ? -1 : hints->ai_socktype,
 		    hints == NULL ? -1 : hints->ai_protocol,
 		    netid) < 0) {
-		goto exit;
+		return -1;
 	}
 	// literal NULL byte at end, required by FrameworkListener
 	if (fputc(0, proxy) == EOF ||
 	    fflush(proxy) != 0) {
-		goto exit;
+		return -1;
 	}
+	return 0;
+}
+
+// Reads the proxy's answer to a getaddrinfo request. Returns 0 on success, else returns on error.
+static int
+android_getaddrinfo_proxy_recv(FILE* proxy, struct addrinfo **res)
+{
+	int success = 0;
+
+	// Clear this at start, as we use its non-NULLness later (in the
+	// error path) to decide if we have to free up any memory we
+	// allocated in the process (before failing).
+	*res = NULL;
 
 	char buf[4];
 	// read result code for gethostbyaddr
@@ -468,11 +530,10 @@ android_getaddrinfo_proxy(
 			break;
 		}
 
-		struct addrinfo* ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_storage));
+		struct addrinfo* ai = ai_alloc(sizeof(struct sockaddr_storage));
 		if (ai == NULL) {
 			break;
 		}
-		ai->ai_addr = (struct sockaddr*)(ai + 1);
 
 		// struct addrinfo {
 		//	int	ai_flags;	/* AI_PASSIVE, AI_CANONNAME, AI_NUMERICHOST */
@@ -538,10 +599,6 @@ android_getaddrinfo_proxy(
 		freeaddrinfo(ai);
 	}
 exit:
-	if (proxy != NULL) {
-		fclose(proxy);
-	}
-
 	if (success) {
 		return 0;
 	}
@@ -554,6 +611,89 @@ exit:
 	}
 	return EAI_NODATA;
 }
+
+static bool
+readBE32At(const u_char *buf, size_t len, size_t *off, int32_t *result)
+{
+	int32_t tmp;
+
+	if (len < sizeof(tmp) || *off > len - sizeof(tmp)) {
+		return false;
+	}
+	memcpy(&tmp, buf + *off, sizeof(tmp));
+	*off += sizeof(tmp);
+	*result = ntohl(tmp);
+	return true;
+}
+
+// Returns true if "buf" holds the whole of the proxy's answer to a getaddrinfo
+// request, as android_getaddrinfo_proxy_recv() reads it.
+static bool
+android_getaddrinfo_proxy_complete(const u_char *buf, size_t len)
+{
+	char code[5];
+	size_t off = 4;
+	int32_t have_more, addr_len, name_len;
+
+	if (len < 4) {
+		return false;
+	}
+	memcpy(code, buf, 4);
+	code[4] = '\0';
+	if ((int)strtol(code, NULL, 10) != DnsProxyQueryResult) {
+		// Followed by an error code.
+		return len >= 8;
+	}
+	while (1) {
+		if (!readBE32At(buf, len, &off, &have_more)) {
+			return false;
+		}
+		if (have_more == 0) {
+			return true;
+		}
+		// ai_flags, ai_family, ai_socktype and ai_protocol, then the address.
+		off += 16;
+		if (!readBE32At(buf, len, &off, &addr_len)) {
+			return false;
+		}
+		if (addr_len < 0 || (size_t) addr_len > sizeof(struct sockaddr_storage)) {
+			// Bogus; android_getaddrinfo_proxy_recv() will stop here.
+			return true;
+		}
+		off += addr_len;
+		if (!readBE32At(buf, len, &off, &name_len)) {
+			return false;
+		}
+		if (name_len < 0) {
+			return true;
+		}
+		off += name_len;
+	}
+}
+
+// Returns 0 on success, else returns on error.
+static int
+android_getaddrinfo_proxy(
+    const char *hostname, const char *servname,
+    const struct addrinfo *hints, struct addrinfo **res, unsigned netid)
+{
+	int error = EAI_NODATA;
+
+	*res = NULL;
+	if (!android_getaddrinfo_proxy_serializable(hostname, servname)) {
+		return EAI_NODATA;
+	}
+
+	FILE* proxy = android_open_proxy();
+	if (proxy == NULL) {
+		return EAI_SYSTEM;
+	}
+	if (android_getaddrinfo_proxy_send(proxy, hostname, servname, hints, netid) == 0) {
+		error = android_getaddrinfo_proxy_recv(proxy, res);
+	}
+	fclose(proxy);
+	return error;
+}
 #endif
 
 int
@@ -1100,8 +1240,7 @@ get_ai(const struct addrinfo *pai, const struct afd *afd, const char *addr)
 	assert(afd != NULL);
 	assert(addr != NULL);
 
-	ai = (struct addrinfo *)malloc(sizeof(struct addrinfo)
-		+ (afd->a_socklen));
+	ai = ai_alloc(afd->a_socklen);
 	if (ai == NULL)
 		return NULL;
 
@@ -1290,35 +1429,39 @@ ip6_str2scopeid(char *scope, struct sockaddr_in6 *sin6, u_int32_t *scopeid)
 static const char AskedForGot[] =
 	"gethostby*.getanswer: asked for \"%s\", got \"%s\"";
 
-#define BOUNDED_INCR(x) \
-	do { \
-		BOUNDS_CHECK(cp, x); \
-		cp += (x); \
-	} while (/*CONSTCOND*/0)
-
-#define BOUNDS_CHECK(ptr, count) \
-	do { \
-		if (eom - (ptr) < (count)) { h_errno = NO_RECOVERY; return NULL; } \
-	} while (/*CONSTCOND*/0)
+/*
+ * Returns true if the uncompressed name "name" is a valid host name,
+ * leaving its text in "buf".
+ */
+static int
+name_ok(const u_char *name, char *buf, size_t bufsize)
+{
+	return ns_name_ntop(name, buf, bufsize) >= 0 &&
+	    strlen(buf) + 1 < MAXHOSTNAMELEN && res_hnok(buf);
+}
 
+/*
+ * Parses the A and AAAA records of an answer in a single pass, comparing
+ * names in their uncompressed wire form: a name is only converted to text
+ * (and checked with res_hnok()) when it becomes the canonical name or
+ * differs from it, and the records normally share the canonical name.
+ * The resulting addrinfos are carved out of one allocation, see
+ * struct ai_block.  Only the answer section is looked at, and a malformed
+ * record ends it: the addresses before it are still returned.
+ */
 static struct addrinfo *
 getanswer(const querybuf *answer, int anslen, const char *qname, int qtype,
     const struct addrinfo *pai)
 {
 	struct addrinfo sentinel, *cur;
-	struct addrinfo ai;
+	struct ai_block *block = NULL;
+	struct ai_block_node *node;
 	const struct afd *afd;
-	char *canonname;
-	const HEADER *hp;
-	const u_char *cp;
-	int n;
-	const u_char *eom;
-	char *bp, *ep;
-	int type, class, ancount, qdcount;
-	int haveanswer, had_error;
-	char tbuf[MAXDNAME];
-	int (*name_ok) (const char *);
-	char hostbuf[8*1024];
+	const u_char *base, *eom, *cp;
+	u_char canon[NS_MAXCDNAME], name[NS_MAXCDNAME], first[NS_MAXCDNAME];
+	size_t canonlen, namelen, firstlen = 0;
+	char qbuf[MAXDNAME], tbuf[MAXDNAME];
+	int n, type, class, rdlen, ancount, maxnodes, had_error;
 
 	assert(answer != NULL);
 	assert(qname != NULL);
@@ -1327,96 +1470,82 @@ getanswer(const querybuf *answer, int anslen, const char *qname, int qtype,
 	memset(&sentinel, 0, sizeof(sentinel));
 	cur = &sentinel;
 
-	canonname = NULL;
-	eom = answer->buf + anslen;
 	switch (qtype) {
 	case T_A:
 	case T_AAAA:
 	case T_ANY:	/*use T_ANY only for T_A/T_AAAA lookup*/
-		name_ok = res_hnok;
 		break;
 	default:
 		return NULL;	/* XXX should be abort(); */
 	}
-	/*
-	 * find first satisfactory answer
-	 */
-	hp = &answer->hdr;
-	ancount = ntohs(hp->ancount);
-	qdcount = ntohs(hp->qdcount);
-	bp = hostbuf;
-	ep = hostbuf + sizeof hostbuf;
-	cp = answer->buf;
-	BOUNDED_INCR(HFIXEDSZ);
-	if (qdcount != 1) {
+	if (anslen < HFIXEDSZ || ntohs(answer->hdr.qdcount) != 1) {
 		h_errno = NO_RECOVERY;
-		return (NULL);
+		return NULL;
 	}
-	n = dn_expand(answer->buf, eom, cp, bp, ep - bp);
-	if ((n < 0) || !(*name_ok)(bp)) {
+	base = answer->buf;
+	eom = base + anslen;
+	ancount = ntohs(answer->hdr.ancount);
+
+	/* res_send() has already verified that the query name is the
+	 * same as the one we sent; this just gets the expanded name
+	 * (i.e., with the succeeding search-domain tacked on).
+	 */
+	cp = base + HFIXEDSZ;
+	n = ns_name_unpack2(base, eom, cp, canon, sizeof(canon), &canonlen);
+	if (n < 0 || !name_ok(canon, qbuf, sizeof(qbuf))) {
 		h_errno = NO_RECOVERY;
-		return (NULL);
+		return NULL;
 	}
-	BOUNDED_INCR(n + QFIXEDSZ);
-	if (qtype == T_A || qtype == T_AAAA || qtype == T_ANY) {
-		/* res_send() has already verified that the query name is the
-		 * same as the one we sent; this just gets the expanded name
-		 * (i.e., with the succeeding search-domain tacked on).
-		 */
-		n = strlen(bp) + 1;		/* for the \0 */
-		if (n >= MAXHOSTNAMELEN) {
-			h_errno = NO_RECOVERY;
-			return (NULL);
-		}
-		canonname = bp;
-		bp += n;
-		/* The qname can be abbreviated, but h_name is now absolute. */
-		qname = canonname;
+	/* The qname can be abbreviated, but h_name is now absolute. */
+	qname = qbuf;
+	if (eom - (cp + n) < QFIXEDSZ) {
+		h_errno = NO_RECOVERY;
+		return NULL;
 	}
-	haveanswer = 0;
+	cp += n + QFIXEDSZ;
+	/* However many records the header claims, each takes this much room. */
+	maxnodes = MIN(ancount, (int)((eom - cp) / (1 + RRFIXEDSZ + INADDRSZ)));
+
 	had_error = 0;
 	while (ancount-- > 0 && cp < eom && !had_error) {
-		n = dn_expand(answer->buf, eom, cp, bp, ep - bp);
-		if ((n < 0) || !(*name_ok)(bp)) {
+		n = ns_name_unpack2(base, eom, cp, name, sizeof(name), &namelen);
+		if (n < 0 || (ns_name_eq(name, namelen, canon, canonlen) != 1 &&
+		    !name_ok(name, tbuf, sizeof(tbuf)))) {
 			had_error++;
 			continue;
 		}
 		cp += n;			/* name */
-		BOUNDS_CHECK(cp, 3 * INT16SZ + INT32SZ);
-		type = _getshort(cp);
- 		cp += INT16SZ;			/* type */
-		class = _getshort(cp);
- 		cp += INT16SZ + INT32SZ;	/* class, TTL */
-		n = _getshort(cp);
-		cp += INT16SZ;			/* len */
-		BOUNDS_CHECK(cp, n);
+		if (eom - cp < RRFIXEDSZ) {
+			had_error++;
+			continue;
+		}
+		NS_GET16(type, cp);
+		NS_GET16(class, cp);
+		cp += INT32SZ;			/* TTL */
+		NS_GET16(rdlen, cp);
+		if (eom - cp < rdlen) {
+			had_error++;
+			continue;
+		}
 		if (class != C_IN) {
 			/* XXX - debug? syslog? */
-			cp += n;
+			cp += rdlen;
 			continue;		/* XXX - had_error++ ? */
 		}
-		if ((qtype == T_A || qtype == T_AAAA || qtype == T_ANY) &&
-		    type == T_CNAME) {
-			n = dn_expand(answer->buf, eom, cp, tbuf, sizeof tbuf);
-			if ((n < 0) || !(*name_ok)(tbuf)) {
-				had_error++;
-				continue;
-			}
-			cp += n;
+		if (type == T_CNAME) {
 			/* Get canonical name. */
-			n = strlen(tbuf) + 1;	/* for the \0 */
-			if (n > ep - bp || n >= MAXHOSTNAMELEN) {
+			n = ns_name_unpack2(base, eom, cp, canon, sizeof(canon),
+			    &canonlen);
+			if (n < 0 || !name_ok(canon, tbuf, sizeof(tbuf))) {
 				had_error++;
 				continue;
 			}
-			strlcpy(bp, tbuf, (size_t)(ep - bp));
-			canonname = bp;
-			bp += n;
+			cp += n;
 			continue;
 		}
 		if (qtype == T_ANY) {
 			if (!(type == T_A || type == T_AAAA)) {
-				cp += n;
+				cp += rdlen;
 				continue;
 			}
 		} else if (type != qtype) {
@@ -1425,68 +1554,78 @@ getanswer(const querybuf *answer, int anslen, const char *qname, int qtype,
 	       "gethostby*.getanswer: asked for \"%s %s %s\", got type \"%s\"",
 				       qname, p_class(C_IN), p_type(qtype),
 				       p_type(type));
-			cp += n;
+			cp += rdlen;
 			continue;		/* XXX - had_error++ ? */
 		}
-		switch (type) {
-		case T_A:
-		case T_AAAA:
-			if (strcasecmp(canonname, bp) != 0) {
+		if (ns_name_eq(name, namelen, canon, canonlen) != 1) {
+			char cbuf[MAXDNAME];
+			if (ns_name_ntop(canon, cbuf, sizeof(cbuf)) >= 0)
 				syslog(LOG_NOTICE|LOG_AUTH,
-				       AskedForGot, canonname, bp);
-				cp += n;
-				continue;	/* XXX - had_error++ ? */
-			}
-			if (type == T_A && n != INADDRSZ) {
-				cp += n;
-				continue;
-			}
-			if (type == T_AAAA && n != IN6ADDRSZ) {
-				cp += n;
+				       AskedForGot, cbuf, tbuf);
+			cp += rdlen;
+			continue;	/* XXX - had_error++ ? */
+		}
+		if ((type == T_A && rdlen != INADDRSZ) ||
+		    (type == T_AAAA && rdlen != IN6ADDRSZ)) {
+			cp += rdlen;
+			continue;
+		}
+		if (type == T_AAAA) {
+			struct in6_addr in6;
+			memcpy(&in6, cp, IN6ADDRSZ);
+			if (IN6_IS_ADDR_V4MAPPED(&in6)) {
+				cp += rdlen;
 				continue;
 			}
-			if (type == T_AAAA) {
-				struct in6_addr in6;
-				memcpy(&in6, cp, IN6ADDRSZ);
-				if (IN6_IS_ADDR_V4MAPPED(&in6)) {
-					cp += n;
-					continue;
-				}
-			}
-			if (!haveanswer) {
-				int nn;
-
-				canonname = bp;
-				nn = strlen(bp) + 1;	/* for the \0 */
-				bp += nn;
-			}
+		}
+		afd = find_afd((type == T_A) ? AF_INET : AF_INET6);
+		if (afd == NULL) {
+			cp += rdlen;
+			continue;
+		}
 
-			/* don't overwrite pai */
-			ai = *pai;
-			ai.ai_family = (type == T_A) ? AF_INET : AF_INET6;
-			afd = find_afd(ai.ai_family);
-			if (afd == NULL) {
-				cp += n;
+		if (block == NULL) {
+			/*
+			 * Room for every answer to be an address, and for
+			 * the canonical name: one allocation however many
+			 * records there are.
+			 */
+			block = malloc(sizeof(*block) +
+			    maxnodes * sizeof(block->nodes[0]) +
+			    ((pai->ai_flags & AI_CANONNAME) ? MAXDNAME : 0));
+			if (block == NULL) {
+				had_error++;
 				continue;
 			}
-			cur->ai_next = get_ai(&ai, afd, (const char *)cp);
-			if (cur->ai_next == NULL)
-				had_error++;
-			while (cur && cur->ai_next)
-				cur = cur->ai_next;
-			cp += n;
-			break;
-		default:
-			abort();
+			block->refs = 0;
+			/* The owner of the first address is the canonical name. */
+			memcpy(first, name, namelen);
+			firstlen = namelen;
 		}
-		if (!had_error)
-			haveanswer++;
+		node = &block->nodes[block->refs++];
+		/* don't overwrite pai */
+		node->ai = *pai;
+		node->ai.ai_family = afd->a_af;
+		node->ai.ai_addrlen = afd->a_socklen;
+		node->ai.ai_addr = (struct sockaddr *)(void *)&node->addr;
+		node->ai.ai_canonname = NULL;
+		node->ai.ai_next = NULL;
+		node->prefix.block = block;
+		memset(&node->addr, 0, sizeof(node->addr));
+		node->ai.ai_addr->sa_family = afd->a_af;
+		memcpy((char *)(void *)&node->addr + afd->a_off, cp,
+		    (size_t)afd->a_addrlen);
+		cur->ai_next = &node->ai;
+		cur = cur->ai_next;
+		cp += rdlen;
 	}
-	if (haveanswer) {
-		if (!canonname)
-			(void)get_canonname(pai, sentinel.ai_next, qname);
-		else
-			(void)get_canonname(pai, sentinel.ai_next, canonname);
+	if (block != NULL) {
+		if ((pai->ai_flags & AI_CANONNAME) != 0) {
+			char *canonname = (char *)(void *)&block->nodes[block->refs];
+			if (firstlen > 0 &&
+			    ns_name_ntop(first, canonname, MAXDNAME) >= 0)
+				sentinel.ai_next->ai_canonname = canonname;
+		}
 		h_errno = NETDB_SUCCESS;
 		return sentinel.ai_next;
 	}
@@ -1779,7 +1918,8 @@ _rfc6724_compare(const void *ptr1, const void* ptr2)
 
 /*ARGSUSED*/
 static int
-_find_src_addr(const struct sockaddr *addr, struct sockaddr *src_addr, unsigned mark, uid_t uid)
+_find_src_addr_uncached(const struct sockaddr *addr, struct sockaddr *src_addr, unsigned mark,
+    uid_t uid)
 {
 	int sock;
 	int ret;
@@ -1830,6 +1970,267 @@ _find_src_addr(const struct sockaddr *addr, struct sockaddr *src_addr, unsigned
 	return 1;
 }
 
+/*
+ * A small cache of _find_src_addr() answers, so that sorting the results of
+ * a lookup that hit the DNS cache, or checking AI_ADDRCONFIG, doesn't cost a
+ * socket, a connect() and a getsockname() per address.  The answers depend
+ * on the routing tables, so the cache is flushed whenever the kernel reports
+ * a change of links, addresses or routes on a netlink socket, which is
+ * drained without blocking on each lookup.  Where such a socket can't be
+ * had, answers are only kept for a second.  A denial (SELinux doesn't let
+ * every domain have one) is remembered, so it's only asked for once; other
+ * failures are retried every SRC_CACHE_TTL seconds.  Children don't inherit
+ * the socket: fork() closes their copy.
+ */
+#define SRC_CACHE_SIZE		64
+#define SRC_CACHE_TTL		30	/* seconds, while changes are monitored */
+#define SRC_CACHE_TTL_BLIND	1	/* seconds, otherwise */
+
+struct src_cache_entry {
+	int valid;
+	unsigned mark;
+	uid_t uid;
+	sockaddr_union dst;	/* port cleared */
+	int result;		/* 1 or 0, as returned by _find_src_addr() */
+	sockaddr_union src;
+	time_t expires;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pid_t pid;		/* process that opened the netlink socket */
+	int nl;			/* netlink socket, or -1 */
+	dev_t nl_dev;		/* and its identity, in case the process */
+	ino_t nl_ino;		/* closed it and reused the number */
+	int nl_denied;		/* we may not have one */
+	time_t nl_retry;	/* when to try again after a failure */
+	unsigned generation;	/* bumped on every flush */
+	struct src_cache_entry entries[SRC_CACHE_SIZE];
+} _src_cache = { .lock = PTHREAD_MUTEX_INITIALIZER, .pid = 0, .nl = -1 };
+
+static void
+_src_cache_flush_locked(void)
+{
+	int i;
+
+	for (i = 0; i < SRC_CACHE_SIZE; i++)
+		_src_cache.entries[i].valid = 0;
+	_src_cache.generation++;
+}
+
+/*
+ * Whether _src_cache.nl is still the socket we opened.  The process may
+ * have closed it behind our back, in which case the number is either
+ * unused or somebody else's, and must be neither read nor closed.
+ */
+static int
+_src_cache_nl_is_ours_locked(void)
+{
+	struct stat st;
+
+	return fstat(_src_cache.nl, &st) == 0 &&
+	    st.st_dev == _src_cache.nl_dev && st.st_ino == _src_cache.nl_ino;
+}
+
+static void
+_src_cache_prefork(void)
+{
+	pthread_mutex_lock(&_src_cache.lock);
+}
+
+static void
+_src_cache_postfork_parent(void)
+{
+	pthread_mutex_unlock(&_src_cache.lock);
+}
+
+/*
+ * A child can't share the parent's netlink socket, as either would drain
+ * notifications the other needs.  It opens its own if it needs one.
+ */
+static void
+_src_cache_postfork_child(void)
+{
+	if (_src_cache.nl != -1 && _src_cache_nl_is_ours_locked())
+		close(_src_cache.nl);
+	_src_cache.nl = -1;
+	pthread_mutex_unlock(&_src_cache.lock);
+}
+
+static void
+_src_cache_init(void)
+{
+	pthread_atfork(_src_cache_prefork, _src_cache_postfork_parent,
+	    _src_cache_postfork_child);
+}
+
+/* Open a netlink socket for the changes that can affect the answers. */
+static void
+_src_cache_open_locked(time_t now)
+{
+	static const struct sockaddr_nl snl = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+		    RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE,
+	};
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	struct stat st;
+	int error;
+
+	if (_src_cache.nl_denied || now < _src_cache.nl_retry)
+		return;
+	pthread_once(&once, _src_cache_init);
+	_src_cache.nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+	    NETLINK_ROUTE);
+	if (_src_cache.nl == -1 ||
+	    bind(_src_cache.nl, (const struct sockaddr *)(const void *)&snl,
+	    sizeof(snl)) == -1 || fstat(_src_cache.nl, &st) == -1) {
+		error = errno;
+		if (_src_cache.nl != -1)
+			close(_src_cache.nl);
+		_src_cache.nl = -1;
+		if (error == EACCES || error == EPERM)
+			_src_cache.nl_denied = 1;
+		else
+			_src_cache.nl_retry = now + SRC_CACHE_TTL;
+		return;
+	}
+	_src_cache.nl_dev = st.st_dev;
+	_src_cache.nl_ino = st.st_ino;
+}
+
+/*
+ * Flush the cache if the routing configuration may have changed since it
+ * was last looked at.
+ */
+static void
+_src_cache_sync_locked(time_t now)
+{
+	char buf[4096];
+	int saved_errno = errno;
+	int changed = 0;
+	ssize_t n;
+
+	if (_src_cache.pid != getpid()) {
+		/* A child the fork handler didn't run in, e.g. after clone(). */
+		if (_src_cache.nl != -1 && _src_cache_nl_is_ours_locked())
+			close(_src_cache.nl);
+		_src_cache.nl = -1;
+		_src_cache.pid = getpid();
+		changed = 1;
+	} else if (_src_cache.nl != -1 && !_src_cache_nl_is_ours_locked()) {
+		/* Notifications may have been missed while it was gone. */
+		_src_cache.nl = -1;
+		changed = 1;
+	}
+	if (_src_cache.nl == -1) {
+		_src_cache_open_locked(now);
+		if (_src_cache.nl != -1)
+			changed = 1;
+	}
+	while (_src_cache.nl != -1) {
+		n = recv(_src_cache.nl, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n > 0 || (n == -1 && errno == ENOBUFS)) {
+			/* A notification, or so many that some were lost. */
+			changed = 1;
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		break;
+	}
+	if (changed)
+		_src_cache_flush_locked();
+	errno = saved_errno;
+}
+
+static time_t
+_src_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+ * Find the source address that will be used if trying to connect to the given
+ * address, as _find_src_addr_uncached() does, consulting the cache first.
+ */
+static int
+_find_src_addr(const struct sockaddr *addr, struct sockaddr *src_addr, unsigned mark, uid_t uid)
+{
+	struct src_cache_entry *e;
+	sockaddr_union dst, src;
+	unsigned h, generation;
+	time_t now;
+	int ret;
+
+	memset(&dst, 0, sizeof(dst));
+	switch (addr->sa_family) {
+	case AF_INET:
+		dst.in.sin_family = AF_INET;
+		dst.in.sin_addr = ((const struct sockaddr_in *)(const void *)addr)->sin_addr;
+		h = dst.in.sin_addr.s_addr;
+		break;
+	case AF_INET6:
+		dst.in6.sin6_family = AF_INET6;
+		dst.in6.sin6_addr = ((const struct sockaddr_in6 *)(const void *)addr)->sin6_addr;
+		dst.in6.sin6_scope_id =
+		    ((const struct sockaddr_in6 *)(const void *)addr)->sin6_scope_id;
+		h = dst.in6.sin6_addr.s6_addr32[0] ^ dst.in6.sin6_addr.s6_addr32[1] ^
+		    dst.in6.sin6_addr.s6_addr32[2] ^ dst.in6.sin6_addr.s6_addr32[3] ^
+		    dst.in6.sin6_scope_id;
+		break;
+	default:
+		/* No known usable source address for non-INET families. */
+		return 0;
+	}
+	h ^= mark ^ (unsigned)uid;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	e = &_src_cache.entries[h % SRC_CACHE_SIZE];
+
+	now = _src_cache_now();
+	pthread_mutex_lock(&_src_cache.lock);
+	_src_cache_sync_locked(now);
+	if (e->valid && e->expires > now && e->mark == mark && e->uid == uid &&
+	    memcmp(&e->dst, &dst, sizeof(dst)) == 0) {
+		ret = e->result;
+		if (ret == 1 && src_addr)
+			memcpy(src_addr, &e->src, (e->src.generic.sa_family == AF_INET6) ?
+			    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		pthread_mutex_unlock(&_src_cache.lock);
+		return ret;
+	}
+	generation = _src_cache.generation;
+	pthread_mutex_unlock(&_src_cache.lock);
+
+	memset(&src, 0, sizeof(src));
+	ret = _find_src_addr_uncached(addr, &src.generic, mark, uid);
+	if (ret == -1)
+		return ret;
+	if (ret == 1 && src_addr)
+		memcpy(src_addr, &src, (src.generic.sa_family == AF_INET6) ?
+		    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+
+	pthread_mutex_lock(&_src_cache.lock);
+	/* Don't cache an answer that a flush since the lookup may have outdated. */
+	if (_src_cache.generation != generation) {
+		pthread_mutex_unlock(&_src_cache.lock);
+		return ret;
+	}
+	e->valid = 1;
+	e->mark = mark;
+	e->uid = uid;
+	e->dst = dst;
+	e->result = ret;
+	e->src = src;
+	e->expires = now + ((_src_cache.nl != -1) ? SRC_CACHE_TTL : SRC_CACHE_TTL_BLIND);
+	pthread_mutex_unlock(&_src_cache.lock);
+	return ret;
+}
+
 /*
  * Sort the linked list starting at sentinel->ai_next in RFC6724 order.
  * Will leave the list unchanged if an error occurs.
@@ -2124,7 +2525,8 @@ _files_getaddrinfo(void *rv, void *cb_data, va_list ap)
 	memset(&sentinel, 0, sizeof(sentinel));
 	cur = &sentinel;
 
-	_sethtent(&hostf);
+	if ((hostf = _hf_open_byname(name)) == NULL)
+		_sethtent(&hostf);
 	while ((p = _gethtent(&hostf, name, pai)) != NULL) {
 		cur->ai_next = p;
 		while (cur && cur->ai_next)
@@ -2157,7 +2559,8 @@ res_queryN(const char *name, /* domain name */ struct res_target *target,
 	u_char buf[MAXPACKET];
 	HEADER *hp;
 	int n;
-	struct res_target *t;
+	struct res_target *t, *paired;
+	int paired_n;
 	int rcode;
 	int ancount;
 
@@ -2166,6 +2569,8 @@ res_queryN(const char *name, /* domain name */ struct res_target *target,
 
 	rcode = NOERROR;
 	ancount = 0;
+	paired = NULL;
+	paired_n = -1;
 
 	for (t = target; t; t = t->next) {
 		int class, type;
@@ -2173,6 +2578,11 @@ res_queryN(const char *name, /* domain name */ struct res_target *target,
 		int anslen;
 
 		hp = (HEADER *)(void *)t->answer;
+		if (t == paired) {
+			/* Already sent alongside the previous target. */
+			n = paired_n;
+			goto answered;
+		}
 		hp->rcode = NOERROR;	/* default */
 
 		/* make it easier... */
@@ -2199,18 +2609,47 @@ res_queryN(const char *name, /* domain name */ struct res_target *target,
 			h_errno = NO_RECOVERY;
 			return n;
 		}
-		n = res_nsend(res, buf, n, answer, anslen);
-#if 0
-		if (n < 0) {
-#ifdef DEBUG
-			if (res->options & RES_DEBUG)
-				printf(";; res_query: send error\n");
+		if (t->next != NULL && t->next->next == NULL) {
+			/*
+			 * Send the last two targets (the AAAA and A queries
+			 * for AF_UNSPEC) at once rather than one after the
+			 * other.  The second query goes in the rest of "buf".
+			 */
+			struct res_target *t2 = t->next;
+			u_char *buf2 = buf + n;
+			int n2;
+
+			n2 = res_nmkquery(res, QUERY, name, t2->qclass,
+			    t2->qtype, NULL, 0, NULL, buf2, sizeof(buf) - n);
+#ifdef RES_USE_EDNS0
+			if (n2 > 0 && (res->options & RES_USE_EDNS0) != 0)
+				n2 = res_nopt(res, n2, buf2, sizeof(buf) - n,
+				    t2->anslen);
+#endif
+			if (n2 > 0) {
+				/* The replies are told apart by ID. */
+				if (((HEADER *)(void *)buf2)->id == ((HEADER *)(void *)buf)->id)
+					((HEADER *)(void *)buf2)->id ^= htons(1);
+				((HEADER *)(void *)t2->answer)->rcode = NOERROR;
+				n = res_nsend_pair(res, buf, n, answer, anslen,
+				    buf2, n2, t2->answer, t2->anslen, &paired_n);
+				paired = t2;
+				goto answered;
+			}
+		}
+		n = res_nsend(res, buf, n, answer, anslen);
+#if 0
+		if (n < 0) {
+#ifdef DEBUG
+			if (res->options & RES_DEBUG)
+				printf(";; res_query: send error\n");
 #endif
 			h_errno = TRY_AGAIN;
 			return n;
 		}
 #endif
 
+ answered:
 		if (n < 0 || hp->rcode != NOERROR || ntohs(hp->ancount) == 0) {
 			rcode = hp->rcode;	/* record most recent error */
 #ifdef DEBUG
@@ -2445,3 +2884,1306 @@ res_querydomainN(const char *name, const char *domain,
 	}
 	return res_queryN(longname, target, res);
 }
+
+/*
+ * Asynchronous getaddrinfo.
+ *
+ * Names that can be answered without the network (NULL and numeric hosts,
+ * names in the hosts file) complete as soon as the request is submitted.
+ * When netd proxies DNS, the request is written to it at once, and its
+ * reply is read as it arrives without blocking.
+ *
+ * Otherwise the queries android_getaddrinfofornetcontext() would send for
+ * each name of the search list are built here and looked up in the cache,
+ * and the misses are sent over a non-blocking socket the caller polls, to
+ * the servers in the order res_send ranks them.  A query that somebody else
+ * is already asking waits for their answer to reach the cache instead.  The
+ * answers are added to the cache as they arrive.  Once a name has been
+ * answered, or the search list is exhausted, the lookup is replayed with
+ * RES_F_CACHEONLY set: it finds everything it needs in the cache, never
+ * touches the network, and builds exactly the result getaddrinfo() would
+ * have.  A truncated answer is asked for again over TCP, from the server
+ * that truncated it, one query at a time.  The rare lookups that can't be
+ * done any of those ways (answers the cache won't keep, retries without
+ * EDNS0, TCP failures, host aliases, query hooks) are queued for a single
+ * worker thread running the synchronous lookup, and the caller waits for
+ * the job's eventfd instead.  The worker exits when it has been idle for a
+ * while; when its queue is full, the lookup fails with EAI_AGAIN.
+ */
+
+#define ASYNC_MAXQUERIES	2
+/* How often to look for the answer to a query somebody else is asking. */
+#define ASYNC_WAIT_POLL_MS	50
+/* How long to wait for them, as PENDING_REQUEST_TIMEOUT in res_cache.c. */
+#define ASYNC_WAIT_LIMIT	20
+/* The most we'll buffer of the proxy's reply. */
+#define ASYNC_MAXPROXYREPLY	65536
+/* How often to see whether a TCP connection has been established. */
+#define ASYNC_TCP_POLL_MS	10
+/* The most lookups queued for the worker, and how long it stays idle. */
+#define ASYNC_MAXJOBS		32
+#define ASYNC_WORKER_IDLE_SEC	10
+
+enum {
+	ASYNC_Q_WAITING,	/* somebody else is asking: look in the cache */
+	ASYNC_Q_PENDING,	/* waiting for an answer from the network */
+	ASYNC_Q_DONE
+};
+
+struct android_getaddrinfo_query {
+	u_char buf[PACKETSZ];
+	int buflen;
+	int state;
+	int owned;		/* the cache is waiting for our answer */
+	int sent;		/* sent to the current server */
+	int bad;		/* the current server failed this query */
+	int sampled;		/* the current server's stats have been told */
+	struct timespec start;	/* when it was sent, or started waiting */
+	int rcode;		/* -1 if there was no answer */
+	int ancount;
+	int tc;
+	int ns;			/* the server that answered */
+};
+
+/*
+ * A synchronous lookup queued for the worker thread.  The request and the
+ * queue each hold a reference, so that either can go first.
+ */
+struct android_getaddrinfo_job {
+	struct android_getaddrinfo_job *next;
+	pthread_mutex_t lock;
+	int refs;
+	int efd;		/* readable once the lookup is done */
+	char *hostname;
+	char *servname;
+	struct addrinfo hints;
+	int has_hints;
+	struct android_net_context netcontext;
+	int done;
+	int error;
+	struct addrinfo *result;
+};
+
+struct android_getaddrinfo_request {
+	char *hostname;
+	char *servname;
+	struct addrinfo hints;
+	int has_hints;
+	struct android_net_context netcontext;
+
+	int done;
+	int error;
+	struct addrinfo *result;
+
+	FILE *proxy;
+	u_char *reply;		/* what the proxy has sent so far */
+	size_t replylen;
+	size_t replysize;
+
+	struct android_getaddrinfo_job *job;
+
+	res_state res;
+	u_char *answer;		/* MAXPACKET bytes */
+	int qtypes[ASYNC_MAXQUERIES];
+	int nqtypes;
+	int candidate;		/* index of the next name of the search list */
+	int positive;		/* some name got an address */
+	int sock;
+	int order[MAXNS];	/* the usable servers, best first */
+	int norder;
+	int revision_id;	/* of the servers' stats */
+	int max_samples;
+	int attempt;
+	struct timespec deadline;
+	struct android_getaddrinfo_query q[ASYNC_MAXQUERIES];
+	int nq;
+
+	int tcp;		/* the query being asked over TCP, or -1 */
+	int tcpsent;		/* the connection is up and the query sent */
+	u_char tcphdr[2];	/* the answer's length */
+	size_t tcpread;		/* bytes of the length and answer read */
+};
+
+static pthread_mutex_t _async_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _async_worker_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t _async_worker_once = PTHREAD_ONCE_INIT;
+static struct android_getaddrinfo_job *_async_jobs;	/* oldest first */
+static struct android_getaddrinfo_job **_async_jobs_tail = &_async_jobs;
+static int _async_njobs;
+static struct android_getaddrinfo_job *_async_running;	/* the worker's */
+static int _async_worker;	/* there is a worker thread */
+
+static void
+_async_job_put(struct android_getaddrinfo_job *job)
+{
+	int refs;
+
+	pthread_mutex_lock(&job->lock);
+	refs = --job->refs;
+	pthread_mutex_unlock(&job->lock);
+	if (refs > 0)
+		return;
+	if (job->result != NULL)
+		freeaddrinfo(job->result);
+	if (job->efd >= 0)
+		close(job->efd);
+	pthread_mutex_destroy(&job->lock);
+	free(job->hostname);
+	free(job->servname);
+	free(job);
+}
+
+static void
+_async_job_run(struct android_getaddrinfo_job *job)
+{
+	struct addrinfo *result = NULL;
+	int error, cancelled;
+
+	/* Nobody wants the result of a request finished while it queued. */
+	pthread_mutex_lock(&job->lock);
+	cancelled = (job->refs == 1);
+	pthread_mutex_unlock(&job->lock);
+	if (!cancelled) {
+		error = android_getaddrinfofornetcontext(job->hostname,
+		    job->servname, job->has_hints ? &job->hints : NULL,
+		    &job->netcontext, &result);
+		pthread_mutex_lock(&job->lock);
+		job->error = error;
+		job->result = result;
+		job->done = 1;
+		pthread_mutex_unlock(&job->lock);
+		eventfd_write(job->efd, 1);
+	}
+}
+
+/* Runs the queued lookups one at a time, until it has been idle a while. */
+static void *
+_async_worker_run(void *arg)
+{
+	struct android_getaddrinfo_job *job;
+	struct timespec ts;
+
+	(void)arg;
+	pthread_mutex_lock(&_async_worker_lock);
+	for (;;) {
+		if (_async_jobs == NULL) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += ASYNC_WORKER_IDLE_SEC;
+			while (_async_jobs == NULL &&
+			    pthread_cond_timedwait(&_async_worker_cond,
+			    &_async_worker_lock, &ts) != ETIMEDOUT)
+				continue;
+			if (_async_jobs == NULL)
+				break;
+		}
+		job = _async_jobs;
+		if ((_async_jobs = job->next) == NULL)
+			_async_jobs_tail = &_async_jobs;
+		_async_njobs--;
+		_async_running = job;
+		pthread_mutex_unlock(&_async_worker_lock);
+
+		_async_job_run(job);
+
+		/* Together, so that fork() sees the job either running or gone. */
+		pthread_mutex_lock(&_async_worker_lock);
+		_async_running = NULL;
+		_async_job_put(job);
+	}
+	_async_worker = 0;
+	pthread_mutex_unlock(&_async_worker_lock);
+	return NULL;
+}
+
+static void
+_async_worker_prefork(void)
+{
+	pthread_mutex_lock(&_async_worker_lock);
+}
+
+static void
+_async_worker_postfork_parent(void)
+{
+	pthread_mutex_unlock(&_async_worker_lock);
+}
+
+/*
+ * The worker doesn't survive fork(), and starting another here isn't safe:
+ * fail the child's copies of the lookups it had, rather than leave their
+ * requests waiting forever.
+ */
+static void
+_async_worker_postfork_child(void)
+{
+	struct android_getaddrinfo_job *job;
+
+	if ((job = _async_running) != NULL)
+		job->next = _async_jobs;
+	else
+		job = _async_jobs;
+	while (job != NULL) {
+		struct android_getaddrinfo_job *next = job->next;
+
+		pthread_mutex_init(&job->lock, NULL);
+		if (!job->done) {
+			job->error = EAI_AGAIN;
+			job->done = 1;
+			eventfd_write(job->efd, 1);
+		}
+		_async_job_put(job);
+		job = next;
+	}
+	_async_jobs = _async_running = NULL;
+	_async_jobs_tail = &_async_jobs;
+	_async_njobs = 0;
+	_async_worker = 0;
+	pthread_cond_init(&_async_worker_cond, NULL);
+	pthread_mutex_unlock(&_async_worker_lock);
+}
+
+static void
+_async_worker_init(void)
+{
+	pthread_atfork(_async_worker_prefork, _async_worker_postfork_parent,
+	    _async_worker_postfork_child);
+}
+
+/*
+ * Queues "job" for the worker, starting one if there isn't one.  Returns 0,
+ * or an EAI_* error.
+ */
+static int
+_async_worker_queue(struct android_getaddrinfo_job *job)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t set, old;
+	int error = 0;
+
+	pthread_once(&_async_worker_once, _async_worker_init);
+	pthread_mutex_lock(&_async_worker_lock);
+	if (_async_njobs >= ASYNC_MAXJOBS) {
+		error = EAI_AGAIN;
+	} else if (!_async_worker) {
+		/* The worker mustn't run anybody's signal handlers. */
+		sigfillset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, &old);
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, _async_worker_run,
+		    NULL) == 0)
+			_async_worker = 1;
+		else
+			error = EAI_AGAIN;
+		pthread_attr_destroy(&attr);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	if (error == 0) {
+		job->refs++;
+		job->next = NULL;
+		*_async_jobs_tail = job;
+		_async_jobs_tail = &job->next;
+		_async_njobs++;
+		pthread_cond_signal(&_async_worker_cond);
+	}
+	pthread_mutex_unlock(&_async_worker_lock);
+	return error;
+}
+
+static void
+_async_close(struct android_getaddrinfo_request *req)
+{
+	if (req->sock >= 0) {
+		close(req->sock);
+		req->sock = -1;
+	}
+	req->tcp = -1;
+	if (req->proxy != NULL) {
+		fclose(req->proxy);
+		req->proxy = NULL;
+	}
+	free(req->reply);
+	req->reply = NULL;
+	req->replylen = req->replysize = 0;
+	if (req->job != NULL) {
+		_async_job_put(req->job);
+		req->job = NULL;
+	}
+}
+
+static void
+_async_complete(struct android_getaddrinfo_request *req, int error,
+    struct addrinfo *result)
+{
+	_async_close(req);
+	req->error = error;
+	req->result = result;
+	req->done = 1;
+}
+
+/* Tells the cache we won't be answering the queries we took on. */
+static void
+_async_release(struct android_getaddrinfo_request *req)
+{
+	int i;
+
+	for (i = 0; i < req->nq; i++) {
+		if (req->q[i].owned) {
+			_resolv_cache_query_failed(req->netcontext.dns_netid,
+			    req->q[i].buf, req->q[i].buflen);
+			req->q[i].owned = 0;
+		}
+	}
+}
+
+/*
+ * Completes the request with the result of a synchronous lookup, for the
+ * requests that don't need the network at all.
+ */
+static void
+_async_run_sync(struct android_getaddrinfo_request *req)
+{
+	const struct addrinfo *hints = req->has_hints ? &req->hints : NULL;
+	struct addrinfo *result = NULL;
+	int error;
+
+	error = android_getaddrinfofornetcontext(req->hostname, req->servname,
+	    hints, &req->netcontext, &result);
+	_async_complete(req, error, result);
+}
+
+/*
+ * Hands the request to the worker thread running the synchronous lookup,
+ * for the lookups that can't be done without blocking.
+ */
+static void
+_async_run_worker(struct android_getaddrinfo_request *req)
+{
+	struct android_getaddrinfo_job *job;
+	int error;
+
+	_async_release(req);
+	_async_close(req);
+	if ((job = calloc(1, sizeof(*job))) == NULL) {
+		_async_complete(req, EAI_MEMORY, NULL);
+		return;
+	}
+	pthread_mutex_init(&job->lock, NULL);
+	job->refs = 1;
+	job->hints = req->hints;
+	job->has_hints = req->has_hints;
+	job->netcontext = req->netcontext;
+	if ((job->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		_async_job_put(job);
+		_async_complete(req, EAI_SYSTEM, NULL);
+		return;
+	}
+	if ((job->hostname = strdup(req->hostname)) == NULL ||
+	    (req->servname != NULL &&
+	     (job->servname = strdup(req->servname)) == NULL)) {
+		_async_job_put(job);
+		_async_complete(req, EAI_MEMORY, NULL);
+		return;
+	}
+
+	if ((error = _async_worker_queue(job)) != 0) {
+		_async_job_put(job);
+		_async_complete(req, error, NULL);
+		return;
+	}
+	req->job = job;
+}
+
+/*
+ * Completes the request by replaying the lookup from the cache, or hands it
+ * to a worker if something it needs isn't there.
+ */
+static void
+_async_replay(struct android_getaddrinfo_request *req)
+{
+	const struct addrinfo *hints = req->has_hints ? &req->hints : NULL;
+	struct addrinfo *result = NULL;
+	res_state res;
+	int error, miss;
+
+	_async_release(req);
+	if ((res = __res_get_state()) == NULL) {
+		_async_run_worker(req);
+		return;
+	}
+	res->_flags = (res->_flags & ~RES_F_CACHEMISS) | RES_F_CACHEONLY;
+	error = android_getaddrinfofornetcontext(req->hostname, req->servname,
+	    hints, &req->netcontext, &result);
+	/* e.g. an answer with a zero TTL, or one somebody else is refreshing. */
+	miss = (res->_flags & RES_F_CACHEMISS) != 0;
+	res->_flags &= ~(RES_F_CACHEONLY | RES_F_CACHEMISS);
+	__res_put_state(res);
+	if (miss) {
+		if (result != NULL)
+			freeaddrinfo(result);
+		_async_run_worker(req);
+		return;
+	}
+	_async_complete(req, error, result);
+}
+
+/* Returns true if the hosts file has an address for the request's name. */
+static int
+_async_in_hosts(const struct android_getaddrinfo_request *req)
+{
+	struct addrinfo ai, *p;
+	FILE *hostf;
+
+	memset(&ai, 0, sizeof(ai));
+	ai.ai_family = req->hints.ai_family;
+	if ((hostf = _hf_open_byname(req->hostname)) == NULL)
+		_sethtent(&hostf);
+	p = _gethtent(&hostf, req->hostname, &ai);
+	_endhtent(&hostf);
+	if (p == NULL)
+		return 0;
+	freeaddrinfo(p);
+	return 1;
+}
+
+/*
+ * Returns the "idx"th name res_searchN() would try for the request's name
+ * in "name": 1 if there is one, 0 if the search list is exhausted, and -1
+ * if that name is too long to be tried.
+ */
+static int
+_async_candidate(const struct android_getaddrinfo_request *req, int idx,
+    char *name, size_t size)
+{
+	const res_state res = req->res;
+	const char *cp, *const *domain;
+	const char *domainname = NULL;
+	u_int dots = 0;
+	int trailing_dot = 0, as_is_first, k = 0;
+	size_t n;
+
+	for (cp = req->hostname; *cp; cp++)
+		dots += (*cp == '.');
+	if (cp > req->hostname && cp[-1] == '.')
+		trailing_dot = 1;
+
+	as_is_first = (dots >= res->ndots);
+	if (as_is_first && idx == k++)
+		goto as_is;
+	if ((!dots && (res->options & RES_DEFNAMES)) ||
+	    (dots && !trailing_dot && (res->options & RES_DNSRCH))) {
+		for (domain = (const char * const *)res->dnsrch; *domain;
+		    domain++) {
+			if (idx == k++) {
+				domainname = *domain;
+				goto as_is;
+			}
+			if (!(res->options & RES_DNSRCH))
+				break;
+		}
+	}
+	if (!as_is_first && idx == k++)
+		goto as_is;
+	return 0;
+
+as_is:
+	/* As res_querydomainN(). */
+	n = strlen(req->hostname);
+	if (domainname != NULL) {
+		if (n + 1 + strlen(domainname) + 1 > size)
+			return -1;
+		snprintf(name, size, "%s.%s", req->hostname, domainname);
+	} else {
+		if (n + 1 > size)
+			return -1;
+		memcpy(name, req->hostname, n + 1);
+		if (n > 0 && name[n - 1] == '.')
+			name[n - 1] = '\0';
+	}
+	return 1;
+}
+
+static void
+_async_answered(struct android_getaddrinfo_request *req,
+    struct android_getaddrinfo_query *q, const u_char *ans, int anslen)
+{
+	if (ans != NULL) {
+		const HEADER *hp = (const HEADER *)(const void *)ans;
+		q->rcode = hp->rcode;
+		q->ancount = ntohs(hp->ancount);
+		q->tc = hp->tc;
+	}
+	if (q->owned) {
+		if (ans != NULL && !q->tc)
+			_resolv_cache_add(req->netcontext.dns_netid, q->buf,
+			    q->buflen, ans, anslen);
+		else
+			_resolv_cache_query_failed(req->netcontext.dns_netid,
+			    q->buf, q->buflen);
+		q->owned = 0;
+	}
+	q->state = ASYNC_Q_DONE;
+}
+
+/*
+ * Looks for the answer to a query somebody else is asking.  If they gave
+ * up, or are taking too long, the query is ours to send.
+ */
+static void
+_async_wait(struct android_getaddrinfo_request *req,
+    struct android_getaddrinfo_query *q)
+{
+	struct timespec now;
+	int anslen = 0;
+
+	switch (_resolv_cache_lookup_nowait(req->netcontext.dns_netid, q->buf,
+	    q->buflen, req->answer, MAXPACKET, &anslen)) {
+	case RESOLV_CACHE_FOUND:
+		_async_answered(req, q, req->answer, anslen);
+		break;
+	case RESOLV_CACHE_REFRESH:
+		/*
+		 * Leave refreshing to the synchronous path: this lookup
+		 * mustn't wait on the network for an answer it already has.
+		 */
+		_resolv_cache_query_failed(req->netcontext.dns_netid,
+		    q->buf, q->buflen);
+		_resolv_cache_refresh_done();
+		_async_answered(req, q, req->answer, anslen);
+		break;
+	case RESOLV_CACHE_NOTFOUND:
+		q->owned = 1;
+		q->state = ASYNC_Q_PENDING;
+		q->sent = 0;
+		break;
+	case RESOLV_CACHE_PENDING:
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - q->start.tv_sec >= ASYNC_WAIT_LIMIT) {
+			/* As _resolv_cache_lookup() after its timeout. */
+			q->owned = 1;
+			q->state = ASYNC_Q_PENDING;
+			q->sent = 0;
+		}
+		break;
+	default:
+		/* The network's cache is gone. */
+		_async_run_worker(req);
+		break;
+	}
+}
+
+/*
+ * Builds the queries for "name" and looks them up in the cache.  Returns 0,
+ * or -1 if the request had to be completed or handed to a worker instead.
+ */
+static int
+_async_build(struct android_getaddrinfo_request *req, const char *name)
+{
+	const res_state res = req->res;
+	struct android_getaddrinfo_query *q;
+	int i, n;
+
+	req->nq = 0;
+	for (i = 0; i < req->nqtypes; i++) {
+		q = &req->q[req->nq];
+		memset(q, 0, sizeof(*q));
+		q->rcode = -1;
+		n = res_nmkquery(res, QUERY, name, C_IN, req->qtypes[i], NULL, 0,
+		    NULL, q->buf, sizeof(q->buf));
+#ifdef RES_USE_EDNS0
+		/* The same bytes as res_queryN(), so the cache keys match. */
+		if (n > 0 && (res->options & RES_USE_EDNS0) != 0)
+			n = res_nopt(res, n, q->buf, sizeof(q->buf), MAXPACKET);
+#endif
+		if (n <= 0) {
+			_async_replay(req);
+			return -1;
+		}
+		q->buflen = n;
+		/* The replies are told apart by ID. */
+		if (i > 0 && ((HEADER *)(void *)q->buf)->id ==
+		    ((HEADER *)(void *)req->q[0].buf)->id)
+			((HEADER *)(void *)q->buf)->id ^= htons(1);
+		req->nq++;
+
+		q->state = ASYNC_Q_WAITING;
+		clock_gettime(CLOCK_MONOTONIC, &q->start);
+		_async_wait(req, q);
+		if (req->done || req->job != NULL)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Adds a sample for the current server to its stats, the first time each
+ * server is tried, as send_query() does.
+ */
+static void
+_async_sample(struct android_getaddrinfo_request *req,
+    struct android_getaddrinfo_query *q, int rcode)
+{
+	struct __res_sample sample;
+	struct timespec now;
+
+	if (q->sampled || req->attempt >= req->norder)
+		return;
+	q->sampled = 1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	_res_stats_set_sample(&sample, time(NULL), rcode,
+	    _res_stats_calculate_rtt(&now, &q->start));
+	_resolv_cache_add_resolver_stats_sample(req->res->netid,
+	    req->revision_id, req->order[req->attempt % req->norder], &sample,
+	    req->max_samples);
+}
+
+/* Sends the pending queries that haven't been sent to the current server. */
+static void
+_async_send_pending(struct android_getaddrinfo_request *req)
+{
+	struct android_getaddrinfo_query *q;
+	int i;
+
+	for (i = 0; i < req->nq; i++) {
+		q = &req->q[i];
+		if (q->state != ASYNC_Q_PENDING || q->sent)
+			continue;
+		q->sent = 1;
+		q->bad = 0;
+		q->sampled = 0;
+		clock_gettime(CLOCK_MONOTONIC, &q->start);
+		if (req->sock < 0 || send(req->sock, q->buf, q->buflen, 0) !=
+		    q->buflen) {
+			q->bad = 1;
+			_async_sample(req, q, RCODE_INTERNAL_ERROR);
+		}
+	}
+}
+
+/*
+ * Sends the pending queries to the server for "attempt", or gives up on
+ * them once every server has had its retries.  The servers are tried in
+ * the order res_send ranks them, ranked afresh with every first attempt.
+ */
+static void
+_async_send(struct android_getaddrinfo_request *req, int attempt)
+{
+	const res_state res = req->res;
+	struct android_getaddrinfo_query *q;
+	struct sockaddr *nsap;
+	socklen_t nsaplen;
+	int i, ns;
+
+	for (i = 0; i < req->nq; i++) {
+		q = &req->q[i];
+		if (q->state == ASYNC_Q_PENDING && q->sent)
+			_async_sample(req, q, RCODE_TIMEOUT);
+	}
+	if (req->sock >= 0) {
+		close(req->sock);
+		req->sock = -1;
+	}
+	if (attempt == 0) {
+		struct __res_stats stats[MAXNS];
+		struct __res_params params;
+		bool usable_servers[MAXNS];
+
+		req->revision_id = _resolv_cache_get_resolver_stats(res->netid,
+		    &params, stats);
+		android_net_res_stats_get_usable_servers(&params, stats,
+		    res->nscount, usable_servers);
+		req->norder = _res_stats_rank_servers(stats, res->nscount,
+		    usable_servers, req->order);
+		req->max_samples = params.max_samples;
+	}
+	if (attempt >= res->retry * req->norder) {
+		for (i = 0; i < req->nq; i++) {
+			q = &req->q[i];
+			if (q->state == ASYNC_Q_PENDING)
+				_async_answered(req, q, NULL, 0);
+		}
+		return;
+	}
+	req->attempt = attempt;
+	ns = req->order[attempt % req->norder];
+
+	nsap = res_get_nsaddr(res, (size_t)ns);
+	nsaplen = (nsap->sa_family == AF_INET6) ?
+	    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	clock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	req->deadline.tv_sec += res_get_timeout(res, ns);
+
+	req->sock = socket(nsap->sa_family,
+	    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (req->sock >= 0 && res->_mark != MARK_UNSET &&
+	    setsockopt(req->sock, SOL_SOCKET, SO_MARK, &res->_mark,
+	    sizeof(res->_mark)) < 0) {
+		close(req->sock);
+		req->sock = -1;
+	}
+	if (req->sock >= 0 && __connect(req->sock, nsap, nsaplen) < 0) {
+		close(req->sock);
+		req->sock = -1;
+	}
+	for (i = 0; i < req->nq; i++)
+		req->q[i].sent = 0;
+	_async_send_pending(req);
+}
+
+/* Reads whatever answers have arrived. */
+static void
+_async_receive(struct android_getaddrinfo_request *req)
+{
+	struct android_getaddrinfo_query *q;
+	const HEADER *hp;
+	ssize_t n;
+	int i;
+
+	if (req->sock < 0)
+		return;
+	for (;;) {
+		n = recv(req->sock, req->answer, MAXPACKET, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* e.g. ECONNREFUSED: try the next server. */
+				for (i = 0; i < req->nq; i++) {
+					q = &req->q[i];
+					if (q->state != ASYNC_Q_PENDING ||
+					    !q->sent)
+						continue;
+					q->bad = 1;
+					_async_sample(req, q,
+					    RCODE_INTERNAL_ERROR);
+				}
+			}
+			return;
+		}
+		if (n < HFIXEDSZ)
+			continue;
+		hp = (const HEADER *)(const void *)req->answer;
+		for (i = 0; i < req->nq; i++) {
+			q = &req->q[i];
+			if (q->state != ASYNC_Q_PENDING || !q->sent ||
+			    hp->id != ((const HEADER *)(const void *)q->buf)->id ||
+			    !res_queriesmatch(q->buf, q->buf + q->buflen,
+			    req->answer, req->answer + n))
+				continue;
+			_async_sample(req, q, hp->rcode);
+			if (hp->rcode == SERVFAIL || hp->rcode == NOTIMP ||
+			    hp->rcode == REFUSED) {
+				/* As send_dg(): ask the next server. */
+				q->rcode = hp->rcode;
+				q->bad = 1;
+			} else {
+				q->ns = req->order[req->attempt % req->norder];
+				_async_answered(req, q, req->answer, (int)n);
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Asks query "idx", whose answer was truncated, again over TCP from the
+ * server that answered it, as send_vc() would.
+ */
+static void
+_async_tcp_start(struct android_getaddrinfo_request *req, int idx)
+{
+	const res_state res = req->res;
+	struct sockaddr *nsap;
+	socklen_t nsaplen;
+	int ns = req->q[idx].ns;
+
+	if (req->sock >= 0)
+		close(req->sock);
+	req->tcp = idx;
+	req->tcpsent = 0;
+	req->tcpread = 0;
+	nsap = res_get_nsaddr(res, (size_t)ns);
+	nsaplen = (nsap->sa_family == AF_INET6) ?
+	    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	clock_gettime(CLOCK_MONOTONIC, &req->deadline);
+	req->deadline.tv_sec += res_get_timeout(res, ns);
+
+	req->sock = socket(nsap->sa_family,
+	    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (req->sock < 0 ||
+	    (res->_mark != MARK_UNSET &&
+	     setsockopt(req->sock, SOL_SOCKET, SO_MARK, &res->_mark,
+	     sizeof(res->_mark)) < 0) ||
+	    (__connect(req->sock, nsap, nsaplen) < 0 &&
+	     errno != EINPROGRESS)) {
+		_async_run_worker(req);
+		return;
+	}
+}
+
+/*
+ * Sends the TCP query once the connection is up.  The caller only waits
+ * for the socket to become readable, so this is tried again every
+ * ASYNC_TCP_POLL_MS until then.
+ */
+static void
+_async_tcp_send(struct android_getaddrinfo_request *req)
+{
+	const struct android_getaddrinfo_query *q = &req->q[req->tcp];
+	u_char buf[INT16SZ + PACKETSZ];
+	ssize_t n;
+
+	ns_put16((u_int)q->buflen, buf);
+	memcpy(buf + INT16SZ, q->buf, (size_t)q->buflen);
+	do {
+		n = send(req->sock, buf, INT16SZ + q->buflen, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+	    errno == ENOTCONN || errno == EINPROGRESS))
+		return;
+	/* A fresh connection takes a whole query, or something's wrong. */
+	if (n != INT16SZ + q->buflen) {
+		_async_run_worker(req);
+		return;
+	}
+	req->tcpsent = 1;
+}
+
+/* Reads what has arrived of the TCP answer, and takes it once it's all there. */
+static void
+_async_tcp_receive(struct android_getaddrinfo_request *req)
+{
+	struct android_getaddrinfo_query *q = &req->q[req->tcp];
+	const HEADER *hp;
+	size_t len = 0;
+	ssize_t n;
+
+	if (!req->tcpsent)
+		return;
+	for (;;) {
+		if (req->tcpread < INT16SZ) {
+			n = recv(req->sock, req->tcphdr + req->tcpread,
+			    INT16SZ - req->tcpread, 0);
+		} else {
+			len = ns_get16(req->tcphdr);
+			/* We'd have to truncate it again. */
+			if (len < HFIXEDSZ || len > MAXPACKET)
+				break;
+			if (req->tcpread == INT16SZ + len)
+				goto answered;
+			n = recv(req->sock,
+			    req->answer + (req->tcpread - INT16SZ),
+			    INT16SZ + len - req->tcpread, 0);
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0)
+			break;
+		req->tcpread += (size_t)n;
+	}
+	_async_run_worker(req);
+	return;
+
+answered:
+	hp = (const HEADER *)(const void *)req->answer;
+	if (hp->tc || hp->id != ((const HEADER *)(const void *)q->buf)->id ||
+	    !res_queriesmatch(q->buf, q->buf + q->buflen, req->answer,
+	    req->answer + len)) {
+		_async_run_worker(req);
+		return;
+	}
+	close(req->sock);
+	req->sock = -1;
+	req->tcp = -1;
+	_resolv_cache_add(req->netcontext.dns_netid, q->buf, q->buflen,
+	    req->answer, (int)len);
+	_async_answered(req, q, req->answer, (int)len);
+}
+
+#if defined(__ANDROID__)
+/* Reads whatever the proxy has sent, and completes the request once it's all there. */
+static void
+_async_proxy_receive(struct android_getaddrinfo_request *req)
+{
+	struct addrinfo *result = NULL;
+	int error = EAI_NODATA;
+	u_char *reply;
+	size_t size;
+	ssize_t n;
+	FILE *fp;
+
+	for (;;) {
+		if (req->replylen == req->replysize) {
+			size = (req->replysize == 0) ? 512 : req->replysize * 2;
+			if (size > ASYNC_MAXPROXYREPLY ||
+			    (reply = realloc(req->reply, size)) == NULL)
+				break;
+			req->reply = reply;
+			req->replysize = size;
+		}
+		n = read(fileno(req->proxy), req->reply + req->replylen,
+		    req->replysize - req->replylen);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0)
+			break;
+		req->replylen += (size_t)n;
+		if (android_getaddrinfo_proxy_complete(req->reply,
+		    req->replylen))
+			break;
+	}
+
+	/* Whatever we have, complete or not, is parsed the way getaddrinfo() would. */
+	if (req->replylen > 0 &&
+	    (fp = fmemopen(req->reply, req->replylen, "r")) != NULL) {
+		error = android_getaddrinfo_proxy_recv(fp, &result);
+		fclose(fp);
+	}
+	_async_complete(req, error, result);
+}
+#endif
+
+static int
+_async_expired(const struct android_getaddrinfo_request *req)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > req->deadline.tv_sec ||
+	    (now.tv_sec == req->deadline.tv_sec &&
+	     now.tv_nsec >= req->deadline.tv_nsec);
+}
+
+/*
+ * Moves the lookup on as far as it can go without waiting: picks up answers
+ * somebody else got, retries queries that failed or timed out, moves to the
+ * next name of the search list, and replays the lookup once there is
+ * nothing left to ask.
+ */
+static void
+_async_advance(struct android_getaddrinfo_request *req)
+{
+	char name[MAXDNAME];
+	struct android_getaddrinfo_query *q;
+	int i, n, waiting, inflight, unsent, bad, stop;
+
+	while (!req->done && req->job == NULL) {
+		if (req->tcp >= 0) {
+			if (!req->tcpsent)
+				_async_tcp_send(req);
+			if (req->tcp >= 0 && req->job == NULL &&
+			    _async_expired(req))
+				_async_run_worker(req);
+			return;
+		}
+
+		waiting = inflight = unsent = bad = 0;
+		for (i = 0; i < req->nq; i++) {
+			q = &req->q[i];
+			if (q->state == ASYNC_Q_WAITING) {
+				_async_wait(req, q);
+				if (req->done || req->job != NULL)
+					return;
+			}
+			if (q->state == ASYNC_Q_WAITING) {
+				waiting++;
+			} else if (q->state == ASYNC_Q_PENDING) {
+				if (!q->sent)
+					unsent++;
+				else {
+					inflight++;
+					bad += q->bad;
+				}
+			}
+		}
+		if (unsent > 0) {
+			/* Join the queries in flight, or start afresh. */
+			if (inflight > 0)
+				_async_send_pending(req);
+			else
+				_async_send(req, 0);
+			continue;
+		}
+		if (inflight > 0) {
+			if (bad < inflight && !_async_expired(req))
+				return;
+			_async_send(req, req->attempt + 1);
+			continue;
+		}
+		if (waiting > 0)
+			return;
+
+		/* Every query for this name has been answered, or not. */
+		for (i = 0; i < req->nq; i++) {
+			if (req->q[i].tc)
+				break;
+		}
+		if (i < req->nq) {
+			_async_tcp_start(req, i);
+			continue;
+		}
+		stop = 0;
+		for (i = 0; i < req->nq; i++) {
+			q = &req->q[i];
+			if (q->rcode == FORMERR) {
+				/* Needs a retry without EDNS0. */
+				_async_run_worker(req);
+				return;
+			}
+			if (q->rcode == NOERROR && q->ancount > 0)
+				req->positive = 1;
+			else if (q->rcode != -1 && q->rcode != NOERROR &&
+			    q->rcode != NXDOMAIN && q->rcode != SERVFAIL)
+				stop = 1;
+		}
+		req->nq = 0;
+		if (req->positive || stop) {
+			_async_replay(req);
+			return;
+		}
+
+		n = _async_candidate(req, req->candidate++, name, sizeof(name));
+		if (n == 0) {
+			_async_replay(req);
+			return;
+		}
+		if (n > 0 && _async_build(req, name) < 0)
+			return;
+	}
+}
+
+/*
+ * Starts the local resolution of the request's name.  Returns -1 if it
+ * should be handed to a worker instead.
+ */
+static int
+_async_start(struct android_getaddrinfo_request *req)
+{
+	int query_ipv6 = 1, query_ipv4 = 1;
+
+	if (_async_in_hosts(req)) {
+		_async_run_sync(req);
+		return 0;
+	}
+	if (req->netcontext.qhook != NULL ||
+	    (strchr(req->hostname, '.') == NULL &&
+	     __hostalias(req->hostname) != NULL))
+		return -1;
+
+	/* As _dns_getaddrinfo(). */
+	switch (req->hints.ai_family) {
+	case AF_UNSPEC:
+		if (req->hints.ai_flags & AI_ADDRCONFIG) {
+			query_ipv6 = _have_ipv6(req->netcontext.app_mark,
+			    req->netcontext.uid);
+			query_ipv4 = _have_ipv4(req->netcontext.app_mark,
+			    req->netcontext.uid);
+		}
+		if (query_ipv6)
+			req->qtypes[req->nqtypes++] = T_AAAA;
+		if (query_ipv4)
+			req->qtypes[req->nqtypes++] = T_A;
+		break;
+	case AF_INET:
+		req->qtypes[req->nqtypes++] = T_A;
+		break;
+	case AF_INET6:
+		req->qtypes[req->nqtypes++] = T_AAAA;
+		break;
+	}
+	if (req->nqtypes == 0)
+		return -1;
+
+	if ((req->answer = malloc(MAXPACKET)) == NULL ||
+	    (req->res = calloc(1, sizeof(*req->res))) == NULL)
+		return -1;
+	if (res_ninit(req->res) < 0) {
+		free(req->res);
+		req->res = NULL;
+		return -1;
+	}
+	res_setnetcontext(req->res, &req->netcontext);
+	_resolv_populate_res_for_net(req->res);
+	if (req->res->nscount == 0)
+		return -1;
+
+	_async_advance(req);
+	return 0;
+}
+
+int
+android_getaddrinfo_async(const char *hostname, const char *servname,
+    const struct addrinfo *hints, const struct android_net_context *netcontext,
+    struct android_getaddrinfo_request **request)
+{
+	struct android_getaddrinfo_request *req;
+	struct addrinfo numeric, *result = NULL;
+	int error;
+
+	assert(netcontext != NULL);
+	assert(request != NULL);
+	*request = NULL;
+	if ((req = calloc(1, sizeof(*req))) == NULL)
+		return EAI_MEMORY;
+	req->sock = -1;
+	req->tcp = -1;
+	req->netcontext = *netcontext;
+	if (hints != NULL) {
+		req->hints = *hints;
+		req->has_hints = 1;
+	}
+	if ((hostname != NULL && (req->hostname = strdup(hostname)) == NULL) ||
+	    (servname != NULL && (req->servname = strdup(servname)) == NULL)) {
+		free(req->hostname);
+		free(req);
+		return EAI_MEMORY;
+	}
+	*request = req;
+
+	/*
+	 * Everything but a name that needs looking up, including bad
+	 * arguments, is dealt with before the proxy is tried; let the
+	 * synchronous path do that.
+	 */
+	if (hostname == NULL || (req->hints.ai_flags & AI_NUMERICHOST) != 0) {
+		_async_run_sync(req);
+		return 0;
+	}
+	numeric = req->hints;
+	numeric.ai_flags |= AI_NUMERICHOST;
+	error = android_getaddrinfofornetcontext(hostname, servname, &numeric,
+	    netcontext, &result);
+	if (result != NULL)
+		freeaddrinfo(result);
+	if (error != EAI_NONAME) {
+		_async_run_sync(req);
+		return 0;
+	}
+
+#if defined(__ANDROID__)
+	if ((req->proxy = android_open_proxy()) != NULL) {
+		int fd = fileno(req->proxy);
+		if (!android_getaddrinfo_proxy_serializable(hostname, servname) ||
+		    android_getaddrinfo_proxy_send(req->proxy, hostname,
+		    servname, hints, netcontext->app_netid) < 0 ||
+		    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+			_async_complete(req, EAI_NODATA, NULL);
+		return 0;
+	}
+#endif
+
+	if (_async_start(req) < 0)
+		_async_run_worker(req);
+	return 0;
+}
+
+int
+android_getaddrinfo_async_fd(const struct android_getaddrinfo_request *req)
+{
+	if (req->done)
+		return -1;
+	if (req->proxy != NULL)
+		return fileno(req->proxy);
+	if (req->job != NULL)
+		return req->job->efd;
+	return req->sock;
+}
+
+int
+android_getaddrinfo_async_timeout(const struct android_getaddrinfo_request *req)
+{
+	struct timespec now;
+	long long ms = -1;
+	int i, waiting = 0, inflight = 0;
+
+	if (req->done || req->proxy != NULL || req->job != NULL)
+		return -1;
+	for (i = 0; i < req->nq; i++) {
+		if (req->q[i].state == ASYNC_Q_WAITING)
+			waiting = 1;
+		else if (req->q[i].state == ASYNC_Q_PENDING)
+			inflight = 1;
+	}
+	if (inflight || req->tcp >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (long long)(req->deadline.tv_sec - now.tv_sec) * 1000 +
+		    (req->deadline.tv_nsec - now.tv_nsec) / 1000000;
+		ms = (ms < 0) ? 0 : ms + 1;
+	}
+	if (waiting && (ms < 0 || ms > ASYNC_WAIT_POLL_MS))
+		ms = ASYNC_WAIT_POLL_MS;
+	if (req->tcp >= 0 && !req->tcpsent && ms > ASYNC_TCP_POLL_MS)
+		ms = ASYNC_TCP_POLL_MS;
+	return (int)ms;
+}
+
+int
+android_getaddrinfo_async_process(struct android_getaddrinfo_request *req)
+{
+	if (req->done)
+		return 0;
+	if (req->proxy != NULL) {
+#if defined(__ANDROID__)
+		_async_proxy_receive(req);
+#endif
+		return !req->done;
+	}
+	if (req->job != NULL) {
+		struct android_getaddrinfo_job *job = req->job;
+		struct addrinfo *result;
+		eventfd_t value;
+		int error;
+
+		eventfd_read(job->efd, &value);
+		pthread_mutex_lock(&job->lock);
+		if (!job->done) {
+			pthread_mutex_unlock(&job->lock);
+			return 1;
+		}
+		error = job->error;
+		result = job->result;
+		job->result = NULL;
+		pthread_mutex_unlock(&job->lock);
+		_async_complete(req, error, result);
+		return 0;
+	}
+	if (req->tcp >= 0)
+		_async_tcp_receive(req);
+	else
+		_async_receive(req);
+	_async_advance(req);
+	return !req->done;
+}
+
+int
+android_getaddrinfo_async_finish(struct android_getaddrinfo_request *req,
+    struct addrinfo **res)
+{
+	int error, cancelled = !req->done;
+
+	assert(res != NULL);
+	*res = NULL;
+	if (cancelled) {
+		_async_release(req);
+		_async_close(req);
+		error = EAI_SYSTEM;
+	} else {
+		error = req->error;
+		*res = req->result;
+	}
+	if (req->res != NULL) {
+		res_ndestroy(req->res);
+		free(req->res);
+	}
+	free(req->answer);
+	free(req->hostname);
+	free(req->servname);
+	free(req);
+	if (cancelled)
+		errno = ECANCELED;
+	return error;
+}
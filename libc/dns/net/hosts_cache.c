@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * An index over /etc/hosts, so that looking a name or an address up doesn't
+ * mean reading and parsing every line of the file.
+ *
+ * The file is mapped and every name, alias and address on each line is
+ * hashed to the offset of that line.  A lookup hands the caller a stream
+ * holding just the lines whose hash matches, in file order, and the caller
+ * parses them exactly as it would have parsed the whole file.  Collisions
+ * therefore cost a line of parsing but can't change the result.  The index
+ * is rebuilt whenever the file is replaced or modified.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hostent.h"
+#include "resolv_private.h"
+
+struct hosts_key {
+	uint32_t hash;
+	uint32_t line;		/* offset of the start of the line */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int valid;
+	const char *map;
+	size_t size;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	struct hosts_key *names;
+	size_t nnames;
+	struct hosts_key *addrs;
+	size_t naddrs;
+} hosts = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* FNV-1a, folding names to lower case as strcasecmp() does. */
+static uint32_t
+hash_name(const char *p, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (uint32_t)tolower((unsigned char)*p++);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static uint32_t
+hash_bytes(const void *p, size_t len)
+{
+	const unsigned char *cp = p;
+	uint32_t h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= *cp++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * IPv4 addresses are hashed in their v4-mapped form, which is also how
+ * they are returned when RES_USE_INET6 is set.
+ */
+static uint32_t
+hash_addr(const void *addr, int len)
+{
+	unsigned char mapped[NS_IN6ADDRSZ];
+
+	if (len == NS_INADDRSZ) {
+		memset(mapped, 0, 10);
+		mapped[10] = mapped[11] = 0xff;
+		memcpy(mapped + 12, addr, NS_INADDRSZ);
+		addr = mapped;
+		len = NS_IN6ADDRSZ;
+	}
+	return hash_bytes(addr, (size_t)len);
+}
+
+static int
+key_cmp(const void *a, const void *b)
+{
+	const struct hosts_key *ka = a, *kb = b;
+
+	if (ka->hash != kb->hash)
+		return (ka->hash < kb->hash) ? -1 : 1;
+	if (ka->line != kb->line)
+		return (ka->line < kb->line) ? -1 : 1;
+	return 0;
+}
+
+static int
+add_key(struct hosts_key **keys, size_t *n, size_t *cap, uint32_t hash,
+    size_t line)
+{
+	struct hosts_key *k;
+
+	if (*n == *cap) {
+		size_t ncap = (*cap == 0) ? 256 : *cap * 2;
+		if ((k = realloc(*keys, ncap * sizeof(*k))) == NULL)
+			return -1;
+		*keys = k;
+		*cap = ncap;
+	}
+	(*keys)[*n].hash = hash;
+	(*keys)[*n].line = (uint32_t)line;
+	(*n)++;
+	return 0;
+}
+
+static int
+is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static void
+hosts_clear_locked(void)
+{
+	if (hosts.map != NULL)
+		munmap((void *)hosts.map, hosts.size);
+	free(hosts.names);
+	free(hosts.addrs);
+	hosts.map = NULL;
+	hosts.size = 0;
+	hosts.names = hosts.addrs = NULL;
+	hosts.nnames = hosts.naddrs = 0;
+	hosts.valid = 0;
+}
+
+/*
+ * Hashes the fields of every line of the mapped file.  The tokenization
+ * is that of netbsd_gethostent_r() and _gethtent(), but more lenient: a
+ * line that they would skip may be indexed, never the other way round.
+ */
+static int
+hosts_index_locked(void)
+{
+	size_t ncap = 0, acap = 0, pos = 0;
+	unsigned char addr[NS_IN6ADDRSZ];
+	char abuf[INET6_ADDRSTRLEN + 1];
+
+	while (pos < hosts.size) {
+		const char *line = hosts.map + pos;
+		const char *end = memchr(line, '\n', hosts.size - pos);
+		const char *cp, *tok;
+		size_t len;
+
+		if (end == NULL)
+			end = hosts.map + hosts.size;
+		pos = (size_t)(end - hosts.map) + 1;
+		if (*line == '#')
+			continue;
+		if ((cp = memchr(line, '#', (size_t)(end - line))) != NULL)
+			end = cp;
+
+		/*
+		 * The address.  Only plain addresses are indexed by address;
+		 * the names are indexed whatever the address looks like, since
+		 * _gethtent() also accepts scoped ones ("fe80::1%wlan0").
+		 */
+		for (cp = line; cp < end && !is_blank(*cp); cp++)
+			continue;
+		len = (size_t)(cp - line);
+		if (len == 0)
+			continue;
+		if (len < sizeof(abuf)) {
+			memcpy(abuf, line, len);
+			abuf[len] = '\0';
+			if (inet_pton(AF_INET6, abuf, addr) > 0)
+				len = NS_IN6ADDRSZ;
+			else if (inet_pton(AF_INET, abuf, addr) > 0)
+				len = NS_INADDRSZ;
+			else
+				len = 0;
+			if (len != 0 && add_key(&hosts.addrs, &hosts.naddrs,
+			    &acap, hash_addr(addr, (int)len),
+			    (size_t)(line - hosts.map)) < 0)
+				return -1;
+		}
+
+		/* The canonical name and the aliases. */
+		while (cp < end) {
+			while (cp < end && is_blank(*cp))
+				cp++;
+			for (tok = cp; cp < end && !is_blank(*cp); cp++)
+				continue;
+			if (cp == tok)
+				break;
+			if (add_key(&hosts.names, &hosts.nnames, &ncap,
+			    hash_name(tok, (size_t)(cp - tok)),
+			    (size_t)(line - hosts.map)) < 0)
+				return -1;
+		}
+	}
+	if (hosts.nnames > 0)
+		qsort(hosts.names, hosts.nnames, sizeof(*hosts.names), key_cmp);
+	if (hosts.naddrs > 0)
+		qsort(hosts.addrs, hosts.naddrs, sizeof(*hosts.addrs), key_cmp);
+	return 0;
+}
+
+/*
+ * Makes sure the index describes the current contents of the hosts file.
+ * Returns -1 if it can't, in which case the caller should read the file
+ * the old way.
+ */
+static int
+hosts_refresh_locked(void)
+{
+	struct stat st;
+	int fd;
+
+	if (stat(_PATH_HOSTS, &st) < 0) {
+		hosts_clear_locked();
+		return -1;
+	}
+	if (hosts.valid && st.st_dev == hosts.dev && st.st_ino == hosts.ino &&
+	    (size_t)st.st_size == hosts.size &&
+	    st.st_mtim.tv_sec == hosts.mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == hosts.mtime.tv_nsec)
+		return 0;
+
+	hosts_clear_locked();
+	/* Offsets are stored in 32 bits. */
+	if ((uint64_t)st.st_size > UINT32_MAX)
+		return -1;
+	if ((fd = open(_PATH_HOSTS, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+		    MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		hosts.map = map;
+		hosts.size = (size_t)st.st_size;
+	}
+	close(fd);
+	if (hosts_index_locked() < 0) {
+		hosts_clear_locked();
+		return -1;
+	}
+	hosts.dev = st.st_dev;
+	hosts.ino = st.st_ino;
+	hosts.mtime = st.st_mtim;
+	hosts.valid = 1;
+	return 0;
+}
+
+/*
+ * Returns a stream holding the lines indexed under "hash", in file order,
+ * or NULL if there is no usable index.
+ */
+static FILE *
+hosts_open(const struct hosts_key *keys, size_t n, uint32_t hash)
+{
+	size_t lo = 0, hi = n, first, i, total = 0;
+	uint32_t prev = UINT32_MAX;
+	FILE *fp;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (keys[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+	for (i = first; i < n && keys[i].hash == hash; i++) {
+		const char *line = hosts.map + keys[i].line;
+		const char *end = memchr(line, '\n', hosts.size - keys[i].line);
+		if (keys[i].line == prev)
+			continue;
+		prev = keys[i].line;
+		total += (end != NULL) ? (size_t)(end - line) + 1 :
+		    hosts.size - keys[i].line;
+	}
+
+	/* The stream owns its buffer, which fclose() frees. */
+	if ((fp = fmemopen(NULL, total + 1, "w+")) == NULL)
+		return NULL;
+	prev = UINT32_MAX;
+	for (i = first; i < n && keys[i].hash == hash; i++) {
+		const char *line = hosts.map + keys[i].line;
+		const char *end = memchr(line, '\n', hosts.size - keys[i].line);
+		size_t len;
+		if (keys[i].line == prev)
+			continue;
+		prev = keys[i].line;
+		len = (end != NULL) ? (size_t)(end - line) + 1 :
+		    hosts.size - keys[i].line;
+		if (fwrite(line, 1, len, fp) != len) {
+			fclose(fp);
+			return NULL;
+		}
+	}
+	rewind(fp);
+	return fp;
+}
+
+FILE *
+_hf_open_byname(const char *name)
+{
+	FILE *fp = NULL;
+
+	pthread_mutex_lock(&hosts.lock);
+	if (hosts_refresh_locked() == 0)
+		fp = hosts_open(hosts.names, hosts.nnames,
+		    hash_name(name, strlen(name)));
+	pthread_mutex_unlock(&hosts.lock);
+	return fp;
+}
+
+FILE *
+_hf_open_byaddr(const void *addr, int len)
+{
+	FILE *fp = NULL;
+
+	if (len != NS_INADDRSZ && len != NS_IN6ADDRSZ)
+		return NULL;
+	pthread_mutex_lock(&hosts.lock);
+	if (hosts_refresh_locked() == 0)
+		fp = hosts_open(hosts.addrs, hosts.naddrs,
+		    hash_addr(addr, len));
+	pthread_mutex_unlock(&hosts.lock);
+	return fp;
+}
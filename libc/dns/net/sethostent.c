@@ -136,8 +136,8 @@ _hf_gethtbyname2(const char *name, int af, struct getnamaddr *info)
 
 	_DIAGASSERT(name != NULL);
 
-	hf = NULL;
-	sethostent_r(&hf);
+	if ((hf = _hf_open_byname(name)) == NULL)
+		sethostent_r(&hf);
 	if (hf == NULL) {
 		errno = EINVAL;
 		*info->he = NETDB_INTERNAL;
@@ -252,8 +252,8 @@ _hf_gethtbyaddr(void *rv, void *cb_data, va_list ap)
 	info->hp->h_length = va_arg(ap, int);
 	info->hp->h_addrtype = va_arg(ap, int);
 
-	hf = NULL;
-	sethostent_r(&hf);
+	if ((hf = _hf_open_byaddr(addr, info->hp->h_length)) == NULL)
+		sethostent_r(&hf);
 	if (hf == NULL) {
 		*info->he = NETDB_INTERNAL;
 		return NS_UNAVAIL;
@@ -34,7 +34,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <poll.h>
+#include <unistd.h>
 #include "pthread.h"
+#include <stdatomic.h>
 
 #include <errno.h>
 #include <arpa/nameser.h>
@@ -131,6 +134,20 @@
  */
 #define  CONFIG_MAX_ENTRIES    64 * 2 * 5
 
+/* An entry that has answered at least PREFETCH_MIN_HITS lookups is handed
+ * back for refreshing by the first lookup in the last PREFETCH_PERCENT of its
+ * TTL, so that popular names don't all miss at once when they expire.
+ */
+#define  PREFETCH_MIN_HITS     2
+#define  PREFETCH_PERCENT      10
+
+/* Only one lookup in the whole process refreshes at a time, so that a burst
+ * of entries coming due doesn't hold up a burst of callers.  Set by
+ * _cache_lookup() when it hands an entry back, cleared by
+ * _resolv_cache_refresh_done().
+ */
+static atomic_bool _res_cache_refreshing;
+
 /****************************************************************************/
 /****************************************************************************/
 /*****                                                                  *****/
@@ -993,6 +1010,10 @@ typedef struct Entry {
     const uint8_t*   answer;
     int              answerlen;
     time_t           expires;   /* time_t when the entry isn't valid any more */
+    time_t           refresh_at; /* time_t after which a hot entry is refreshed */
+    int              hits;      /* lookups answered since the entry was added */
+    int              refreshing; /* a caller is re-querying this entry */
+    int              heap_index; /* position in the cache's expiry heap */
     int              id;        /* for debugging purpose */
 } Entry;
 
@@ -1212,25 +1233,44 @@ typedef struct pending_req_info {
     struct pending_req_info*    next;
 } PendingReqInfo;
 
+/* The cache of each network is split into CACHE_SHARDS independent shards,
+ * picked by the top bits of the query hash, each with its own hash table,
+ * MRU list and pending requests. Threads looking up different names then
+ * only share the read side of _res_cache_list_lock.
+ *
+ * A 'Cache' is one shard. The shard locks are global rather than part of
+ * the shard, so that a thread waiting for a pending request can't have its
+ * mutex freed under it if the network goes away.
+ */
+#define CACHE_SHARD_BITS  4
+#define CACHE_SHARDS      (1 << CACHE_SHARD_BITS)
+#define CACHE_SHARD_INDEX(hash)  ((hash) >> (32 - CACHE_SHARD_BITS))
+
 typedef struct resolv_cache {
     int              max_entries;
     int              num_entries;
     Entry            mru_list;
     int              last_id;
     Entry*           entries;
+    Entry**          expiry_heap;   /* min-heap of the entries by 'expires' */
     PendingReqInfo   pending_requests;
 } Cache;
 
 struct resolv_cache_info {
     unsigned                    netid;
-    Cache*                      cache;
+    Cache*                      cache;      // CACHE_SHARDS shards
     struct resolv_cache_info*   next;
     int                         nscount;
     char*                       nameservers[MAXNS];
     struct addrinfo*            nsaddrinfo[MAXNS];
     int                         revision_id; // # times the nameservers have been replaced
     struct __res_params         params;
+    pthread_mutex_t             stats_lock; // protects nsstats for readers of the list
     struct __res_stats          nsstats[MAXNS];
+    pthread_mutex_t             tcp_lock;   // protects tcp_socks and friends
+    int                         tcp_socks[MAXNS];     // idle connections, or -1
+    pid_t                       tcp_pids[MAXNS];      // process that opened each
+    time_t                      tcp_idle_since[MAXNS];
     char                        defdname[MAXDNSRCHPATH];
     int                         dnsrch_offset[MAXDNSRCH+1];  // offsets into defdname
 };
@@ -1240,12 +1280,35 @@ struct resolv_cache_info {
 static pthread_once_t        _res_cache_once = PTHREAD_ONCE_INIT;
 static void _res_cache_init(void);
 
-// lock protecting everything in the _resolve_cache_info structs (next ptr, etc)
-static pthread_mutex_t _res_cache_list_lock;
+// lock protecting everything in the _resolve_cache_info structs (next ptr, etc).
+// Lookups, additions and stats updates take it for reading, together with the
+// lock of the shard or the stats_lock of the network they touch; changes to the
+// network configuration take it for writing.
+static pthread_rwlock_t _res_cache_list_lock;
+
+// locks for the shards of every network's cache, indexed by CACHE_SHARD_INDEX()
+static pthread_mutex_t _res_cache_shard_locks[CACHE_SHARDS];
 
 /* gets cache associated with a network, or NULL if none exists */
 static struct resolv_cache* _find_named_cache_locked(unsigned netid);
 
+/* gets the shard of a network's cache holding 'key', or NULL if none exists */
+static Cache*
+_find_cache_shard_locked(unsigned netid, const Entry* key)
+{
+    Cache*  cache = _find_named_cache_locked(netid);
+
+    if (cache == NULL)
+        return NULL;
+    return &cache[CACHE_SHARD_INDEX(key->hash)];
+}
+
+static pthread_mutex_t*
+_cache_shard_lock(const Entry* key)
+{
+    return &_res_cache_shard_locks[CACHE_SHARD_INDEX(key->hash)];
+}
+
 static void
 _cache_flush_pending_requests_locked( struct resolv_cache* cache )
 {
@@ -1268,9 +1331,13 @@ _cache_flush_pending_requests_locked( struct resolv_cache* cache )
 
 /* Return 0 if no pending request is found matching the key.
  * If a matching request is found the calling thread will wait until
- * the matching request completes, then update *cache and return 1. */
+ * the matching request completes, then update *cache and return 1;
+ * if 'wait' is 0 it returns 1 at once instead.
+ * Must be called with the list lock held for reading and the shard lock
+ * held; both are dropped while waiting and held again on return. */
 static int
-_cache_check_pending_request_locked( struct resolv_cache** cache, Entry* key, unsigned netid )
+_cache_check_pending_request_locked( struct resolv_cache** cache, Entry* key, unsigned netid,
+                                     int wait )
 {
     struct pending_req_info *ri, *prev;
     int exist = 0;
@@ -1294,13 +1361,19 @@ _cache_check_pending_request_locked( struct resolv_cache** cache, Entry* key, un
                 pthread_cond_init(&ri->cond, NULL);
                 prev->next = ri;
             }
-        } else {
+        } else if (wait) {
             struct timespec ts = {0,0};
+            pthread_mutex_t* lock = _cache_shard_lock(key);
             XLOG("Waiting for previous request");
             ts.tv_sec = _time_now() + PENDING_REQUEST_TIMEOUT;
-            pthread_cond_timedwait(&ri->cond, &_res_cache_list_lock, &ts);
+            // Don't hold up changes to the network configuration while we wait.
+            pthread_rwlock_unlock(&_res_cache_list_lock);
+            pthread_cond_timedwait(&ri->cond, lock, &ts);
+            pthread_mutex_unlock(lock);
+            pthread_rwlock_rdlock(&_res_cache_list_lock);
+            pthread_mutex_lock(lock);
             /* Must update *cache as it could have been deleted. */
-            *cache = _find_named_cache_locked(netid);
+            *cache = _find_cache_shard_locked(netid, key);
         }
     }
 
@@ -1335,6 +1408,8 @@ _cache_notify_waiting_tid_locked( struct resolv_cache* cache, Entry* key )
     }
 }
 
+static Entry** _cache_lookup_p(Cache* cache, Entry* key);
+
 /* notify the cache that the query failed */
 void
 _resolv_cache_query_failed( unsigned    netid,
@@ -1342,20 +1417,27 @@ _resolv_cache_query_failed( unsigned    netid,
                    int         querylen)
 {
     Entry    key[1];
+    Entry*   e;
     Cache*   cache;
 
     if (!entry_init_key(key, query, querylen))
         return;
 
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
-    cache = _find_named_cache_locked(netid);
+    cache = _find_cache_shard_locked(netid, key);
 
     if (cache) {
+        pthread_mutex_lock(_cache_shard_lock(key));
         _cache_notify_waiting_tid_locked(cache, key);
+        /* let a later lookup try to refresh the entry again */
+        e = *_cache_lookup_p(cache, key);
+        if (e != NULL)
+            e->refreshing = 0;
+        pthread_mutex_unlock(_cache_shard_lock(key));
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
 }
 
 static struct resolv_cache_info* _find_cache_info_locked(unsigned netid);
@@ -1388,11 +1470,29 @@ _cache_flush_locked( Cache*  cache )
          "*************************");
 }
 
+/* flush every shard of a network's cache. Must be called with the list lock
+ * held for writing. */
+static void
+_cache_flush_shards_locked( Cache*  cache )
+{
+    int     nn;
+
+    for (nn = 0; nn < CACHE_SHARDS; nn++) {
+        pthread_mutex_lock(&_res_cache_shard_locks[nn]);
+        _cache_flush_locked(&cache[nn]);
+        pthread_mutex_unlock(&_res_cache_shard_locks[nn]);
+    }
+}
+
 static int
-_res_cache_get_max_entries( void )
+_res_cache_get_max_entries( const struct __res_params*  params )
 {
     int cache_size = CONFIG_MAX_ENTRIES;
 
+    if (params != NULL && params->max_cache_entries != 0) {
+        cache_size = params->max_cache_entries;
+    }
+
     const char* cache_mode = getenv("ANDROID_DNS_MODE");
     if (cache_mode == NULL || strcmp(cache_mode, "local") != 0) {
         // Don't use the cache in local mode. This is used by the proxy itself.
@@ -1403,26 +1503,92 @@ _res_cache_get_max_entries( void )
     return cache_size;
 }
 
+static void
+_resolv_cache_free( struct resolv_cache*  cache )
+{
+    int  nn;
+
+    for (nn = 0; nn < CACHE_SHARDS; nn++) {
+        free(cache[nn].entries);
+        free(cache[nn].expiry_heap);
+    }
+    free(cache);
+}
+
+/* number of entries in each shard of a cache holding 'cache_size' entries */
+static int
+_res_cache_shard_entries( int  cache_size )
+{
+    int  max_entries = cache_size / CACHE_SHARDS;
+
+    return (max_entries < 1) ? 1 : max_entries;
+}
+
+/* (re)allocate the tables of an empty shard. Returns 0 on failure, leaving
+ * the shard as it was. */
+static int
+_cache_alloc_tables( Cache*  cache, int  max_entries )
+{
+    Entry*   entries = calloc(sizeof(*entries), max_entries);
+    Entry**  heap    = calloc(sizeof(*heap), max_entries);
+
+    if (entries == NULL || heap == NULL) {
+        free(entries);
+        free(heap);
+        return 0;
+    }
+    free(cache->entries);
+    free(cache->expiry_heap);
+    cache->entries     = entries;
+    cache->expiry_heap = heap;
+    cache->max_entries = max_entries;
+    return 1;
+}
+
 static struct resolv_cache*
 _resolv_cache_create( void )
 {
     struct resolv_cache*  cache;
+    int                   max_entries, nn;
 
-    cache = calloc(sizeof(*cache), 1);
+    cache = calloc(sizeof(*cache), CACHE_SHARDS);
     if (cache) {
-        cache->max_entries = _res_cache_get_max_entries();
-        cache->entries = calloc(sizeof(*cache->entries), cache->max_entries);
-        if (cache->entries) {
-            cache->mru_list.mru_prev = cache->mru_list.mru_next = &cache->mru_list;
-            XLOG("%s: cache created\n", __FUNCTION__);
-        } else {
-            free(cache);
-            cache = NULL;
+        max_entries = _res_cache_shard_entries(_res_cache_get_max_entries(NULL));
+        for (nn = 0; nn < CACHE_SHARDS; nn++) {
+            Cache*  shard = &cache[nn];
+
+            if (!_cache_alloc_tables(shard, max_entries)) {
+                _resolv_cache_free(cache);
+                return NULL;
+            }
+            shard->mru_list.mru_prev = shard->mru_list.mru_next = &shard->mru_list;
         }
+        XLOG("%s: cache created\n", __FUNCTION__);
     }
     return cache;
 }
 
+/* apply the cache size from the network's parameters, flushing the cache if
+ * it changes. Must be called with the list lock held for writing. */
+static void
+_resolv_cache_resize_locked( struct resolv_cache*  cache,
+                             const struct __res_params*  params )
+{
+    int  max_entries = _res_cache_shard_entries(_res_cache_get_max_entries(params));
+    int  nn;
+
+    if (cache == NULL || cache->max_entries == max_entries)
+        return;
+
+    for (nn = 0; nn < CACHE_SHARDS; nn++) {
+        pthread_mutex_lock(&_res_cache_shard_locks[nn]);
+        _cache_flush_locked(&cache[nn]);
+        _cache_alloc_tables(&cache[nn], max_entries);
+        pthread_mutex_unlock(&_res_cache_shard_locks[nn]);
+    }
+    XLOG("%s: cache resized to %d entries per shard", __FUNCTION__, max_entries);
+}
+
 
 #if DEBUG
 static void
@@ -1527,6 +1693,69 @@ _cache_lookup_p( Cache*   cache,
     return pnode;
 }
 
+/* The expiry heap keeps the entries ordered by expiration time, so that
+ * expired entries can be found without walking the whole MRU list. Each
+ * entry records its own position so that it can be removed in O(log n).
+ */
+static void
+_cache_heap_set( Cache*  cache, int  index, Entry*  e )
+{
+    cache->expiry_heap[index] = e;
+    e->heap_index = index;
+}
+
+static void
+_cache_heap_up( Cache*  cache, int  index )
+{
+    Entry*  e = cache->expiry_heap[index];
+
+    while (index > 0) {
+        int     parent = (index - 1) / 2;
+        Entry*  p      = cache->expiry_heap[parent];
+
+        if (p->expires <= e->expires)
+            break;
+        _cache_heap_set(cache, index, p);
+        index = parent;
+    }
+    _cache_heap_set(cache, index, e);
+}
+
+static void
+_cache_heap_down( Cache*  cache, int  index, int  size )
+{
+    Entry*  e = cache->expiry_heap[index];
+
+    for (;;) {
+        int  child = 2 * index + 1;
+
+        if (child >= size)
+            break;
+        if (child + 1 < size &&
+            cache->expiry_heap[child + 1]->expires < cache->expiry_heap[child]->expires)
+            child += 1;
+        if (e->expires <= cache->expiry_heap[child]->expires)
+            break;
+        _cache_heap_set(cache, index, cache->expiry_heap[child]);
+        index = child;
+    }
+    _cache_heap_set(cache, index, e);
+}
+
+/* remove 'e' from the heap, must be called before num_entries is decremented */
+static void
+_cache_heap_remove( Cache*  cache, Entry*  e )
+{
+    int     index = e->heap_index;
+    Entry*  last  = cache->expiry_heap[cache->num_entries - 1];
+
+    if (last == e)
+        return;
+    _cache_heap_set(cache, index, last);
+    _cache_heap_up(cache, index);
+    _cache_heap_down(cache, last->heap_index, cache->num_entries - 1);
+}
+
 /* Add a new entry to the hash table. 'lookup' must be the
  * result of an immediate previous failed _lookup_p() call
  * (i.e. with *lookup == NULL), and 'e' is the pointer to the
@@ -1540,6 +1769,8 @@ _cache_add_p( Cache*   cache,
     *lookup = e;
     e->id = ++cache->last_id;
     entry_mru_add(e, &cache->mru_list);
+    _cache_heap_set(cache, cache->num_entries, e);
+    _cache_heap_up(cache, cache->num_entries);
     cache->num_entries += 1;
 
     XLOG("%s: entry %d added (count=%d)", __FUNCTION__,
@@ -1560,6 +1791,7 @@ _cache_remove_p( Cache*   cache,
          e->id, cache->num_entries-1);
 
     entry_mru_remove(e);
+    _cache_heap_remove(cache, e);
     *lookup = e->hlink;
     entry_free(e);
     cache->num_entries -= 1;
@@ -1587,38 +1819,33 @@ _cache_remove_oldest( Cache*  cache )
 /* Remove all expired entries from the hash table.
  */
 static void _cache_remove_expired(Cache* cache) {
-    Entry* e;
     time_t now = _time_now();
 
-    for (e = cache->mru_list.mru_next; e != &cache->mru_list;) {
-        // Entry is old, remove
-        if (now >= e->expires) {
-            Entry** lookup = _cache_lookup_p(cache, e);
-            if (*lookup == NULL) { /* should not happen */
-                XLOG("%s: ENTRY NOT IN HTABLE ?", __FUNCTION__);
-                return;
-            }
-            e = e->mru_next;
-            _cache_remove_p(cache, lookup);
-        } else {
-            e = e->mru_next;
+    while (cache->num_entries > 0 && now >= cache->expiry_heap[0]->expires) {
+        Entry** lookup = _cache_lookup_p(cache, cache->expiry_heap[0]);
+        if (*lookup == NULL) { /* should not happen */
+            XLOG("%s: ENTRY NOT IN HTABLE ?", __FUNCTION__);
+            return;
         }
+        _cache_remove_p(cache, lookup);
     }
 }
 
-ResolvCacheStatus
-_resolv_cache_lookup( unsigned              netid,
-                      const void*           query,
-                      int                   querylen,
-                      void*                 answer,
-                      int                   answersize,
-                      int                  *answerlen )
+static ResolvCacheStatus
+_cache_lookup( unsigned              netid,
+               const void*           query,
+               int                   querylen,
+               void*                 answer,
+               int                   answersize,
+               int                  *answerlen,
+               int                   wait )
 {
     Entry      key[1];
     Entry**    lookup;
     Entry*     e;
     time_t     now;
     Cache*     cache;
+    pthread_mutex_t*  lock = NULL;
 
     ResolvCacheStatus  result = RESOLV_CACHE_NOTFOUND;
 
@@ -1632,13 +1859,15 @@ _resolv_cache_lookup( unsigned              netid,
     }
     /* lookup cache */
     pthread_once(&_res_cache_once, _res_cache_init);
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
-    cache = _find_named_cache_locked(netid);
+    cache = _find_cache_shard_locked(netid, key);
     if (cache == NULL) {
         result = RESOLV_CACHE_UNSUPPORTED;
         goto Exit;
     }
+    lock = _cache_shard_lock(key);
+    pthread_mutex_lock(lock);
 
     /* see the description of _lookup_p to understand this.
      * the function always return a non-NULL pointer.
@@ -1650,7 +1879,11 @@ _resolv_cache_lookup( unsigned              netid,
         XLOG( "NOT IN CACHE");
         // calling thread will wait if an outstanding request is found
         // that matching this query
-        if (!_cache_check_pending_request_locked(&cache, key, netid) || cache == NULL) {
+        if (!_cache_check_pending_request_locked(&cache, key, netid, wait) || cache == NULL) {
+            goto Exit;
+        } else if (!wait) {
+            XLOG( "PENDING");
+            result = RESOLV_CACHE_PENDING;
             goto Exit;
         } else {
             lookup = _cache_lookup_p(cache, key);
@@ -1690,11 +1923,50 @@ _resolv_cache_lookup( unsigned              netid,
     XLOG( "FOUND IN CACHE entry=%p", e );
     result = RESOLV_CACHE_FOUND;
 
+    /* ask this caller to refresh a popular entry that is about to expire,
+     * everybody else keeps getting the cached answer meanwhile */
+    if (++e->hits >= PREFETCH_MIN_HITS && now >= e->refresh_at && !e->refreshing &&
+        !atomic_exchange(&_res_cache_refreshing, true)) {
+        XLOG( "REFRESHING entry=%p", e );
+        e->refreshing = 1;
+        result = RESOLV_CACHE_REFRESH;
+    }
+
 Exit:
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    if (lock != NULL)
+        pthread_mutex_unlock(lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
     return result;
 }
 
+void
+_resolv_cache_refresh_done(void)
+{
+    atomic_store(&_res_cache_refreshing, false);
+}
+
+ResolvCacheStatus
+_resolv_cache_lookup( unsigned              netid,
+                      const void*           query,
+                      int                   querylen,
+                      void*                 answer,
+                      int                   answersize,
+                      int                  *answerlen )
+{
+    return _cache_lookup(netid, query, querylen, answer, answersize, answerlen, 1);
+}
+
+ResolvCacheStatus
+_resolv_cache_lookup_nowait( unsigned              netid,
+                             const void*           query,
+                             int                   querylen,
+                             void*                 answer,
+                             int                   answersize,
+                             int                  *answerlen )
+{
+    return _cache_lookup(netid, query, querylen, answer, answersize, answerlen, 0);
+}
+
 
 void
 _resolv_cache_add( unsigned              netid,
@@ -1716,12 +1988,13 @@ _resolv_cache_add( unsigned              netid,
         return;
     }
 
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
-    cache = _find_named_cache_locked(netid);
+    cache = _find_cache_shard_locked(netid, key);
     if (cache == NULL) {
         goto Exit;
     }
+    pthread_mutex_lock(_cache_shard_lock(key));
 
     XLOG( "%s: query:", __FUNCTION__ );
     XLOG_QUERY(query,querylen);
@@ -1734,10 +2007,15 @@ _resolv_cache_add( unsigned              netid,
     lookup = _cache_lookup_p(cache, key);
     e      = *lookup;
 
-    if (e != NULL) { /* should not happen */
-        XLOG("%s: ALREADY IN CACHE (%p) ? IGNORING ADD",
-             __FUNCTION__, e);
-        goto Exit;
+    if (e != NULL) {
+        if (!e->refreshing) { /* should not happen */
+            XLOG("%s: ALREADY IN CACHE (%p) ? IGNORING ADD",
+                 __FUNCTION__, e);
+            goto Exit;
+        }
+        /* replace the entry with the refreshed answer */
+        _cache_remove_p(cache, lookup);
+        lookup = _cache_lookup_p(cache, key);
     }
 
     if (cache->num_entries >= cache->max_entries) {
@@ -1756,10 +2034,11 @@ _resolv_cache_add( unsigned              netid,
     }
 
     ttl = answer_getTTL(answer, answerlen);
-    if (ttl > 0) {
+    if (ttl > 0 && cache->num_entries < cache->max_entries) {
         e = entry_alloc(key, answer, answerlen);
         if (e != NULL) {
             e->expires = ttl + _time_now();
+            e->refresh_at = e->expires - ttl * PREFETCH_PERCENT / 100;
             _cache_add_p(cache, lookup, e);
         }
     }
@@ -1769,8 +2048,9 @@ _resolv_cache_add( unsigned              netid,
 Exit:
     if (cache != NULL) {
       _cache_notify_waiting_tid_locked(cache, key);
+      pthread_mutex_unlock(_cache_shard_lock(key));
     }
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
 }
 
 /****************************************************************************/
@@ -1796,6 +2076,7 @@ static struct resolv_cache* _get_res_cache_for_net_locked(unsigned netid);
 static void _flush_cache_for_net_locked(unsigned netid);
 /* empty the nameservers set for the named cache */
 static void _free_nameservers_locked(struct resolv_cache_info* cache_info);
+static void _close_tcp_sockets_locked(struct resolv_cache_info* cache_info, time_t idle_before);
 /* return 1 if the provided list of name servers differs from the list of name servers
  * currently attached to the provided cache_info */
 static int _resolv_is_nameservers_equal_locked(struct resolv_cache_info* cache_info,
@@ -1806,8 +2087,12 @@ static void _res_cache_clear_stats_locked(struct resolv_cache_info* cache_info);
 static void
 _res_cache_init(void)
 {
+    int  nn;
+
     memset(&_res_cache_list, 0, sizeof(_res_cache_list));
-    pthread_mutex_init(&_res_cache_list_lock, NULL);
+    pthread_rwlock_init(&_res_cache_list_lock, NULL);
+    for (nn = 0; nn < CACHE_SHARDS; nn++)
+        pthread_mutex_init(&_res_cache_shard_locks[nn], NULL);
 }
 
 static struct resolv_cache*
@@ -1834,11 +2119,11 @@ void
 _resolv_flush_cache_for_net(unsigned netid)
 {
     pthread_once(&_res_cache_once, _res_cache_init);
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_wrlock(&_res_cache_list_lock);
 
     _flush_cache_for_net_locked(netid);
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
 }
 
 static void
@@ -1846,7 +2131,7 @@ _flush_cache_for_net_locked(unsigned netid)
 {
     struct resolv_cache* cache = _find_named_cache_locked(netid);
     if (cache) {
-        _cache_flush_locked(cache);
+        _cache_flush_shards_locked(cache);
     }
 
     // Also clear the NS statistics.
@@ -1857,7 +2142,7 @@ _flush_cache_for_net_locked(unsigned netid)
 void _resolv_delete_cache_for_net(unsigned netid)
 {
     pthread_once(&_res_cache_once, _res_cache_init);
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_wrlock(&_res_cache_list_lock);
 
     struct resolv_cache_info* prev_cache_info = &_res_cache_list;
 
@@ -1866,10 +2151,11 @@ void _resolv_delete_cache_for_net(unsigned netid)
 
         if (cache_info->netid == netid) {
             prev_cache_info->next = cache_info->next;
-            _cache_flush_locked(cache_info->cache);
-            free(cache_info->cache->entries);
-            free(cache_info->cache);
+            _cache_flush_shards_locked(cache_info->cache);
+            _resolv_cache_free(cache_info->cache);
             _free_nameservers_locked(cache_info);
+            pthread_mutex_destroy(&cache_info->stats_lock);
+            pthread_mutex_destroy(&cache_info->tcp_lock);
             free(cache_info);
             break;
         }
@@ -1877,7 +2163,7 @@ void _resolv_delete_cache_for_net(unsigned netid)
         prev_cache_info = prev_cache_info->next;
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
 }
 
 static struct resolv_cache_info*
@@ -1886,6 +2172,13 @@ _create_cache_info(void)
     struct resolv_cache_info* cache_info;
 
     cache_info = calloc(sizeof(*cache_info), 1);
+    if (cache_info) {
+        pthread_mutex_init(&cache_info->stats_lock, NULL);
+        pthread_mutex_init(&cache_info->tcp_lock, NULL);
+        for (int i = 0; i < MAXNS; i++) {
+            cache_info->tcp_socks[i] = -1;
+        }
+    }
     return cache_info;
 }
 
@@ -1931,6 +2224,8 @@ _resolv_set_default_params(struct __res_params* params) {
     params->success_threshold = SUCCESS_THRESHOLD;
     params->min_samples = 0;
     params->max_samples = 0;
+    params->max_cache_entries = 0;
+    params->concurrent_servers = 0;
 }
 
 int
@@ -1969,7 +2264,7 @@ _resolv_set_nameservers_for_net(unsigned netid, const char** servers, unsigned n
     }
 
     pthread_once(&_res_cache_once, _res_cache_init);
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_wrlock(&_res_cache_list_lock);
 
     // creates the cache if not created
     _get_res_cache_for_net_locked(netid);
@@ -1983,6 +2278,7 @@ _resolv_set_nameservers_for_net(unsigned netid, const char** servers, unsigned n
         } else {
             _resolv_set_default_params(&cache_info->params);
         }
+        _resolv_cache_resize_locked(cache_info->cache, &cache_info->params);
 
         if (!_resolv_is_nameservers_equal_locked(cache_info, servers, numservers)) {
             // free current before adding new
@@ -2041,7 +2337,7 @@ _resolv_set_nameservers_for_net(unsigned netid, const char** servers, unsigned n
         *offset = -1; /* cache_info->dnsrch_offset has MAXDNSRCH+1 items */
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
     return 0;
 }
 
@@ -2088,6 +2384,7 @@ _free_nameservers_locked(struct resolv_cache_info* cache_info)
             cache_info->nsstats[i].sample_next = 0;
     }
     cache_info->nscount = 0;
+    _close_tcp_sockets_locked(cache_info, 0);
     _res_cache_clear_stats_locked(cache_info);
     ++cache_info->revision_id;
 }
@@ -2100,7 +2397,7 @@ _resolv_populate_res_for_net(res_state statp)
     }
 
     pthread_once(&_res_cache_once, _res_cache_init);
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
     struct resolv_cache_info* info = _find_cache_info_locked(statp->netid);
     if (info != NULL) {
@@ -2141,7 +2438,7 @@ _resolv_populate_res_for_net(res_state statp)
             *pp++ = &statp->defdname[0] + *p++;
         }
     }
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
 }
 
 /* Resolver reachability statistics. */
@@ -2176,12 +2473,13 @@ android_net_res_stats_get_info_for_net(unsigned netid, int* nscount,
         struct sockaddr_storage servers[MAXNS], int* dcount, char domains[MAXDNSRCH][MAXDNSRCHPATH],
         struct __res_params* params, struct __res_stats stats[MAXNS]) {
     int revision_id = -1;
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_once(&_res_cache_once, _res_cache_init);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
     struct resolv_cache_info* info = _find_cache_info_locked(netid);
     if (info) {
         if (info->nscount > MAXNS) {
-            pthread_mutex_unlock(&_res_cache_list_lock);
+            pthread_rwlock_unlock(&_res_cache_list_lock);
             XLOG("%s: nscount %d > MAXNS %d", __FUNCTION__, info->nscount, MAXNS);
             errno = EFAULT;
             return -1;
@@ -2195,29 +2493,31 @@ android_net_res_stats_get_info_for_net(unsigned netid, int* nscount,
             int addrlen = info->nsaddrinfo[i]->ai_addrlen;
             if (addrlen < (int) sizeof(struct sockaddr) ||
                     addrlen > (int) sizeof(servers[0])) {
-                pthread_mutex_unlock(&_res_cache_list_lock);
+                pthread_rwlock_unlock(&_res_cache_list_lock);
                 XLOG("%s: nsaddrinfo[%d].ai_addrlen == %d", __FUNCTION__, i, addrlen);
                 errno = EMSGSIZE;
                 return -1;
             }
             if (info->nsaddrinfo[i]->ai_addr == NULL) {
-                pthread_mutex_unlock(&_res_cache_list_lock);
+                pthread_rwlock_unlock(&_res_cache_list_lock);
                 XLOG("%s: nsaddrinfo[%d].ai_addr == NULL", __FUNCTION__, i);
                 errno = ENOENT;
                 return -1;
             }
             if (info->nsaddrinfo[i]->ai_next != NULL) {
-                pthread_mutex_unlock(&_res_cache_list_lock);
+                pthread_rwlock_unlock(&_res_cache_list_lock);
                 XLOG("%s: nsaddrinfo[%d].ai_next != NULL", __FUNCTION__, i);
                 errno = ENOTUNIQ;
                 return -1;
             }
         }
         *nscount = info->nscount;
+        pthread_mutex_lock(&info->stats_lock);
         for (i = 0; i < info->nscount; i++) {
             memcpy(&servers[i], info->nsaddrinfo[i]->ai_addr, info->nsaddrinfo[i]->ai_addrlen);
             stats[i] = info->nsstats[i];
         }
+        pthread_mutex_unlock(&info->stats_lock);
         for (i = 0; i < MAXDNSRCH; i++) {
             const char* cur_domain = info->defdname + info->dnsrch_offset[i];
             // dnsrch_offset[i] can either be -1 or point to an empty string to indicate the end
@@ -2235,7 +2535,7 @@ android_net_res_stats_get_info_for_net(unsigned netid, int* nscount,
         revision_id = info->revision_id;
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
     return revision_id;
 }
 
@@ -2243,16 +2543,19 @@ int
 _resolv_cache_get_resolver_stats( unsigned netid, struct __res_params* params,
         struct __res_stats stats[MAXNS]) {
     int revision_id = -1;
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_once(&_res_cache_once, _res_cache_init);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
     struct resolv_cache_info* info = _find_cache_info_locked(netid);
     if (info) {
+        pthread_mutex_lock(&info->stats_lock);
         memcpy(stats, info->nsstats, sizeof(info->nsstats));
+        pthread_mutex_unlock(&info->stats_lock);
         *params = info->params;
         revision_id = info->revision_id;
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
     return revision_id;
 }
 
@@ -2261,13 +2564,108 @@ _resolv_cache_add_resolver_stats_sample( unsigned netid, int revision_id, int ns
        const struct __res_sample* sample, int max_samples) {
     if (max_samples <= 0) return;
 
-    pthread_mutex_lock(&_res_cache_list_lock);
+    pthread_once(&_res_cache_once, _res_cache_init);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
 
     struct resolv_cache_info* info = _find_cache_info_locked(netid);
 
     if (info && info->revision_id == revision_id) {
+        pthread_mutex_lock(&info->stats_lock);
         _res_cache_add_stats_sample_locked(&info->nsstats[ns], sample, max_samples);
+        pthread_mutex_unlock(&info->stats_lock);
     }
 
-    pthread_mutex_unlock(&_res_cache_list_lock);
+    pthread_rwlock_unlock(&_res_cache_list_lock);
+}
+
+// Idle TCP connections to the name servers are closed after this many seconds.
+// Servers tend to drop idle clients after a few seconds (RFC 7766 section 6.2.3),
+// so there is little point in keeping them much longer than that.
+#define TCP_IDLE_TIMEOUT  10
+
+/* closes the pooled TCP connections that have been idle since before 'idle_before', or all of
+ * them if it is 0. */
+static void
+_close_tcp_sockets_locked(struct resolv_cache_info* cache_info, time_t idle_before)
+{
+    pthread_mutex_lock(&cache_info->tcp_lock);
+    for (int i = 0; i < MAXNS; i++) {
+        if (cache_info->tcp_socks[i] >= 0 &&
+                (idle_before == 0 || cache_info->tcp_idle_since[i] < idle_before)) {
+            close(cache_info->tcp_socks[i]);
+            cache_info->tcp_socks[i] = -1;
+        }
+    }
+    pthread_mutex_unlock(&cache_info->tcp_lock);
+}
+
+int
+_resolv_cache_take_tcp_socket(unsigned netid, int ns)
+{
+    int sock = -1;
+
+    if (ns < 0 || ns >= MAXNS) {
+        return -1;
+    }
+
+    pthread_once(&_res_cache_once, _res_cache_init);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
+
+    struct resolv_cache_info* info = _find_cache_info_locked(netid);
+    if (info) {
+        pthread_mutex_lock(&info->tcp_lock);
+        sock = info->tcp_socks[ns];
+        info->tcp_socks[ns] = -1;
+        if (sock >= 0) {
+            // A connection inherited across fork() is still in use by the parent, and one
+            // that has idled out or that the server has closed (a pending EOF or reset
+            // makes it readable) is of no use either.
+            struct pollfd pfd = { .fd = sock, .events = POLLIN, .revents = 0 };
+            if (info->tcp_pids[ns] != getpid() ||
+                    _time_now() - info->tcp_idle_since[ns] >= TCP_IDLE_TIMEOUT ||
+                    poll(&pfd, 1, 0) != 0) {
+                XLOG("%s: dropping idle TCP connection %d to server %d", __FUNCTION__, sock, ns);
+                close(sock);
+                sock = -1;
+            }
+        }
+        pthread_mutex_unlock(&info->tcp_lock);
+    }
+
+    pthread_rwlock_unlock(&_res_cache_list_lock);
+    return sock;
+}
+
+void
+_resolv_cache_put_tcp_socket(unsigned netid, int ns, int sock)
+{
+    if (ns < 0 || ns >= MAXNS) {
+        close(sock);
+        return;
+    }
+
+    pthread_once(&_res_cache_once, _res_cache_init);
+    pthread_rwlock_rdlock(&_res_cache_list_lock);
+
+    struct resolv_cache_info* info = _find_cache_info_locked(netid);
+    if (info && ns < info->nscount) {
+        time_t now = _time_now();
+        _close_tcp_sockets_locked(info, now - TCP_IDLE_TIMEOUT);
+        pthread_mutex_lock(&info->tcp_lock);
+        // Keep the connection that was used last; another thread may have had one of its
+        // own open to the same server at the same time.
+        if (info->tcp_socks[ns] >= 0) {
+            close(info->tcp_socks[ns]);
+        }
+        info->tcp_socks[ns] = sock;
+        info->tcp_pids[ns] = getpid();
+        info->tcp_idle_since[ns] = now;
+        sock = -1;
+        pthread_mutex_unlock(&info->tcp_lock);
+    }
+
+    pthread_rwlock_unlock(&_res_cache_list_lock);
+    if (sock >= 0) {
+        close(sock);
+    }
 }
@@ -19,4 +19,11 @@ struct __res_state_ext {
 extern int
 res_ourserver_p(const res_state statp, const struct sockaddr *sa);
 
+/* The address of nameserver "n", and how long to wait for its answers. */
+extern struct sockaddr *
+res_get_nsaddr(res_state statp, size_t n);
+
+extern int
+res_get_timeout(const res_state statp, const int ns);
+
 #endif
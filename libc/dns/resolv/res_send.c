@@ -97,6 +97,7 @@ __RCSID("$NetBSD: res_send.c,v 1.9 2006/01/24 17:41:25 christos Exp $");
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #ifdef ANDROID_CHANGES
 #include "resolv_netid.h"
 #include "resolv_private.h"
@@ -132,19 +133,53 @@ __RCSID("$NetBSD: res_send.c,v 1.9 2006/01/24 17:41:25 christos Exp $");
 #define EXT(res) ((res)->_u._ext)
 #define DBG 0
 
-static const int highestFD = FD_SETSIZE - 1;
-
 /* Forward. */
 
 static int		get_salen __P((const struct sockaddr *));
-static struct sockaddr * get_nsaddr __P((res_state, size_t));
+static int		open_vc(res_state, int, int *, int *, int *);
+static void		release_vc(res_state, int);
 static int		send_vc(res_state, const u_char *, int,
 				u_char *, int, int *, int,
 				time_t *, int *, int *);
+/* One of the two queries handled by res_nsend_pair(). */
+struct pair_query {
+	const u_char *buf;
+	int buflen;
+	u_char *ans;
+	int anssiz;
+	ResolvCacheStatus cache_status;
+	int resplen;		/* -1 until answered */
+	int v_circuit;		/* truncated over UDP, use TCP */
+	int sent;		/* sent in this round */
+	int waiting;		/* sent in this round, no reply yet */
+	int cached;		/* result reported to the cache */
+	time_t at;
+	int rcode;
+	int delay;
+};
+
+static void		sync_nameservers(res_state);
+static int		send_query(res_state, const u_char *, int,
+				u_char *, int, ResolvCacheStatus);
+static ResolvCacheStatus cache_lookup(res_state, const u_char *, int,
+				u_char *, int, int *);
+static int		refresh_query(res_state, const u_char *, int,
+				u_char *, int, int);
+static void		send_pair(res_state, struct pair_query *);
+static void		pair_update_cache(res_state, struct pair_query *, int);
+static int		open_dg(res_state, int, int *);
 static int		send_dg(res_state, const u_char *, int,
 				u_char *, int, int *, int,
 				int *, int *,
 				time_t *, int *, int *);
+static int		send_dg_pair(res_state, struct pair_query *,
+				int *, int, int *);
+static int		read_vc(int, u_char *, size_t);
+static int		send_vc_pair(res_state, struct pair_query *,
+				int *, int);
+static int		send_dg_race(res_state, const u_char *, int,
+				u_char *, int, int *, const int *, int,
+				int *, int *, int *, time_t *, int *, int *);
 static void		Aerror(const res_state, FILE *, const char *, int,
 			       const struct sockaddr *, int);
 static void		Perror(const res_state, FILE *, const char *, int);
@@ -157,7 +192,7 @@ static int		pselect(int, void *, void *, void *,
 void res_pquery(const res_state, const u_char *, int, FILE *);
 static int connect_with_timeout(int sock, const struct sockaddr *nsap,
 			socklen_t salen, int sec);
-static int retrying_select(const int sock, fd_set *readset, fd_set *writeset,
+static int retrying_poll(const int sock, const short events,
 			const struct timespec *finish);
 
 /* BIONIC-BEGIN: implement source port randomization */
@@ -238,7 +273,7 @@ res_ourserver_p(const res_state statp, const struct sockaddr *sa) {
 	case AF_INET:
 		inp = (const struct sockaddr_in *)(const void *)sa;
 		for (ns = 0;  ns < statp->nscount;  ns++) {
-			srv = (struct sockaddr_in *)(void *)get_nsaddr(statp, (size_t)ns);
+			srv = (struct sockaddr_in *)(void *)res_get_nsaddr(statp, (size_t)ns);
 			if (srv->sin_family == inp->sin_family &&
 			    srv->sin_port == inp->sin_port &&
 			    (srv->sin_addr.s_addr == INADDR_ANY ||
@@ -251,7 +286,7 @@ res_ourserver_p(const res_state statp, const struct sockaddr *sa) {
 			break;
 		in6p = (const struct sockaddr_in6 *)(const void *)sa;
 		for (ns = 0;  ns < statp->nscount;  ns++) {
-			srv6 = (struct sockaddr_in6 *)(void *)get_nsaddr(statp, (size_t)ns);
+			srv6 = (struct sockaddr_in6 *)(void *)res_get_nsaddr(statp, (size_t)ns);
 			if (srv6->sin6_family == in6p->sin6_family &&
 			    srv6->sin6_port == in6p->sin6_port &&
 #ifdef HAVE_SIN6_SCOPE_ID
@@ -356,44 +391,14 @@ res_queriesmatch(const u_char *buf1, const u_char *eom1,
 	return (1);
 }
 
-int
-res_nsend(res_state statp,
-	  const u_char *buf, int buflen, u_char *ans, int anssiz)
+/*
+ * Bring our private copy of the nameserver list in line with the resolver
+ * state, and apply RES_ROTATE.
+ */
+static void
+sync_nameservers(res_state statp)
 {
-	int gotsomewhere, terrno, try, v_circuit, resplen, ns, n;
-	char abuf[NI_MAXHOST];
-	ResolvCacheStatus     cache_status = RESOLV_CACHE_UNSUPPORTED;
-
-	if (anssiz < HFIXEDSZ) {
-		errno = EINVAL;
-		return (-1);
-	}
-	DprintQ((statp->options & RES_DEBUG) || (statp->pfcode & RES_PRF_QUERY),
-		(stdout, ";; res_send()\n"), buf, buflen);
-	v_circuit = (statp->options & RES_USEVC) || buflen > PACKETSZ;
-	gotsomewhere = 0;
-	terrno = ETIMEDOUT;
-
-	int  anslen = 0;
-	cache_status = _resolv_cache_lookup(
-			statp->netid, buf, buflen,
-			ans, anssiz, &anslen);
-
-	if (cache_status == RESOLV_CACHE_FOUND) {
-		return anslen;
-	} else if (cache_status != RESOLV_CACHE_UNSUPPORTED) {
-		// had a cache miss for a known network, so populate the thread private
-		// data so the normal resolve path can do its thing
-		_resolv_populate_res_for_net(statp);
-	}
-	if (statp->nscount == 0) {
-		// We have no nameservers configured, so there's no point trying.
-		// Tell the cache the query failed, or any retries and anyone else asking the same
-		// question will block for PENDING_REQUEST_TIMEOUT seconds instead of failing fast.
-		_resolv_cache_query_failed(statp->netid, buf, buflen);
-		errno = ESRCH;
-		return (-1);
-	}
+	int ns;
 
 	/*
 	 * If the ns_addr_list in the resolver context has changed, then
@@ -424,7 +429,7 @@ res_nsend(res_state statp,
 					break;
 				}
 				if (!sock_eq((struct sockaddr *)(void *)&peer,
-				    get_nsaddr(statp, (size_t)ns))) {
+				    res_get_nsaddr(statp, (size_t)ns))) {
 					needclose++;
 					break;
 				}
@@ -482,6 +487,123 @@ res_nsend(res_state statp,
 		EXT(statp).nssocks[lastns] = fd;
 		EXT(statp).nstimes[lastns] = nstime;
 	}
+}
+
+int
+res_nsend(res_state statp,
+	  const u_char *buf, int buflen, u_char *ans, int anssiz)
+{
+	ResolvCacheStatus     cache_status = RESOLV_CACHE_UNSUPPORTED;
+
+	if (anssiz < HFIXEDSZ) {
+		errno = EINVAL;
+		return (-1);
+	}
+	DprintQ((statp->options & RES_DEBUG) || (statp->pfcode & RES_PRF_QUERY),
+		(stdout, ";; res_send()\n"), buf, buflen);
+
+	int  anslen = 0;
+	cache_status = cache_lookup(statp, buf, buflen, ans, anssiz, &anslen);
+
+	if (cache_status == RESOLV_CACHE_PENDING) {
+		errno = ESRCH;
+		return (-1);
+	} else if (cache_status == RESOLV_CACHE_FOUND) {
+		return anslen;
+	} else if (cache_status == RESOLV_CACHE_REFRESH) {
+		return refresh_query(statp, buf, buflen, ans, anssiz, anslen);
+	} else if (cache_status != RESOLV_CACHE_UNSUPPORTED) {
+		// had a cache miss for a known network, so populate the thread private
+		// data so the normal resolve path can do its thing
+		_resolv_populate_res_for_net(statp);
+	}
+	return send_query(statp, buf, buflen, ans, anssiz, cache_status);
+}
+
+/*
+ * Look a query up in the cache.  A lookup that may only be answered from
+ * the cache doesn't wait for somebody else's pending request for the same
+ * query: it returns RESOLV_CACHE_PENDING, and the lookup fails with
+ * RES_F_CACHEMISS set, as it does when the answer isn't in the cache.
+ */
+static ResolvCacheStatus
+cache_lookup(res_state statp,
+	     const u_char *buf, int buflen, u_char *ans, int anssiz, int *anslen)
+{
+	ResolvCacheStatus status;
+
+	if ((statp->_flags & RES_F_CACHEONLY) == 0)
+		return _resolv_cache_lookup(statp->netid, buf, buflen,
+		    ans, anssiz, anslen);
+	status = _resolv_cache_lookup_nowait(statp->netid, buf, buflen,
+	    ans, anssiz, anslen);
+	if (status == RESOLV_CACHE_PENDING)
+		statp->_flags |= RES_F_CACHEMISS;
+	return status;
+}
+
+/*
+ * The cache gave us a valid answer for a popular query that is about to
+ * expire, and made us the one lookup in the process that refreshes.  Query
+ * again now so that the entry is replaced before it does, but fall back to
+ * the cached answer if that fails.  Everybody else keeps getting the cached
+ * answer meanwhile.
+ */
+static int
+refresh_query(res_state statp,
+	      const u_char *buf, int buflen, u_char *ans, int anssiz, int anslen)
+{
+	int saved_errno = errno;
+	u_char *fresh;
+	int n;
+
+	fresh = malloc((size_t)anssiz);
+	if (fresh == NULL) {
+		_resolv_cache_query_failed(statp->netid, buf, buflen);
+		_resolv_cache_refresh_done();
+		return anslen;
+	}
+	_resolv_populate_res_for_net(statp);
+	n = send_query(statp, buf, buflen, fresh, anssiz, RESOLV_CACHE_REFRESH);
+	_resolv_cache_refresh_done();
+	if (n > 0) {
+		memcpy(ans, fresh, (size_t)((n > anssiz) ? anssiz : n));
+		anslen = n;
+	}
+	free(fresh);
+	errno = saved_errno;
+	return anslen;
+}
+
+/*
+ * Send a query that missed the cache to the configured nameservers,
+ * retrying and falling back to TCP as needed.
+ */
+static int
+send_query(res_state statp,
+	   const u_char *buf, int buflen, u_char *ans, int anssiz,
+	   ResolvCacheStatus cache_status)
+{
+	int gotsomewhere, terrno, try, v_circuit, resplen, ns, n, first, i;
+	char abuf[NI_MAXHOST];
+
+	v_circuit = (statp->options & RES_USEVC) || buflen > PACKETSZ;
+	gotsomewhere = 0;
+	terrno = ETIMEDOUT;
+
+	if (statp->nscount == 0 || (statp->_flags & RES_F_CACHEONLY)) {
+		// We have no nameservers configured, or were asked to answer from the cache only,
+		// so there's no point trying. Tell the cache the query failed, or any retries and anyone else asking the same
+		// question will block for PENDING_REQUEST_TIMEOUT seconds instead of failing fast.
+		_resolv_cache_query_failed(statp->netid, buf, buflen);
+		if ((statp->_flags & RES_F_CACHEONLY) &&
+		    cache_status != RESOLV_CACHE_REFRESH)
+			statp->_flags |= RES_F_CACHEMISS;
+		errno = ESRCH;
+		return (-1);
+	}
+
+	sync_nameservers(statp);
 
 	/*
 	 * Send request, RETRY times, or until successful.
@@ -493,15 +615,89 @@ res_nsend(res_state statp,
 	    bool usable_servers[MAXNS];
 	    android_net_res_stats_get_usable_servers(&params, stats, statp->nscount,
 		    usable_servers);
+	    first = 0;
+
+	    /*
+	     * Race the query to the best few usable servers at once and take
+	     * the first good answer, rather than waiting out a timeout on each
+	     * in turn.  The hooks expect one server at a time, and TCP never
+	     * races.
+	     */
+	    if (!v_circuit && statp->qhook == NULL && statp->rhook == NULL) {
+		int order[MAXNS], rcodes[MAXNS], delays[MAXNS];
+		int width, count, winner;
+		time_t now = 0;
 
-	    for (ns = 0; ns < statp->nscount; ns++) {
+		width = (statp->options & RES_BLAST) ? statp->nscount :
+		    params.concurrent_servers;
+		count = _res_stats_rank_servers(stats, statp->nscount,
+		    usable_servers, order);
+		if (count > width)
+			count = width;
+		if (count > 1) {
+			n = send_dg_race(statp, buf, buflen, ans, anssiz,
+			    &terrno, order, count, &v_circuit, &gotsomewhere,
+			    &winner, &now, rcodes, delays);
+
+			/* Only record stats the first time we try a query. */
+			if (try == 0) {
+				for (i = 0; i < count; i++) {
+					struct __res_sample sample;
+
+					ns = order[i];
+					if (rcodes[ns] < 0)
+						continue;
+					_res_stats_set_sample(&sample, now,
+					    rcodes[ns], delays[ns]);
+					_resolv_cache_add_resolver_stats_sample(
+					    statp->netid, revision_id, ns,
+					    &sample, params.max_samples);
+				}
+			}
+
+			if (DBG) {
+				async_safe_format_log(ANDROID_LOG_DEBUG, "libc",
+					"used send_dg_race %d\n", n);
+			}
+
+			if (n < 0)
+				goto fail;
+			if (n == 0)
+				continue;
+			if (!v_circuit) {
+				resplen = n;
+				statp->_flags &= ~RES_F_LASTMASK;
+				statp->_flags |= (winner << RES_F_LASTSHIFT);
+				DprintQ((statp->options & RES_DEBUG) ||
+					(statp->pfcode & RES_PRF_REPLY),
+					(stdout, ";; got answer:\n"),
+					ans, (resplen > anssiz) ? anssiz : resplen);
+				if (cache_status == RESOLV_CACHE_NOTFOUND ||
+				    cache_status == RESOLV_CACHE_REFRESH) {
+					_resolv_cache_add(statp->netid, buf, buflen,
+					    ans, resplen);
+				}
+				if ((statp->options & RES_STAYOPEN) == 0U)
+					res_nclose(statp);
+				return (resplen);
+			}
+			/*
+			 * Truncated: fall through and retry over TCP,
+			 * starting with the server that has the answer.
+			 */
+			first = winner;
+		}
+	    }
+
+	    for (i = 0; i < statp->nscount; i++) {
+		ns = (first + i) % statp->nscount;
 		if (!usable_servers[ns]) continue;
 		struct sockaddr *nsap;
 		int nsaplen;
 		time_t now = 0;
 		int rcode = RCODE_INTERNAL_ERROR;
 		int delay = 0;
-		nsap = get_nsaddr(statp, (size_t)ns);
+		nsap = res_get_nsaddr(statp, (size_t)ns);
 		nsaplen = get_salen(nsap);
 		statp->_flags &= ~RES_F_LASTMASK;
 		statp->_flags |= (ns << RES_F_LASTSHIFT);
@@ -523,7 +719,8 @@ res_nsend(res_state statp,
 					res_nclose(statp);
 					goto next_ns;
 				case res_done:
-					if (cache_status == RESOLV_CACHE_NOTFOUND) {
+					if (cache_status == RESOLV_CACHE_NOTFOUND ||
+					    cache_status == RESOLV_CACHE_REFRESH) {
 						_resolv_cache_add(statp->netid, buf, buflen,
 								ans, resplen);
 					}
@@ -621,7 +818,8 @@ res_nsend(res_state statp,
 			(stdout, "%s", ""),
 			ans, (resplen > anssiz) ? anssiz : resplen);
 
-		if (cache_status == RESOLV_CACHE_NOTFOUND) {
+		if (cache_status == RESOLV_CACHE_NOTFOUND ||
+		    cache_status == RESOLV_CACHE_REFRESH) {
 		    _resolv_cache_add(statp->netid, buf, buflen,
 				      ans, resplen);
 		}
@@ -686,6 +884,236 @@ res_nsend(res_state statp,
 	return (-1);
 }
 
+/*
+ * Send two queries for the same name (typically the AAAA and A queries of
+ * an AF_UNSPEC getaddrinfo) at the same time.  Over UDP both go out on the
+ * same socket and the replies are matched by ID, so a dual-stack lookup
+ * costs one round trip rather than two.  The length of the first answer is
+ * returned; the length of the second is stored in "*resplen2".  Either may
+ * be -1 if that query failed.
+ */
+int
+res_nsend_pair(res_state statp,
+	       const u_char *buf, int buflen, u_char *ans, int anssiz,
+	       const u_char *buf2, int buflen2, u_char *ans2, int anssiz2,
+	       int *resplen2)
+{
+	struct pair_query q[2];
+	const HEADER *hp = (const HEADER *)(const void *)buf;
+	const HEADER *hp2 = (const HEADER *)(const void *)buf2;
+	int i, anslen;
+
+	*resplen2 = -1;
+	if (anssiz < HFIXEDSZ || anssiz2 < HFIXEDSZ) {
+		errno = EINVAL;
+		return (-1);
+	}
+	DprintQ((statp->options & RES_DEBUG) || (statp->pfcode & RES_PRF_QUERY),
+		(stdout, ";; res_send()\n"), buf, buflen);
+	DprintQ((statp->options & RES_DEBUG) || (statp->pfcode & RES_PRF_QUERY),
+		(stdout, ";; res_send()\n"), buf2, buflen2);
+
+	memset(q, 0, sizeof(q));
+	q[0].buf = buf;
+	q[0].buflen = buflen;
+	q[0].ans = ans;
+	q[0].anssiz = anssiz;
+	q[1].buf = buf2;
+	q[1].buflen = buflen2;
+	q[1].ans = ans2;
+	q[1].anssiz = anssiz2;
+
+	/*
+	 * Always look the queries up in the same order, so that two threads
+	 * resolving the same name cannot each wait for the other's pending
+	 * request.
+	 */
+	for (i = 0; i < 2; i++) {
+		anslen = 0;
+		q[i].cache_status = cache_lookup(statp, q[i].buf, q[i].buflen,
+		    q[i].ans, q[i].anssiz, &anslen);
+		q[i].resplen = (q[i].cache_status == RESOLV_CACHE_FOUND ||
+		    q[i].cache_status == RESOLV_CACHE_REFRESH) ? anslen : -1;
+	}
+	if (q[0].resplen >= 0 && q[1].resplen >= 0)
+		goto done;
+	for (i = 0; i < 2; i++) {
+		if (q[i].cache_status != RESOLV_CACHE_PENDING)
+			continue;
+		/* Answering from the cache only, which can't be done. */
+		if (q[1 - i].cache_status == RESOLV_CACHE_NOTFOUND)
+			_resolv_cache_query_failed(statp->netid, q[1 - i].buf,
+			    q[1 - i].buflen);
+		errno = ESRCH;
+		goto done;
+	}
+	if (q[0].cache_status != RESOLV_CACHE_UNSUPPORTED)
+		_resolv_populate_res_for_net(statp);
+
+	if (q[0].resplen < 0 && q[1].resplen < 0 &&
+	    (statp->options & RES_USEVC) == 0U &&
+	    buflen <= PACKETSZ && buflen2 <= PACKETSZ &&
+	    hp->id != hp2->id &&
+	    statp->qhook == NULL && statp->rhook == NULL) {
+		send_pair(statp, q);
+	} else {
+		for (i = 0; i < 2; i++) {
+			if (q[i].resplen < 0)
+				q[i].resplen = send_query(statp, q[i].buf,
+				    q[i].buflen, q[i].ans, q[i].anssiz,
+				    q[i].cache_status);
+		}
+	}
+ done:
+	for (i = 0; i < 2; i++) {
+		if (q[i].cache_status == RESOLV_CACHE_REFRESH)
+			q[i].resplen = refresh_query(statp, q[i].buf,
+			    q[i].buflen, q[i].ans, q[i].anssiz, q[i].resplen);
+	}
+	*resplen2 = q[1].resplen;
+	return (q[0].resplen);
+}
+
+/*
+ * The UDP retry loop of send_query(), for a pair of queries.  Each round
+ * sends whichever queries are still unanswered to one nameserver.  A
+ * truncated reply moves that query to TCP, as in send_query().
+ */
+static void
+send_pair(res_state statp, struct pair_query *q)
+{
+	int gotsomewhere, terrno, try, ns, n, i, tcp;
+
+	gotsomewhere = 0;
+	terrno = ETIMEDOUT;
+
+	if (statp->nscount == 0 || (statp->_flags & RES_F_CACHEONLY)) {
+		for (i = 0; i < 2; i++)
+			_resolv_cache_query_failed(statp->netid, q[i].buf, q[i].buflen);
+		if (statp->_flags & RES_F_CACHEONLY)
+			statp->_flags |= RES_F_CACHEMISS;
+		errno = ESRCH;
+		return;
+	}
+
+	sync_nameservers(statp);
+
+	for (try = 0; try < statp->retry; try++) {
+	    struct __res_stats stats[MAXNS];
+	    struct __res_params params;
+	    int revision_id = _resolv_cache_get_resolver_stats(statp->netid, &params, stats);
+	    bool usable_servers[MAXNS];
+	    android_net_res_stats_get_usable_servers(&params, stats, statp->nscount,
+		    usable_servers);
+
+	    for (ns = 0; ns < statp->nscount; ns++) {
+		if (!usable_servers[ns]) continue;
+		statp->_flags &= ~RES_F_LASTMASK;
+		statp->_flags |= (ns << RES_F_LASTSHIFT);
+
+		n = send_dg_pair(statp, q, &terrno, ns, &gotsomewhere);
+		if (n < 0)
+			goto fail;
+
+		tcp = 0;
+		for (i = 0; i < 2; i++) {
+			/* Only record stats the first time we try a query. */
+			if (q[i].sent && try == 0) {
+				struct __res_sample sample;
+				_res_stats_set_sample(&sample, q[i].at, q[i].rcode,
+				    q[i].delay);
+				_resolv_cache_add_resolver_stats_sample(statp->netid,
+				    revision_id, ns, &sample, params.max_samples);
+			}
+			if (q[i].resplen < 0 && q[i].v_circuit)
+				tcp++;
+		}
+
+		/* Both truncated: pipeline them over one connection. */
+		if (tcp == 2) {
+			n = send_vc_pair(statp, q, &terrno, ns);
+			for (i = 0; i < 2 && try == 0; i++) {
+				struct __res_sample sample;
+				_res_stats_set_sample(&sample, q[i].at, q[i].rcode,
+				    q[i].delay);
+				_resolv_cache_add_resolver_stats_sample(statp->netid,
+				    revision_id, ns, &sample, params.max_samples);
+			}
+			if (n < 0)
+				goto fail;
+			tcp = 0;
+		}
+
+		for (i = 0; i < 2 && tcp > 0; i++) {
+			if (q[i].resplen >= 0 || !q[i].v_circuit)
+				continue;
+
+			/* Truncated: ask over TCP, as send_query() would. */
+			n = send_vc(statp, q[i].buf, q[i].buflen, q[i].ans,
+			    q[i].anssiz, &terrno, ns, &q[i].at, &q[i].rcode,
+			    &q[i].delay);
+			if (try == 0) {
+				struct __res_sample sample;
+				_res_stats_set_sample(&sample, q[i].at, q[i].rcode,
+				    q[i].delay);
+				_resolv_cache_add_resolver_stats_sample(statp->netid,
+				    revision_id, ns, &sample, params.max_samples);
+			}
+			if (n < 0)
+				goto fail;
+			if (n > 0)
+				q[i].resplen = n;
+		}
+		pair_update_cache(statp, q, 0);
+		if (q[0].resplen >= 0 && q[1].resplen >= 0)
+			goto done;
+	   } /*foreach ns*/
+	} /*foreach retry*/
+	if (!q[0].v_circuit && !q[1].v_circuit) {
+		if (!gotsomewhere)
+			errno = ECONNREFUSED;	/* no nameservers found */
+		else
+			errno = ETIMEDOUT;	/* no answer obtained */
+	} else
+		errno = terrno;
+ done:
+	pair_update_cache(statp, q, 1);
+	if ((statp->options & RES_STAYOPEN) == 0U ||
+	    q[0].resplen < 0 || q[1].resplen < 0 ||
+	    q[0].v_circuit || q[1].v_circuit)
+		res_nclose(statp);
+	return;
+ fail:
+	pair_update_cache(statp, q, 1);
+	res_nclose(statp);
+}
+
+/*
+ * Tell the cache about answered queries as soon as we have them, so that
+ * anyone waiting on one of them does not also wait for the other.  With
+ * "final" set, report the unanswered ones as failed.
+ */
+static void
+pair_update_cache(res_state statp, struct pair_query *q, int final)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (q[i].cached)
+			continue;
+		if (q[i].resplen >= 0) {
+			if (q[i].cache_status == RESOLV_CACHE_NOTFOUND)
+				_resolv_cache_add(statp->netid, q[i].buf,
+				    q[i].buflen, q[i].ans, q[i].resplen);
+		} else if (final) {
+			_resolv_cache_query_failed(statp->netid, q[i].buf,
+			    q[i].buflen);
+		} else
+			continue;
+		q[i].cached = 1;
+	}
+}
+
 /* Private */
 
 static int
@@ -710,8 +1138,8 @@ get_salen(sa)
 /*
  * pick appropriate nsaddr_list for use.  see res_init() for initialization.
  */
-static struct sockaddr *
-get_nsaddr(statp, n)
+struct sockaddr *
+res_get_nsaddr(statp, n)
 	res_state statp;
 	size_t n;
 {
@@ -733,7 +1161,7 @@ get_nsaddr(statp, n)
 	}
 }
 
-static int get_timeout(const res_state statp, const int ns)
+int res_get_timeout(const res_state statp, const int ns)
 {
 	int timeout = (statp->retrans << ns);
 	if (ns > 0) {
@@ -749,36 +1177,28 @@ static int get_timeout(const res_state statp, const int ns)
 	return timeout;
 }
 
+/*
+ * Make sure statp->_vcsock is connected to nameserver "ns", reusing the
+ * network's idle connection to it if there is one.  "*reused" tells whether
+ * the connection was already open, and so may turn out to have been closed
+ * by the server.  Returns 1 on success, 0 if the next nameserver should be
+ * tried, and -1 on a fatal error.
+ */
 static int
-send_vc(res_state statp,
-	const u_char *buf, int buflen, u_char *ans, int anssiz,
-	int *terrno, int ns, time_t* at, int* rcode, int* delay)
+open_vc(res_state statp, int ns, int *terrno, int *rcode, int *reused)
 {
-	*at = time(NULL);
-	*rcode = RCODE_INTERNAL_ERROR;
-	*delay = 0;
-	const HEADER *hp = (const HEADER *)(const void *)buf;
-	HEADER *anhp = (HEADER *)(void *)ans;
 	struct sockaddr *nsap;
 	int nsaplen;
-	int truncating, connreset, resplen, n;
-	struct iovec iov[2];
-	u_short len;
-	u_char *cp;
-	void *tmp;
-
-	if (DBG) {
-		async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "using send_vc\n");
-	}
 
-	nsap = get_nsaddr(statp, (size_t)ns);
+	nsap = res_get_nsaddr(statp, (size_t)ns);
 	nsaplen = get_salen(nsap);
+	*reused = 0;
 
-	connreset = 0;
- same_ns:
-	truncating = 0;
-
-	struct timespec now = evNowTime();
+	if (statp->_vcsock < 0) {
+		statp->_vcsock = _resolv_cache_take_tcp_socket(statp->netid, ns);
+		if (statp->_vcsock >= 0)
+			statp->_flags |= RES_F_VC;
+	}
 
 	/* Are we still talking to whom we want to talk to? */
 	if (statp->_vcsock >= 0 && (statp->_flags & RES_F_VC) != 0) {
@@ -793,6 +1213,8 @@ send_vc(res_state statp,
 			old_mark != statp->_mark) {
 			res_nclose(statp);
 			statp->_flags &= ~RES_F_VC;
+		} else {
+			*reused = 1;
 		}
 	}
 
@@ -801,10 +1223,6 @@ send_vc(res_state statp,
 			res_nclose(statp);
 
 		statp->_vcsock = socket(nsap->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
-		if (statp->_vcsock > highestFD) {
-			res_nclose(statp);
-			errno = ENOTSOCK;
-		}
 		if (statp->_vcsock < 0) {
 			switch (errno) {
 			case EPROTONOSUPPORT:
@@ -837,7 +1255,7 @@ send_vc(res_state statp,
 			return (0);
 		}
 		if (connect_with_timeout(statp->_vcsock, nsap, (socklen_t)nsaplen,
-				get_timeout(statp, ns)) < 0) {
+				res_get_timeout(statp, ns)) < 0) {
 			*terrno = errno;
 			Aerror(statp, stderr, "connect/vc", errno, nsap,
 			    nsaplen);
@@ -847,7 +1265,7 @@ send_vc(res_state statp,
 			 * determining whether this was really a timeout or e.g. ECONNREFUSED. Since
 			 * currently both cases are handled in the same way, there is no need to
 			 * change this (yet). If we ever need to reliably distinguish between these
-			 * cases, both connect_with_timeout() and retrying_select() need to be
+			 * cases, both connect_with_timeout() and retrying_poll() need to be
 			 * modified, though.
 			 */
 			*rcode = RCODE_TIMEOUT;
@@ -855,24 +1273,77 @@ send_vc(res_state statp,
 		}
 		statp->_flags |= RES_F_VC;
 	}
+	return (1);
+}
 
-	/*
-	 * Send length & message
-	 */
-	ns_put16((u_short)buflen, (u_char*)(void *)&len);
-	iov[0] = evConsIovec(&len, INT16SZ);
-	DE_CONST(buf, tmp);
-	iov[1] = evConsIovec(tmp, (size_t)buflen);
-	if (writev(statp->_vcsock, iov, 2) != (INT16SZ + buflen)) {
-		*terrno = errno;
-		Perror(statp, stderr, "write failed", errno);
-		res_nclose(statp);
-		return (0);
-	}
-	/*
-	 * Receive length & response
-	 */
- read_len:
+/*
+ * Hand the connection to nameserver "ns" back to the network once every
+ * answer sent on it has been read, so that the next truncated answer does
+ * not pay for another handshake.  Idle connections are closed after a while
+ * by the cache.
+ */
+static void
+release_vc(res_state statp, int ns)
+{
+	if (statp->_vcsock < 0 || (statp->_flags & RES_F_VC) == 0)
+		return;
+	_resolv_cache_put_tcp_socket(statp->netid, ns, statp->_vcsock);
+	statp->_vcsock = -1;
+	statp->_flags &= ~(RES_F_VC | RES_F_CONN);
+}
+
+static int
+send_vc(res_state statp,
+	const u_char *buf, int buflen, u_char *ans, int anssiz,
+	int *terrno, int ns, time_t* at, int* rcode, int* delay)
+{
+	*at = time(NULL);
+	*rcode = RCODE_INTERNAL_ERROR;
+	*delay = 0;
+	const HEADER *hp = (const HEADER *)(const void *)buf;
+	HEADER *anhp = (HEADER *)(void *)ans;
+	int truncating, connreset, reused, resplen, n;
+	struct iovec iov[2];
+	u_short len;
+	u_char *cp;
+	void *tmp;
+
+	if (DBG) {
+		async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "using send_vc\n");
+	}
+
+	connreset = 0;
+ same_ns:
+	truncating = 0;
+
+	struct timespec now = evNowTime();
+
+	n = open_vc(statp, ns, terrno, rcode, &reused);
+	if (n <= 0)
+		return (n);
+
+	/*
+	 * Send length & message
+	 */
+	ns_put16((u_short)buflen, (u_char*)(void *)&len);
+	iov[0] = evConsIovec(&len, INT16SZ);
+	DE_CONST(buf, tmp);
+	iov[1] = evConsIovec(tmp, (size_t)buflen);
+	if (writev(statp->_vcsock, iov, 2) != (INT16SZ + buflen)) {
+		*terrno = errno;
+		Perror(statp, stderr, "write failed", errno);
+		res_nclose(statp);
+		/* The server may have closed an idle connection. */
+		if (reused && !connreset) {
+			connreset = 1;
+			goto same_ns;
+		}
+		return (0);
+	}
+	/*
+	 * Receive length & response
+	 */
+ read_len:
 	cp = ans;
 	len = INT16SZ;
 	while ((n = read(statp->_vcsock, (char *)cp, (size_t)len)) > 0) {
@@ -891,9 +1362,11 @@ send_vc(res_state statp,
 		 * trying a new one.  When there is only one
 		 * server, this means that a query might work
 		 * instead of failing.  We only allow one reset
-		 * per query to prevent looping.
+		 * per query to prevent looping.  The same goes
+		 * for a reused connection that the server closed
+		 * while it was idle.
 		 */
-		if (*terrno == ECONNRESET && !connreset) {
+		if ((*terrno == ECONNRESET || reused) && !connreset) {
 			connreset = 1;
 			res_nclose(statp);
 			goto same_ns;
@@ -973,6 +1446,7 @@ send_vc(res_state statp,
 	    *delay = _res_stats_calculate_rtt(&done, &now);
 	    *rcode = anhp->rcode;
 	}
+	release_vc(statp, ns);
 	return (resplen);
 }
 
@@ -981,7 +1455,6 @@ static int
 connect_with_timeout(int sock, const struct sockaddr *nsap, socklen_t salen, int sec)
 {
 	int res, origflags;
-	fd_set rset, wset;
 	struct timespec now, timeout, finish;
 
 	origflags = fcntl(sock, F_GETFL, 0);
@@ -1000,7 +1473,7 @@ connect_with_timeout(int sock, const struct sockaddr *nsap, socklen_t salen, int
 			async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "  %d send_vc\n", sock);
 		}
 
-		res = retrying_select(sock, &rset, &wset, &finish);
+		res = retrying_poll(sock, POLLIN | POLLOUT, &finish);
 		if (res <= 0) {
 			res = -1;
 		}
@@ -1015,37 +1488,33 @@ done:
 }
 
 static int
-retrying_select(const int sock, fd_set *readset, fd_set *writeset, const struct timespec *finish)
+retrying_poll(const int sock, const short events, const struct timespec *finish)
 {
 	struct timespec now, timeout;
+	struct pollfd fds;
 	int n, error;
 	socklen_t len;
 
 
 retry:
 	if (DBG) {
-		async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "  %d retrying_select\n", sock);
+		async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "  %d retrying_poll\n", sock);
 	}
 
 	now = evNowTime();
-	if (readset) {
-		FD_ZERO(readset);
-		FD_SET(sock, readset);
-	}
-	if (writeset) {
-		FD_ZERO(writeset);
-		FD_SET(sock, writeset);
-	}
 	if (evCmpTime(*finish, now) > 0)
 		timeout = evSubTime(*finish, now);
 	else
 		timeout = evConsTime(0L, 0L);
 
-	n = pselect(sock + 1, readset, writeset, NULL, &timeout, NULL);
+	fds.fd = sock;
+	fds.events = events;
+	fds.revents = 0;
+	n = ppoll(&fds, 1, &timeout, NULL);
 	if (n == 0) {
 		if (DBG) {
 			async_safe_format_log(ANDROID_LOG_DEBUG, " libc",
-				"  %d retrying_select timeout\n", sock);
+				"  %d retrying_poll timeout\n", sock);
 		}
 		errno = ETIMEDOUT;
 		return 0;
@@ -1055,17 +1524,17 @@ retry:
 			goto retry;
 		if (DBG) {
 			async_safe_format_log(ANDROID_LOG_DEBUG, "libc",
-				"  %d retrying_select got error %d\n",sock, n);
+				"  %d retrying_poll got error %d\n",sock, n);
 		}
 		return n;
 	}
-	if ((readset && FD_ISSET(sock, readset)) || (writeset && FD_ISSET(sock, writeset))) {
+	if (fds.revents & (POLLIN | POLLOUT | POLLERR | POLLHUP)) {
 		len = sizeof(error);
 		if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
 			errno = error;
 			if (DBG) {
 				async_safe_format_log(ANDROID_LOG_DEBUG, "libc",
-					"  %d retrying_select dot error2 %d\n", sock, errno);
+					"  %d retrying_poll dot error2 %d\n", sock, errno);
 			}
 
 			return -1;
@@ -1073,39 +1542,26 @@ retry:
 	}
 	if (DBG) {
 		async_safe_format_log(ANDROID_LOG_DEBUG, "libc",
-			"  %d retrying_select returning %d\n",sock, n);
+			"  %d retrying_poll returning %d\n",sock, n);
 	}
 
 	return n;
 }
 
+/*
+ * Make sure we have a datagram socket for nameserver "ns".  Returns 1 on
+ * success, 0 if the next nameserver should be tried, and -1 on a fatal error.
+ */
 static int
-send_dg(res_state statp,
-	const u_char *buf, int buflen, u_char *ans, int anssiz,
-	int *terrno, int ns, int *v_circuit, int *gotsomewhere,
-	time_t *at, int *rcode, int* delay)
+open_dg(res_state statp, int ns, int *terrno)
 {
-	*at = time(NULL);
-	*rcode = RCODE_INTERNAL_ERROR;
-	*delay = 0;
-	const HEADER *hp = (const HEADER *)(const void *)buf;
-	HEADER *anhp = (HEADER *)(void *)ans;
 	const struct sockaddr *nsap;
 	int nsaplen;
-	struct timespec now, timeout, finish, done;
-	fd_set dsmask;
-	struct sockaddr_storage from;
-	socklen_t fromlen;
-	int resplen, seconds, n, s;
 
-	nsap = get_nsaddr(statp, (size_t)ns);
+	nsap = res_get_nsaddr(statp, (size_t)ns);
 	nsaplen = get_salen(nsap);
 	if (EXT(statp).nssocks[ns] == -1) {
 		EXT(statp).nssocks[ns] = socket(nsap->sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-		if (EXT(statp).nssocks[ns] > highestFD) {
-			res_nclose(statp);
-			errno = ENOTSOCK;
-		}
 		if (EXT(statp).nssocks[ns] < 0) {
 			switch (errno) {
 			case EPROTONOSUPPORT:
@@ -1126,7 +1582,7 @@ send_dg(res_state statp,
 			if (setsockopt(EXT(statp).nssocks[ns], SOL_SOCKET,
 					SO_MARK, &(statp->_mark), sizeof(statp->_mark)) < 0) {
 				res_nclose(statp);
-				return -1;
+				return (-1);
 			}
 		}
 #ifndef CANNOT_CONNECT_DGRAM
@@ -1158,6 +1614,28 @@ send_dg(res_state statp,
 		       (stdout, ";; new DG socket\n"))
 
 	}
+	return (1);
+}
+
+static int
+send_dg(res_state statp,
+	const u_char *buf, int buflen, u_char *ans, int anssiz,
+	int *terrno, int ns, int *v_circuit, int *gotsomewhere,
+	time_t *at, int *rcode, int* delay)
+{
+	*at = time(NULL);
+	*rcode = RCODE_INTERNAL_ERROR;
+	*delay = 0;
+	const HEADER *hp = (const HEADER *)(const void *)buf;
+	HEADER *anhp = (HEADER *)(void *)ans;
+	struct timespec now, timeout, finish, done;
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	int resplen, seconds, n, s;
+
+	n = open_dg(statp, ns, terrno);
+	if (n <= 0)
+		return (n);
 	s = EXT(statp).nssocks[ns];
 #ifndef CANNOT_CONNECT_DGRAM
 	if (send(s, (const char*)buf, (size_t)buflen, 0) != buflen) {
@@ -1166,23 +1644,28 @@ send_dg(res_state statp,
 		return (0);
 	}
 #else /* !CANNOT_CONNECT_DGRAM */
+	{
+	const struct sockaddr *nsap = res_get_nsaddr(statp, (size_t)ns);
+	int nsaplen = get_salen(nsap);
+
 	if (sendto(s, (const char*)buf, buflen, 0, nsap, nsaplen) != buflen)
 	{
 		Aerror(statp, stderr, "sendto", errno, nsap, nsaplen);
 		res_nclose(statp);
 		return (0);
 	}
+	}
 #endif /* !CANNOT_CONNECT_DGRAM */
 
 	/*
 	 * Wait for reply.
 	 */
-	seconds = get_timeout(statp, ns);
+	seconds = res_get_timeout(statp, ns);
 	now = evNowTime();
 	timeout = evConsTime((long)seconds, 0L);
 	finish = evAddTime(now, timeout);
 retry:
-	n = retrying_select(s, &dsmask, NULL, &finish);
+	n = retrying_poll(s, POLLIN, &finish);
 
 	if (n == 0) {
 		*rcode = RCODE_TIMEOUT;
@@ -1307,6 +1790,560 @@ retry:
 	return (resplen);
 }
 
+/*
+ * Send the query to the "count" nameservers listed in "order" at once, each
+ * over its own socket, and return the first acceptable answer.  The server
+ * that gave it is stored in "*winner".  A server that rejects the query is
+ * dropped from the race; a truncated answer ends it with "*v_circuit" set.
+ * "rcodes" and "delays", indexed by server, receive the outcome of each
+ * server that finished; servers that were still pending when the race was
+ * decided are left at -1 so that no sample is recorded for them.  Returns
+ * the answer length, 0 if no server answered, or -1 on a fatal error.
+ */
+static int
+send_dg_race(res_state statp,
+	const u_char *buf, int buflen, u_char *ans, int anssiz,
+	int *terrno, const int *order, int count, int *v_circuit,
+	int *gotsomewhere, int *winner, time_t *at, int *rcodes, int *delays)
+{
+	const HEADER *hp = (const HEADER *)(const void *)buf;
+	HEADER *anhp = (HEADER *)(void *)ans;
+	struct pollfd fds[MAXNS];
+	struct timespec start, now, timeout, finish[MAXNS], soonest;
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	int skipped[MAXNS], pending, resplen, i, n, ns;
+
+	*at = time(NULL);
+	*winner = -1;
+	for (ns = 0; ns < MAXNS; ns++) {
+		rcodes[ns] = -1;
+		delays[ns] = 0;
+	}
+
+	/*
+	 * Open every socket before sending anything: open_dg() closes all
+	 * the sockets when one of them can't be set up, so start over
+	 * without that server if it does.
+	 */
+	memset(skipped, 0, sizeof(skipped));
+again:
+	for (i = 0; i < count; i++) {
+		if (skipped[i])
+			continue;
+		n = open_dg(statp, order[i], terrno);
+		if (n < 0)
+			return (-1);
+		if (n == 0) {
+			rcodes[order[i]] = RCODE_INTERNAL_ERROR;
+			skipped[i] = 1;
+			goto again;
+		}
+	}
+
+	start = evNowTime();
+	pending = 0;
+	for (i = 0; i < count; i++) {
+		ns = order[i];
+		fds[i].fd = -1;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		if (skipped[i])
+			continue;
+#ifndef CANNOT_CONNECT_DGRAM
+		if (send(EXT(statp).nssocks[ns], (const char*)buf,
+		    (size_t)buflen, 0) != buflen) {
+			Perror(statp, stderr, "send", errno);
+			rcodes[ns] = RCODE_INTERNAL_ERROR;
+			continue;
+		}
+#else /* !CANNOT_CONNECT_DGRAM */
+		{
+		const struct sockaddr *nsap = res_get_nsaddr(statp, (size_t)ns);
+		int nsaplen = get_salen(nsap);
+
+		if (sendto(EXT(statp).nssocks[ns], (const char*)buf, buflen,
+		    0, nsap, nsaplen) != buflen) {
+			Aerror(statp, stderr, "sendto", errno, nsap, nsaplen);
+			rcodes[ns] = RCODE_INTERNAL_ERROR;
+			continue;
+		}
+		}
+#endif /* !CANNOT_CONNECT_DGRAM */
+		fds[i].fd = EXT(statp).nssocks[ns];
+		finish[i] = evAddTime(start,
+		    evConsTime((long)res_get_timeout(statp, ns), 0L));
+		pending++;
+	}
+
+	/*
+	 * Wait for replies.
+	 */
+	while (pending > 0) {
+		soonest = evConsTime(0L, 0L);
+		for (i = 0; i < count; i++) {
+			if (fds[i].fd == -1)
+				continue;
+			if (evCmpTime(soonest, evConsTime(0L, 0L)) == 0 ||
+			    evCmpTime(finish[i], soonest) < 0)
+				soonest = finish[i];
+		}
+		now = evNowTime();
+		if (evCmpTime(soonest, now) > 0)
+			timeout = evSubTime(soonest, now);
+		else
+			timeout = evConsTime(0L, 0L);
+		n = ppoll(fds, (nfds_t)count, &timeout, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			Perror(statp, stderr, "poll", errno);
+			break;
+		}
+		now = evNowTime();
+		if (n == 0) {
+			/* Give up on the servers whose time is up. */
+			for (i = 0; i < count; i++) {
+				if (fds[i].fd == -1 ||
+				    evCmpTime(finish[i], now) > 0)
+					continue;
+				Dprint(statp->options & RES_DEBUG,
+				       (stdout, ";; timeout\n"));
+				rcodes[order[i]] = RCODE_TIMEOUT;
+				fds[i].fd = -1;
+				pending--;
+				*gotsomewhere = 1;
+			}
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			if (fds[i].fd == -1 || fds[i].revents == 0)
+				continue;
+			fds[i].revents = 0;
+			ns = order[i];
+			fromlen = sizeof(from);
+			resplen = recvfrom(fds[i].fd, (char*)ans,
+			    (size_t)anssiz, 0,
+			    (struct sockaddr *)(void *)&from, &fromlen);
+			if (resplen <= 0) {
+				Perror(statp, stderr, "recvfrom", errno);
+				rcodes[ns] = RCODE_INTERNAL_ERROR;
+				fds[i].fd = -1;
+				pending--;
+				continue;
+			}
+			*gotsomewhere = 1;
+			if (resplen < HFIXEDSZ) {
+				/*
+				 * Undersized message.
+				 */
+				Dprint(statp->options & RES_DEBUG,
+				       (stdout, ";; undersized: %d\n",
+					resplen));
+				*terrno = EMSGSIZE;
+				rcodes[ns] = RCODE_INTERNAL_ERROR;
+				fds[i].fd = -1;
+				pending--;
+				continue;
+			}
+			if (hp->id != anhp->id ||
+			    (!(statp->options & RES_INSECURE1) &&
+			     !res_ourserver_p(statp,
+				(struct sockaddr *)(void *)&from))) {
+				/*
+				 * Old answer or wrong server, ignore it.
+				 */
+				DprintQ((statp->options & RES_DEBUG) ||
+					(statp->pfcode & RES_PRF_REPLY),
+					(stdout, ";; old answer or not our server:\n"),
+					ans, (resplen > anssiz) ? anssiz : resplen);
+				continue;
+			}
+#ifdef RES_USE_EDNS0
+			if (anhp->rcode == FORMERR &&
+			    (statp->options & RES_USE_EDNS0) != 0U) {
+				/*
+				 * The server doesn't understand EDNS0; see
+				 * send_dg().
+				 */
+				statp->_flags |= RES_F_EDNS0ERR;
+				rcodes[ns] = RCODE_INTERNAL_ERROR;
+				fds[i].fd = -1;
+				pending--;
+				continue;
+			}
+#endif
+			if (!(statp->options & RES_INSECURE2) &&
+			    !res_queriesmatch(buf, buf + buflen,
+					      ans, ans + anssiz)) {
+				/*
+				 * response contains wrong query? ignore it.
+				 */
+				DprintQ((statp->options & RES_DEBUG) ||
+					(statp->pfcode & RES_PRF_REPLY),
+					(stdout, ";; wrong query name:\n"),
+					ans, (resplen > anssiz) ? anssiz : resplen);
+				continue;
+			}
+			delays[ns] = _res_stats_calculate_rtt(&now, &start);
+			if ((anhp->rcode == SERVFAIL ||
+			     anhp->rcode == NOTIMP ||
+			     anhp->rcode == REFUSED) && !statp->pfcode) {
+				DprintQ(statp->options & RES_DEBUG,
+					(stdout, "server rejected query:\n"),
+					ans, (resplen > anssiz) ? anssiz : resplen);
+				rcodes[ns] = anhp->rcode;
+				fds[i].fd = -1;
+				pending--;
+				continue;
+			}
+			rcodes[ns] = anhp->rcode;
+			*winner = ns;
+			if (!(statp->options & RES_IGNTC) && anhp->tc) {
+				/*
+				 * To get the rest of answer, use TCP.
+				 */
+				Dprint(statp->options & RES_DEBUG,
+				       (stdout, ";; truncated answer\n"));
+				*v_circuit = 1;
+				res_nclose(statp);
+				return (1);
+			}
+			return (resplen);
+		}
+	}
+	res_nclose(statp);
+	return (0);
+}
+
+/*
+ * Read exactly "len" bytes from a virtual circuit into "buf", or discard
+ * them if "buf" is NULL.  Returns 1 on success and 0 on error or EOF.
+ */
+static int
+read_vc(int sock, u_char *buf, size_t len)
+{
+	char junk[PACKETSZ];
+	ssize_t n;
+
+	while (len != 0) {
+		if (buf != NULL)
+			n = read(sock, buf, len);
+		else
+			n = read(sock, junk, (len > sizeof junk) ? sizeof junk : len);
+		if (n <= 0)
+			return (0);
+		if (buf != NULL)
+			buf += n;
+		len -= (size_t)n;
+	}
+	return (1);
+}
+
+/*
+ * Send both truncated queries in "q" to nameserver "ns" back to back over
+ * one virtual circuit, and match the answers to them by ID in whatever
+ * order the server sends them.  The outcome of each query is left in "q".
+ * Returns -1 on a fatal error, and 0 otherwise.
+ */
+static int
+send_vc_pair(res_state statp, struct pair_query *q, int *terrno, int ns)
+{
+	const HEADER *hp;
+	HEADER *anhp;
+	struct timespec now, done;
+	struct iovec iov[4];
+	u_short len[2];
+	u_char hdr[HFIXEDSZ];
+	int connreset, reused, answered, rcode, resplen, i, n;
+	size_t want;
+	void *tmp;
+
+	for (i = 0; i < 2; i++) {
+		q[i].at = time(NULL);
+		q[i].rcode = RCODE_INTERNAL_ERROR;
+		q[i].delay = 0;
+	}
+
+	connreset = 0;
+ same_ns:
+	rcode = RCODE_INTERNAL_ERROR;
+	n = open_vc(statp, ns, terrno, &rcode, &reused);
+	if (n <= 0) {
+		for (i = 0; i < 2; i++)
+			q[i].rcode = rcode;
+		return (n);
+	}
+	now = evNowTime();
+
+	/*
+	 * Send length & message, twice.
+	 */
+	for (i = 0; i < 2; i++) {
+		ns_put16((u_short)q[i].buflen, (u_char*)(void *)&len[i]);
+		iov[2 * i] = evConsIovec(&len[i], INT16SZ);
+		DE_CONST(q[i].buf, tmp);
+		iov[2 * i + 1] = evConsIovec(tmp, (size_t)q[i].buflen);
+	}
+	if (writev(statp->_vcsock, iov, 4) !=
+	    (2 * INT16SZ + q[0].buflen + q[1].buflen)) {
+		*terrno = errno;
+		Perror(statp, stderr, "write failed", errno);
+		res_nclose(statp);
+		if (reused && !connreset) {
+			connreset = 1;
+			goto same_ns;
+		}
+		return (0);
+	}
+
+	/*
+	 * Receive length & response until both are answered.  Anything
+	 * else is left over from an earlier query and is dropped.
+	 */
+	answered = 0;
+	while (answered < 2) {
+		if (!read_vc(statp->_vcsock, (u_char *)(void *)&len[0], INT16SZ) ||
+		    (resplen = ns_get16((u_char *)(void *)&len[0])) < HFIXEDSZ ||
+		    !read_vc(statp->_vcsock, hdr, HFIXEDSZ)) {
+			*terrno = errno;
+			Perror(statp, stderr, "read(vc)", errno);
+			res_nclose(statp);
+			if (answered == 0 && (*terrno == ECONNRESET || reused) &&
+			    !connreset) {
+				connreset = 1;
+				goto same_ns;
+			}
+			return (0);
+		}
+		for (i = 0; i < 2; i++) {
+			hp = (const HEADER *)(const void *)q[i].buf;
+			if (q[i].resplen < 0 &&
+			    hp->id == ((HEADER *)(void *)hdr)->id)
+				break;
+		}
+		if (i == 2) {
+			DprintQ((statp->options & RES_DEBUG) ||
+				(statp->pfcode & RES_PRF_REPLY),
+				(stdout, ";; old answer (unexpected):\n"),
+				hdr, HFIXEDSZ);
+			if (!read_vc(statp->_vcsock, NULL,
+			    (size_t)resplen - HFIXEDSZ)) {
+				*terrno = errno;
+				res_nclose(statp);
+				return (0);
+			}
+			continue;
+		}
+
+		/* q[i].anssiz is at least HFIXEDSZ; see res_nsend_pair(). */
+		memcpy(q[i].ans, hdr, HFIXEDSZ);
+		want = (size_t)((resplen > q[i].anssiz) ? q[i].anssiz : resplen);
+		if (!read_vc(statp->_vcsock, q[i].ans + HFIXEDSZ,
+		    want - HFIXEDSZ) ||
+		    !read_vc(statp->_vcsock, NULL, (size_t)resplen - want)) {
+			*terrno = errno;
+			Perror(statp, stderr, "read(vc)", errno);
+			res_nclose(statp);
+			return (0);
+		}
+		anhp = (HEADER *)(void *)q[i].ans;
+		if ((size_t)resplen > want) {
+			Dprint(statp->options & RES_DEBUG,
+			       (stdout, ";; response truncated\n"));
+			anhp->tc = 1;
+		}
+		done = evNowTime();
+		q[i].delay = _res_stats_calculate_rtt(&done, &now);
+		q[i].rcode = anhp->rcode;
+		q[i].resplen = resplen;
+		answered++;
+	}
+	release_vc(statp, ns);
+	return (0);
+}
+
+/*
+ * Send the unanswered queries in "q" that have not been moved to TCP to
+ * nameserver "ns" over one socket, and collect the replies in whatever
+ * order they arrive.  The outcome of each query is left in "q".  Returns
+ * -1 on a fatal error, and 0 otherwise.
+ */
+static int
+send_dg_pair(res_state statp, struct pair_query *q,
+	int *terrno, int ns, int *gotsomewhere)
+{
+	HEADER peek;
+	const HEADER *hp;
+	HEADER *anhp;
+	struct timespec now, timeout, finish, done;
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	u_char junk[HFIXEDSZ];
+	int resplen, seconds, n, s, i;
+
+	for (i = 0; i < 2; i++)
+		q[i].sent = q[i].waiting = 0;
+	if ((q[0].resplen >= 0 || q[0].v_circuit) &&
+	    (q[1].resplen >= 0 || q[1].v_circuit))
+		return (0);
+
+	n = open_dg(statp, ns, terrno);
+	if (n <= 0)
+		return (n);
+	s = EXT(statp).nssocks[ns];
+
+	now = evNowTime();
+	for (i = 0; i < 2; i++) {
+		if (q[i].resplen >= 0 || q[i].v_circuit)
+			continue;
+		q[i].at = time(NULL);
+		q[i].rcode = RCODE_INTERNAL_ERROR;
+		q[i].delay = 0;
+		if (send(s, (const char*)q[i].buf, (size_t)q[i].buflen, 0) != q[i].buflen) {
+			Perror(statp, stderr, "send", errno);
+			res_nclose(statp);
+			return (0);
+		}
+		q[i].sent = 1;
+		q[i].waiting = 1;
+	}
+
+	/*
+	 * Wait for replies.
+	 */
+	seconds = res_get_timeout(statp, ns);
+	timeout = evConsTime((long)seconds, 0L);
+	finish = evAddTime(now, timeout);
+	while (q[0].waiting || q[1].waiting) {
+		n = retrying_poll(s, POLLIN, &finish);
+		if (n == 0) {
+			for (i = 0; i < 2; i++) {
+				if (q[i].waiting)
+					q[i].rcode = RCODE_TIMEOUT;
+			}
+			Dprint(statp->options & RES_DEBUG, (stdout, ";; timeout\n"));
+			*gotsomewhere = 1;
+			return (0);
+		}
+		if (n < 0) {
+			Perror(statp, stderr, "select", errno);
+			res_nclose(statp);
+			return (0);
+		}
+
+		/* Peek at the ID to find out which buffer the reply belongs in. */
+		errno = 0;
+		resplen = recv(s, &peek, sizeof(peek), MSG_PEEK);
+		if (resplen <= 0) {
+			Perror(statp, stderr, "recvfrom", errno);
+			res_nclose(statp);
+			return (0);
+		}
+		*gotsomewhere = 1;
+		if (resplen < HFIXEDSZ) {
+			/*
+			 * Undersized message.
+			 */
+			Dprint(statp->options & RES_DEBUG,
+			       (stdout, ";; undersized: %d\n",
+				resplen));
+			*terrno = EMSGSIZE;
+			res_nclose(statp);
+			return (0);
+		}
+		for (i = 0; i < 2; i++) {
+			hp = (const HEADER *)(const void *)q[i].buf;
+			if (q[i].waiting && hp->id == peek.id)
+				break;
+		}
+		if (i == 2) {
+			/*
+			 * response from old query, ignore it.
+			 */
+			Dprint(statp->options & RES_DEBUG,
+			       (stdout, ";; old answer\n"));
+			(void) recv(s, junk, sizeof(junk), 0);
+			continue;
+		}
+
+		anhp = (HEADER *)(void *)q[i].ans;
+		fromlen = sizeof(from);
+		resplen = recvfrom(s, (char*)q[i].ans, (size_t)q[i].anssiz, 0,
+				   (struct sockaddr *)(void *)&from, &fromlen);
+		if (resplen < HFIXEDSZ) {
+			Perror(statp, stderr, "recvfrom", errno);
+			res_nclose(statp);
+			return (0);
+		}
+		if (!(statp->options & RES_INSECURE1) &&
+		    !res_ourserver_p(statp, (struct sockaddr *)(void *)&from)) {
+			/*
+			 * response from wrong server? ignore it.
+			 */
+			DprintQ((statp->options & RES_DEBUG) ||
+				(statp->pfcode & RES_PRF_REPLY),
+				(stdout, ";; not our server:\n"),
+				q[i].ans, (resplen > q[i].anssiz) ? q[i].anssiz : resplen);
+			continue;
+		}
+#ifdef RES_USE_EDNS0
+		if (anhp->rcode == FORMERR && (statp->options & RES_USE_EDNS0) != 0U) {
+			/*
+			 * Do not retry if the server do not understand EDNS0.
+			 */
+			DprintQ(statp->options & RES_DEBUG,
+				(stdout, "server rejected query with EDNS0:\n"),
+				q[i].ans, (resplen > q[i].anssiz) ? q[i].anssiz : resplen);
+			/* record the error */
+			statp->_flags |= RES_F_EDNS0ERR;
+			res_nclose(statp);
+			return (0);
+		}
+#endif
+		if (!(statp->options & RES_INSECURE2) &&
+		    !res_queriesmatch(q[i].buf, q[i].buf + q[i].buflen,
+				      q[i].ans, q[i].ans + q[i].anssiz)) {
+			/*
+			 * response contains wrong query? ignore it.
+			 */
+			DprintQ((statp->options & RES_DEBUG) ||
+				(statp->pfcode & RES_PRF_REPLY),
+				(stdout, ";; wrong query name:\n"),
+				q[i].ans, (resplen > q[i].anssiz) ? q[i].anssiz : resplen);
+			continue;
+		}
+		done = evNowTime();
+		q[i].delay = _res_stats_calculate_rtt(&done, &now);
+		q[i].rcode = anhp->rcode;
+		q[i].waiting = 0;
+		if ((anhp->rcode == SERVFAIL ||
+		     anhp->rcode == NOTIMP ||
+		     anhp->rcode == REFUSED) && !statp->pfcode) {
+			/*
+			 * Server rejected this query; the other one may still
+			 * be answered, and this one goes to the next server.
+			 */
+			DprintQ(statp->options & RES_DEBUG,
+				(stdout, "server rejected query:\n"),
+				q[i].ans, (resplen > q[i].anssiz) ? q[i].anssiz : resplen);
+			continue;
+		}
+		if (!(statp->options & RES_IGNTC) && anhp->tc) {
+			/*
+			 * To get the rest of answer,
+			 * use TCP with same server.
+			 */
+			Dprint(statp->options & RES_DEBUG,
+			       (stdout, ";; truncated answer\n"));
+			q[i].v_circuit = 1;
+			continue;
+		}
+		q[i].resplen = resplen;
+	}
+	return (0);
+}
+
 static void
 Aerror(const res_state statp, FILE *file, const char *string, int error,
        const struct sockaddr *address, int alen)
@@ -184,3 +184,42 @@ android_net_res_stats_get_usable_servers(const struct __res_params* params,
         }
     }
 }
+
+int
+_res_stats_rank_servers(struct __res_stats stats[], int nscount, const bool usable_servers[],
+        int order[]) {
+    int rate[MAXNS];
+    int rtt[MAXNS];
+    int count = 0;
+    for (int ns = 0; ns < nscount && ns < MAXNS; ns++) {
+        if (!usable_servers[ns]) {
+            continue;
+        }
+        int successes, errors, timeouts, internal_errors, rtt_avg;
+        time_t last_sample_time;
+        android_net_res_stats_aggregate(&stats[ns], &successes, &errors, &timeouts,
+                &internal_errors, &rtt_avg, &last_sample_time);
+        int total = successes + errors + timeouts;
+        rate[ns] = (total > 0) ? successes * 100 / total : 100;
+        rtt[ns] = (rtt_avg >= 0) ? rtt_avg : 0;
+
+        // Insertion sort; at most MAXNS entries, and ties keep the configured order.
+        int i = count++;
+        while (i > 0) {
+            int prev = order[i - 1];
+            if (rate[prev] > rate[ns] || (rate[prev] == rate[ns] && rtt[prev] <= rtt[ns])) {
+                break;
+            }
+            order[i] = prev;
+            --i;
+        }
+        order[i] = ns;
+    }
+    if (DBG) {
+        for (int i = 0; i < count; i++) {
+            async_safe_format_log(ANDROID_LOG_DEBUG, "libc", "rank %d: ns %d (%d%%, %d ms)\n",
+                    i, order[i], rate[order[i]], rtt[order[i]]);
+        }
+    }
+    return count;
+}
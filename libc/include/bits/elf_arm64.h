@@ -83,7 +83,11 @@
 #define R_AARCH64_GLOB_DAT              1025    /* Create GOT entry.  */
 #define R_AARCH64_JUMP_SLOT             1026    /* Create PLT entry.  */
 #define R_AARCH64_RELATIVE              1027    /* Adjust by program base.  */
+#define R_AARCH64_TLS_DTPMOD64          1028
+#define R_AARCH64_TLS_DTPREL64          1029
 #define R_AARCH64_TLS_TPREL64           1030
+#define R_AARCH64_TLSDESC               1031
+/* Historically misnamed: 1031 is R_AARCH64_TLSDESC. */
 #define R_AARCH64_TLS_DTPREL32          1031
 #define R_AARCH64_IRELATIVE             1032
 
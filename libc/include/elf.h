@@ -45,6 +45,10 @@
 
 typedef __s64 Elf32_Sxword;
 
+/* A RELR entry: an address, or a bitmap of the words that follow one. */
+typedef Elf32_Word Elf32_Relr;
+typedef Elf64_Xword Elf64_Relr;
+
 typedef struct {
   __u32 a_type;
   union {
@@ -170,6 +174,11 @@ typedef struct {
 #define DT_PREINIT_ARRAY 32
 #define DT_PREINIT_ARRAYSZ 33
 
+/* Compact relative relocations. */
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#define DT_RELRENT 37
+
 /* Android compressed rel/rela sections */
 #define DT_ANDROID_REL (DT_LOOS + 2)
 #define DT_ANDROID_RELSZ (DT_LOOS + 3)
@@ -177,9 +186,18 @@ typedef struct {
 #define DT_ANDROID_RELA (DT_LOOS + 4)
 #define DT_ANDROID_RELASZ (DT_LOOS + 5)
 
+/* The tags DT_RELR had before it got standard ones. */
+#define DT_ANDROID_RELR 0x6fffe000
+#define DT_ANDROID_RELRSZ 0x6fffe001
+#define DT_ANDROID_RELRENT 0x6fffe003
+
 /* gnu hash entry */
 #define DT_GNU_HASH 0x6ffffef5
 
+/* Lazy TLSDESC resolution, which we don't do: we always bind now. */
+#define DT_TLSDESC_PLT 0x6ffffef6
+#define DT_TLSDESC_GOT 0x6ffffef7
+
 #define ELFOSABI_SYSV 0 /* Synonym for ELFOSABI_NONE used by valgrind. */
 
 #define PT_GNU_RELRO 0x6474e552
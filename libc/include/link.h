@@ -47,6 +47,18 @@ struct dl_phdr_info {
   const char* dlpi_name;
   const ElfW(Phdr)* dlpi_phdr;
   ElfW(Half) dlpi_phnum;
+
+  /*
+   * The fields below are only present if the size passed to the callback
+   * says so. dlpi_adds and dlpi_subs count the objects ever loaded and
+   * unloaded: if they haven't changed, neither has the list of objects.
+   */
+  unsigned long long dlpi_adds;
+  unsigned long long dlpi_subs;
+  /* The object's TLS module id, or 0 if it has no PT_TLS segment. */
+  size_t dlpi_tls_modid;
+  /* The calling thread's TLS block for this object, or NULL if it doesn't have one yet. */
+  void* dlpi_tls_data;
 };
 
 #if defined(__arm__)
@@ -25,6 +25,7 @@
 #include "private/bionic_macros.h"
 
 struct abort_msg_t;
+struct TlsModules;
 
 // When the kernel starts the dynamic linker, it passes a pointer to a block
 // of memory containing argc, the argv array, the environment variable array,
@@ -66,6 +67,7 @@ class KernelArgumentBlock {
   ElfW(auxv_t)* auxv;
 
   abort_msg_t** abort_message_ptr;
+  TlsModules* tls_modules;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(KernelArgumentBlock);
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PRIVATE_BIONIC_ELF_TLS_H
+#define _PRIVATE_BIONIC_ELF_TLS_H
+
+#include <link.h>
+#include <pthread.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include "private/bionic_tls.h"
+
+// Native ELF TLS.
+//
+// The PT_TLS segments of the executable and of the libraries loaded along
+// with it are laid out once, at startup, in a static TLS area that every
+// thread gets a copy of next to its TLS slots. Code can reach those blocks
+// at a constant offset from the thread pointer (the initial-exec and
+// local-exec models).
+//
+// Libraries loaded later with dlopen() get a module id but no static
+// offset. Each thread allocates their blocks lazily, the first time
+// __tls_get_addr() (or a TLSDESC resolver) asks for them, and finds them
+// again through its DTV, which is indexed by module id.
+//
+// The id of an unloaded library is given to the next one dlopen()ed, so
+// the table of modules and every DTV stay as big as the most libraries with
+// TLS that were ever loaded at once. Unloading bumps a generation count, and
+// a DTV that was brought up to date before the latest unload is stale: the
+// next access through it goes down the slow path, which drops the entries of
+// modules that have gone (or whose id was reused since) and recycles their
+// blocks within the thread. The static TLS space of a module is never
+// reused, nor is its id.
+
+class pthread_internal_t;
+
+struct TlsSegment {
+  size_t size = 0;
+  size_t alignment = 1;
+  const void* init_ptr = nullptr; // The initialization image (.tdata).
+  size_t init_size = 0;
+};
+
+__LIBC_HIDDEN__ bool __bionic_get_tls_segment(const ElfW(Phdr)* phdr_table, size_t phdr_count,
+                                              ElfW(Addr) load_bias, TlsSegment* out);
+
+// Assigns offsets from the thread pointer to static TLS blocks.
+//
+// On arm and arm64 (TLS variant 1) the thread pointer points at bionic's
+// TLS slots and the blocks follow them. The executable's block is at an
+// offset fixed by the ABI, so it must be aligned enough to clear the slots.
+//
+// On x86 and x86-64 (TLS variant 2) the blocks precede the thread pointer,
+// the executable's immediately.
+class StaticTlsLayout {
+ public:
+  constexpr StaticTlsLayout() {}
+
+  // The executable's block must be reserved before any other.
+  bool reserve_exe_segment(const TlsSegment& segment, ptrdiff_t* offset);
+  ptrdiff_t reserve(size_t size, size_t alignment);
+
+  // The size of a thread's static TLS area, including bionic's slots.
+  size_t size() const;
+  // Where the thread pointer lies within the static TLS area.
+  size_t tp_offset() const;
+
+ private:
+#if defined(__i386__) || defined(__x86_64__)
+  size_t cursor_ = 0;
+#else
+  size_t cursor_ = BIONIC_TLS_SLOTS * sizeof(void*);
+#endif
+  size_t alignment_ = alignof(void*);
+};
+
+struct TlsModule {
+  TlsSegment segment;
+  bool in_use = false;
+  bool is_static = false;
+  ptrdiff_t static_offset = 0; // From the thread pointer.
+  // The generation when the module was registered: a DTV older than that
+  // may hold the block of a previous module with the same id.
+  size_t first_generation = 0;
+};
+
+// The state shared by the linker, which registers modules, and libc, which
+// creates threads and resolves dynamic TLS. The linker owns it and hands it
+// to libc through the KernelArgumentBlock.
+struct TlsModules {
+  pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+  // Indexed by module id - 1.
+  TlsModule* modules = nullptr;
+  size_t module_count = 0;
+  size_t module_capacity = 0;
+
+  StaticTlsLayout static_layout;
+  bool static_layout_frozen = false;
+
+  // Bumped whenever a module is unregistered. Written with the lock held,
+  // but read without it by __tls_get_addr() and the TLSDESC resolvers.
+  std::atomic<size_t> generation{0};
+};
+
+// The argument to __tls_get_addr(), as laid out in the GOT by DTPMOD/DTPREL
+// relocation pairs.
+struct TlsIndex {
+  size_t module_id;
+  size_t offset;
+};
+
+struct TlsDtv {
+  size_t count;
+  size_t generation; // TlsModules::generation when last brought up to date.
+  void* modules[]; // Indexed by module id - 1; nullptr until first used.
+};
+
+// What a thread's DTV slot points to until it first uses dynamic TLS.
+__LIBC_HIDDEN__ extern TlsDtv __bionic_tls_empty_dtv;
+
+// Registers a PT_TLS segment, returning its module id, or 0 and an
+// explanation in *error. Until the static layout is frozen, the block is
+// also given a static TLS offset.
+__LIBC_HIDDEN__ size_t __bionic_tls_register_module(const TlsSegment& segment, bool is_executable,
+                                                    const char** error);
+__LIBC_HIDDEN__ void __bionic_tls_unregister_module(size_t module_id);
+__LIBC_HIDDEN__ bool __bionic_tls_get_static_offset(size_t module_id, ptrdiff_t* offset);
+__LIBC_HIDDEN__ const std::atomic<size_t>* __bionic_tls_generation();
+__LIBC_HIDDEN__ void __bionic_tls_freeze_static_layout();
+
+// The static TLS area of a thread lives in the same mapping as its
+// pthread_internal_t.
+__LIBC_HIDDEN__ size_t __bionic_tls_static_area_size();
+__LIBC_HIDDEN__ size_t __bionic_tls_static_tp_offset();
+// Copies the initialization images into a new thread's static TLS area.
+__LIBC_HIDDEN__ void __bionic_tls_init_static_blocks(void** tp);
+__LIBC_HIDDEN__ void __bionic_tls_free_dynamic(pthread_internal_t* thread);
+
+extern "C" void* __tls_get_addr(const TlsIndex* ti);
+#if defined(__i386__)
+extern "C" void* ___tls_get_addr(const TlsIndex* ti) __attribute__((__regparm__(1)));
+#endif
+
+// TLSDESC: the linker fills each descriptor with one of the resolvers below
+// and its argument: the offset of the variable from the thread pointer if it
+// is in static TLS, or one of these otherwise. The resolvers return the
+// offset from the thread pointer and preserve every other register, so they
+// aren't C functions.
+struct TlsDynamicResolverArg {
+  TlsIndex index;
+  // TlsModules::generation, which the resolvers can't otherwise reach.
+  const std::atomic<size_t>* generation;
+};
+
+#if defined(__aarch64__) || defined(__x86_64__)
+extern "C" __LIBC_HIDDEN__ void tlsdesc_resolver_static();
+extern "C" __LIBC_HIDDEN__ void tlsdesc_resolver_dynamic();
+#endif
+
+#endif
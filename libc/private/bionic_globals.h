@@ -31,6 +31,8 @@
 
 #include <sys/cdefs.h>
 
+struct TlsModules;
+
 #include "private/bionic_malloc_dispatch.h"
 #include "private/bionic_vdso.h"
 #include "private/WriteProtected.h"
@@ -44,6 +46,7 @@ struct libc_globals {
   void* executable_start;
   void* executable_end;
   MallocDispatch malloc_dispatch;
+  TlsModules* tls_modules;
 };
 
 __LIBC_HIDDEN__ extern WriteProtected<libc_globals> __libc_globals;
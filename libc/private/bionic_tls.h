@@ -79,6 +79,10 @@ enum {
   // state.
   TLS_SLOT_TSAN,
 
+  // The thread's dynamic thread vector (see bionic_elf_tls.h). The TLSDESC
+  // resolvers read it directly, so it must stay at this index.
+  TLS_SLOT_DTV = 9,
+
   BIONIC_TLS_SLOTS // Must come last!
 };
 
@@ -133,6 +137,7 @@ __END_DECLS
 #if defined(__cplusplus)
 class KernelArgumentBlock;
 extern void __libc_init_main_thread(KernelArgumentBlock&);
+extern void __libc_init_main_thread_static_tls();
 #endif
 
 #endif /* __BIONIC_PRIVATE_BIONIC_TLS_H_ */
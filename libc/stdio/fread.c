@@ -71,9 +71,10 @@ fread(void *buf, size_t size, size_t count, FILE *fp) __overloadable
 		fp->_r = 0;
 
 	/*
-	 * Ensure _bf._size is valid.
+	 * Ensure _bf._size is valid. ("m" mode streams get their buffer
+	 * from __srefill instead.)
 	 */
-	if (fp->_bf._base == NULL) {
+	if (fp->_bf._base == NULL && (fp->_flags & __SMMAP) == 0) {
 		__smakebuf(fp);
 	}
 
@@ -99,9 +100,12 @@ fread(void *buf, size_t size, size_t count, FILE *fp) __overloadable
 
 		/*
 		 * Do we have so much more to read that we should
-		 * avoid copying it through the buffer?
+		 * avoid copying it through the buffer? (Not if the
+		 * buffer is a mapping of the file: that's already
+		 * the cheapest way to get at the data.)
 		 */
-		if (total > (size_t) fp->_bf._size) {
+		if ((fp->_flags & __SMMAP) == 0 &&
+		    total > (size_t) fp->_bf._size) {
 			/*
 			 * Make sure that fseek doesn't think it can
 			 * reuse the buffer since we are going to read
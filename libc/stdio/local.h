@@ -37,6 +37,7 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 #include <wchar.h>
 #include "wcio.h"
 
@@ -122,6 +123,33 @@ struct __sfileext {
   // Equivalent to `_seek` but for _FILE_OFFSET_BITS=64.
   // Callers should use this but fall back to `__sFILE::_seek`.
   off64_t (*_seek64)(void*, off64_t, int);
+
+  // Link in the list of released FILEs that __sfp hands out next.
+  // Protected by `__sfp_mutex`.
+  FILE* _free_next;
+  bool _on_free_list;
+
+  // Links in the list of FILEs that are in write mode, so fflush(nullptr)
+  // only has to visit streams that might actually have buffered output.
+  // Protected by `__swriters_mutex`.
+  FILE* _writer_prev;
+  FILE* _writer_next;
+  bool _on_writer_list;
+
+  // The mapping backing `_bf` for "m" mode streams, or null.
+  // `_bf._base` may be inside this mapping because mmap offsets are page-aligned.
+  void* _mmap_base;
+  size_t _mmap_size;
+
+  // Adaptive buffer sizing (see __srefill). `_adaptive_buf` is set by
+  // __smakebuf for regular files and cleared by setvbuf. `_seq_refills`
+  // counts refills since the last seek, up to SEQ_REFILLS.
+  bool _adaptive_buf;
+  int _seq_refills;
+
+  // Called by fpurge after it empties the buffer, for streams that buffer
+  // in place in their destination (open_memstream), or null.
+  void (*_purge)(FILE*);
 };
 
 // Values for `__sFILE::_flags`.
@@ -139,6 +167,7 @@ struct __sfileext {
 // #define __SOPT 0x0400 --- historical (do fseek() optimization).
 // #define __SNPT 0x0800 --- historical (do not do fseek() optimization).
 // #define __SOFF 0x1000 --- historical (set iff _offset is in fact correct).
+#define __SMMAP 0x1000 // Read via mmap(2) where possible (fopen "m").
 #define __SMOD 0x2000  // true => fgetln modified _p text.
 #define __SALC 0x4000  // Allocate string space dynamically.
 #define __SIGN 0x8000  // Ignore this file in _fwalk.
@@ -163,6 +192,16 @@ do { \
 	pthread_mutex_init(&_FLOCK(fp), &attr); \
 	pthread_mutexattr_destroy(&attr); \
 	_EXT(fp)->_caller_handles_locking = false; \
+	_EXT(fp)->_free_next = NULL; \
+	_EXT(fp)->_on_free_list = false; \
+	_EXT(fp)->_writer_prev = NULL; \
+	_EXT(fp)->_writer_next = NULL; \
+	_EXT(fp)->_on_writer_list = false; \
+	_EXT(fp)->_mmap_base = NULL; \
+	_EXT(fp)->_mmap_size = 0; \
+	_EXT(fp)->_adaptive_buf = false; \
+	_EXT(fp)->_seq_refills = 0; \
+	_EXT(fp)->_purge = NULL; \
 } while (0)
 
 #define _FILEEXT_SETUP(f, fext) \
@@ -197,7 +236,11 @@ __LIBC32_LEGACY_PUBLIC__ int __sclose(void *);
 __LIBC32_LEGACY_PUBLIC__ int _fwalk(int (*)(FILE *));
 
 off64_t __sseek64(void*, off64_t, int);
+void	__sfp_release(FILE *);
 int	__sflush_locked(FILE *);
+void	__slink_writer(FILE *);
+void	__sunlink_writer(FILE *);
+int	_fwalk_writers(int (*)(FILE *));
 int	__swhatbuf(FILE *, size_t *, int *);
 wint_t __fgetwc_unlock(FILE *);
 wint_t	__ungetwc(wint_t, FILE *);
@@ -233,6 +276,18 @@ int	__vfwscanf(FILE * __restrict, const wchar_t * __restrict, __va_list);
 	(fp)->_lb._base = NULL; \
 }
 
+/*
+ * test for an mmap(2)ed read buffer ("m" mode).
+ */
+#define	HASMMAP(fp) (_EXT(fp)->_mmap_base != NULL)
+#define	FREEMMAP(fp) { \
+	munmap(_EXT(fp)->_mmap_base, _EXT(fp)->_mmap_size); \
+	_EXT(fp)->_mmap_base = NULL; \
+	_EXT(fp)->_mmap_size = 0; \
+	(fp)->_bf._base = NULL; \
+	(fp)->_bf._size = 0; \
+}
+
 #define FLOCKFILE(fp)   if (!_EXT(fp)->_caller_handles_locking) flockfile(fp)
 #define FUNLOCKFILE(fp) if (!_EXT(fp)->_caller_handles_locking) funlockfile(fp)
 
@@ -32,10 +32,84 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "local.h"
 
+/*
+ * How much of a file an "m" mode stream maps at once. _r is an int, and
+ * 32-bit processes don't have much address space to spare.
+ */
+#if defined(__LP64__)
+#define	MMAP_WINDOW	(1024 * 1024 * 1024)
+#else
+#define	MMAP_WINDOW	(64 * 1024 * 1024)
+#endif
+
+/*
+ * Sequential reads of regular files double the buffer every refill, up to
+ * a cap, once we've seen this many refills without a seek in between.
+ * LIBC_STDIO_MAX_BUFSIZE overrides the cap; 0 turns growth off.
+ */
+#define	SEQ_REFILLS		2
+#define	DEFAULT_MAX_BUFSIZE	(128 * 1024)
+
+static pthread_once_t max_bufsize_once = PTHREAD_ONCE_INIT;
+static size_t max_bufsize = DEFAULT_MAX_BUFSIZE;
+
+static void
+__sinit_max_bufsize(void)
+{
+	const char *s;
+	char *end;
+	unsigned long n;
+
+	if ((s = getenv("LIBC_STDIO_MAX_BUFSIZE")) == NULL || *s == '\0')
+		return;
+	n = strtoul(s, &end, 0);
+	if (*end == '\0' && n <= INT_MAX)
+		max_bufsize = n;
+}
+
+/*
+ * Called before refilling a buffer __smakebuf made for a regular file.
+ * The buffer is empty at this point, so there's nothing to preserve.
+ */
+static void
+__sgrowbuf(FILE *fp)
+{
+	unsigned char *p;
+	size_t size;
+
+	if (_EXT(fp)->_seq_refills < SEQ_REFILLS) {
+		if (++_EXT(fp)->_seq_refills < SEQ_REFILLS)
+			return;
+		/* First time since open or the last seek: tell the kernel too. */
+		posix_fadvise(fp->_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	pthread_once(&max_bufsize_once, __sinit_max_bufsize);
+	if ((size_t)fp->_bf._size >= max_bufsize)
+		return;
+
+	size = fp->_bf._size * 2;
+	if (size > max_bufsize)
+		size = max_bufsize;
+	if ((p = malloc(size)) == NULL) {
+		_EXT(fp)->_adaptive_buf = false;
+		return;
+	}
+	free(fp->_bf._base);
+	fp->_bf._base = fp->_p = p;
+	fp->_bf._size = size;
+}
+
 static int
 lflush(FILE *fp)
 {
@@ -44,6 +118,77 @@ lflush(FILE *fp)
 	return (0);
 }
 
+/*
+ * Refill an "m" mode stream by mapping the next window of the file.
+ *
+ * The file offset is left at the end of the window, just as if we'd
+ * read() it, so ftell/fseek and mixing with the direct read path in
+ * fread keep working unchanged.
+ *
+ * Return 0 if there's data, EOF on eof or error, and 1 if the file
+ * can't be mapped and the caller should fall back to read(2).
+ */
+static int
+__smmap_refill(FILE *fp)
+{
+	struct stat st;
+	off64_t off, aligned;
+	size_t len, delta;
+	void *p;
+
+	/* Respect a buffer we didn't make. */
+	if (fp->_bf._base != NULL && !HASMMAP(fp))
+		goto fallback;
+	if (HASMMAP(fp))
+		FREEMMAP(fp);
+
+	if (fp->_file < 0 || fstat(fp->_file, &st) == -1 ||
+	    !S_ISREG(st.st_mode))
+		goto fallback;
+	if ((off = lseek64(fp->_file, 0, SEEK_CUR)) == -1)
+		goto fallback;
+
+	if (off >= st.st_size) {
+		fp->_flags |= __SEOF;
+		return (EOF);
+	}
+
+	len = st.st_size - off;
+	if (len > MMAP_WINDOW)
+		len = MMAP_WINDOW;
+	aligned = off & ~((off64_t) getpagesize() - 1);
+	delta = off - aligned;
+
+	/*
+	 * MAP_PRIVATE and PROT_WRITE so that callers of fgetln(3), who are
+	 * allowed to modify the returned line, only touch their own copy.
+	 */
+	p = mmap64(NULL, len + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	    fp->_file, aligned);
+	if (p == MAP_FAILED)
+		goto fallback;
+	madvise(p, len + delta, MADV_SEQUENTIAL);
+
+	if (lseek64(fp->_file, off + len, SEEK_SET) == -1) {
+		munmap(p, len + delta);
+		fp->_flags |= __SERR;
+		return (EOF);
+	}
+
+	_EXT(fp)->_mmap_base = p;
+	_EXT(fp)->_mmap_size = len + delta;
+	fp->_bf._base = fp->_p = (unsigned char *)p + delta;
+	fp->_bf._size = len;
+	fp->_r = len;
+	fp->_flags &= ~__SMOD;
+	return (0);
+
+fallback:
+	/* Pipes, sockets, ttys &c: behave as if "m" hadn't been given. */
+	fp->_flags &= ~__SMMAP;
+	return (1);
+}
+
 /*
  * Refill a stdio buffer.
  * Return EOF on eof or error, 0 otherwise.
@@ -73,6 +218,7 @@ __srefill(FILE *fp)
 			fp->_flags &= ~__SWR;
 			fp->_w = 0;
 			fp->_lbfsize = 0;
+			__sunlink_writer(fp);
 		}
 		fp->_flags |= __SRD;
 	} else {
@@ -91,8 +237,16 @@ __srefill(FILE *fp)
 		}
 	}
 
+	if (fp->_flags & __SMMAP) {
+		int r = __smmap_refill(fp);
+		if (r != 1)
+			return (r);
+	}
+
 	if (fp->_bf._base == NULL)
 		__smakebuf(fp);
+	else if (_EXT(fp)->_adaptive_buf && (fp->_flags & __SMBF))
+		__sgrowbuf(fp);
 
 	/*
 	 * Before reading from a line buffered or unbuffered file,
@@ -100,9 +254,9 @@ __srefill(FILE *fp)
 	 * standard.
 	 */
 	if (fp->_flags & (__SLBF|__SNBF)) {
-		/* Ignore this file in _fwalk to avoid potential deadlock. */
+		/* Ignore this file in _fwalk_writers to avoid potential deadlock. */
 		fp->_flags |= __SIGN;
-		(void) _fwalk(lflush);
+		(void) _fwalk_writers(lflush);
 		fp->_flags &= ~__SIGN;
 
 		/* Now flush this file without locking it. */
@@ -67,6 +67,7 @@
     {(unsigned char *)(__sFext+file), 0},nullptr,0,{0},{0},{0,0},0,0}
 
 _THREAD_PRIVATE_MUTEX(__sfp_mutex);
+_THREAD_PRIVATE_MUTEX(__swriters_mutex);
 
 // TODO: when we no longer have to support both clang and GCC, we can simplify all this.
 #define SBUF_INIT {0,0}
@@ -78,9 +79,12 @@ _THREAD_PRIVATE_MUTEX(__sfp_mutex);
 #define WCHAR_IO_DATA_INIT {MBSTATE_T_INIT,MBSTATE_T_INIT,{0},0,0}
 
 static struct __sfileext __sFext[3] = {
-  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64 },
-  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64 },
-  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64 },
+  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64,
+    nullptr, false, nullptr, nullptr, false, nullptr, 0, false, 0 },
+  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64,
+    nullptr, false, nullptr, nullptr, false, nullptr, 0, false, 0 },
+  { SBUF_INIT, WCHAR_IO_DATA_INIT, PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, false, __sseek64,
+    nullptr, false, nullptr, nullptr, false, nullptr, 0, false, 0 },
 };
 
 // __sF is exported for backwards compatibility. Until M, we didn't have symbols
@@ -98,6 +102,13 @@ FILE* stderr = &__sF[2];
 struct glue __sglue = { NULL, 3, __sF };
 static struct glue* lastglue = &__sglue;
 
+// Released FILE slots, so __sfp doesn't have to scan every glue block.
+static FILE* __sfp_free_list = nullptr;
+
+// FILEs in write mode. See __slink_writer.
+static FILE* __swriters = nullptr;
+static size_t __swriter_count = 0;
+
 class ScopedFileLock {
  public:
   explicit ScopedFileLock(FILE* fp) : fp_(fp) {
@@ -132,19 +143,36 @@ static glue* moreglue(int n) {
   return g;
 }
 
+// Puts `fp` back on the free list. Caller holds `__sfp_mutex`.
+static void __sfp_push_free(FILE* fp) {
+  if (_EXT(fp)->_on_free_list) return;
+  _EXT(fp)->_free_next = __sfp_free_list;
+  _EXT(fp)->_on_free_list = true;
+  __sfp_free_list = fp;
+}
+
+// Returns `fp` to the pool used by __sfp.
+void __sfp_release(FILE* fp) {
+  _THREAD_PRIVATE_MUTEX_LOCK(__sfp_mutex);
+  fp->_flags = 0;
+  __sfp_push_free(fp);
+  _THREAD_PRIVATE_MUTEX_UNLOCK(__sfp_mutex);
+}
+
 /*
  * Find a free FILE for fopen et al.
  */
 FILE* __sfp(void) {
 	FILE *fp;
-	int n;
 	struct glue *g;
 
 	_THREAD_PRIVATE_MUTEX_LOCK(__sfp_mutex);
-	for (g = &__sglue; g != NULL; g = g->next) {
-		for (fp = g->iobs, n = g->niobs; --n >= 0; fp++)
-			if (fp->_flags == 0)
-				goto found;
+	while ((fp = __sfp_free_list) != NULL) {
+		__sfp_free_list = _EXT(fp)->_free_next;
+		_EXT(fp)->_on_free_list = false;
+		/* freopen(3) can resurrect a FILE that's still on the list. */
+		if (fp->_flags == 0)
+			goto found;
 	}
 
 	/* release lock while mallocing */
@@ -155,6 +183,9 @@ FILE* __sfp(void) {
 	lastglue->next = g;
 	lastglue = g;
 	fp = g->iobs;
+	/* the rest of the new block goes on the free list */
+	for (int n = g->niobs; --n > 0; )
+		__sfp_push_free(&g->iobs[n]);
 found:
 	fp->_flags = 1;		/* reserve this slot; caller sets real flags */
 	_THREAD_PRIVATE_MUTEX_UNLOCK(__sfp_mutex);
@@ -178,9 +209,83 @@ found:
 	return fp;
 }
 
+// Called by __swsetup when `fp` enters write mode. Only streams on this list
+// can have buffered output, so flushing everything is O(writers) rather than
+// O(every FILE ever allocated).
+//
+// We track write mode rather than individual writes because LP32 apps built
+// against old headers have inline putc that writes straight into the buffer.
+void __slink_writer(FILE* fp) {
+  // String streams are often on the stack and never need flushing.
+  if (fp->_flags & __SSTR) return;
+
+  _THREAD_PRIVATE_MUTEX_LOCK(__swriters_mutex);
+  if (!_EXT(fp)->_on_writer_list) {
+    _EXT(fp)->_writer_prev = nullptr;
+    _EXT(fp)->_writer_next = __swriters;
+    if (__swriters != nullptr) _EXT(__swriters)->_writer_prev = fp;
+    __swriters = fp;
+    _EXT(fp)->_on_writer_list = true;
+    ++__swriter_count;
+  }
+  _THREAD_PRIVATE_MUTEX_UNLOCK(__swriters_mutex);
+}
+
+void __sunlink_writer(FILE* fp) {
+  _THREAD_PRIVATE_MUTEX_LOCK(__swriters_mutex);
+  if (_EXT(fp)->_on_writer_list) {
+    FILE* prev = _EXT(fp)->_writer_prev;
+    FILE* next = _EXT(fp)->_writer_next;
+    if (prev != nullptr) {
+      _EXT(prev)->_writer_next = next;
+    } else {
+      __swriters = next;
+    }
+    if (next != nullptr) _EXT(next)->_writer_prev = prev;
+    _EXT(fp)->_writer_prev = _EXT(fp)->_writer_next = nullptr;
+    _EXT(fp)->_on_writer_list = false;
+    --__swriter_count;
+  }
+  _THREAD_PRIVATE_MUTEX_UNLOCK(__swriters_mutex);
+}
+
+// Like _fwalk, but only visits streams in write mode.
+//
+// `function` will typically take the FILE's lock, and __slink_writer is called
+// with that lock held, so we can't call `function` with `__swriters_mutex` held.
+// Instead we take a snapshot. FILEs are never freed, so a stale entry is at
+// worst a FILE that's no longer writing, which __sflush ignores.
+int _fwalk_writers(int (*function)(FILE*)) {
+  FILE* stack_snapshot[32];
+  FILE** snapshot = stack_snapshot;
+
+  _THREAD_PRIVATE_MUTEX_LOCK(__swriters_mutex);
+  size_t count = __swriter_count;
+  if (count > sizeof(stack_snapshot)/sizeof(stack_snapshot[0])) {
+    snapshot = reinterpret_cast<FILE**>(malloc(count * sizeof(FILE*)));
+    if (snapshot == nullptr) {
+      _THREAD_PRIVATE_MUTEX_UNLOCK(__swriters_mutex);
+      return _fwalk(function);
+    }
+  }
+  size_t n = 0;
+  for (FILE* fp = __swriters; fp != nullptr; fp = _EXT(fp)->_writer_next) {
+    snapshot[n++] = fp;
+  }
+  _THREAD_PRIVATE_MUTEX_UNLOCK(__swriters_mutex);
+
+  int result = 0;
+  for (size_t i = 0; i < n; ++i) {
+    FILE* fp = snapshot[i];
+    if (fp->_flags != 0 && (fp->_flags & __SIGN) == 0) result |= (*function)(fp);
+  }
+  if (snapshot != stack_snapshot) free(snapshot);
+  return result;
+}
+
 extern "C" __LIBC_HIDDEN__ void __libc_stdio_cleanup(void) {
   // Equivalent to fflush(nullptr), but without all the locking since we're shutting down anyway.
-  _fwalk(__sflush);
+  _fwalk_writers(__sflush);
 }
 
 static FILE* __fopen(int fd, int flags) {
@@ -316,7 +421,9 @@ FILE* freopen(const char* file, const char* mode, FILE* fp) {
   // keep fp->_base: it may be the wrong size.  This loses the effect
   // of any setbuffer calls, but stdio has always done this before.
   if (isopen && fd != wantfd) (*fp->_close)(fp->_cookie);
+  __sunlink_writer(fp);
   if (fp->_flags & __SMBF) free(fp->_bf._base);
+  if (HASMMAP(fp)) FREEMMAP(fp);
   fp->_w = 0;
   fp->_r = 0;
   fp->_p = NULL;
@@ -330,7 +437,7 @@ FILE* freopen(const char* file, const char* mode, FILE* fp) {
   fp->_lb._size = 0;
 
   if (fd < 0) { // Did not get it after all.
-    fp->_flags = 0; // Release.
+    __sfp_release(fp);
     errno = sverrno; // Restore errno in case _close clobbered it.
     return nullptr;
   }
@@ -347,7 +454,7 @@ FILE* freopen(const char* file, const char* mode, FILE* fp) {
 
   // _file is only a short.
   if (fd > SHRT_MAX) {
-      fp->_flags = 0; // Release.
+      __sfp_release(fp);
       errno = EMFILE;
       return nullptr;
   }
@@ -359,6 +466,7 @@ FILE* freopen(const char* file, const char* mode, FILE* fp) {
   fp->_write = __swrite;
   fp->_close = __sclose;
   _EXT(fp)->_seek64 = __sseek64;
+  _EXT(fp)->_purge = nullptr;
 
   // When opening in append mode, even though we use O_APPEND,
   // we need to seek to the end so that ftell() gets the right
@@ -385,15 +493,18 @@ int fclose(FILE* fp) {
     r = EOF;
   }
   if (fp->_flags & __SMBF) free(fp->_bf._base);
+  if (HASMMAP(fp)) FREEMMAP(fp);
   if (HASUB(fp)) FREEUB(fp);
   if (HASLB(fp)) FREELB(fp);
 
+  __sunlink_writer(fp);
+
   // Poison this FILE so accesses after fclose will be obvious.
   fp->_file = -1;
   fp->_r = fp->_w = 0;
 
   // Release this FILE for reuse.
-  fp->_flags = 0;
+  __sfp_release(fp);
   return r;
 }
 
@@ -532,7 +643,8 @@ int __fseeko64(FILE* fp, off64_t offset, int whence, int off_t_bits) {
     return -1;
   }
 
-  if (fp->_bf._base == NULL) __smakebuf(fp);
+  // "m" mode streams map a new window from the new offset on the next refill.
+  if (fp->_bf._base == NULL && (fp->_flags & __SMMAP) == 0) __smakebuf(fp);
 
   // Flush unwritten data and attempt the seek.
   if (__sflush(fp) || __seek_unlocked(fp, offset, whence) == -1) {
@@ -541,6 +653,7 @@ int __fseeko64(FILE* fp, off64_t offset, int whence, int off_t_bits) {
 
   // Success: clear EOF indicator and discard ungetc() data.
   if (HASUB(fp)) FREEUB(fp);
+  _EXT(fp)->_seq_refills = 0;
   fp->_p = fp->_bf._base;
   fp->_r = 0;
   /* fp->_w = 0; */	/* unnecessary (I think...) */
@@ -92,6 +92,106 @@
 
 static u_char *__sccl(char *, u_char *);
 
+/*
+ * Skip white space, refilling as needed.
+ * Return EOF if we ran out of input, 0 otherwise.
+ */
+static int
+__sskipspace(FILE *fp, int *nreadp)
+{
+	u_char *p, *end;
+
+	for (;;) {
+		p = fp->_p;
+		end = p + fp->_r;
+		while (p < end && isspace(*p))
+			p++;
+		*nreadp += p - fp->_p;
+		fp->_r -= p - fp->_p;
+		fp->_p = p;
+		if (fp->_r > 0)
+			return (0);
+		if (__srefill(fp))
+			return (EOF);
+	}
+}
+
+/*
+ * Return the length of the run of decimal digits at s, looking at
+ * eight bytes at a time while we can.
+ */
+static size_t
+__sdigitspan(const u_char *s, const u_char *end)
+{
+	const u_char *p = s;
+	uint64_t w;
+
+	while (end - p >= 8) {
+		memcpy(&w, p, sizeof(w));
+		/* Every byte is 0x3[0-9] iff both nibble tests pass. */
+		if (((w & 0xf0f0f0f0f0f0f0f0ULL) |
+		    (((w + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) !=
+		    0x3333333333333333ULL)
+			break;
+		p += 8;
+	}
+	while (p < end && (u_int)(*p - '0') < 10)
+		p++;
+	return (p - s);
+}
+
+/*
+ * Fast path for %d and %u when the whole number is already buffered
+ * (which is always true for sscanf).  Returns the number of characters
+ * consumed, or 0 if the caller should use the general code instead.
+ *
+ * Numbers short enough not to overflow are converted here and
+ * *convertedp is set; longer ones are copied to buf for strtoimax.
+ * (strtoumax of a negative number gives the same bits as strtoimax,
+ * so signedness doesn't matter here.)
+ */
+static size_t
+__sscandec(FILE *fp, size_t width, char *buf, uintmax_t *resp,
+    int *convertedp)
+{
+	const u_char *s = fp->_p, *p, *digits, *end;
+	size_t avail, limit, n, ndigits;
+	uintmax_t v;
+
+	if (fp->_r <= 0)
+		return (0);
+	avail = fp->_r;
+	limit = (width == 0 || width > BUF - 1) ? BUF - 1 : width;
+	end = s + (avail < limit ? avail : limit);
+
+	p = s;
+	if (*p == '+' || *p == '-')
+		p++;
+	digits = p;
+	p += __sdigitspan(p, end);
+	ndigits = p - digits;
+	if (ndigits == 0)
+		return (0);
+	/* The number might continue past the end of the buffer. */
+	if (p == s + avail && avail < limit && (fp->_flags & __SSTR) == 0)
+		return (0);
+
+	n = p - s;
+	if (ndigits <= 18) {
+		for (v = 0; digits < p; digits++)
+			v = v * 10 + (*digits - '0');
+		*resp = (*s == '-') ? -v : v;
+		*convertedp = 1;
+	} else {
+		memcpy(buf, s, n);
+		buf[n] = '\0';
+		*convertedp = 0;
+	}
+	fp->_p += n;
+	fp->_r -= n;
+	return (n);
+}
+
 /*
  * Internal, unlocked version of vfscanf
  */
@@ -108,6 +208,8 @@ __svfscanf(FILE *fp, const char *fmt0, __va_list ap)
 	int nassigned;		/* number of fields assigned */
 	int nread;		/* number of characters consumed from fp */
 	int base;		/* base argument to strtoimax/strtouimax */
+	uintmax_t res;		/* result of an integer conversion */
+	int converted;		/* res was computed by __sscandec */
 	char ccltab[256];	/* character class table for %[...] */
 	char buf[BUF];		/* buffer for numeric conversions */
 #ifdef SCANF_WIDE_CHAR
@@ -130,9 +232,7 @@ __svfscanf(FILE *fp, const char *fmt0, __va_list ap)
 		if (c == 0)
 			return (nassigned);
 		if (isspace(c)) {
-			while ((fp->_r > 0 || __srefill(fp) == 0) &&
-			    isspace(*fp->_p))
-				nread++, fp->_r--, fp->_p++;
+			(void) __sskipspace(fp, &nread);
 			continue;
 		}
 		if (c != '%')
@@ -315,13 +415,8 @@ literal:
 		 * that suppress this.
 		 */
 		if ((flags & NOSKIP) == 0) {
-			while (isspace(*fp->_p)) {
-				nread++;
-				if (--fp->_r > 0)
-					fp->_p++;
-				else if (__srefill(fp))
-					goto input_failure;
-			}
+			if (__sskipspace(fp, &nread))
+				goto input_failure;
 			/*
 			 * Note that there is at least one character in
 			 * the buffer, so conversions that do not set NOSKIP
@@ -576,34 +671,47 @@ literal:
 				}
 			} else
 #endif /* SCANF_WIDE_CHAR */
-			if (flags & SUPPRESS) {
-				n = 0;
-				while (!isspace(*fp->_p)) {
-					n++, fp->_r--, fp->_p++;
-					if (--width == 0)
+			{
+				u_char *s, *q, *end;
+
+				/* Copy a buffer's worth at a time. */
+				p0 = p = (flags & SUPPRESS) ? NULL :
+				    va_arg(ap, char *);
+				for (;;) {
+					s = q = fp->_p;
+					end = s + ((size_t)fp->_r < width ?
+					    (size_t)fp->_r : width);
+					while (q < end && !isspace(*q))
+						q++;
+					n = q - s;
+					if (p != NULL) {
+						memcpy(p, s, n);
+						p += n;
+					}
+					nread += n;
+					fp->_p += n;
+					fp->_r -= n;
+					width -= n;
+					if (q < end || width == 0)
 						break;
-					if (fp->_r <= 0 && __srefill(fp))
+					if (__srefill(fp))
 						break;
 				}
-				nread += n;
-			} else {
-				p0 = p = va_arg(ap, char *);
-				while (!isspace(*fp->_p)) {
-					fp->_r--;
-					*p++ = *fp->_p++;
-					if (--width == 0)
-						break;
-					if (fp->_r <= 0 && __srefill(fp))
-						break;
+				if (p != NULL) {
+					*p = '\0';
+					nassigned++;
 				}
-				*p = '\0';
-				nread += p - p0;
-				nassigned++;
 			}
 			continue;
 
 		case CT_INT:
 			/* scan an integer as if by strtoimax/strtoumax */
+			converted = 0;
+			if (base == 10 &&
+			    (n = __sscandec(fp, width, buf, &res, &converted)) != 0) {
+				p = buf + n;
+				goto intdone;
+			}
 #ifdef hardway
 			if (width == 0 || width > sizeof(buf) - 1)
 				width = sizeof(buf) - 1;
@@ -725,11 +833,12 @@ literal:
 				--p;
 				(void) ungetc(c, fp);
 			}
+			*p = '\0';
+intdone:
 			if ((flags & SUPPRESS) == 0) {
-				uintmax_t res;
-
-				*p = '\0';
-				if (flags & UNSIGNED)
+				if (converted)
+					;
+				else if (flags & UNSIGNED)
 					res = strtoumax(buf, NULL, base);
 				else
 					res = strtoimax(buf, NULL, base);
@@ -42,7 +42,7 @@ fflush(FILE *fp)
 	int	r;
 
 	if (fp == NULL)
-		return (_fwalk(__sflush_locked));
+		return (_fwalk_writers(__sflush_locked));
 	FLOCKFILE(fp);
 	if ((fp->_flags & (__SWR | __SRW)) == 0) {
 		errno = EBADF;
@@ -45,7 +45,7 @@
 int
 __sflags(const char *mode, int *optr)
 {
-	int ret, m, o;
+	int ret, m, o, usemmap;
 
 	switch (*mode++) {
 
@@ -72,6 +72,7 @@ __sflags(const char *mode, int *optr)
 		return (0);
 	}
 
+	usemmap = 0;
 	while (*mode != '\0') 
 		switch (*mode++) {
 		case 'b':
@@ -87,6 +88,10 @@ __sflags(const char *mode, int *optr)
 			if (o & O_CREAT)
 				o |= O_EXCL;
 			break;
+		case 'm':
+			/* glibc extension: read via mmap(2) */
+			usemmap = 1;
+			break;
 		default:
 			/*
 			 * Lots of software passes other extension mode
@@ -100,6 +105,10 @@ __sflags(const char *mode, int *optr)
 #endif
 		}
 
+	/* Only read-only streams can be mmap(2)ed. */
+	if (usemmap && ret == __SRD)
+		ret |= __SMMAP;
+
 	*optr = m | o;
 	return (ret);
 }
@@ -36,24 +36,28 @@ static int
 fmemopen_read(void *v, char *b, int l)
 {
 	struct state	*st = v;
-	int		 i;
+	size_t		 n;
 
-	for (i = 0; i < l && i + st->pos < st->len; i++)
-		b[i] = st->string[st->pos + i];
-	st->pos += i;
+	n = st->pos < st->len ? st->len - st->pos : 0;
+	if (n > (size_t)l)
+		n = l;
+	memcpy(b, st->string + st->pos, n);
+	st->pos += n;
 
-	return (i);
+	return (n);
 }
 
 static int
 fmemopen_write(void *v, const char *b, int l)
 {
 	struct state	*st = v;
-	int		i;
+	size_t		n;
 
-	for (i = 0; i < l && i + st->pos < st->size; i++)
-		st->string[st->pos + i] = b[i];
-	st->pos += i;
+	n = st->pos < st->size ? st->size - st->pos : 0;
+	if (n > (size_t)l)
+		n = l;
+	memcpy(st->string + st->pos, b, n);
+	st->pos += n;
 
 	if (st->pos >= st->len) {
 		st->len = st->pos;
@@ -64,7 +68,7 @@ fmemopen_write(void *v, const char *b, int l)
 			st->string[st->size - 1] = '\0';
 	}
 
-	return (i);
+	return (n);
 }
 
 static fpos_t
@@ -151,7 +155,7 @@ fmemopen(void *buf, size_t size, const char *mode)
 	if (buf == NULL) {
 		if ((st->string = malloc(size)) == NULL) {
 			free(st);
-			fp->_flags = 0;
+			__sfp_release(fp);
 			return (NULL);
 		}
 		*st->string = '\0';
@@ -56,6 +56,8 @@ fpurge(FILE *fp)
 	fp->_p = fp->_bf._base;
 	fp->_r = 0;
 	fp->_w = fp->_flags & (__SLBF|__SNBF) ? 0 : fp->_bf._size;
+	if (_EXT(fp)->_purge != NULL)
+		(*_EXT(fp)->_purge)(fp);
 	FUNLOCKFILE(fp);
 	return (0);
 }
@@ -68,9 +68,14 @@ __smakebuf(FILE *fp)
 	flags |= __SMBF;
 	fp->_bf._base = fp->_p = p;
 	fp->_bf._size = size;
+	/* Let __srefill grow the buffer for sequential reads of a file. */
+	_EXT(fp)->_adaptive_buf = (flags & __SOPT) != 0;
 	if (couldbetty && isatty(fp->_file))
 		flags |= __SLBF;
 	fp->_flags |= flags;
+	/* __fseeko64 can give a writer its buffer without __swsetup */
+	if (fp->_flags & __SWR)
+		__slink_writer(fp);
 }
 
 /*
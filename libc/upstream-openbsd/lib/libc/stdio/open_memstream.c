@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 #define	MINIMUM(a, b)	(((a) < (b)) ? (a) : (b))
 
 struct state {
+	FILE		 *fp;		/* the stream itself */
 	char		 *string;	/* actual stream */
 	char		**pbuf;		/* point to the stream */
 	size_t		 *psize;	/* point to min(pos, len) */
@@ -35,41 +37,121 @@ struct state {
 	size_t		  len;		/* length of the data */
 };
 
+/*
+ * Make sure the string has room for at least `need' bytes.  The new
+ * space isn't zeroed: it's either about to be written, or it's past
+ * `len' where nothing can see it until memstream_write fills the gap.
+ */
 static int
-memstream_write(void *v, const char *b, int l)
+memstream_grow(struct state *st, size_t need)
 {
-	struct state	*st = v;
-	char		*p;
-	size_t		 i, end;
+	char	*p;
+	size_t	 sz;
 
-	end = (st->pos + l);
+	if (need <= st->size)
+		return (0);
+	/* 1.6 is (very) close to the golden ratio. */
+	sz = st->size * 8 / 5;
+	if (sz < need)
+		sz = need;
+	p = realloc(st->string, sz);
+	if (!p)
+		return (-1);
+	*st->pbuf = st->string = p;
+	st->size = sz;
+	return (0);
+}
 
-	if (end >= st->size) {
-		/* 1.6 is (very) close to the golden ratio. */
-		size_t	sz = st->size * 8 / 5;
+/*
+ * Point the FILE buffer at the string's current position, so that
+ * buffered writes land where they belong and flushing them is free.
+ * That's only done at or past the end of the data: buffered bytes
+ * mustn't overwrite data that is already written, since fpurge(3)
+ * could still discard them.  Once the stream moves back into its data,
+ * stdio gives it a buffer of its own, and it keeps that one.
+ */
+static void
+memstream_alias(struct state *st)
+{
+	FILE	*fp = st->fp;
+	size_t	 room = st->size - st->pos - 1;
 
-		if (sz < end + 1)
-			sz = end + 1;
-		p = realloc(st->string, sz);
-		if (!p)
-			return (-1);
-		bzero(p + st->size, sz - st->size);
-		*st->pbuf = st->string = p;
-		st->size = sz;
+	if (st->pos < st->len) {
+		fp->_bf._base = fp->_p = NULL;
+		fp->_bf._size = 0;
+		fp->_w = 0;
+		return;
 	}
+	fp->_bf._base = fp->_p = (unsigned char *)st->string + st->pos;
+	fp->_bf._size = MINIMUM(room, INT_MAX);
+	fp->_w = fp->_bf._size;
+}
+
+/*
+ * fpurge(3) discarded whatever was buffered in place, which may have
+ * overwritten the NUL after the data.
+ */
+static void
+memstream_purge(FILE *fp)
+{
+	struct state	*st = fp->_cookie;
+
+	st->string[st->len] = '\0';
+}
+
+/*
+ * Is the FILE buffer still ours? (It isn't if someone called setvbuf(3).)
+ */
+static int
+memstream_aliased(struct state *st)
+{
+	unsigned char	*base = st->fp->_bf._base;
+
+	return (base >= (unsigned char *)st->string &&
+	    base < (unsigned char *)st->string + st->size);
+}
 
-	for (i = 0; i < l; i++)
-		st->string[st->pos + i] = b[i];
-	st->pos += l;
+static int
+memstream_write(void *v, const char *b, int l)
+{
+	struct state	*st = v;
+	char		*old = st->string;
+	size_t		 end;
+	int		 aliased, inside;
 
-	if (st->pos > st->len) {
+	/* `b' is in the string if the data was buffered there. */
+	aliased = memstream_aliased(st);
+	inside = b >= old && b < old + st->size;
+
+	end = st->pos + l;
+	/* Room for the NUL, and for at least one more buffered byte. */
+	if (memstream_grow(st, end + 1 + aliased))
+		return (-1);
+	if (inside)
+		b = st->string + (b - old);
+
+	/*
+	 * Data buffered in place needs no copy.  Anything else is
+	 * copied before zero-filling the gap left by seeking past the
+	 * end, in case the caller handed us a pointer into that gap.
+	 */
+	if (b != st->string + st->pos)
+		memmove(st->string + st->pos, b, l);
+	if (st->pos > st->len)
+		memset(st->string + st->len, 0, st->pos - st->len);
+	st->pos = end;
+
+	/* Buffered writes may have overwritten the NUL. */
+	if (st->pos > st->len)
 		st->len = st->pos;
-		st->string[st->len] = '\0';
-	}
+	st->string[st->len] = '\0';
 
 	*st->psize = st->pos;
 
-	return (i);
+	if (aliased)
+		memstream_alias(st);
+
+	return (l);
 }
 
 static fpos_t
@@ -94,7 +176,21 @@ memstream_seek(void *v, fpos_t off, int whence)
 		return (-1);
 	}
 
-	st->pos = base + off;
+	/*
+	 * Our callers always flush first, so the buffer is empty and we
+	 * can move it to the new position.
+	 */
+	if (memstream_aliased(st)) {
+		if (base + off > SIZE_MAX - 2) {
+			errno = EOVERFLOW;
+			return (-1);
+		}
+		if (memstream_grow(st, base + off + 2))
+			return (-1);
+		st->pos = base + off;
+		memstream_alias(st);
+	} else
+		st->pos = base + off;
 	*st->psize = MINIMUM(st->pos, st->len);
 
 	return (st->pos);
@@ -130,13 +226,14 @@ open_memstream(char **pbuf, size_t *psize)
 	}
 
 	st->size = BUFSIZ;
-	if ((st->string = calloc(1, st->size)) == NULL) {
+	if ((st->string = malloc(st->size)) == NULL) {
 		free(st);
-		fp->_flags = 0;
+		__sfp_release(fp);
 		return (NULL);
 	}
 
 	*st->string = '\0';
+	st->fp = fp;
 	st->pos = 0;
 	st->len = 0;
 	st->pbuf = pbuf;
@@ -152,8 +249,13 @@ open_memstream(char **pbuf, size_t *psize)
 	fp->_write = memstream_write;
 	fp->_seek = memstream_seek;
 	fp->_close = memstream_close;
+	_EXT(fp)->_purge = memstream_purge;
 	_SET_ORIENTATION(fp, -1);
 
+	/* Write straight into the string rather than a separate buffer. */
+	memstream_alias(st);
+	__slink_writer(fp);
+
 	return (fp);
 }
 DEF_WEAK(open_memstream);
@@ -71,7 +71,12 @@ setvbuf(FILE *fp, char *buf, int mode, size_t size)
 	flags = fp->_flags;
 	if (flags & __SMBF)
 		free(fp->_bf._base);
-	flags &= ~(__SLBF | __SNBF | __SMBF | __SOPT | __SNPT | __SEOF);
+	if (HASMMAP(fp))
+		FREEMMAP(fp);
+	/* Explicit buffering overrides "m" mode. */
+	flags &= ~(__SLBF | __SNBF | __SMBF | __SOPT | __SNPT | __SEOF | __SMMAP);
+	/* Explicit buffering also fixes the buffer size. */
+	_EXT(fp)->_adaptive_buf = false;
 
 	/* If setting unbuffered mode, skip all the hard work. */
 	if (mode == _IONBF)
@@ -149,6 +154,7 @@ nbf:
 			fp->_lbfsize = -fp->_bf._size;
 		} else
 			fp->_w = size;
+		__slink_writer(fp);
 	} else {
 		/* begin/continue reading, or stay in intermediate state */
 		fp->_w = 0;
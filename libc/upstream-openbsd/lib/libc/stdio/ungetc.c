@@ -99,6 +99,7 @@ error:			FUNLOCKFILE(fp);
 			fp->_flags &= ~__SWR;
 			fp->_w = 0;
 			fp->_lbfsize = 0;
+			__sunlink_writer(fp);
 		}
 		fp->_flags |= __SRD;
 	}
@@ -49,7 +49,8 @@ vsscanf(const char *str, const char *fmt, __va_list ap)
 	struct __sfileext fext;
 
 	_FILEEXT_SETUP(&f, &fext);
-	f._flags = __SRD;
+	/* __SSTR tells __svfscanf there's no input beyond the buffer. */
+	f._flags = __SRD | __SSTR;
 	f._bf._base = f._p = (unsigned char *)str;
 	f._bf._size = f._r = strlen(str);
 	f._read = eofread;
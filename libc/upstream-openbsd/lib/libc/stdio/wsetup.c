@@ -82,5 +82,6 @@ __swsetup(FILE *fp)
 		fp->_lbfsize = -fp->_bf._size;
 	} else
 		fp->_w = fp->_flags & __SNBF ? 0 : fp->_bf._size;
+	__slink_writer(fp);
 	return (0);
 }
@@ -138,14 +138,13 @@ int __dlclose(void* handle) {
 }
 
 // This function is needed by libgcc.a (this is why there is no prefix for this one)
+// It doesn't take g_dl_mutex: see linker_loaded_objects.h.
 int dl_iterate_phdr(int (*cb)(dl_phdr_info* info, size_t size, void* data), void* data) {
-  ScopedPthreadMutexLocker locker(&g_dl_mutex);
   return do_dl_iterate_phdr(cb, data);
 }
 
 #if defined(__arm__)
 _Unwind_Ptr __dl_unwind_find_exidx(_Unwind_Ptr pc, int* pcount) {
-  ScopedPthreadMutexLocker locker(&g_dl_mutex);
   return do_dl_unwind_find_exidx(pc, pcount);
 }
 #endif
@@ -58,10 +58,15 @@
 #include "linker_globals.h"
 #include "linker_debug.h"
 #include "linker_dlwarning.h"
+#include "linker_loaded_objects.h"
 #include "linker_main.h"
 #include "linker_namespaces.h"
 #include "linker_sleb128.h"
+#include "linker_symbol_cache.h"
 #include "linker_phdr.h"
+#include "linker_profile.h"
+#include "linker_relr.h"
+#include "linker_relro_cache.h"
 #include "linker_relocs.h"
 #include "linker_reloc_iterators.h"
 #include "linker_utils.h"
@@ -227,14 +232,16 @@ struct linker_stats_t {
 };
 
 static linker_stats_t linker_stats;
+#endif
 
 void count_relocation(RelocationKind kind) {
+#if STATS
   ++linker_stats.count[kind];
-}
-#else
-void count_relocation(RelocationKind) {
-}
 #endif
+  if (__predict_false(g_linker_profiling)) {
+    linker_profile_count_relocation(kind);
+  }
+}
 
 #if COUNT_PAGES
 uint32_t bitmask[4096];
@@ -306,19 +313,25 @@ static void soinfo_free(soinfo* si) {
     return;
   }
 
-  if (si->base != 0 && si->size != 0) {
-    if (!si->is_mapped_by_caller()) {
-      munmap(reinterpret_cast<void*>(si->base), si->size);
-    } else {
-      // remap the region as PROT_NONE, MAP_ANONYMOUS | MAP_NORESERVE
-      mmap(reinterpret_cast<void*>(si->base), si->size, PROT_NONE,
-           MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-    }
+  TRACE("name %s: freeing soinfo @ %p", si->get_realpath(), si);
+
+  // dl_iterate_phdr() doesn't take g_dl_mutex: the segments are unmapped
+  // once it can no longer see them.
+  bool removed = solist_remove_soinfo(si);
+  unpublish_loaded_object(si);
+
+  if (si->get_tls_module_id() != 0) {
+    __bionic_tls_unregister_module(si->get_tls_module_id());
   }
 
-  TRACE("name %s: freeing soinfo @ %p", si->get_realpath(), si);
+  if (g_linker_profiling) {
+    linker_profile_remove(si);
+  }
 
-  if (!solist_remove_soinfo(si)) {
+  // The symbol cache may point to this library, or into its string table.
+  symbol_cache_invalidate();
+
+  if (!removed) {
     // TODO (dimitry): revisit this - for now preserving the logic
     // but it does not look right, abort if soinfo is not in the list instead?
     return;
@@ -356,50 +369,18 @@ static bool realpath_fd(int fd, std::string* realpath) {
   return true;
 }
 
-#if defined(__arm__)
-
-// For a given PC, find the .so that it belongs to.
-// Returns the base address of the .ARM.exidx section
-// for that .so, and the number of 8-byte entries
-// in that section (via *pcount).
-//
-// Intended to be called by libc's __gnu_Unwind_Find_exidx().
-_Unwind_Ptr do_dl_unwind_find_exidx(_Unwind_Ptr pc, int* pcount) {
-  for (soinfo* si = solist_get_head(); si != 0; si = si->next) {
-    if ((pc >= si->base) && (pc < (si->base + si->size))) {
-        *pcount = si->ARM_exidx_count;
-        return reinterpret_cast<_Unwind_Ptr>(si->ARM_exidx);
-    }
-  }
-  *pcount = 0;
-  return 0;
-}
-
-#endif
-
-// Here, we only have to provide a callback to iterate across all the
-// loaded libraries. gcc_eh does the rest.
-int do_dl_iterate_phdr(int (*cb)(dl_phdr_info* info, size_t size, void* data), void* data) {
-  int rv = 0;
-  for (soinfo* si = solist_get_head(); si != nullptr; si = si->next) {
-    dl_phdr_info dl_info;
-    dl_info.dlpi_addr = si->link_map_head.l_addr;
-    dl_info.dlpi_name = si->link_map_head.l_name;
-    dl_info.dlpi_phdr = si->phdr;
-    dl_info.dlpi_phnum = si->phnum;
-    rv = cb(&dl_info, sizeof(dl_phdr_info), data);
-    if (rv != 0) {
-      break;
-    }
-  }
-  return rv;
-}
-
-
 bool soinfo_do_lookup(soinfo* si_from, const char* name, const version_info* vi,
                       soinfo** si_found_in, const soinfo_list_t& global_group,
                       const soinfo_list_t& local_group, const ElfW(Sym)** symbol) {
   SymbolName symbol_name(name);
+  return soinfo_do_lookup(si_from, symbol_name, vi, si_found_in, global_group, local_group,
+                          symbol);
+}
+
+bool soinfo_do_lookup(soinfo* si_from, SymbolName& symbol_name, const version_info* vi,
+                      soinfo** si_found_in, const soinfo_list_t& global_group,
+                      const soinfo_list_t& local_group, const ElfW(Sym)** symbol) {
+  const char* name = symbol_name.get_name();
   const ElfW(Sym)* s = nullptr;
 
   /* "This element's presence in a shared object library alters the dynamic linker's
@@ -489,6 +470,37 @@ bool soinfo_do_lookup(soinfo* si_from, const char* name, const version_info* vi,
   return true;
 }
 
+// soinfo_do_lookup() for relocations, going through the symbol cache for
+// definitions in the global group.
+static bool soinfo_do_cached_lookup(soinfo* si_from, const char* name, const version_info* vi,
+                                    soinfo** si_found_in, const soinfo_list_t& global_group,
+                                    const soinfo_list_t& local_group,
+                                    const ElfW(Sym)** symbol) {
+  // DT_SYMBOLIC lookups don't start with the global group, and the bootstrap
+  // links of the linker, the vdso and a lone executable are made without one.
+  android_namespace_t* ns = si_from->get_primary_namespace();
+  bool cacheable = ns != nullptr && !si_from->has_DT_SYMBOLIC && !global_group.empty();
+
+  SymbolName symbol_name(name);
+  if (cacheable &&
+      symbol_cache_find(ns, symbol_name.gnu_hash(), name, vi, si_found_in, symbol)) {
+    count_relocation(kRelocSymbolGlobalCached);
+    return true;
+  }
+
+  if (!soinfo_do_lookup(si_from, symbol_name, vi, si_found_in, global_group, local_group,
+                        symbol)) {
+    return false;
+  }
+
+  // The global group is searched first, so a definition in one of its members
+  // was found there.
+  if (cacheable && *symbol != nullptr && global_group.contains(*si_found_in)) {
+    symbol_cache_insert(ns, symbol_name.gnu_hash(), name, vi, *si_found_in, *symbol);
+  }
+  return true;
+}
+
 ProtectedDataGuard::ProtectedDataGuard() {
   if (ref_count_++ == 0) {
     protect_data(PROT_READ | PROT_WRITE);
@@ -880,13 +892,7 @@ static const ElfW(Sym)* dlsym_linear_lookup(android_namespace_t* ns,
 }
 
 soinfo* find_containing_library(const void* p) {
-  ElfW(Addr) address = reinterpret_cast<ElfW(Addr)>(p);
-  for (soinfo* si = solist_get_head(); si != nullptr; si = si->next) {
-    if (address >= si->base && address - si->base < si->size) {
-      return si;
-    }
-  }
-  return nullptr;
+  return find_loaded_object(reinterpret_cast<ElfW(Addr)>(p));
 }
 
 class ZipArchiveCache {
@@ -1129,20 +1135,13 @@ static bool find_loaded_library_by_inode(android_namespace_t* ns,
                                          bool search_linked_namespaces,
                                          soinfo** candidate) {
 
-  auto predicate = [&](soinfo* si) {
-    return si->get_st_dev() != 0 &&
-           si->get_st_ino() != 0 &&
-           si->get_st_dev() == file_stat.st_dev &&
-           si->get_st_ino() == file_stat.st_ino &&
-           si->get_file_offset() == file_offset;
-  };
-
-  *candidate = ns->soinfo_list().find_if(predicate);
+  *candidate = ns->find_soinfo_by_inode(file_stat.st_dev, file_stat.st_ino, file_offset);
 
   if (*candidate == nullptr && search_linked_namespaces) {
     for (auto& link : ns->linked_namespaces()) {
       android_namespace_t* linked_ns = link.linked_namespace();
-      soinfo* si = linked_ns->soinfo_list().find_if(predicate);
+      soinfo* si = linked_ns->find_soinfo_by_inode(file_stat.st_dev, file_stat.st_ino,
+                                                   file_offset);
 
       if (si != nullptr && link.is_accessible(si->get_soname())) {
         *candidate = si;
@@ -1156,14 +1155,12 @@ static bool find_loaded_library_by_inode(android_namespace_t* ns,
 
 static bool find_loaded_library_by_realpath(android_namespace_t* ns, const char* realpath,
                                             bool search_linked_namespaces, soinfo** candidate) {
-  auto predicate = [&](soinfo* si) { return strcmp(realpath, si->get_realpath()) == 0; };
-
-  *candidate = ns->soinfo_list().find_if(predicate);
+  *candidate = ns->find_soinfo_by_realpath(realpath);
 
   if (*candidate == nullptr && search_linked_namespaces) {
     for (auto& link : ns->linked_namespaces()) {
       android_namespace_t* linked_ns = link.linked_namespace();
-      soinfo* si = linked_ns->soinfo_list().find_if(predicate);
+      soinfo* si = linked_ns->find_soinfo_by_realpath(realpath);
 
       if (si != nullptr && link.is_accessible(si->get_soname())) {
         *candidate = si;
@@ -1281,7 +1278,9 @@ static bool load_library(android_namespace_t* ns,
   task->set_soinfo(si);
 
   // Read the ELF header and some of the segments.
+  LinkerProfileTimer read_timer(si, kProfileRead);
   if (!task->read(realpath.c_str(), file_stat.st_size)) {
+    read_timer.set_soinfo(nullptr);
     soinfo_free(si);
     task->set_soinfo(nullptr);
     return false;
@@ -1338,7 +1337,9 @@ static bool load_library(android_namespace_t* ns,
   }
 
   // Open the file.
+  uint64_t open_start_ns = g_linker_profiling ? linker_profile_now() : 0;
   int fd = open_library(ns, zip_archive_cache, name, needed_by, &file_offset, &realpath);
+  uint64_t open_ns = g_linker_profiling ? linker_profile_now() - open_start_ns : 0;
   if (fd == -1) {
     DL_ERR("library \"%s\" not found", name);
     return false;
@@ -1347,21 +1348,27 @@ static bool load_library(android_namespace_t* ns,
   task->set_fd(fd, true);
   task->set_file_offset(file_offset);
 
-  return load_library(ns, task, load_tasks, rtld_flags, realpath, search_linked_namespaces);
+  if (!load_library(ns, task, load_tasks, rtld_flags, realpath, search_linked_namespaces)) {
+    return false;
+  }
+
+  // The soinfo didn't exist yet: the time goes to the library that was found,
+  // even if it turned out to be loaded already.
+  if (g_linker_profiling) {
+    linker_profile_add(task->get_soinfo(), kProfileOpen, open_ns);
+  }
+  return true;
 }
 
 static bool find_loaded_library_by_soname(android_namespace_t* ns,
                                           const char* name,
                                           soinfo** candidate) {
-  return !ns->soinfo_list().visit([&](soinfo* si) {
-    const char* soname = si->get_soname();
-    if (soname != nullptr && (strcmp(name, soname) == 0)) {
-      *candidate = si;
-      return false;
-    }
-
-    return true;
-  });
+  soinfo* si = ns->find_soinfo_by_soname(name);
+  if (si == nullptr) {
+    return false;
+  }
+  *candidate = si;
+  return true;
 }
 
 // Returns true if library was found and false otherwise
@@ -1605,6 +1612,7 @@ bool find_libraries(android_namespace_t* ns,
   shuffle(&load_list);
 
   for (auto&& task : load_list) {
+    LinkerProfileTimer map_timer(task->get_soinfo(), kProfileMap);
     if (!task->load()) {
       return false;
     }
@@ -1706,6 +1714,9 @@ bool find_libraries(android_namespace_t* ns,
     });
 
     failure_guard.Disable();
+    // Before any constructor runs, so that exceptions can unwind through
+    // the new libraries.
+    publish_loaded_objects();
   }
 
   return linked;
@@ -1955,6 +1966,15 @@ void* do_dlopen(const char* name, int flags,
   auto failure_guard = android::base::make_scope_guard(
       [&]() { LD_LOG(kLogDlopen, "... dlopen failed: %s", linker_get_error_buffer()); });
 
+  if (g_linker_profiling) {
+    linker_profile_begin_event();
+  }
+  auto profile_guard = android::base::make_scope_guard([&]() {
+    if (g_linker_profiling) {
+      linker_profile_end_event("dlopen", name);
+    }
+  });
+
   if ((flags & ~(RTLD_NOW|RTLD_LAZY|RTLD_LOCAL|RTLD_GLOBAL|RTLD_NODELETE|RTLD_NOLOAD)) != 0) {
     DL_ERR("invalid flags to dlopen: %x", flags);
     return nullptr;
@@ -2128,7 +2148,13 @@ bool do_dlsym(void* handle,
     uint32_t bind = ELF_ST_BIND(sym->st_info);
 
     if ((bind == STB_GLOBAL || bind == STB_WEAK) && sym->st_shndx != 0) {
-      *symbol = reinterpret_cast<void*>(found->resolve_symbol_address(sym));
+      if (ELF_ST_TYPE(sym->st_info) == STT_TLS) {
+        // The calling thread's copy of the variable.
+        TlsIndex ti = { found->get_tls_module_id(), sym->st_value };
+        *symbol = __tls_get_addr(&ti);
+      } else {
+        *symbol = reinterpret_cast<void*>(found->resolve_symbol_address(sym));
+      }
       failure_guard.Disable();
       LD_LOG(kLogDlsym,
              "... dlsym successful: sym_name=\"%s\", sym_ver=\"%s\", found in=\"%s\", address=%p",
@@ -2486,17 +2512,25 @@ static ElfW(Addr) get_addend(ElfW(Rela)* rela, ElfW(Addr) reloc_addr __unused) {
 }
 #else
 static ElfW(Addr) get_addend(ElfW(Rel)* rel, ElfW(Addr) reloc_addr) {
-  if (ELFW(R_TYPE)(rel->r_info) == R_GENERIC_RELATIVE ||
-      ELFW(R_TYPE)(rel->r_info) == R_GENERIC_IRELATIVE) {
-    return *reinterpret_cast<ElfW(Addr)*>(reloc_addr);
+  switch (ELFW(R_TYPE)(rel->r_info)) {
+    case R_GENERIC_RELATIVE:
+    case R_GENERIC_IRELATIVE:
+    case R_GENERIC_TLS_DTPREL:
+    case R_GENERIC_TLS_TPREL:
+#if defined(__i386__)
+    case R_386_TLS_TPOFF32:
+#endif
+      return *reinterpret_cast<ElfW(Addr)*>(reloc_addr);
+    default:
+      return 0;
   }
-  return 0;
 }
 #endif
 
 template<typename ElfRelIteratorT>
 bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& rel_iterator,
-                      const soinfo_list_t& global_group, const soinfo_list_t& local_group) {
+                      const soinfo_list_t& global_group, const soinfo_list_t& local_group,
+                      RelocationSymbolCache* symbol_cache) {
   for (size_t idx = 0; rel_iterator.has_next(); ++idx) {
     const auto rel = rel_iterator.next();
     if (rel == nullptr) {
@@ -2521,14 +2555,21 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
 
     if (sym != 0) {
       sym_name = get_string(symtab_[sym].st_name);
-      const version_info* vi = nullptr;
 
-      if (!lookup_version_info(version_tracker, sym, sym_name, &vi)) {
-        return false;
-      }
+      if (symbol_cache->find(sym, &lsi, &s)) {
+        count_relocation(kRelocSymbolCached);
+      } else {
+        const version_info* vi = nullptr;
 
-      if (!soinfo_do_lookup(this, sym_name, vi, &lsi, global_group, local_group, &s)) {
-        return false;
+        if (!lookup_version_info(version_tracker, sym, sym_name, &vi)) {
+          return false;
+        }
+
+        LinkerProfileTimer lookup_timer(this, kProfileSymbolLookup);
+        if (!soinfo_do_cached_lookup(this, sym_name, vi, &lsi, global_group, local_group, &s)) {
+          return false;
+        }
+        symbol_cache->insert(sym, lsi, s);
       }
 
       if (s == nullptr) {
@@ -2603,7 +2644,12 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
           }
         }
 #endif
-        sym_addr = lsi->resolve_symbol_address(s);
+        if (ELF_ST_TYPE(s->st_info) == STT_TLS) {
+          // The value of a TLS symbol is its offset in its module's TLS block.
+          sym_addr = s->st_value;
+        } else {
+          sym_addr = lsi->resolve_symbol_address(s);
+        }
 #if !defined(__LP64__)
         if (protect_segments) {
           if (phdr_table_unprotect_segments(phdr, phnum, load_bias) < 0) {
@@ -2677,6 +2723,90 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
         }
         break;
 
+      // With no symbol, a TLS relocation refers to the module itself.
+      case R_GENERIC_TLS_DTPMOD:
+        count_relocation(kRelocAbsolute);
+        MARK(rel->r_offset);
+        {
+          const soinfo* tls_si = (lsi != nullptr) ? lsi : this;
+          size_t module_id = tls_si->get_tls_module_id();
+          if (module_id == 0) {
+            DL_ERR("TLS relocation in \"%s\" refers to \"%s\", which has no TLS segment",
+                   get_realpath(), tls_si->get_realpath());
+            return false;
+          }
+          TRACE_TYPE(RELO, "RELO TLS_DTPMOD %16p <- %zu %s\n",
+                     reinterpret_cast<void*>(reloc), module_id, sym_name);
+          *reinterpret_cast<ElfW(Addr)*>(reloc) = module_id;
+        }
+        break;
+      case R_GENERIC_TLS_DTPREL:
+        count_relocation(kRelocRelative);
+        MARK(rel->r_offset);
+        TRACE_TYPE(RELO, "RELO TLS_DTPREL %16p <- %16p %s\n",
+                   reinterpret_cast<void*>(reloc),
+                   reinterpret_cast<void*>(sym_addr + addend), sym_name);
+        *reinterpret_cast<ElfW(Addr)*>(reloc) = sym_addr + addend;
+        break;
+      case R_GENERIC_TLS_TPREL:
+#if defined(__i386__)
+      case R_386_TLS_TPOFF32:
+#endif
+        count_relocation(kRelocRelative);
+        MARK(rel->r_offset);
+        {
+          const soinfo* tls_si = (lsi != nullptr) ? lsi : this;
+          ptrdiff_t tp_offset;
+          if (!tls_si->get_tls_static_offset(&tp_offset)) {
+            DL_ERR("\"%s\" uses the initial-exec TLS model to access TLS in \"%s\", which "
+                   "has no static TLS (was it loaded with dlopen?)",
+                   get_realpath(), tls_si->get_realpath());
+            return false;
+          }
+          ElfW(Addr) value = tp_offset + sym_addr + addend;
+#if defined(__i386__)
+          // R_386_TLS_TPOFF32 wants the offset negated, but not the addend.
+          if (type == R_386_TLS_TPOFF32) {
+            value = addend - (tp_offset + sym_addr);
+          }
+#endif
+          TRACE_TYPE(RELO, "RELO TLS_TPREL %16p <- %16p %s\n",
+                     reinterpret_cast<void*>(reloc), reinterpret_cast<void*>(value), sym_name);
+          *reinterpret_cast<ElfW(Addr)*>(reloc) = value;
+        }
+        break;
+#if defined(R_GENERIC_TLSDESC)
+      case R_GENERIC_TLSDESC:
+        count_relocation(kRelocRelative);
+        MARK(rel->r_offset);
+        {
+          const soinfo* tls_si = (lsi != nullptr) ? lsi : this;
+          ElfW(Addr)* desc = reinterpret_cast<ElfW(Addr)*>(reloc);
+          ptrdiff_t tp_offset;
+          if (tls_si->get_tls_static_offset(&tp_offset)) {
+            desc[0] = reinterpret_cast<ElfW(Addr)>(tlsdesc_resolver_static);
+            desc[1] = tp_offset + sym_addr + addend;
+          } else {
+            if (tls_si->get_tls_module_id() == 0) {
+              DL_ERR("TLS relocation in \"%s\" refers to \"%s\", which has no TLS segment",
+                     get_realpath(), tls_si->get_realpath());
+              return false;
+            }
+            TlsDynamicResolverArg* arg = new TlsDynamicResolverArg;
+            arg->index.module_id = tls_si->get_tls_module_id();
+            arg->index.offset = sym_addr + addend;
+            arg->generation = __bionic_tls_generation();
+            tlsdesc_args_.emplace_back(arg);
+            desc[0] = reinterpret_cast<ElfW(Addr)>(tlsdesc_resolver_dynamic);
+            desc[1] = reinterpret_cast<ElfW(Addr)>(arg);
+          }
+          TRACE_TYPE(RELO, "RELO TLSDESC %16p <- %16p, %16p %s\n",
+                     reinterpret_cast<void*>(reloc), reinterpret_cast<void*>(desc[0]),
+                     reinterpret_cast<void*>(desc[1]), sym_name);
+        }
+        break;
+#endif
+
 #if defined(__aarch64__)
       case R_AARCH64_ABS64:
         count_relocation(kRelocAbsolute);
@@ -2777,14 +2907,6 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
          */
         DL_ERR("%s R_AARCH64_COPY relocations are not supported", get_realpath());
         return false;
-      case R_AARCH64_TLS_TPREL64:
-        TRACE_TYPE(RELO, "RELO TLS_TPREL64 *** %16llx <- %16llx - %16llx\n",
-                   reloc, (sym_addr + addend), rel->r_offset);
-        break;
-      case R_AARCH64_TLS_DTPREL32:
-        TRACE_TYPE(RELO, "RELO TLS_DTPREL32 *** %16llx <- %16llx - %16llx\n",
-                   reloc, (sym_addr + addend), rel->r_offset);
-        break;
 #elif defined(__x86_64__)
       case R_X86_64_32:
         count_relocation(kRelocRelative);
@@ -2848,6 +2970,9 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
                    reloc, (sym_addr - reloc), sym_addr, reloc, sym_name);
         *reinterpret_cast<ElfW(Addr)*>(reloc) += (sym_addr - reloc);
         break;
+      case R_386_TLS_DESC:
+        DL_ERR("\"%s\" uses TLSDESC relocations, which aren't supported on x86", get_realpath());
+        return false;
 #endif
       default:
         DL_ERR("unknown reloc type %d @ %p (%zu)", type, rel, idx);
@@ -2862,6 +2987,8 @@ bool soinfo::relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& r
 static soinfo_list_t g_empty_list;
 
 bool soinfo::prelink_image() {
+  LinkerProfileTimer prelink_timer(this, kProfilePrelink);
+
   /* Extract dynamic section */
   ElfW(Word) dynamic_flags = 0;
   phdr_table_get_dynamic_section(phdr, phnum, load_bias, &dynamic, &dynamic_flags);
@@ -3096,6 +3223,24 @@ bool soinfo::prelink_image() {
         return false;
 
 #endif
+      case DT_RELR:
+      case DT_ANDROID_RELR:
+        relr_ = reinterpret_cast<ElfW(Relr)*>(load_bias + d->d_un.d_ptr);
+        break;
+
+      case DT_RELRSZ:
+      case DT_ANDROID_RELRSZ:
+        relr_count_ = d->d_un.d_val / sizeof(ElfW(Relr));
+        break;
+
+      case DT_RELRENT:
+      case DT_ANDROID_RELRENT:
+        if (d->d_un.d_val != sizeof(ElfW(Relr))) {
+          DL_ERR("invalid DT_RELRENT: %zd", static_cast<size_t>(d->d_un.d_val));
+          return false;
+        }
+        break;
+
       case DT_INIT:
         init_func_ = reinterpret_cast<linker_ctor_function_t>(load_bias + d->d_un.d_ptr);
         DEBUG("%s constructors (DT_INIT) found at %p", get_realpath(), init_func_);
@@ -3210,6 +3355,11 @@ bool soinfo::prelink_image() {
       case DT_BIND_NOW:
         break;
 
+      // Ignored: these are for resolving TLSDESC relocations lazily.
+      case DT_TLSDESC_GOT:
+      case DT_TLSDESC_PLT:
+        break;
+
       case DT_VERSYM:
         versym_ = reinterpret_cast<ElfW(Versym)*>(load_bias + d->d_un.d_ptr);
         break;
@@ -3282,6 +3432,20 @@ bool soinfo::prelink_image() {
     }
   }
 
+  // Register the TLS segment, which gets static TLS if this is part of the
+  // initial load.
+  TlsSegment tls_segment;
+  if (!relocating_linker && tls_module_id_ == 0 &&
+      __bionic_get_tls_segment(phdr, phnum, load_bias, &tls_segment)) {
+    const char* error = nullptr;
+    tls_module_id_ = __bionic_tls_register_module(tls_segment, is_main_executable(), &error);
+    if (tls_module_id_ == 0) {
+      DL_ERR("can't use the TLS segment of \"%s\": %s", get_realpath(), error);
+      return false;
+    }
+    tls_is_static_ = __bionic_tls_get_static_offset(tls_module_id_, &tls_static_offset_);
+  }
+
   // Before M release linker was using basename in place of soname.
   // In the case when dt_soname is absent some apps stop working
   // because they can't find dt_needed library by soname.
@@ -3292,7 +3456,7 @@ bool soinfo::prelink_image() {
       this != solist_get_somain() &&
       (flags_ & FLAG_LINKER) == 0 &&
       get_application_target_sdk_version() < __ANDROID_API_M__) {
-    soname_ = basename(realpath_.c_str());
+    set_soname(basename(realpath_.c_str()));
     DL_WARN("%s: is missing DT_SONAME will use basename as a replacement: \"%s\"",
         get_realpath(), soname_);
     // Don't call add_dlwarning because a missing DT_SONAME isn't important enough to show in the UI
@@ -3302,6 +3466,7 @@ bool soinfo::prelink_image() {
 
 bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t& local_group,
                         const android_dlextinfo* extinfo) {
+  LinkerProfileTimer link_timer(this, kProfileLink);
 
   local_group_root_ = local_group.front();
   if (local_group_root_ == nullptr) {
@@ -3318,6 +3483,8 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
     return false;
   }
 
+  RelocationSymbolCache symbol_cache;
+
 #if !defined(__LP64__)
   if (has_text_relocations) {
     // Fail if app is targeting M or above.
@@ -3341,6 +3508,17 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
   }
 #endif
 
+  // Relative relocations don't need symbol lookup, so get them out of the way
+  // first, in bulk.
+  if (relr_ != nullptr) {
+    DEBUG("[ relocating %s relr ]", get_realpath());
+    if (!relocate_relr(relr_, relr_ + relr_count_, load_bias)) {
+      DL_ERR("\"%s\" has invalid RELR relocations: the first entry is a bitmap",
+             get_realpath());
+      return false;
+    }
+  }
+
   if (android_relocs_ != nullptr) {
     // check signature
     if (android_relocs_size_ > 3 &&
@@ -3358,7 +3536,7 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
           version_tracker,
           packed_reloc_iterator<sleb128_decoder>(
             sleb128_decoder(packed_relocs, packed_relocs_size)),
-          global_group, local_group);
+          global_group, local_group, &symbol_cache);
 
       if (!relocated) {
         return false;
@@ -3373,14 +3551,16 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
   if (rela_ != nullptr) {
     DEBUG("[ relocating %s ]", get_realpath());
     if (!relocate(version_tracker,
-            plain_reloc_iterator(rela_, rela_count_), global_group, local_group)) {
+            plain_reloc_iterator(rela_, rela_count_), global_group, local_group,
+            &symbol_cache)) {
       return false;
     }
   }
   if (plt_rela_ != nullptr) {
     DEBUG("[ relocating %s plt ]", get_realpath());
     if (!relocate(version_tracker,
-            plain_reloc_iterator(plt_rela_, plt_rela_count_), global_group, local_group)) {
+            plain_reloc_iterator(plt_rela_, plt_rela_count_), global_group, local_group,
+            &symbol_cache)) {
       return false;
     }
   }
@@ -3388,14 +3568,16 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
   if (rel_ != nullptr) {
     DEBUG("[ relocating %s ]", get_realpath());
     if (!relocate(version_tracker,
-            plain_reloc_iterator(rel_, rel_count_), global_group, local_group)) {
+            plain_reloc_iterator(rel_, rel_count_), global_group, local_group,
+            &symbol_cache)) {
       return false;
     }
   }
   if (plt_rel_ != nullptr) {
     DEBUG("[ relocating %s plt ]", get_realpath());
     if (!relocate(version_tracker,
-            plain_reloc_iterator(plt_rel_, plt_rel_count_), global_group, local_group)) {
+            plain_reloc_iterator(plt_rel_, plt_rel_count_), global_group, local_group,
+            &symbol_cache)) {
       return false;
     }
   }
@@ -3441,6 +3623,8 @@ bool soinfo::link_image(const soinfo_list_t& global_group, const soinfo_list_t&
              get_realpath(), strerror(errno));
       return false;
     }
+  } else if (!is_linker()) {
+    relro_cache_share(this, extinfo);
   }
 
   notify_gdb_of_load(this);
@@ -3565,7 +3749,7 @@ std::vector<android_namespace_t*> init_default_namespaces(const char* executable
       auto it_to = namespaces.find(ns_link.ns_name());
       CHECK(it_to != namespaces.end());
       android_namespace_t* namespace_to = it_to->second;
-      link_namespaces(namespace_from, namespace_to, ns_link.shared_libs().c_str());
+      link_namespaces(namespace_from, namespace_to, ns_link.shared_libs());
     }
   }
   // we can no longer rely on the fact that libdl.so is part of default namespace
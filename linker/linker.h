@@ -89,12 +89,17 @@ class VersionTracker {
 bool soinfo_do_lookup(soinfo* si_from, const char* name, const version_info* vi,
                       soinfo** si_found_in, const soinfo_list_t& global_group,
                       const soinfo_list_t& local_group, const ElfW(Sym)** symbol);
+bool soinfo_do_lookup(soinfo* si_from, SymbolName& symbol_name, const version_info* vi,
+                      soinfo** si_found_in, const soinfo_list_t& global_group,
+                      const soinfo_list_t& local_group, const ElfW(Sym)** symbol);
 
 enum RelocationKind {
   kRelocAbsolute = 0,
   kRelocRelative,
   kRelocCopy,
   kRelocSymbol,
+  kRelocSymbolCached,       // Symbol relocations that reused the object's own earlier lookup.
+  kRelocSymbolGlobalCached, // Symbol relocations resolved from the global group's cache.
   kRelocMax
 };
 
@@ -38,8 +38,13 @@
 
 #include <async_safe/log.h>
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <string>
 #include <unordered_map>
 
@@ -156,220 +161,685 @@ static std::string create_error_msg(const char* file,
   return std::string(buf);
 }
 
-static bool parse_config_file(const char* ld_config_file_path,
-                              const char* binary_realpath,
-                              std::unordered_map<std::string, PropertyValue>* properties,
-                              std::string* error_msg) {
-  std::string content;
-  if (!android::base::ReadFileToString(ld_config_file_path, &content)) {
-    if (errno != ENOENT) {
-      *error_msg = std::string("error reading file \"") +
-                   ld_config_file_path + "\": " + strerror(errno);
-    }
-    return false;
-  }
+static constexpr const char* kDefaultConfigName = "default";
+static constexpr const char* kPropertyAdditionalNamespaces = "additional.namespaces";
+#if defined(__LP64__)
+static constexpr const char* kLibParamValue = "lib64";
+#else
+static constexpr const char* kLibParamValue = "lib";
+#endif
 
-  ConfigParser cp(std::move(content));
+class Properties {
+ public:
+  explicit Properties(std::unordered_map<std::string, PropertyValue>&& properties)
+      : properties_(properties) {}
 
-  std::string section_name;
+  std::vector<std::string> get_strings(const std::string& name, size_t* lineno = nullptr) const {
+    auto it = find_property(name, lineno);
+    if (it == properties_.end()) {
+      // return empty vector
+      return std::vector<std::string>();
+    }
 
-  while(true) {
-    std::string name;
-    std::string value;
-    std::string error;
+    std::vector<std::string> strings = android::base::Split(it->second.value(), ",");
 
-    int result = cp.next_token(&name, &value, &error);
-    if (result == ConfigParser::kError) {
-      DL_WARN("error parsing %s:%zd: %s (ignoring this line)",
-              ld_config_file_path,
-              cp.lineno(),
-              error.c_str());
-      continue;
+    for (size_t i = 0; i < strings.size(); ++i) {
+      strings[i] = android::base::Trim(strings[i]);
     }
 
-    if (result == ConfigParser::kSection || result == ConfigParser::kEndOfFile) {
+    return strings;
+  }
+
+  bool get_bool(const std::string& name, size_t* lineno = nullptr) const {
+    auto it = find_property(name, lineno);
+    if (it == properties_.end()) {
       return false;
     }
 
-    if (result == ConfigParser::kProperty) {
+    return it->second.value() == "true";
+  }
+
+  std::string get_string(const std::string& name, size_t* lineno = nullptr) const {
+    auto it = find_property(name, lineno);
+    return (it == properties_.end()) ? "" : it->second.value();
+  }
+
+ private:
+  std::unordered_map<std::string, PropertyValue>::const_iterator
+  find_property(const std::string& name, size_t* lineno) const {
+    auto it = properties_.find(name);
+    if (it != properties_.end() && lineno != nullptr) {
+      *lineno = it->second.lineno();
+    }
+
+    return it;
+  }
+  std::unordered_map<std::string, PropertyValue> properties_;
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(Properties);
+};
+
+// The compiled form of a config file holds, for each of its sections, what
+// read_binary_config() makes of it short of reading the .version file and
+// formatting and resolving paths: the namespaces with their flags, links and
+// unformatted paths, the warnings to print, and the error to fail with if
+// the section is invalid. The dir.<section> properties that precede the
+// first section come first, with trailing '/' removed. Strings are offsets
+// into a pool of NUL-terminated strings.
+//
+// When there is no up to date compiled form, read_binary_config() compiles
+// the text file in memory, so that the config is read from one image either
+// way, and points into it rather than copying strings out of it.
+static constexpr uint32_t kCompiledConfigMagic = 0x464e434c; // "LCNF"
+static constexpr uint32_t kCompiledConfigVersion = 2;
+static constexpr uint32_t kNoString = UINT32_MAX;
+
+struct CompiledConfigHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_size;
+  uint32_t line_count;
+  uint32_t dir_count;
+  uint32_t dirs_offset;
+  uint32_t section_count;
+  uint32_t sections_offset;
+  uint32_t namespace_count;
+  uint32_t namespaces_offset;
+  uint32_t link_count;
+  uint32_t links_offset;
+  uint32_t warning_count;
+  uint32_t warnings_offset;
+  // The first warnings are about the dir.<section> properties.
+  uint32_t preamble_warning_count;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+  uint32_t reserved;
+};
+
+struct CompiledConfigDir {
+  uint32_t section_name;
+  uint32_t path;
+};
+
+enum : uint32_t {
+  kSectionTargetSdkVersion = 1,
+};
+
+struct CompiledConfigSection {
+  uint32_t name;
+  uint32_t flags;
+  // The first namespace is the default one.
+  uint32_t first_namespace;
+  uint32_t namespace_count;
+  uint32_t first_warning;
+  uint32_t warning_count;
+  uint32_t error_lineno;
+  uint32_t error;
+};
+
+enum : uint32_t {
+  kNamespaceIsolated = 1,
+  kNamespaceVisible = 2,
+};
+
+struct CompiledConfigNamespace {
+  uint32_t name;
+  uint32_t flags;
+  uint32_t first_link;
+  uint32_t link_count;
+  // Indexed by is_asan.
+  uint32_t search_paths[2];
+  uint32_t permitted_paths[2];
+};
+
+struct CompiledConfigLink {
+  uint32_t ns_name;
+  uint32_t shared_libs;
+};
+
+enum : uint32_t {
+  kWarningParseError,
+  kWarningUnexpectedName,
+  kWarningEmptyValue,
+  kWarningRedefinition,
+};
+
+struct CompiledConfigWarning {
+  uint32_t kind;
+  uint32_t lineno;
+  uint32_t arg;
+};
+
+static std::string compiled_config_path(const char* ld_config_file_path) {
+  std::string path = ld_config_file_path;
+  if (android::base::EndsWith(path, ".txt")) {
+    path.resize(path.size() - 4);
+  }
+  return path + ".bin";
+}
+
+// Tokenizes the whole text file and lays out what every section of it makes,
+// as described above.
+class ConfigCompiler {
+ public:
+  ConfigCompiler() : preamble_warning_count_(0) {}
+
+  void compile(std::string&& content, std::string* image) {
+    CompiledConfigHeader header = {};
+    header.magic = kCompiledConfigMagic;
+    header.version = kCompiledConfigVersion;
+    header.source_size = content.size();
+
+    ConfigParser cp(std::move(content));
+    // The properties of the current section, if any.
+    std::unordered_map<std::string, PropertyValue> properties;
+
+    while (true) {
+      std::string name;
+      std::string value;
+      std::string error;
+
+      int result = cp.next_token(&name, &value, &error);
+      if (result == ConfigParser::kEndOfFile) {
+        break;
+      }
+
+      if (result == ConfigParser::kError) {
+        add_warning(kWarningParseError, cp.lineno(), error);
+        continue;
+      }
+
+      if (result == ConfigParser::kSection) {
+        if (sections_.empty()) {
+          preamble_warning_count_ = warnings_.size();
+        } else {
+          compile_section(&sections_.back(), std::move(properties));
+          properties.clear();
+        }
+        CompiledConfigSection section = {};
+        section.name = add_string(name);
+        section.first_warning = warnings_.size();
+        section.error = kNoString;
+        sections_.push_back(section);
+        continue;
+      }
+
+      if (!sections_.empty()) {
+        if (properties.find(name) != properties.end()) {
+          add_warning(kWarningRedefinition, cp.lineno(), name);
+        }
+        properties[name] = PropertyValue(std::move(value), cp.lineno());
+        continue;
+      }
+
       if (!android::base::StartsWith(name, "dir.")) {
-        DL_WARN("error parsing %s:%zd: unexpected property name \"%s\", "
-                "expected format dir.<section_name> (ignoring this line)",
-                ld_config_file_path,
-                cp.lineno(),
-                name.c_str());
+        add_warning(kWarningUnexpectedName, cp.lineno(), name);
         continue;
       }
 
       // remove trailing '/'
-      while (value[value.size() - 1] == '/') {
+      while (!value.empty() && value[value.size() - 1] == '/') {
         value = value.substr(0, value.size() - 1);
       }
 
       if (value.empty()) {
-        DL_WARN("error parsing %s:%zd: property value is empty (ignoring this line)",
-                ld_config_file_path,
-                cp.lineno());
+        add_warning(kWarningEmptyValue, cp.lineno(), "");
         continue;
       }
 
-      if (file_is_under_dir(binary_realpath, value)) {
-        section_name = name.substr(4);
-        break;
-      }
+      CompiledConfigDir dir;
+      dir.section_name = add_string(name.substr(4));
+      dir.path = add_string(value);
+      dirs_.push_back(dir);
     }
-  }
 
-  // skip everything until we meet a correct section
-  while (true) {
-    std::string name;
-    std::string value;
-    std::string error;
+    if (sections_.empty()) {
+      preamble_warning_count_ = warnings_.size();
+    } else {
+      compile_section(&sections_.back(), std::move(properties));
+    }
 
-    int result = cp.next_token(&name, &value, &error);
+    header.line_count = cp.lineno();
+    header.preamble_warning_count = preamble_warning_count_;
+    // The string pool is never empty, so that it can be checked for a final NUL.
+    add_string("");
+
+    auto append_table = [image](const void* data, size_t size) {
+      uint32_t offset = image->size();
+      image->append(reinterpret_cast<const char*>(data), size);
+      return offset;
+    };
+
+    image->assign(sizeof(header), '\0');
+    header.dir_count = dirs_.size();
+    header.dirs_offset = append_table(dirs_.data(), dirs_.size() * sizeof(CompiledConfigDir));
+    header.section_count = sections_.size();
+    header.sections_offset =
+        append_table(sections_.data(), sections_.size() * sizeof(CompiledConfigSection));
+    header.namespace_count = namespaces_.size();
+    header.namespaces_offset =
+        append_table(namespaces_.data(), namespaces_.size() * sizeof(CompiledConfigNamespace));
+    header.link_count = links_.size();
+    header.links_offset = append_table(links_.data(), links_.size() * sizeof(CompiledConfigLink));
+    header.warning_count = warnings_.size();
+    header.warnings_offset =
+        append_table(warnings_.data(), warnings_.size() * sizeof(CompiledConfigWarning));
+    header.strings_size = strings_.size();
+    header.strings_offset = append_table(strings_.data(), strings_.size());
+    memcpy(&(*image)[0], &header, sizeof(header));
+  }
 
-    if (result == ConfigParser::kSection && name == section_name) {
-      break;
+ private:
+  uint32_t add_string(const std::string& s) {
+    auto it = string_offsets_.find(s);
+    if (it != string_offsets_.end()) {
+      return it->second;
     }
+    uint32_t offset = strings_.size();
+    strings_.append(s.c_str(), s.size() + 1);
+    string_offsets_[s] = offset;
+    return offset;
+  }
 
-    if (result == ConfigParser::kEndOfFile) {
-      *error_msg = create_error_msg(ld_config_file_path,
-                                    cp.lineno(),
-                                    std::string("section \"") + section_name + "\" not found");
-      return false;
-    }
+  void add_warning(uint32_t kind, size_t lineno, const std::string& arg) {
+    CompiledConfigWarning warning;
+    warning.kind = kind;
+    warning.lineno = lineno;
+    warning.arg = add_string(arg);
+    warnings_.push_back(warning);
   }
 
-  // found the section - parse it
-  while (true) {
-    std::string name;
-    std::string value;
-    std::string error;
+  // Does what read_binary_config() would with the properties of a section,
+  // up to the first error.
+  void compile_section(CompiledConfigSection* section,
+                       std::unordered_map<std::string, PropertyValue>&& property_map) {
+    section->warning_count = warnings_.size() - section->first_warning;
+    section->first_namespace = namespaces_.size();
 
-    int result = cp.next_token(&name, &value, &error);
+    Properties properties(std::move(property_map));
 
-    if (result == ConfigParser::kEndOfFile || result == ConfigParser::kSection) {
-      break;
+    if (properties.get_bool("enable.target.sdk.version")) {
+      section->flags |= kSectionTargetSdkVersion;
     }
 
-    if (result == ConfigParser::kProperty) {
-      if (properties->find(name) != properties->end()) {
-        DL_WARN("%s:%zd: warning: property \"%s\" redefinition",
-                ld_config_file_path,
-                cp.lineno(),
-                name.c_str());
+    std::vector<std::string> names = { kDefaultConfigName };
+    for (const auto& name : properties.get_strings(kPropertyAdditionalNamespaces)) {
+      if (std::find(names.begin(), names.end(), name) == names.end()) {
+        names.push_back(name);
       }
-
-      (*properties)[name] = PropertyValue(std::move(value), cp.lineno());
     }
 
-    if (result == ConfigParser::kError) {
-      DL_WARN("error parsing %s:%zd: %s (ignoring this line)",
-              ld_config_file_path,
-              cp.lineno(),
-              error.c_str());
-      continue;
+    for (const auto& name : names) {
+      std::string property_name_prefix = std::string("namespace.") + name;
+
+      CompiledConfigNamespace ns;
+      ns.name = add_string(name);
+      ns.flags = 0;
+      if (properties.get_bool(property_name_prefix + ".isolated")) {
+        ns.flags |= kNamespaceIsolated;
+      }
+      if (properties.get_bool(property_name_prefix + ".visible")) {
+        ns.flags |= kNamespaceVisible;
+      }
+
+      size_t lineno = 0;
+      std::vector<std::string> linked_namespaces =
+          properties.get_strings(property_name_prefix + ".links", &lineno);
+
+      ns.first_link = links_.size();
+      for (const auto& linked_ns_name : linked_namespaces) {
+        if (std::find(names.begin(), names.end(), linked_ns_name) == names.end()) {
+          set_error(section, lineno, std::string("undefined namespace: ") + linked_ns_name);
+          return;
+        }
+
+        std::string shared_libs = properties.get_string(property_name_prefix +
+                                                        ".link." +
+                                                        linked_ns_name +
+                                                        ".shared_libs", &lineno);
+
+        if (shared_libs.empty()) {
+          set_error(section,
+                    lineno,
+                    std::string("list of shared_libs for ") +
+                    name +
+                    "->" +
+                    linked_ns_name +
+                    " link is not specified or is empty.");
+          return;
+        }
+
+        CompiledConfigLink link;
+        link.ns_name = add_string(linked_ns_name);
+        link.shared_libs = add_string(shared_libs);
+        links_.push_back(link);
+      }
+      ns.link_count = links_.size() - ns.first_link;
+
+      // these are affected by is_asan flag
+      ns.search_paths[0] = add_string(properties.get_string(property_name_prefix + ".search.paths"));
+      ns.search_paths[1] =
+          add_string(properties.get_string(property_name_prefix + ".asan.search.paths"));
+      ns.permitted_paths[0] =
+          add_string(properties.get_string(property_name_prefix + ".permitted.paths"));
+      ns.permitted_paths[1] =
+          add_string(properties.get_string(property_name_prefix + ".asan.permitted.paths"));
+
+      namespaces_.push_back(ns);
+      section->namespace_count++;
     }
   }
 
-  return true;
-}
+  void set_error(CompiledConfigSection* section, size_t lineno, const std::string& msg) {
+    section->error_lineno = lineno;
+    section->error = add_string(msg);
+  }
 
-static Config g_config;
+  std::vector<CompiledConfigDir> dirs_;
+  std::vector<CompiledConfigSection> sections_;
+  std::vector<CompiledConfigNamespace> namespaces_;
+  std::vector<CompiledConfigLink> links_;
+  std::vector<CompiledConfigWarning> warnings_;
+  uint32_t preamble_warning_count_;
+  std::string strings_;
+  std::unordered_map<std::string, uint32_t> string_offsets_;
 
-static constexpr const char* kDefaultConfigName = "default";
-static constexpr const char* kPropertyAdditionalNamespaces = "additional.namespaces";
-#if defined(__LP64__)
-static constexpr const char* kLibParamValue = "lib64";
-#else
-static constexpr const char* kLibParamValue = "lib";
-#endif
+  DISALLOW_COPY_AND_ASSIGN(ConfigCompiler);
+};
 
-class Properties {
+// A compiled config, either mapped from the .bin file or compiled from the
+// text file in memory.
+class CompiledConfig {
  public:
-  explicit Properties(std::unordered_map<std::string, PropertyValue>&& properties)
-      : properties_(properties), target_sdk_version_(__ANDROID_API__) {}
+  CompiledConfig() : map_(nullptr), data_(nullptr), size_(0) {}
 
-  std::vector<std::string> get_strings(const std::string& name, size_t* lineno = nullptr) const {
-    auto it = find_property(name, lineno);
-    if (it == properties_.end()) {
-      // return empty vector
-      return std::vector<std::string>();
+  ~CompiledConfig() {
+    if (map_ != nullptr) {
+      munmap(map_, size_);
     }
+  }
 
-    std::vector<std::string> strings = android::base::Split(it->second.value(), ",");
+  // Maps the compiled form of ld_config_file_path if it exists and is up to
+  // date: if it was compiled from a file of the size of the text file, and
+  // is no older than it. Image builds give every file the same mtime, and
+  // editing the text file on a device makes it the newer one.
+  bool map(const char* ld_config_file_path) {
+    struct stat source_st;
+    if (stat(ld_config_file_path, &source_st) == -1) {
+      return false;
+    }
 
-    for (size_t i = 0; i < strings.size(); ++i) {
-      strings[i] = android::base::Trim(strings[i]);
+    std::string path = compiled_config_path(ld_config_file_path);
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd == -1) {
+      return false;
     }
 
-    return strings;
-  }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(CompiledConfigHeader) ||
+        st.st_mtim.tv_sec < source_st.st_mtim.tv_sec ||
+        (st.st_mtim.tv_sec == source_st.st_mtim.tv_sec &&
+         st.st_mtim.tv_nsec < source_st.st_mtim.tv_nsec)) {
+      close(fd);
+      return false;
+    }
 
-  bool get_bool(const std::string& name, size_t* lineno = nullptr) const {
-    auto it = find_property(name, lineno);
-    if (it == properties_.end()) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
       return false;
     }
 
-    return it->second.value() == "true";
-  }
+    map_ = map;
+    data_ = reinterpret_cast<const char*>(map);
+    size_ = st.st_size;
 
-  std::string get_string(const std::string& name, size_t* lineno = nullptr) const {
-    auto it = find_property(name, lineno);
-    return (it == properties_.end()) ? "" : it->second.value();
+    return check_layout() && header()->source_size == static_cast<uint64_t>(source_st.st_size);
   }
 
-  std::vector<std::string> get_paths(const std::string& name, bool resolve, size_t* lineno = nullptr) {
-    std::string paths_str = get_string(name, lineno);
+  // Compiles the text file instead.
+  bool compile(const char* ld_config_file_path, std::string* error_msg) {
+    std::string content;
+    if (!android::base::ReadFileToString(ld_config_file_path, &content)) {
+      if (errno != ENOENT) {
+        *error_msg = std::string("error reading file \"") +
+                     ld_config_file_path + "\": " + strerror(errno);
+      }
+      return false;
+    }
+
+    ConfigCompiler().compile(std::move(content), &buffer_);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+  }
 
-    std::vector<std::string> paths;
-    split_path(paths_str.c_str(), ":", &paths);
+  // Returns the section for binary_realpath, having printed the warnings
+  // that apply to it, or nullptr if there is none or it is invalid.
+  const CompiledConfigSection* find_section(const char* ld_config_file_path,
+                                            const char* binary_realpath,
+                                            std::string* error_msg) const {
+    warn(ld_config_file_path, 0, header()->preamble_warning_count);
+
+    const char* section_name = nullptr;
+    for (uint32_t i = 0; i < header()->dir_count; ++i) {
+      const CompiledConfigDir& dir = dirs()[i];
+      if (file_is_under_dir(binary_realpath, string_at(dir.path))) {
+        section_name = string_at(dir.section_name);
+        break;
+      }
+    }
 
-    std::vector<std::pair<std::string, std::string>> params;
-    params.push_back({ "LIB", kLibParamValue });
-    if (target_sdk_version_ != 0) {
-      char buf[16];
-      async_safe_format_buffer(buf, sizeof(buf), "%d", target_sdk_version_);
-      params.push_back({ "SDK_VER", buf });
+    if (section_name == nullptr) {
+      return nullptr;
     }
 
-    for (auto&& path : paths) {
-      format_string(&path, params);
+    for (uint32_t i = 0; i < header()->section_count; ++i) {
+      const CompiledConfigSection& section = sections()[i];
+      if (strcmp(string_at(section.name), section_name) != 0) {
+        continue;
+      }
+
+      warn(ld_config_file_path, section.first_warning, section.warning_count);
+      if (section.error != kNoString) {
+        *error_msg = create_error_msg(ld_config_file_path,
+                                      section.error_lineno,
+                                      string_at(section.error));
+        return nullptr;
+      }
+      return &section;
     }
 
-    if (resolve) {
-      std::vector<std::string> resolved_paths;
+    *error_msg = create_error_msg(ld_config_file_path,
+                                  header()->line_count,
+                                  std::string("section \"") + section_name + "\" not found");
+    return nullptr;
+  }
 
-      // do not remove paths that do not exist
-      resolve_paths(paths, &resolved_paths);
+  const CompiledConfigNamespace* namespaces() const {
+    return table_at<CompiledConfigNamespace>(header()->namespaces_offset);
+  }
 
-      return resolved_paths;
-    } else {
-      return paths;
-    }
+  const CompiledConfigLink* links() const {
+    return table_at<CompiledConfigLink>(header()->links_offset);
   }
 
-  void set_target_sdk_version(int target_sdk_version) {
-    target_sdk_version_ = target_sdk_version;
+  const char* string_at(uint32_t offset) const {
+    return table_at<char>(header()->strings_offset) + offset;
   }
 
  private:
-  std::unordered_map<std::string, PropertyValue>::const_iterator
-  find_property(const std::string& name, size_t* lineno) const {
-    auto it = properties_.find(name);
-    if (it != properties_.end() && lineno != nullptr) {
-      *lineno = it->second.lineno();
+  const CompiledConfigHeader* header() const {
+    return reinterpret_cast<const CompiledConfigHeader*>(data_);
+  }
+
+  template <typename T>
+  const T* table_at(uint32_t offset) const {
+    return reinterpret_cast<const T*>(data_ + offset);
+  }
+
+  const CompiledConfigDir* dirs() const {
+    return table_at<CompiledConfigDir>(header()->dirs_offset);
+  }
+
+  const CompiledConfigSection* sections() const {
+    return table_at<CompiledConfigSection>(header()->sections_offset);
+  }
+
+  const CompiledConfigWarning* warnings() const {
+    return table_at<CompiledConfigWarning>(header()->warnings_offset);
+  }
+
+  void warn(const char* ld_config_file_path, uint32_t first, uint32_t count) const {
+    for (uint32_t i = first; i < first + count; ++i) {
+      const CompiledConfigWarning& warning = warnings()[i];
+      const char* arg = string_at(warning.arg);
+      switch (warning.kind) {
+        case kWarningParseError:
+          DL_WARN("error parsing %s:%u: %s (ignoring this line)",
+                  ld_config_file_path,
+                  warning.lineno,
+                  arg);
+          break;
+        case kWarningUnexpectedName:
+          DL_WARN("error parsing %s:%u: unexpected property name \"%s\", "
+                  "expected format dir.<section_name> (ignoring this line)",
+                  ld_config_file_path,
+                  warning.lineno,
+                  arg);
+          break;
+        case kWarningEmptyValue:
+          DL_WARN("error parsing %s:%u: property value is empty (ignoring this line)",
+                  ld_config_file_path,
+                  warning.lineno);
+          break;
+        case kWarningRedefinition:
+          DL_WARN("%s:%u: warning: property \"%s\" redefinition",
+                  ld_config_file_path,
+                  warning.lineno,
+                  arg);
+          break;
+      }
     }
+  }
 
-    return it;
+  bool check_table(uint32_t offset, uint32_t count, size_t entry_size, size_t alignment) const {
+    return offset % alignment == 0 && offset <= size_ && count <= (size_ - offset) / entry_size;
   }
-  std::unordered_map<std::string, PropertyValue> properties_;
-  int target_sdk_version_;
 
-  DISALLOW_IMPLICIT_CONSTRUCTORS(Properties);
+  bool check_range(uint32_t first, uint32_t count, uint32_t total) const {
+    return first <= total && count <= total - first;
+  }
+
+  // Makes sure that no offset in the file points outside of it, so that
+  // a truncated or corrupt file is rejected rather than read past its end.
+  bool check_layout() const {
+    const CompiledConfigHeader* h = header();
+    if (h->magic != kCompiledConfigMagic || h->version != kCompiledConfigVersion) {
+      return false;
+    }
+
+    if (!check_table(h->dirs_offset, h->dir_count,
+                     sizeof(CompiledConfigDir), alignof(CompiledConfigDir)) ||
+        !check_table(h->sections_offset, h->section_count,
+                     sizeof(CompiledConfigSection), alignof(CompiledConfigSection)) ||
+        !check_table(h->namespaces_offset, h->namespace_count,
+                     sizeof(CompiledConfigNamespace), alignof(CompiledConfigNamespace)) ||
+        !check_table(h->links_offset, h->link_count,
+                     sizeof(CompiledConfigLink), alignof(CompiledConfigLink)) ||
+        !check_table(h->warnings_offset, h->warning_count,
+                     sizeof(CompiledConfigWarning), alignof(CompiledConfigWarning)) ||
+        !check_table(h->strings_offset, h->strings_size, 1, 1) ||
+        h->preamble_warning_count > h->warning_count) {
+      return false;
+    }
+
+    // Every string ends before the end of the pool.
+    if (h->strings_size == 0 || *(string_at(h->strings_size - 1)) != '\0') {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < h->dir_count; ++i) {
+      if (dirs()[i].section_name >= h->strings_size || dirs()[i].path >= h->strings_size) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < h->section_count; ++i) {
+      const CompiledConfigSection& section = sections()[i];
+      if (section.name >= h->strings_size ||
+          (section.error != kNoString && section.error >= h->strings_size) ||
+          !check_range(section.first_namespace, section.namespace_count, h->namespace_count) ||
+          !check_range(section.first_warning, section.warning_count, h->warning_count)) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < h->namespace_count; ++i) {
+      const CompiledConfigNamespace& ns = namespaces()[i];
+      if (ns.name >= h->strings_size ||
+          ns.search_paths[0] >= h->strings_size || ns.search_paths[1] >= h->strings_size ||
+          ns.permitted_paths[0] >= h->strings_size || ns.permitted_paths[1] >= h->strings_size ||
+          !check_range(ns.first_link, ns.link_count, h->link_count)) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < h->link_count; ++i) {
+      if (links()[i].ns_name >= h->strings_size || links()[i].shared_libs >= h->strings_size) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < h->warning_count; ++i) {
+      if (warnings()[i].arg >= h->strings_size) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void* map_;
+  const char* data_;
+  size_t size_;
+  std::string buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompiledConfig);
 };
 
+static Config g_config;
+
+static std::vector<std::string> get_paths(const char* paths_str,
+                                          bool resolve,
+                                          int target_sdk_version) {
+  std::vector<std::string> paths;
+  split_path(paths_str, ":", &paths);
+
+  std::vector<std::pair<std::string, std::string>> params;
+  params.push_back({ "LIB", kLibParamValue });
+  if (target_sdk_version != 0) {
+    char buf[16];
+    async_safe_format_buffer(buf, sizeof(buf), "%d", target_sdk_version);
+    params.push_back({ "SDK_VER", buf });
+  }
+
+  for (auto&& path : paths) {
+    format_string(&path, params);
+  }
+
+  if (resolve) {
+    std::vector<std::string> resolved_paths;
+
+    // do not remove paths that do not exist
+    resolve_paths(paths, &resolved_paths);
+
+    return resolved_paths;
+  } else {
+    return paths;
+  }
+}
+
 bool Config::read_binary_config(const char* ld_config_file_path,
                                       const char* binary_realpath,
                                       bool is_asan,
@@ -377,27 +847,24 @@ bool Config::read_binary_config(const char* ld_config_file_path,
                                       std::string* error_msg) {
   g_config.clear();
 
-  std::unordered_map<std::string, PropertyValue> property_map;
-  if (!parse_config_file(ld_config_file_path, binary_realpath, &property_map, error_msg)) {
-    return false;
+  std::unique_ptr<CompiledConfig> compiled(new CompiledConfig());
+  if (!compiled->map(ld_config_file_path)) {
+    compiled.reset(new CompiledConfig());
+    if (!compiled->compile(ld_config_file_path, error_msg)) {
+      return false;
+    }
   }
 
-  Properties properties(std::move(property_map));
+  const CompiledConfigSection* section =
+      compiled->find_section(ld_config_file_path, binary_realpath, error_msg);
+  if (section == nullptr) {
+    return false;
+  }
 
   auto failure_guard = android::base::make_scope_guard([] { g_config.clear(); });
 
-  std::unordered_map<std::string, NamespaceConfig*> namespace_configs;
-
-  namespace_configs[kDefaultConfigName] = g_config.create_namespace_config(kDefaultConfigName);
-
-  std::vector<std::string> additional_namespaces = properties.get_strings(kPropertyAdditionalNamespaces);
-  for (const auto& name : additional_namespaces) {
-    namespace_configs[name] = g_config.create_namespace_config(name);
-  }
-
-  bool versioning_enabled = properties.get_bool("enable.target.sdk.version");
   int target_sdk_version = __ANDROID_API__;
-  if (versioning_enabled) {
+  if ((section->flags & kSectionTargetSdkVersion) != 0) {
     std::string version_file = dirname(binary_realpath) + "/.version";
     std::string content;
     if (!android::base::ReadFileToString(version_file, &content)) {
@@ -414,7 +881,6 @@ bool Config::read_binary_config(const char* ld_config_file_path,
       int result = strtol(content_str, &end, 10);
       if (errno == 0 && *end == '\0' && result > 0) {
         target_sdk_version = result;
-        properties.set_target_sdk_version(target_sdk_version);
       } else {
         *error_msg = std::string("invalid version \"") + version_file + "\": \"" + content +"\"";
         return false;
@@ -424,55 +890,25 @@ bool Config::read_binary_config(const char* ld_config_file_path,
 
   g_config.set_target_sdk_version(target_sdk_version);
 
-  for (auto ns_config_it : namespace_configs) {
-    auto& name = ns_config_it.first;
-    NamespaceConfig* ns_config = ns_config_it.second;
+  for (uint32_t i = 0; i < section->namespace_count; ++i) {
+    const CompiledConfigNamespace& ns = compiled->namespaces()[section->first_namespace + i];
+    NamespaceConfig* ns_config = g_config.create_namespace_config(compiled->string_at(ns.name));
 
-    std::string property_name_prefix = std::string("namespace.") + name;
-
-    size_t lineno = 0;
-    std::vector<std::string> linked_namespaces =
-        properties.get_strings(property_name_prefix + ".links", &lineno);
-
-    for (const auto& linked_ns_name : linked_namespaces) {
-      if (namespace_configs.find(linked_ns_name) == namespace_configs.end()) {
-        *error_msg = create_error_msg(ld_config_file_path,
-                                      lineno,
-                                      std::string("undefined namespace: ") + linked_ns_name);
-        return false;
-      }
-
-      std::string shared_libs = properties.get_string(property_name_prefix +
-                                                      ".link." +
-                                                      linked_ns_name +
-                                                      ".shared_libs", &lineno);
-
-      if (shared_libs.empty()) {
-        *error_msg = create_error_msg(ld_config_file_path,
-                                      lineno,
-                                      std::string("list of shared_libs for ") +
-                                      name +
-                                      "->" +
-                                      linked_ns_name +
-                                      " link is not specified or is empty.");
-        return false;
-      }
-
-      ns_config->add_namespace_link(linked_ns_name, shared_libs);
+    for (uint32_t j = 0; j < ns.link_count; ++j) {
+      const CompiledConfigLink& link = compiled->links()[ns.first_link + j];
+      ns_config->add_namespace_link(compiled->string_at(link.ns_name),
+                                    compiled->string_at(link.shared_libs));
     }
 
-    ns_config->set_isolated(properties.get_bool(property_name_prefix + ".isolated"));
-    ns_config->set_visible(properties.get_bool(property_name_prefix + ".visible"));
-
-    // these are affected by is_asan flag
-    if (is_asan) {
-      property_name_prefix += ".asan";
-    }
+    ns_config->set_isolated((ns.flags & kNamespaceIsolated) != 0);
+    ns_config->set_visible((ns.flags & kNamespaceVisible) != 0);
 
     // search paths are resolved (canonicalized). This is required mainly for
     // the case when /vendor is a symlink to /system/vendor, which is true for
     // non Treble-ized legacy devices.
-    ns_config->set_search_paths(properties.get_paths(property_name_prefix + ".search.paths", true));
+    ns_config->set_search_paths(get_paths(compiled->string_at(ns.search_paths[is_asan]),
+                                          true,
+                                          target_sdk_version));
 
     // However, for permitted paths, we are not required to resolve the paths
     // since they are only set for isolated namespaces, which implies the device
@@ -480,22 +916,54 @@ bool Config::read_binary_config(const char* ld_config_file_path,
     // In fact, the resolving is causing an unexpected side effect of selinux
     // denials on some executables which are not allowed to access some of the
     // permitted paths.
-    ns_config->set_permitted_paths(properties.get_paths(property_name_prefix + ".permitted.paths", false));
+    ns_config->set_permitted_paths(get_paths(compiled->string_at(ns.permitted_paths[is_asan]),
+                                             false,
+                                             target_sdk_version));
   }
 
+  g_config.compiled_config_ = std::move(compiled);
+
   failure_guard.Disable();
   *config = &g_config;
   return true;
 }
 
-NamespaceConfig* Config::create_namespace_config(const std::string& name) {
+bool Config::write_compiled_config(const char* ld_config_file_path,
+                                   const char* compiled_file_path,
+                                   std::string* error_msg) {
+  std::string content;
+  if (!android::base::ReadFileToString(ld_config_file_path, &content)) {
+    *error_msg = std::string("error reading file \"") +
+                 ld_config_file_path + "\": " + strerror(errno);
+    return false;
+  }
+
+  std::string compiled;
+  ConfigCompiler().compile(std::move(content), &compiled);
+
+  // Readers must never see a partially written file.
+  std::string tmp_path = std::string(compiled_file_path) + ".tmp";
+  if (!android::base::WriteStringToFile(compiled, tmp_path) ||
+      rename(tmp_path.c_str(), compiled_file_path) == -1) {
+    *error_msg = std::string("error writing file \"") +
+                 compiled_file_path + "\": " + strerror(errno);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+Config::Config() : target_sdk_version_(__ANDROID_API__) {}
+
+Config::~Config() {}
+
+NamespaceConfig* Config::create_namespace_config(const char* name) {
   namespace_configs_.push_back(std::unique_ptr<NamespaceConfig>(new NamespaceConfig(name)));
-  NamespaceConfig* ns_config_ptr = namespace_configs_.back().get();
-  namespace_configs_map_[name] = ns_config_ptr;
-  return ns_config_ptr;
+  return namespace_configs_.back().get();
 }
 
 void Config::clear() {
   namespace_configs_.clear();
-  namespace_configs_map_.clear();
+  compiled_config_.reset();
 }
@@ -40,33 +40,37 @@
 #include <vector>
 #include <unordered_map>
 
+class CompiledConfig;
+
+// The strings of a namespace config, other than its paths, point into the
+// compiled config it was read from, which the Config keeps.
 class NamespaceLinkConfig {
  public:
   NamespaceLinkConfig() = default;
-  NamespaceLinkConfig(const std::string& ns_name, const std::string& shared_libs)
+  NamespaceLinkConfig(const char* ns_name, const char* shared_libs)
       : ns_name_(ns_name), shared_libs_(shared_libs)  {}
 
-  const std::string& ns_name() const {
+  const char* ns_name() const {
     return ns_name_;
   }
 
-  const std::string& shared_libs() const {
+  const char* shared_libs() const {
     return shared_libs_;
   }
 
  private:
-  std::string ns_name_;
-  std::string shared_libs_;
+  const char* ns_name_;
+  const char* shared_libs_;
 };
 
 class NamespaceConfig {
  public:
-  explicit NamespaceConfig(const std::string& name)
+  explicit NamespaceConfig(const char* name)
       : name_(name), isolated_(false), visible_(false)
   {}
 
   const char* name() const {
-    return name_.c_str();
+    return name_;
   }
 
   bool isolated() const {
@@ -89,7 +93,7 @@ class NamespaceConfig {
     return namespace_links_;
   }
 
-  void add_namespace_link(const std::string& ns_name, const std::string& shared_libs) {
+  void add_namespace_link(const char* ns_name, const char* shared_libs) {
     namespace_links_.push_back(NamespaceLinkConfig(ns_name, shared_libs));
   }
 
@@ -109,7 +113,7 @@ class NamespaceConfig {
     permitted_paths_ = permitted_paths;
   }
  private:
-  const std::string name_;
+  const char* name_;
   bool isolated_;
   bool visible_;
   std::vector<std::string> search_paths_;
@@ -121,15 +125,16 @@ class NamespaceConfig {
 
 class Config {
  public:
-  Config() : target_sdk_version_(__ANDROID_API__) {}
+  Config();
+  ~Config();
 
   const std::vector<std::unique_ptr<NamespaceConfig>>& namespace_configs() const {
     return namespace_configs_;
   }
 
+  // The default namespace config always comes first.
   const NamespaceConfig* default_namespace_config() const {
-    auto it = namespace_configs_map_.find("default");
-    return it == namespace_configs_map_.end() ? nullptr : it->second;
+    return namespace_configs_.empty() ? nullptr : namespace_configs_[0].get();
   }
 
   uint32_t target_sdk_version() const {
@@ -146,6 +151,19 @@ class Config {
                                  bool is_asan,
                                  const Config** config,
                                  std::string* error_msg);
+
+  // Writes the compiled form of a config file, which read_binary_config()
+  // maps instead of compiling the text file itself as long as it is up to
+  // date. It is looked for next to the text file, with ".bin" in place of
+  // ".txt".
+  //
+  // Nothing in the build produces ld.config.bin yet: the compiler shares the
+  // linker's logging, which is only built for the device. Until it does, a
+  // compiled config only exists where 'linker --compile-config' was run on
+  // the device, and everywhere else the text file is compiled at startup.
+  static bool write_compiled_config(const char* ld_config_file_path,
+                                    const char* compiled_file_path,
+                                    std::string* error_msg);
  private:
   void clear();
 
@@ -153,10 +171,10 @@ class Config {
     target_sdk_version_ = target_sdk_version;
   }
 
-  NamespaceConfig* create_namespace_config(const std::string& name);
+  NamespaceConfig* create_namespace_config(const char* name);
 
+  std::unique_ptr<CompiledConfig> compiled_config_;
   std::vector<std::unique_ptr<NamespaceConfig>> namespace_configs_;
-  std::unordered_map<std::string, NamespaceConfig*> namespace_configs_map_;
   uint32_t target_sdk_version_;
 
   DISALLOW_COPY_AND_ASSIGN(Config);
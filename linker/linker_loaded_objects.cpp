@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "linker_loaded_objects.h"
+
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <async_safe/log.h>
+
+#include "linker.h"
+#include "linker_block_allocator.h"
+#include "linker_main.h"
+#include "linker_soinfo.h"
+
+#include "private/bionic_elf_tls.h"
+#include "private/bionic_tls.h"
+
+struct LoadedObject {
+  soinfo* si;
+  ElfW(Addr) addr;
+  const char* name;
+  const ElfW(Phdr)* phdr;
+  ElfW(Half) phnum;
+  ElfW(Addr) base;
+  size_t size;
+  size_t tls_module_id;
+  bool tls_is_static;
+  ptrdiff_t tls_static_offset;
+#if defined(__arm__)
+  uint32_t* ARM_exidx;
+  size_t ARM_exidx_count;
+#endif
+};
+
+// A single allocation: the objects are followed by the index, the copied
+// program headers and then the names, so that readers never need to look
+// into a soinfo.
+struct LoadedObjects {
+  unsigned long long adds;
+  unsigned long long subs;
+  // The objects that have been mapped, sorted by address.
+  const LoadedObject** by_address;
+  size_t by_address_count;
+  size_t count;
+  LoadedObject objects[];
+};
+
+// Something a reader may still be looking at.
+struct RetiredObjects {
+  RetiredObjects* next;
+  LoadedObjects* objects;
+  void* map_start;
+  size_t map_size;
+};
+
+static std::atomic<LoadedObjects*> g_loaded_objects;
+
+// Readers register under the parity of the epoch they started in. Everything
+// unpublished before the epoch moved to N can be freed once the readers of
+// epoch N - 1 are gone.
+static std::atomic<size_t> g_epoch;
+static std::atomic<size_t> g_readers[2];
+
+// Only touched with g_dl_mutex held.
+static RetiredObjects* g_retired_pending; // Since the epoch last moved.
+static RetiredObjects* g_retired_waiting; // Before the epoch last moved.
+static LinkerTypeAllocator<RetiredObjects> g_retired_allocator;
+static unsigned long long g_subs;
+
+class LoadedObjectsReader {
+ public:
+  LoadedObjectsReader() {
+    while (true) {
+      epoch_ = g_epoch.load();
+      g_readers[epoch_ & 1].fetch_add(1);
+      // If the epoch moved before we registered, the writer may not have
+      // seen us: start over in the new one.
+      if (g_epoch.load() == epoch_) {
+        break;
+      }
+      g_readers[epoch_ & 1].fetch_sub(1);
+    }
+    objects_ = g_loaded_objects.load(std::memory_order_acquire);
+  }
+
+  ~LoadedObjectsReader() {
+    g_readers[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+  }
+
+  const LoadedObjects* objects() const { return objects_; }
+
+ private:
+  size_t epoch_;
+  const LoadedObjects* objects_;
+
+  DISALLOW_COPY_AND_ASSIGN(LoadedObjectsReader);
+};
+
+static void free_retired(RetiredObjects* retired) {
+  while (retired != nullptr) {
+    RetiredObjects* next = retired->next;
+    if (retired->map_start != nullptr) {
+      munmap(retired->map_start, retired->map_size);
+    }
+    free(retired->objects);
+    g_retired_allocator.free(retired);
+    retired = next;
+  }
+}
+
+static void reclaim_retired() {
+  size_t epoch = g_epoch.load(std::memory_order_relaxed);
+  if (g_retired_waiting != nullptr) {
+    if (g_readers[(epoch - 1) & 1].load() != 0) {
+      return;
+    }
+    free_retired(g_retired_waiting);
+    g_retired_waiting = nullptr;
+  }
+  if (g_retired_pending == nullptr) {
+    return;
+  }
+
+  // The readers of epoch N - 1 must be gone before epoch N + 1 reuses their
+  // counter.
+  if (g_readers[(epoch + 1) & 1].load() != 0) {
+    return;
+  }
+  g_retired_waiting = g_retired_pending;
+  g_retired_pending = nullptr;
+  g_epoch.store(epoch + 1);
+  if (g_readers[epoch & 1].load() == 0) {
+    free_retired(g_retired_waiting);
+    g_retired_waiting = nullptr;
+  }
+}
+
+static void retire(LoadedObjects* objects, void* map_start, size_t map_size) {
+  if (objects == nullptr && map_start == nullptr) {
+    return;
+  }
+  RetiredObjects* retired = g_retired_allocator.alloc();
+  retired->next = g_retired_pending;
+  retired->objects = objects;
+  retired->map_start = map_start;
+  retired->map_size = map_size;
+  g_retired_pending = retired;
+}
+
+static void publish_and_retire(void* map_start, size_t map_size) {
+  size_t count = 0;
+  size_t by_address_count = 0;
+  size_t phdrs_size = 0;
+  size_t names_size = 0;
+  for (soinfo* si = solist_get_head(); si != nullptr; si = si->next) {
+    ++count;
+    if (si->size != 0) {
+      ++by_address_count;
+    }
+    if (si->is_mapped_by_caller()) {
+      phdrs_size += si->phnum * sizeof(ElfW(Phdr));
+    }
+    if (si->link_map_head.l_name != nullptr) {
+      names_size += strlen(si->link_map_head.l_name) + 1;
+    }
+  }
+
+  size_t objects_size = sizeof(LoadedObjects) + count * sizeof(LoadedObject) +
+      by_address_count * sizeof(LoadedObject*);
+  LoadedObjects* objects =
+      static_cast<LoadedObjects*>(malloc(objects_size + phdrs_size + names_size));
+  if (objects == nullptr) {
+    async_safe_fatal("couldn't allocate %zu bytes for the loaded objects",
+                     objects_size + phdrs_size + names_size);
+  }
+  ElfW(Phdr)* phdrs = reinterpret_cast<ElfW(Phdr)*>(reinterpret_cast<char*>(objects) +
+                                                    objects_size);
+  char* names = reinterpret_cast<char*>(phdrs) + phdrs_size;
+
+  // Everything ever added to solist is either still in it or was removed.
+  objects->subs = g_subs;
+  objects->adds = g_subs + count;
+  objects->by_address = reinterpret_cast<const LoadedObject**>(&objects->objects[count]);
+  objects->by_address_count = 0;
+  objects->count = count;
+  LoadedObject* object = objects->objects;
+  for (soinfo* si = solist_get_head(); si != nullptr; si = si->next, ++object) {
+    object->si = si;
+    object->addr = si->link_map_head.l_addr;
+    object->name = nullptr;
+    if (si->link_map_head.l_name != nullptr) {
+      size_t name_size = strlen(si->link_map_head.l_name) + 1;
+      memcpy(names, si->link_map_head.l_name, name_size);
+      object->name = names;
+      names += name_size;
+    }
+    object->phdr = si->phdr;
+    object->phnum = si->phnum;
+    if (si->is_mapped_by_caller() && si->phnum != 0) {
+      memcpy(phdrs, si->phdr, si->phnum * sizeof(ElfW(Phdr)));
+      object->phdr = phdrs;
+      phdrs += si->phnum;
+    }
+    object->base = si->base;
+    object->size = si->size;
+    object->tls_module_id = si->get_tls_module_id();
+    object->tls_is_static = object->tls_module_id != 0 &&
+        __bionic_tls_get_static_offset(object->tls_module_id, &object->tls_static_offset);
+#if defined(__arm__)
+    object->ARM_exidx = si->ARM_exidx;
+    object->ARM_exidx_count = si->ARM_exidx_count;
+#endif
+    if (object->size != 0) {
+      objects->by_address[objects->by_address_count++] = object;
+    }
+  }
+  std::sort(objects->by_address, objects->by_address + objects->by_address_count,
+            [](const LoadedObject* a, const LoadedObject* b) { return a->base < b->base; });
+
+  LoadedObjects* old_objects = g_loaded_objects.exchange(objects, std::memory_order_acq_rel);
+  retire(old_objects, map_start, map_size);
+  reclaim_retired();
+}
+
+void publish_loaded_objects() {
+  publish_and_retire(nullptr, 0);
+}
+
+void unpublish_loaded_object(soinfo* si) {
+  ++g_subs;
+  if (si->base == 0 || si->size == 0) {
+    publish_and_retire(nullptr, 0);
+  } else if (!si->is_mapped_by_caller()) {
+    publish_and_retire(reinterpret_cast<void*>(si->base), si->size);
+  } else {
+    publish_and_retire(nullptr, 0);
+    // remap the region as PROT_NONE, MAP_ANONYMOUS | MAP_NORESERVE
+    mmap(reinterpret_cast<void*>(si->base), si->size, PROT_NONE,
+         MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+}
+
+// Objects don't overlap, so only the last one that starts at or before
+// address can contain it.
+static const LoadedObject* find_by_address(const LoadedObjects* objects, ElfW(Addr) address) {
+  if (objects == nullptr) {
+    return nullptr;
+  }
+  const LoadedObject** end = objects->by_address + objects->by_address_count;
+  const LoadedObject** it = std::upper_bound(objects->by_address, end, address,
+                                             [](ElfW(Addr) address, const LoadedObject* object) {
+    return address < object->base;
+  });
+  if (it == objects->by_address) {
+    return nullptr;
+  }
+  const LoadedObject* object = *(it - 1);
+  return (address - object->base < object->size) ? object : nullptr;
+}
+
+soinfo* find_loaded_object(ElfW(Addr) address) {
+  LoadedObjectsReader reader;
+  const LoadedObject* object = find_by_address(reader.objects(), address);
+  return object != nullptr ? object->si : nullptr;
+}
+
+// The calling thread's block, or nullptr if it hasn't been allocated yet.
+static void* get_tls_data(const LoadedObject& object) {
+  if (object.tls_module_id == 0) {
+    return nullptr;
+  }
+  if (object.tls_is_static) {
+    return reinterpret_cast<char*>(__get_tls()) + object.tls_static_offset;
+  }
+  const TlsDtv* dtv = static_cast<const TlsDtv*>(__get_tls()[TLS_SLOT_DTV]);
+  // A stale DTV may hold the block of a previous module with the same id.
+  if (dtv->generation != __bionic_tls_generation()->load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return object.tls_module_id - 1 < dtv->count ? dtv->modules[object.tls_module_id - 1] : nullptr;
+}
+
+#if defined(__arm__)
+
+// For a given PC, find the .so that it belongs to.
+// Returns the base address of the .ARM.exidx section
+// for that .so, and the number of 8-byte entries
+// in that section (via *pcount).
+//
+// Intended to be called by libc's __gnu_Unwind_Find_exidx().
+_Unwind_Ptr do_dl_unwind_find_exidx(_Unwind_Ptr pc, int* pcount) {
+  LoadedObjectsReader reader;
+  const LoadedObject* object = find_by_address(reader.objects(), pc);
+  if (object != nullptr) {
+    *pcount = object->ARM_exidx_count;
+    return reinterpret_cast<_Unwind_Ptr>(object->ARM_exidx);
+  }
+  *pcount = 0;
+  return 0;
+}
+
+#endif
+
+// Here, we only have to provide a callback to iterate across all the
+// loaded libraries. gcc_eh does the rest.
+int do_dl_iterate_phdr(int (*cb)(dl_phdr_info* info, size_t size, void* data), void* data) {
+  LoadedObjectsReader reader;
+  const LoadedObjects* objects = reader.objects();
+  int rv = 0;
+  for (size_t i = 0; objects != nullptr && i < objects->count; ++i) {
+    const LoadedObject& object = objects->objects[i];
+    dl_phdr_info dl_info;
+    dl_info.dlpi_addr = object.addr;
+    dl_info.dlpi_name = object.name;
+    dl_info.dlpi_phdr = object.phdr;
+    dl_info.dlpi_phnum = object.phnum;
+    dl_info.dlpi_adds = objects->adds;
+    dl_info.dlpi_subs = objects->subs;
+    dl_info.dlpi_tls_modid = object.tls_module_id;
+    dl_info.dlpi_tls_data = get_tls_data(object);
+    rv = cb(&dl_info, sizeof(dl_phdr_info), data);
+    if (rv != 0) {
+      break;
+    }
+  }
+  return rv;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LINKER_LOADED_OBJECTS_H
+#define __LINKER_LOADED_OBJECTS_H
+
+#include <link.h>
+
+struct soinfo;
+
+// dl_iterate_phdr() and dl_unwind_find_exidx() are called by every unwinder,
+// often from many threads at once, so they don't take g_dl_mutex, which is
+// held across whole dlopen() calls including constructors. They read an
+// immutable snapshot of solist instead, which the functions below replace
+// (with g_dl_mutex held) whenever it changes.
+//
+// A snapshot, and the segments of a library removed from it, are only freed
+// once no reader can still be looking at them. That check never blocks: what
+// can't be freed yet is retried the next time the snapshot is replaced.
+
+// The object whose segments contain address, or nullptr. Like
+// dl_iterate_phdr(), this doesn't take g_dl_mutex, but the soinfo may only
+// be used with it held. Objects show up once they've been linked.
+soinfo* find_loaded_object(ElfW(Addr) address);
+
+// Publishes the current contents of solist.
+void publish_loaded_objects();
+
+// Publishes solist without si, which must already have been removed from it,
+// and unmaps si's segments once that's safe. Segments reserved by the caller
+// of android_dlopen_ext() are handed back immediately, since the caller may
+// reuse them as soon as dlclose() returns; readers see a copy of those
+// libraries' program headers instead.
+void unpublish_loaded_object(soinfo* si);
+
+#endif
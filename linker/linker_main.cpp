@@ -30,11 +30,16 @@
 
 #include "linker_debug.h"
 #include "linker_cfi.h"
+#include "linker_config.h"
 #include "linker_gdb_support.h"
 #include "linker_globals.h"
+#include "linker_loaded_objects.h"
 #include "linker_phdr.h"
+#include "linker_profile.h"
+#include "linker_relro_cache.h"
 #include "linker_utils.h"
 
+#include "private/bionic_elf_tls.h"
 #include "private/bionic_globals.h"
 #include "private/bionic_tls.h"
 #include "private/KernelArgumentBlock.h"
@@ -106,6 +111,7 @@ soinfo* solist_get_somain() {
 
 int g_ld_debug_verbosity;
 abort_msg_t* g_abort_message = nullptr; // For debuggerd.
+static TlsModules g_tls_modules;
 
 static std::vector<std::string> g_ld_preload_names;
 
@@ -260,6 +266,14 @@ static ElfW(Addr) __linker_init_post_relocation(KernelArgumentBlock& args) {
     if (ldpreload_env != nullptr) {
       INFO("[ LD_PRELOAD set to \"%s\" ]", ldpreload_env);
     }
+    const char* relro_cache_env = getenv("LD_RELRO_CACHE");
+    if (relro_cache_env != nullptr) {
+      relro_cache_init(relro_cache_env);
+    }
+    const char* profile_file_env = getenv("LD_PROFILE_FILE");
+    if (profile_file_env != nullptr && linker_profile_init(profile_file_env)) {
+      linker_profile_begin_event();
+    }
   }
 
   struct stat file_stat;
@@ -395,11 +409,16 @@ static ElfW(Addr) __linker_init_post_relocation(KernelArgumentBlock& args) {
   }
 
   add_vdso(args);
+  publish_loaded_objects();
 
   if (!get_cfi_shadow()->InitialLinkDone(solist)) {
     async_safe_fatal("CANNOT LINK EXECUTABLE \"%s\": %s", g_argv[0], linker_get_error_buffer());
   }
 
+  // Everything loaded so far has its static TLS offset, and none of it has
+  // run yet: give the main thread its static TLS area.
+  __libc_init_main_thread_static_tls();
+
   si->call_pre_init_constructors();
 
   /* After the prelink_image, the si->load_bias is initialized.
@@ -410,6 +429,10 @@ static ElfW(Addr) __linker_init_post_relocation(KernelArgumentBlock& args) {
   map->l_addr = si->load_bias;
   si->call_constructors();
 
+  if (g_linker_profiling) {
+    linker_profile_end_event("startup", nullptr);
+  }
+
 #if TIMING
   gettimeofday(&t1, nullptr);
   PRINT("LINKER TIME: %s: %d microseconds", g_argv[0], (int) (
@@ -417,11 +440,14 @@ static ElfW(Addr) __linker_init_post_relocation(KernelArgumentBlock& args) {
            (((long long)t0.tv_sec * 1000000LL) + (long long)t0.tv_usec)));
 #endif
 #if STATS
-  PRINT("RELO STATS: %s: %d abs, %d rel, %d copy, %d symbol", g_argv[0],
+  PRINT("RELO STATS: %s: %d abs, %d rel, %d copy, %d symbol (%d cached, %d global cached)",
+         g_argv[0],
          linker_stats.count[kRelocAbsolute],
          linker_stats.count[kRelocRelative],
          linker_stats.count[kRelocCopy],
-         linker_stats.count[kRelocSymbol]);
+         linker_stats.count[kRelocSymbol],
+         linker_stats.count[kRelocSymbolCached],
+         linker_stats.count[kRelocSymbolGlobalCached]);
 #endif
 #if COUNT_PAGES
   {
@@ -555,6 +581,7 @@ extern "C" ElfW(Addr) __linker_init(void* raw_args) {
   if (!linker_so.protect_relro()) __linker_cannot_link(args.argv[0]);
 
   // Initialize the linker's static libc's globals
+  args.tls_modules = &g_tls_modules;
   __libc_init_globals(args);
 
   // store argc/argv/envp to use them for calling constructors
@@ -572,6 +599,17 @@ extern "C" ElfW(Addr) __linker_init(void* raw_args) {
   // This happens when user tries to run 'adb shell /system/bin/linker'
   // see also https://code.google.com/p/android/issues/detail?id=63174
   if (reinterpret_cast<ElfW(Addr)>(&_start) == entry_point) {
+    // 'linker --compile-config ld.config.txt ld.config.bin' writes the
+    // compiled form of a config file (see Config::write_compiled_config).
+    if (args.argc == 4 && strcmp(args.argv[1], "--compile-config") == 0) {
+      std::string error_msg;
+      if (!Config::write_compiled_config(args.argv[2], args.argv[3], &error_msg)) {
+        async_safe_format_fd(STDERR_FILENO, "%s: %s\n", args.argv[0], error_msg.c_str());
+        exit(1);
+      }
+      exit(0);
+    }
+
     async_safe_format_fd(STDOUT_FILENO,
                      "This is %s, the helper program for dynamic executables.\n",
                      args.argv[0]);
@@ -42,19 +42,22 @@
 template bool soinfo::relocate<plain_reloc_iterator>(const VersionTracker& version_tracker,
                                                      plain_reloc_iterator&& rel_iterator,
                                                      const soinfo_list_t& global_group,
-                                                     const soinfo_list_t& local_group);
+                                                     const soinfo_list_t& local_group,
+                                                     RelocationSymbolCache* symbol_cache);
 
 template bool soinfo::relocate<packed_reloc_iterator<sleb128_decoder>>(
     const VersionTracker& version_tracker,
     packed_reloc_iterator<sleb128_decoder>&& rel_iterator,
     const soinfo_list_t& global_group,
-    const soinfo_list_t& local_group);
+    const soinfo_list_t& local_group,
+    RelocationSymbolCache* symbol_cache);
 
 template <typename ElfRelIteratorT>
 bool soinfo::relocate(const VersionTracker& version_tracker,
                       ElfRelIteratorT&& rel_iterator,
                       const soinfo_list_t& global_group,
-                      const soinfo_list_t& local_group) {
+                      const soinfo_list_t& local_group,
+                      RelocationSymbolCache* symbol_cache __unused) {
   for (size_t idx = 0; rel_iterator.has_next(); ++idx) {
     const auto rel = rel_iterator.next();
 
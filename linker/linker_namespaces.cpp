@@ -32,6 +32,100 @@
 #include "linker_utils.h"
 
 #include <dlfcn.h>
+#include <string.h>
+
+#include <algorithm>
+
+template <typename Map, typename Key>
+static void index_add(Map* map, const Key& key, soinfo* si) {
+  (*map)[key].push_back(si);
+}
+
+template <typename Map, typename Key>
+static void index_remove(Map* map, const Key& key, soinfo* si) {
+  auto it = map->find(key);
+  if (it == map->end()) {
+    return;
+  }
+  auto& soinfos = it->second;
+  soinfos.erase(std::remove(soinfos.begin(), soinfos.end(), si), soinfos.end());
+  if (soinfos.empty()) {
+    map->erase(it);
+  }
+}
+
+void android_namespace_t::add_soinfo(soinfo* si) {
+  soinfo_list_.push_back(si);
+
+  index_soname(si);
+  index_add(&soinfos_by_realpath_, std::string(si->get_realpath()), si);
+  if (si->get_st_dev() != 0 && si->get_st_ino() != 0) {
+    index_add(&soinfos_by_inode_, InodeKey{si->get_st_dev(), si->get_st_ino()}, si);
+  }
+}
+
+void android_namespace_t::remove_soinfo(soinfo* si) {
+  soinfo_list_.remove_if([&](soinfo* candidate) {
+    return si == candidate;
+  });
+
+  unindex_soname(si);
+  index_remove(&soinfos_by_realpath_, std::string(si->get_realpath()), si);
+  if (si->get_st_dev() != 0 && si->get_st_ino() != 0) {
+    index_remove(&soinfos_by_inode_, InodeKey{si->get_st_dev(), si->get_st_ino()}, si);
+  }
+}
+
+void android_namespace_t::index_soname(soinfo* si) {
+  if (si->get_soname() != nullptr) {
+    index_add(&soinfos_by_soname_, std::string(si->get_soname()), si);
+  }
+}
+
+void android_namespace_t::unindex_soname(soinfo* si) {
+  if (si->get_soname() != nullptr) {
+    index_remove(&soinfos_by_soname_, std::string(si->get_soname()), si);
+  }
+}
+
+soinfo* android_namespace_t::first_in_list(const soinfo_vector_t& candidates) const {
+  if (candidates.size() == 1) {
+    return candidates[0];
+  }
+  return soinfo_list_.find_if([&](soinfo* si) {
+    return std::find(candidates.begin(), candidates.end(), si) != candidates.end();
+  });
+}
+
+soinfo* android_namespace_t::find_soinfo_by_soname(const char* soname) const {
+  auto it = soinfos_by_soname_.find(soname);
+  return it != soinfos_by_soname_.end() ? first_in_list(it->second) : nullptr;
+}
+
+soinfo* android_namespace_t::find_soinfo_by_realpath(const char* realpath) const {
+  auto it = soinfos_by_realpath_.find(realpath);
+  return it != soinfos_by_realpath_.end() ? first_in_list(it->second) : nullptr;
+}
+
+soinfo* android_namespace_t::find_soinfo_by_inode(dev_t dev, ino_t ino,
+                                                  off64_t file_offset) const {
+  if (dev == 0 || ino == 0) {
+    return nullptr;
+  }
+  auto it = soinfos_by_inode_.find(InodeKey{dev, ino});
+  if (it == soinfos_by_inode_.end()) {
+    return nullptr;
+  }
+  const soinfo_vector_t& candidates = it->second;
+  if (candidates.size() == 1) {
+    return candidates[0]->get_file_offset() == file_offset ? candidates[0] : nullptr;
+  }
+  // The same file may have been loaded from several offsets.
+  return soinfo_list_.find_if([&](soinfo* si) {
+    return si->get_file_offset() == file_offset &&
+           std::find(candidates.begin(), candidates.end(), si) != candidates.end();
+  });
+}
 
 bool android_namespace_t::is_accessible(const std::string& file) {
   if (!is_isolated_) {
@@ -31,8 +31,11 @@
 
 #include "linker_common_types.h"
 
+#include <sys/types.h>
+
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 
 struct android_namespace_t;
@@ -109,9 +112,7 @@ struct android_namespace_t {
     linked_namespaces_.push_back(android_namespace_link_t(linked_namespace, shared_lib_sonames));
   }
 
-  void add_soinfo(soinfo* si) {
-    soinfo_list_.push_back(si);
-  }
+  void add_soinfo(soinfo* si);
 
   void add_soinfos(const soinfo_list_t& soinfos) {
     for (auto si : soinfos) {
@@ -119,14 +120,20 @@ struct android_namespace_t {
     }
   }
 
-  void remove_soinfo(soinfo* si) {
-    soinfo_list_.remove_if([&](soinfo* candidate) {
-      return si == candidate;
-    });
-  }
+  void remove_soinfo(soinfo* si);
 
   const soinfo_list_t& soinfo_list() const { return soinfo_list_; }
 
+  // These return the first soinfo in soinfo_list() that matches, or nullptr.
+  soinfo* find_soinfo_by_soname(const char* soname) const;
+  soinfo* find_soinfo_by_realpath(const char* realpath) const;
+  soinfo* find_soinfo_by_inode(dev_t dev, ino_t ino, off64_t file_offset) const;
+
+  // The soname of a soinfo is usually only known once it's been added:
+  // soinfo::set_soname() calls these around the change.
+  void unindex_soname(soinfo* si);
+  void index_soname(soinfo* si);
+
   // For isolated namespaces - checks if the file is on the search path;
   // always returns true for not isolated namespace.
   bool is_accessible(const std::string& path);
@@ -153,6 +160,29 @@ struct android_namespace_t {
   std::vector<android_namespace_link_t> linked_namespaces_;
   soinfo_list_t soinfo_list_;
 
+  // Indexes of soinfo_list_. When a key has several soinfos, the first in
+  // soinfo_list_ is the one that counts.
+  struct InodeKey {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const InodeKey& other) const {
+      return dev == other.dev && ino == other.ino;
+    }
+  };
+  struct InodeKeyHash {
+    size_t operator()(const InodeKey& key) const {
+      return std::hash<uint64_t>()(static_cast<uint64_t>(key.dev) * 31 + key.ino);
+    }
+  };
+  typedef std::vector<soinfo*> soinfo_vector_t;
+
+  soinfo* first_in_list(const soinfo_vector_t& candidates) const;
+
+  std::unordered_map<std::string, soinfo_vector_t> soinfos_by_soname_;
+  std::unordered_map<std::string, soinfo_vector_t> soinfos_by_realpath_;
+  std::unordered_map<InodeKey, soinfo_vector_t, InodeKeyHash> soinfos_by_inode_;
+
   DISALLOW_COPY_AND_ASSIGN(android_namespace_t);
 };
 
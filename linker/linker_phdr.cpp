@@ -29,12 +29,15 @@
 #include "linker_phdr.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "linker.h"
 #include "linker_dlwarning.h"
 #include "linker_globals.h"
@@ -158,9 +161,11 @@ bool ElfReader::Read(const char* name, int fd, off64_t file_offset, off64_t file
   if (ReadElfHeader() &&
       VerifyElfHeader() &&
       ReadProgramHeaders() &&
-      ReadSectionHeaders() &&
-      ReadDynamicSection()) {
-    did_read_ = true;
+      ReadSectionHeaders()) {
+    ReadAhead();
+    if (ReadDynamicSection()) {
+      did_read_ = true;
+    }
   }
 
   return did_read_;
@@ -360,6 +365,58 @@ bool ElfReader::ReadSectionHeaders() {
   return true;
 }
 
+// Asks the kernel to start reading the parts of the file that linking is sure
+// to touch: the dynamic linking tables, and the data that relocations write
+// to. find_libraries() reads each library's headers in turn, so the rest of a
+// library comes in while the next one's headers are being read, and is there
+// by the time it gets relocated. Code and read-only data are left to be
+// paged in on demand.
+//
+// This is only a hint, so anything odd in the section headers is skipped
+// rather than reported.
+void ElfReader::ReadAhead() {
+  off64_t range_start = 0;
+  off64_t range_end = 0;
+
+  auto flush = [&]() {
+    if (range_end > range_start) {
+      posix_fadvise64(fd_, range_start, range_end - range_start, POSIX_FADV_WILLNEED);
+    }
+  };
+
+  for (size_t i = 0; i < shdr_num_; ++i) {
+    const ElfW(Shdr)* shdr = &shdr_table_[i];
+    if ((shdr->sh_flags & SHF_ALLOC) == 0 || shdr->sh_type == SHT_NOBITS) {
+      continue;
+    }
+    // Writable sections get relocated. Of the others, everything but plain
+    // contents (.text, .rodata, .eh_frame...) is there for the dynamic linker:
+    // symbol, string and hash tables, relocations, version information.
+    if ((shdr->sh_flags & SHF_WRITE) == 0 &&
+        (shdr->sh_type == SHT_PROGBITS || (shdr->sh_flags & SHF_EXECINSTR) != 0)) {
+      continue;
+    }
+
+    off64_t start;
+    off64_t end;
+    if (!safe_add(&start, file_offset_, shdr->sh_offset) ||
+        !safe_add(&end, start, shdr->sh_size) ||
+        end > file_size_) {
+      continue;
+    }
+
+    // Sections come in file order, so coalesce the ones that are close.
+    if (range_end != 0 && start >= range_start && start <= range_end + PAGE_SIZE) {
+      range_end = std::max(range_end, end);
+    } else {
+      flush();
+      range_start = start;
+      range_end = end;
+    }
+  }
+  flush();
+}
+
 bool ElfReader::ReadDynamicSection() {
   // 1. Find .dynamic section (in section headers)
   const ElfW(Shdr)* dynamic_shdr = nullptr;
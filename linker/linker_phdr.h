@@ -60,6 +60,7 @@ class ElfReader {
   bool VerifyElfHeader();
   bool ReadProgramHeaders();
   bool ReadSectionHeaders();
+  void ReadAhead();
   bool ReadDynamicSection();
   bool ReserveAddressSpace(const android_dlextinfo* extinfo);
   bool LoadSegments();
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "linker_profile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <async_safe/log.h>
+
+#include "linker_globals.h"
+#include "linker_soinfo.h"
+
+#include "private/bionic_systrace.h"
+
+bool g_linker_profiling = false;
+
+static const char* const kPhaseNames[kProfilePhaseMax] = {
+  "open",
+  "read",
+  "map",
+  "prelink",
+  "link",
+  "lookup",
+  "constructors",
+};
+
+static const char* const kRelocationKindNames[kRelocMax] = {
+  "absolute",
+  "relative",
+  "copy",
+  "symbol",
+  "symbol_cached",
+  "symbol_global_cached",
+};
+
+struct LibraryProfile {
+  std::string path;
+  uint64_t ns[kProfilePhaseMax];
+  uint32_t count[kProfilePhaseMax];
+  uint32_t relocations[kRelocMax];
+};
+
+static std::string g_profile_path;
+
+// What happened since the last report, in the order libraries were first
+// seen.
+static std::vector<LibraryProfile> g_profiles;
+static std::unordered_map<const soinfo*, size_t> g_profile_index;
+
+// The library being linked, to which relocations are counted.
+static bool g_linking;
+static size_t g_linking_index;
+
+static size_t g_event_depth;
+static uint64_t g_event_start_ns;
+
+bool linker_profile_init(const char* path) {
+  int fd = TEMP_FAILURE_RETRY(open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600));
+  if (fd == -1) {
+    DL_WARN("unable to open linker profile \"%s\": %s", path, strerror(errno));
+    return false;
+  }
+  close(fd);
+
+  g_profile_path = path;
+  g_linker_profiling = true;
+  return true;
+}
+
+uint64_t linker_profile_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static size_t get_profile_index(const soinfo* si) {
+  auto it = g_profile_index.find(si);
+  if (it != g_profile_index.end()) {
+    return it->second;
+  }
+
+  size_t index = g_profiles.size();
+  g_profile_index[si] = index;
+  g_profiles.push_back(LibraryProfile());
+  LibraryProfile& profile = g_profiles.back();
+  memset(profile.ns, 0, sizeof(profile.ns));
+  memset(profile.count, 0, sizeof(profile.count));
+  memset(profile.relocations, 0, sizeof(profile.relocations));
+  profile.path = si->get_realpath();
+  return index;
+}
+
+void linker_profile_add(const soinfo* si, LinkerProfilePhase phase, uint64_t duration_ns) {
+  LibraryProfile& profile = g_profiles[get_profile_index(si)];
+  profile.ns[phase] += duration_ns;
+  profile.count[phase]++;
+}
+
+void linker_profile_count_relocation(RelocationKind kind) {
+  if (g_linking) {
+    g_profiles[g_linking_index].relocations[kind]++;
+  }
+}
+
+void linker_profile_remove(const soinfo* si) {
+  g_profile_index.erase(si);
+}
+
+void linker_profile_begin_event() {
+  if (g_event_depth++ == 0) {
+    g_event_start_ns = linker_profile_now();
+  }
+}
+
+// Writes " key=value", with '%', spaces and control characters in the value
+// written as %XX, so that a field is one word whatever path it holds.
+static void write_field(int fd, const char* key, const char* value) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  char buf[256];
+  size_t n = async_safe_format_buffer(buf, sizeof(buf), " %s=", key);
+  for (const char* p = value; *p != '\0'; ++p) {
+    if (n + 3 > sizeof(buf)) {
+      TEMP_FAILURE_RETRY(write(fd, buf, n));
+      n = 0;
+    }
+    unsigned char c = *p;
+    if (c <= ' ' || c == '%' || c == 0x7f) {
+      buf[n++] = '%';
+      buf[n++] = kHexDigits[c >> 4];
+      buf[n++] = kHexDigits[c & 0xf];
+    } else {
+      buf[n++] = c;
+    }
+  }
+  TEMP_FAILURE_RETRY(write(fd, buf, n));
+}
+
+static void write_report(int fd, const char* event, const char* name, uint64_t total_ns) {
+  async_safe_format_fd(fd, "event=%s pid=%d total_ns=%" PRIu64 " libraries=%zu",
+                       event, getpid(), total_ns, g_profiles.size());
+  write_field(fd, "process", g_argv[0] != nullptr ? g_argv[0] : "(unknown)");
+  if (name != nullptr) {
+    write_field(fd, "name", name);
+  }
+  async_safe_format_fd(fd, "\n");
+
+  for (const LibraryProfile& profile : g_profiles) {
+    async_safe_format_fd(fd, "library");
+    for (size_t i = 0; i < kProfilePhaseMax; ++i) {
+      async_safe_format_fd(fd, " %s_ns=%" PRIu64 " %s_count=%" PRIu32,
+                           kPhaseNames[i], profile.ns[i], kPhaseNames[i], profile.count[i]);
+    }
+    for (size_t i = 0; i < kRelocMax; ++i) {
+      async_safe_format_fd(fd, " relocs_%s=%" PRIu32,
+                           kRelocationKindNames[i], profile.relocations[i]);
+    }
+    write_field(fd, "path", profile.path.c_str());
+    async_safe_format_fd(fd, "\n");
+  }
+}
+
+void linker_profile_end_event(const char* event, const char* name) {
+  if (--g_event_depth != 0) {
+    return;
+  }
+
+  uint64_t total_ns = linker_profile_now() - g_event_start_ns;
+
+  // The file is only open while writing to it, so as not to leave a file
+  // descriptor the program doesn't know about.
+  int fd = TEMP_FAILURE_RETRY(open(g_profile_path.c_str(),
+                                   O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600));
+  if (fd != -1) {
+    write_report(fd, event, name, total_ns);
+    close(fd);
+  }
+
+  g_profiles.clear();
+  g_profile_index.clear();
+}
+
+void LinkerProfileTimer::begin() {
+  if (phase_ == kProfileLink && si_ != nullptr) {
+    g_linking = true;
+    g_linking_index = get_profile_index(si_);
+  }
+
+  // Constructors have their own section already, and lookups are too many.
+  if (si_ != nullptr && phase_ != kProfileConstructors && phase_ != kProfileSymbolLookup) {
+    bionic_trace_begin((std::string("linker ") + kPhaseNames[phase_] + ": " +
+                        si_->get_realpath()).c_str());
+    traced_ = true;
+  }
+
+  start_ns_ = linker_profile_now();
+}
+
+void LinkerProfileTimer::end() {
+  uint64_t duration_ns = linker_profile_now() - start_ns_;
+
+  if (traced_) {
+    bionic_trace_end();
+  }
+
+  if (phase_ == kProfileLink) {
+    g_linking = false;
+  }
+
+  if (si_ != nullptr) {
+    linker_profile_add(si_, phase_, duration_ns);
+  }
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LINKER_PROFILE_H
+#define __LINKER_PROFILE_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include "linker.h"
+
+// Opt-in profiling of where the linker spends its time, library by library,
+// for optimizing startup. Setting LD_PROFILE_FILE to a path enables it for
+// the process (it is ignored for setuid programs). When the executable is
+// about to start, and whenever a dlopen() returns, the linker appends a
+// report to that file: a line for the event, then one per library loaded
+// since the previous report:
+//
+//   event=dlopen pid=1234 total_ns=6018210 libraries=2 process=/system/bin/app_process64 name=libfoo.so
+//   library open_ns=30104 open_count=1 read_ns=18021 ... path=/system/lib64/libfoo.so
+//
+// A dlopen() from a constructor is part of the event of the outer dlopen(),
+// or of startup. The phases are those of LinkerProfilePhase: each has the
+// total time spent in it and how many times it was entered. The process,
+// name and path fields have '%', spaces and control characters written as
+// %XX. The time for symbol lookups is part of the time for linking, and a
+// library's constructors include those of anything they dlopen(), but not
+// those of its dependencies. Relocations are counted by RelocationKind.
+//
+// While profiling, reading, mapping, prelinking and linking a library are
+// also systrace sections, which show up when bionic is being traced, as
+// running its constructors always is.
+
+enum LinkerProfilePhase {
+  kProfileOpen,         // Searching for the file and opening it.
+  kProfileRead,         // Reading the ELF header, program headers and dynamic section.
+  kProfileMap,          // Reserving the address space and mapping the segments.
+  kProfilePrelink,      // Parsing the dynamic section.
+  kProfileLink,         // Relocating, and protecting the RELRO segment.
+  kProfileSymbolLookup, // Finding the definitions of symbols.
+  kProfileConstructors, // Running DT_INIT and DT_INIT_ARRAY.
+  kProfilePhaseMax
+};
+
+// Hidden, so that reading it doesn't need a relocation: it is also read
+// while the linker relocates itself.
+__LIBC_HIDDEN__ extern bool g_linker_profiling;
+
+// Returns false, and leaves profiling disabled, if path can't be written to.
+bool linker_profile_init(const char* path);
+
+uint64_t linker_profile_now();
+void linker_profile_add(const soinfo* si, LinkerProfilePhase phase, uint64_t duration_ns);
+void linker_profile_count_relocation(RelocationKind kind);
+
+// Forgets si, which is being freed, so that its address can be reused.
+void linker_profile_remove(const soinfo* si);
+
+// A report is only written when the outermost event ends, so that the
+// libraries a constructor dlopen()s are reported along with the rest. name,
+// if not null, is what the event was about.
+void linker_profile_begin_event();
+void linker_profile_end_event(const char* event, const char* name);
+
+// The time from construction to destruction goes to si's phase, unless si
+// is reset to null first (because it is being freed, say). Costs a test of
+// g_linker_profiling when profiling is disabled.
+class LinkerProfileTimer {
+ public:
+  LinkerProfileTimer(const soinfo* si, LinkerProfilePhase phase);
+  ~LinkerProfileTimer();
+
+  void set_soinfo(const soinfo* si) {
+    si_ = si;
+  }
+
+ private:
+  void begin();
+  void end();
+
+  const soinfo* si_;
+  LinkerProfilePhase phase_;
+  uint64_t start_ns_;
+  bool traced_;
+
+  DISALLOW_COPY_AND_ASSIGN(LinkerProfileTimer);
+};
+
+inline LinkerProfileTimer::LinkerProfileTimer(const soinfo* si, LinkerProfilePhase phase)
+    : si_(si), phase_(phase), start_ns_(0), traced_(false) {
+  if (__predict_false(g_linker_profiling)) {
+    begin();
+  }
+}
+
+inline LinkerProfileTimer::~LinkerProfileTimer() {
+  if (__predict_false(start_ns_ != 0)) {
+    end();
+  }
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LINKER_RELR_H
+#define __LINKER_RELR_H
+
+#include <link.h>
+#include <stddef.h>
+
+// Applies RELR relative relocations. An even entry is the address of a word
+// to relocate. An odd entry is a bitmap whose bits after the lowest say which
+// of the following 8*sizeof(word)-1 words to relocate, starting right after
+// the last address. Either way the addend is the word itself.
+//
+// Returns false, having relocated nothing, if the table starts with a
+// bitmap: there is no address for it to follow.
+static inline bool relocate_relr(const ElfW(Relr)* begin, const ElfW(Relr)* end,
+                                 ElfW(Addr) load_bias) {
+  constexpr size_t kBitmapWords = 8 * sizeof(ElfW(Addr)) - 1;
+  if (begin < end && (*begin & 1) != 0) {
+    return false;
+  }
+  ElfW(Addr)* base = nullptr;
+  for (const ElfW(Relr)* current = begin; current < end; ++current) {
+    ElfW(Relr) entry = *current;
+    if ((entry & 1) == 0) {
+      ElfW(Addr)* reloc = reinterpret_cast<ElfW(Addr)*>(load_bias + entry);
+      *reloc += load_bias;
+      base = reloc + 1;
+    } else {
+      // Visit only the set bits.
+      for (ElfW(Relr) bits = entry >> 1; bits != 0; bits &= bits - 1) {
+        base[__builtin_ctzl(bits)] += load_bias;
+      }
+      base += kBitmapWords;
+    }
+  }
+  return true;
+}
+
+#endif
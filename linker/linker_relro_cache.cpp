@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "linker_relro_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "linker_debug.h"
+#include "linker_globals.h"
+#include "linker_phdr.h"
+#include "linker_soinfo.h"
+
+// The directory is reopened by path whenever it's needed rather than held
+// open: the program may close any descriptor it didn't open itself, and a
+// number it reused would then be taken for the cache.
+static char g_relro_cache_dir[PATH_MAX];
+
+// Files beyond this many make room by removing the least recently used.
+static constexpr size_t kRelroCacheMaxFiles = 128;
+
+// Only files that nobody else can have written are trusted.
+static bool is_trusted(const struct stat& st) {
+  return (st.st_uid == geteuid() || st.st_uid == 0) && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+static int open_cache_dir(const char* dir) {
+  int fd = TEMP_FAILURE_RETRY(open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (fd == -1) {
+    DL_WARN("can't open the RELRO cache \"%s\": %s", dir, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (TEMP_FAILURE_RETRY(fstat(fd, &st)) != 0 || !is_trusted(st)) {
+    DL_WARN("not using the RELRO cache \"%s\": it must not be writable by other users", dir);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool relro_cache_init(const char* dir) {
+  if (strlen(dir) >= sizeof(g_relro_cache_dir)) {
+    DL_WARN("not using the RELRO cache \"%s\": the path is too long", dir);
+    return false;
+  }
+  int fd = open_cache_dir(dir);
+  if (fd == -1) {
+    return false;
+  }
+  close(fd);
+  strlcpy(g_relro_cache_dir, dir, sizeof(g_relro_cache_dir));
+  INFO("[ Using the RELRO cache \"%s\" ]", dir);
+  return true;
+}
+
+// Only libraries whose address doesn't change from one run to the next are
+// worth a file: anything placed by ASLR would almost never be found again,
+// and would leave a new file behind every time. That includes space the
+// caller reserved, unless it also asked for that address to be used as is.
+static bool is_at_fixed_address(const soinfo* si, const android_dlextinfo* extinfo) {
+  // At the caller's address (ANDROID_DLEXT_LOAD_AT_FIXED_ADDRESS).
+  if (extinfo != nullptr && (extinfo->flags & ANDROID_DLEXT_LOAD_AT_FIXED_ADDRESS) != 0 &&
+      si->base == reinterpret_cast<ElfW(Addr)>(extinfo->reserved_addr)) {
+    return true;
+  }
+  // Loaded at the addresses in its own program headers
+  // (ANDROID_DLEXT_FORCE_FIXED_VADDR).
+  return si->load_bias == 0;
+}
+
+static bool has_gnu_relro(const soinfo* si) {
+  for (size_t i = 0; i < si->phnum; ++i) {
+    if (si->phdr[i].p_type == PT_GNU_RELRO) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void hash_bytes(uint64_t* hash, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    *hash = (*hash ^ p[i]) * 1099511628211ULL;
+  }
+}
+
+// The file a library's pages are kept in is named after the library, the
+// file it was loaded from, and the address it was loaded at.
+static void get_cache_file_name(const soinfo* si, char* name, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  const char* realpath = si->get_realpath();
+  hash_bytes(&hash, realpath, strlen(realpath));
+  dev_t dev = si->get_st_dev();
+  ino_t ino = si->get_st_ino();
+  off64_t file_offset = si->get_file_offset();
+  ElfW(Addr) base = si->base;
+  hash_bytes(&hash, &dev, sizeof(dev));
+  hash_bytes(&hash, &ino, sizeof(ino));
+  hash_bytes(&hash, &file_offset, sizeof(file_offset));
+  hash_bytes(&hash, &base, sizeof(base));
+  snprintf(name, size, "%.64s-%016" PRIx64 ".relro", basename(realpath), hash);
+}
+
+static void map_from_cache(const soinfo* si, int fd, const char* name) {
+  struct stat st;
+  if (TEMP_FAILURE_RETRY(fstat(fd, &st)) != 0 || !S_ISREG(st.st_mode) || !is_trusted(st)) {
+    DL_WARN("not using \"%s\" from the RELRO cache: it must not be writable by other users", name);
+    return;
+  }
+  if (phdr_table_map_gnu_relro(si->phdr, si->phnum, si->load_bias, fd) < 0) {
+    TRACE("\"%s\": failed mapping the GNU RELRO section from \"%s\": %s",
+          si->get_realpath(), name, strerror(errno));
+    return;
+  }
+  // Marks the file as used for prune_cache(). Only its owner can do that.
+  futimens(fd, nullptr);
+}
+
+// Removes the least recently used files (by mtime) until there's room for
+// one more. Temporary files left behind by writers that died count too, and
+// being the oldest they go first.
+static void prune_cache(int dir_fd) {
+  int fd = TEMP_FAILURE_RETRY(openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (fd == -1) {
+    return;
+  }
+  DIR* dir = fdopendir(fd);
+  if (dir == nullptr) {
+    close(fd);
+    return;
+  }
+
+  while (true) {
+    size_t count = 0;
+    char oldest[NAME_MAX + 1] = "";
+    struct timespec oldest_mtime = {};
+    rewinddir(dir);
+    while (dirent* e = readdir(dir)) {
+      struct stat st;
+      if (strstr(e->d_name, ".relro") == nullptr ||
+          fstatat(dir_fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      ++count;
+      if (oldest[0] == '\0' || st.st_mtim.tv_sec < oldest_mtime.tv_sec ||
+          (st.st_mtim.tv_sec == oldest_mtime.tv_sec &&
+           st.st_mtim.tv_nsec < oldest_mtime.tv_nsec)) {
+        strlcpy(oldest, e->d_name, sizeof(oldest));
+        oldest_mtime = st.st_mtim;
+      }
+    }
+    if (count < kRelroCacheMaxFiles || unlinkat(dir_fd, oldest, 0) != 0) {
+      break;
+    }
+  }
+  closedir(dir);
+}
+
+// Written under a temporary name and renamed into place, so that other
+// processes only ever find complete files. A file already under the
+// temporary name was left by a writer that died, with the pid we have now.
+static void write_to_cache(const soinfo* si, int dir_fd, const char* name) {
+  prune_cache(dir_fd);
+
+  char temp_name[PATH_MAX];
+  snprintf(temp_name, sizeof(temp_name), "%s.%d", name, getpid());
+  unlinkat(dir_fd, temp_name, 0);
+  int fd = TEMP_FAILURE_RETRY(openat(dir_fd, temp_name,
+                                     O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0400));
+  if (fd == -1) {
+    TRACE("\"%s\": can't create \"%s\" in the RELRO cache: %s",
+          si->get_realpath(), temp_name, strerror(errno));
+    return;
+  }
+  if (phdr_table_serialize_gnu_relro(si->phdr, si->phnum, si->load_bias, fd) < 0 ||
+      renameat(dir_fd, temp_name, dir_fd, name) != 0) {
+    TRACE("\"%s\": failed writing \"%s\" to the RELRO cache: %s",
+          si->get_realpath(), name, strerror(errno));
+    unlinkat(dir_fd, temp_name, 0);
+  }
+  close(fd);
+}
+
+void relro_cache_share(const soinfo* si, const android_dlextinfo* extinfo) {
+  // Only libraries loaded from a file: not the vdso, say.
+  if (g_relro_cache_dir[0] == '\0' || si->get_st_ino() == 0 || !has_gnu_relro(si) ||
+      !is_at_fixed_address(si, extinfo)) {
+    return;
+  }
+
+  int dir_fd = open_cache_dir(g_relro_cache_dir);
+  if (dir_fd == -1) {
+    return;
+  }
+  char name[NAME_MAX + 1];
+  get_cache_file_name(si, name, sizeof(name));
+  int fd = TEMP_FAILURE_RETRY(openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+  if (fd != -1) {
+    map_from_cache(si, fd, name);
+    close(fd);
+  } else if (errno == ENOENT) {
+    write_to_cache(si, dir_fd, name);
+  }
+  close(dir_fd);
+}
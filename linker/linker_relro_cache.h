@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LINKER_RELRO_CACHE_H
+#define __LINKER_RELRO_CACHE_H
+
+#include <android/dlext.h>
+
+struct soinfo;
+
+// Shares the relocated RELRO pages of libraries between processes that load
+// them at the same address, as ANDROID_DLEXT_WRITE_RELRO and
+// ANDROID_DLEXT_USE_RELRO do, but without a caller arranging it: the
+// LD_RELRO_CACHE environment variable names a directory for the linker to
+// keep the pages in.
+//
+// Only libraries at an address that doesn't depend on ASLR are shared: those
+// loaded at an address the caller fixed (ANDROID_DLEXT_LOAD_AT_FIXED_ADDRESS)
+// or at the addresses in their own program headers
+// (ANDROID_DLEXT_FORCE_FIXED_VADDR). The directory keeps the most recently
+// used files, up to a fixed number.
+//
+// The first process to load a library at a given address writes its RELRO
+// segment to the cache and maps it back. Later ones compare their own
+// relocated pages with the file and map those that are identical, so sharing
+// is safe whatever else differs between the processes. It doesn't save the
+// relocation itself, since what a RELRO page holds depends on where every
+// library it refers to was loaded, and only comparing can tell.
+//
+// The directory has to belong to the process's user (or root) and must not be
+// writable by anyone else: a mapped page reflects later writes to its file.
+
+// Returns false, and leaves sharing disabled, if dir can't be used.
+bool relro_cache_init(const char* dir);
+
+// Called once si has been relocated, with the extinfo it was linked with, and
+// its RELRO segment protected. Any failure just means si's pages aren't
+// shared.
+void relro_cache_share(const soinfo* si, const android_dlextinfo* extinfo);
+
+#endif
@@ -34,11 +34,15 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <async_safe/log.h>
 
 #include "linker_debug.h"
 #include "linker_globals.h"
 #include "linker_logger.h"
+#include "linker_profile.h"
+#include "linker_symbol_cache.h"
 #include "linker_utils.h"
 
 // TODO(dimitry): These functions are currently located in linker.cpp - find a better place for it
@@ -285,50 +289,77 @@ bool soinfo::elf_lookup(SymbolName& symbol_name,
   return true;
 }
 
-ElfW(Sym)* soinfo::find_symbol_by_address(const void* addr) {
-  return is_gnu_hash() ? gnu_addr_lookup(addr) : elf_addr_lookup(addr);
-}
-
 static bool symbol_matches_soaddr(const ElfW(Sym)* sym, ElfW(Addr) soaddr) {
   return sym->st_shndx != SHN_UNDEF &&
       soaddr >= sym->st_value &&
       soaddr < sym->st_value + sym->st_size;
 }
 
-ElfW(Sym)* soinfo::gnu_addr_lookup(const void* addr) {
-  ElfW(Addr) soaddr = reinterpret_cast<ElfW(Addr)>(addr) - load_bias;
+// Of the symbols that contain addr, returns the one with the lowest index,
+// which is the one a walk of the hash table would find first.
+ElfW(Sym)* soinfo::find_symbol_by_address(const void* addr) {
+  if (!symbols_by_address_indexed_) {
+    index_symbols_by_address();
+  }
 
-  for (size_t i = 0; i < gnu_nbucket_; ++i) {
-    uint32_t n = gnu_bucket_[i];
+  ElfW(Addr) soaddr = reinterpret_cast<ElfW(Addr)>(addr) - load_bias;
+  auto it = std::upper_bound(symbols_by_address_.begin(), symbols_by_address_.end(), soaddr,
+                             [&](ElfW(Addr) value, uint32_t n) {
+    return value < symtab_[n].st_value;
+  });
 
-    if (n == 0) {
-      continue;
+  // Every symbol that could contain soaddr starts less than max_symbol_size_
+  // before it.
+  ElfW(Sym)* found = nullptr;
+  while (it != symbols_by_address_.begin()) {
+    uint32_t n = *--it;
+    ElfW(Sym)* sym = symtab_ + n;
+    if (soaddr - sym->st_value >= max_symbol_size_) {
+      break;
+    }
+    if (symbol_matches_soaddr(sym, soaddr) && (found == nullptr || sym < found)) {
+      found = sym;
     }
-
-    do {
-      ElfW(Sym)* sym = symtab_ + n;
-      if (symbol_matches_soaddr(sym, soaddr)) {
-        return sym;
-      }
-    } while ((gnu_chain_[n++] & 1) == 0);
   }
-
-  return nullptr;
+  return found;
 }
 
-ElfW(Sym)* soinfo::elf_addr_lookup(const void* addr) {
-  ElfW(Addr) soaddr = reinterpret_cast<ElfW(Addr)>(addr) - load_bias;
+void soinfo::index_symbols_by_address() {
+  symbols_by_address_indexed_ = true;
+  max_symbol_size_ = 0;
+
+  auto add = [&](uint32_t n) {
+    const ElfW(Sym)* sym = symtab_ + n;
+    // A symbol without a size can't contain anything.
+    if (sym->st_shndx != SHN_UNDEF && sym->st_size != 0) {
+      symbols_by_address_.push_back(n);
+      max_symbol_size_ = std::max(max_symbol_size_, static_cast<ElfW(Addr)>(sym->st_size));
+    }
+  };
 
-  // Search the library's symbol table for any defined symbol which
-  // contains this address.
-  for (size_t i = 0; i < nchain_; ++i) {
-    ElfW(Sym)* sym = symtab_ + i;
-    if (symbol_matches_soaddr(sym, soaddr)) {
-      return sym;
+  if (is_gnu_hash()) {
+    for (size_t i = 0; i < gnu_nbucket_; ++i) {
+      uint32_t n = gnu_bucket_[i];
+      if (n == 0) {
+        continue;
+      }
+      do {
+        add(n);
+      } while ((gnu_chain_[n++] & 1) == 0);
+    }
+  } else {
+    for (size_t i = 0; i < nchain_; ++i) {
+      add(i);
     }
   }
 
-  return nullptr;
+  std::sort(symbols_by_address_.begin(), symbols_by_address_.end(), [&](uint32_t a, uint32_t b) {
+    if (symtab_[a].st_value != symtab_[b].st_value) {
+      return symtab_[a].st_value < symtab_[b].st_value;
+    }
+    return a < b;
+  });
+  symbols_by_address_.shrink_to_fit();
 }
 
 static void call_function(const char* function_name __unused,
@@ -415,9 +446,12 @@ void soinfo::call_constructors() {
     bionic_trace_begin((std::string("calling constructors: ") + get_realpath()).c_str());
   }
 
-  // DT_INIT should be called before DT_INIT_ARRAY if both are present.
-  call_function("DT_INIT", init_func_, get_realpath());
-  call_array("DT_INIT_ARRAY", init_array_, init_array_count_, false, get_realpath());
+  {
+    LinkerProfileTimer constructors_timer(this, kProfileConstructors);
+    // DT_INIT should be called before DT_INIT_ARRAY if both are present.
+    call_function("DT_INIT", init_func_, get_realpath());
+    call_array("DT_INIT_ARRAY", init_array_, init_array_count_, false, get_realpath());
+  }
 
   if (!is_linker()) {
     bionic_trace_end();
@@ -523,6 +557,12 @@ void soinfo::set_dt_flags_1(uint32_t dt_flags_1) {
   if (has_min_version(1)) {
     if ((dt_flags_1 & DF_1_GLOBAL) != 0) {
       rtld_flags_ |= RTLD_GLOBAL;
+
+      // Joining the global group from anywhere but its end can change which
+      // definitions it finds first.
+      if (is_linked() && (dt_flags_1_ & DF_1_GLOBAL) == 0) {
+        symbol_cache_invalidate();
+      }
     }
 
     if ((dt_flags_1 & DF_1_NODELETE) != 0) {
@@ -550,6 +590,16 @@ const char* soinfo::get_realpath() const {
 }
 
 void soinfo::set_soname(const char* soname) {
+  // The namespaces index their soinfos by soname. It's usually set twice,
+  // from the ElfReader's copy of the string table and then from the loaded
+  // one, which doesn't change the key.
+  const char* old_soname = get_soname();
+  bool changed = (old_soname == nullptr || soname == nullptr) ? old_soname != soname
+                                                              : strcmp(old_soname, soname) != 0;
+  if (changed) {
+    for_each_namespace([&](android_namespace_t* ns) { ns->unindex_soname(this); });
+  }
+
 #if defined(__work_around_b_24465209__)
   if (has_min_version(2)) {
     soname_ = soname;
@@ -558,6 +608,10 @@ void soinfo::set_soname(const char* soname) {
 #else
   soname_ = soname;
 #endif
+
+  if (changed) {
+    for_each_namespace([&](android_namespace_t* ns) { ns->index_soname(this); });
+  }
 }
 
 const char* soinfo::get_soname() const {
@@ -636,6 +690,23 @@ ElfW(Addr) soinfo::resolve_symbol_address(const ElfW(Sym)* s) const {
   return static_cast<ElfW(Addr)>(s->st_value + load_bias);
 }
 
+size_t soinfo::get_tls_module_id() const {
+  if (!has_min_version(4)) {
+    return 0;
+  }
+
+  return tls_module_id_;
+}
+
+bool soinfo::get_tls_static_offset(ptrdiff_t* offset) const {
+  if (!has_min_version(4) || !tls_is_static_) {
+    return false;
+  }
+
+  *offset = tls_static_offset_;
+  return true;
+}
+
 const char* soinfo::get_string(ElfW(Word) index) const {
   if (has_min_version(1) && (index >= strtab_size_)) {
     async_safe_fatal("%s: strtab out of bounds error; STRSZ=%zd, name=%d",
@@ -31,7 +31,11 @@
 
 #include <link.h>
 
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "private/bionic_elf_tls.h"
 
 #include "linker_namespaces.h"
 
@@ -43,7 +47,7 @@
                                          // and should not be unmapped
 #define FLAG_NEW_SOINFO       0x40000000 // new soinfo format
 
-#define SOINFO_VERSION 3
+#define SOINFO_VERSION 4
 
 typedef void (*linker_dtor_function_t)();
 typedef void (*linker_ctor_function_t)(int, char**, char**);
@@ -81,6 +85,7 @@ struct version_info {
 
 // TODO(dimitry): remove reference from soinfo member functions to this class.
 class VersionTracker;
+class RelocationSymbolCache;
 
 #if defined(__work_around_b_24465209__)
 #define SOINFO_NAME_LEN 128
@@ -272,18 +277,29 @@ struct soinfo {
   void generate_handle();
   void* to_handle();
 
+  size_t get_tls_module_id() const;
+  bool get_tls_static_offset(ptrdiff_t* offset) const;
+
  private:
   bool elf_lookup(SymbolName& symbol_name, const version_info* vi, uint32_t* symbol_index) const;
-  ElfW(Sym)* elf_addr_lookup(const void* addr);
   bool gnu_lookup(SymbolName& symbol_name, const version_info* vi, uint32_t* symbol_index) const;
-  ElfW(Sym)* gnu_addr_lookup(const void* addr);
+  void index_symbols_by_address();
+
+  template <typename F>
+  void for_each_namespace(F action) {
+    if (primary_namespace_ != nullptr) {
+      action(primary_namespace_);
+    }
+    secondary_namespaces_.for_each(action);
+  }
 
   bool lookup_version_info(const VersionTracker& version_tracker, ElfW(Word) sym,
                            const char* sym_name, const version_info** vi);
 
   template<typename ElfRelIteratorT>
   bool relocate(const VersionTracker& version_tracker, ElfRelIteratorT&& rel_iterator,
-                const soinfo_list_t& global_group, const soinfo_list_t& local_group);
+                const soinfo_list_t& global_group, const soinfo_list_t& local_group,
+                RelocationSymbolCache* symbol_cache);
 
  private:
   // This part of the structure is only available
@@ -337,6 +353,21 @@ struct soinfo {
   android_namespace_list_t secondary_namespaces_;
   uintptr_t handle_;
 
+  // version >= 4
+  size_t tls_module_id_; // 0 if there's no PT_TLS segment.
+  bool tls_is_static_;
+  ptrdiff_t tls_static_offset_;
+  std::vector<std::unique_ptr<TlsDynamicResolverArg>> tlsdesc_args_;
+
+  const ElfW(Relr)* relr_;
+  size_t relr_count_;
+
+  // For find_symbol_by_address(), built by the first call: the defined
+  // symbols the hash table reaches, sorted by address and then by index.
+  bool symbols_by_address_indexed_;
+  std::vector<uint32_t> symbols_by_address_;
+  ElfW(Addr) max_symbol_size_;
+
   friend soinfo* get_libdl_info(const char* linker_path, const link_map& linker_map);
 };
 
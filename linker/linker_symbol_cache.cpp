@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "linker_symbol_cache.h"
+
+#include <string.h>
+
+#include "linker_soinfo.h"
+
+// Direct-mapped by name hash: a collision just costs a lookup. The table
+// starts small and doubles whenever half of it is in use, so it's sized to
+// the symbols actually being looked up rather than to the worst case.
+static constexpr size_t kSymbolCacheMinSize = 128;
+static constexpr size_t kSymbolCacheMaxSize = 4096;
+
+struct SymbolCacheEntry {
+  const android_namespace_t* ns;
+  uint32_t gnu_hash;
+  uint32_t version_hash;
+  // Both in the string table of the library that did the lookup, which
+  // can't be freed without invalidating the cache.
+  const char* name;
+  const char* version;
+  soinfo* si;
+  const ElfW(Sym)* sym;
+  // Entries from before the last symbol_cache_invalidate() are empty.
+  uint32_t generation;
+};
+
+static SymbolCacheEntry* g_symbol_cache;
+static size_t g_symbol_cache_size;
+static size_t g_symbol_cache_used;
+static uint32_t g_symbol_cache_generation = 1;
+
+static bool version_matches(const SymbolCacheEntry& entry, const version_info* vi) {
+  if (vi == nullptr) {
+    return entry.version == nullptr;
+  }
+  return entry.version != nullptr && entry.version_hash == vi->elf_hash &&
+         strcmp(entry.version, vi->name) == 0;
+}
+
+static bool is_live(const SymbolCacheEntry& entry) {
+  return entry.generation == g_symbol_cache_generation;
+}
+
+// Moves the live entries to a table twice the size (or the first table).
+static void grow_symbol_cache() {
+  size_t new_size = g_symbol_cache_size == 0 ? kSymbolCacheMinSize : g_symbol_cache_size * 2;
+  SymbolCacheEntry* new_cache = new SymbolCacheEntry[new_size]();
+  g_symbol_cache_used = 0;
+  for (size_t i = 0; i < g_symbol_cache_size; ++i) {
+    const SymbolCacheEntry& entry = g_symbol_cache[i];
+    if (is_live(entry)) {
+      SymbolCacheEntry& new_entry = new_cache[entry.gnu_hash % new_size];
+      if (!is_live(new_entry)) {
+        ++g_symbol_cache_used;
+      }
+      new_entry = entry;
+    }
+  }
+  delete[] g_symbol_cache;
+  g_symbol_cache = new_cache;
+  g_symbol_cache_size = new_size;
+}
+
+bool symbol_cache_find(const android_namespace_t* ns, uint32_t gnu_hash, const char* name,
+                       const version_info* vi, soinfo** si, const ElfW(Sym)** sym) {
+  if (g_symbol_cache == nullptr) {
+    return false;
+  }
+
+  const SymbolCacheEntry& entry = g_symbol_cache[gnu_hash % g_symbol_cache_size];
+  if (!is_live(entry) || entry.ns != ns || entry.gnu_hash != gnu_hash ||
+      strcmp(entry.name, name) != 0 || !version_matches(entry, vi)) {
+    return false;
+  }
+
+  *si = entry.si;
+  *sym = entry.sym;
+  return true;
+}
+
+void symbol_cache_insert(const android_namespace_t* ns, uint32_t gnu_hash, const char* name,
+                         const version_info* vi, soinfo* si, const ElfW(Sym)* sym) {
+  if (g_symbol_cache == nullptr ||
+      (g_symbol_cache_used >= g_symbol_cache_size / 2 &&
+       g_symbol_cache_size < kSymbolCacheMaxSize)) {
+    grow_symbol_cache();
+  }
+
+  SymbolCacheEntry& entry = g_symbol_cache[gnu_hash % g_symbol_cache_size];
+  if (!is_live(entry)) {
+    ++g_symbol_cache_used;
+  }
+  entry.ns = ns;
+  entry.gnu_hash = gnu_hash;
+  entry.version_hash = vi != nullptr ? vi->elf_hash : 0;
+  entry.name = name;
+  entry.version = vi != nullptr ? vi->name : nullptr;
+  entry.si = si;
+  entry.sym = sym;
+  entry.generation = g_symbol_cache_generation;
+}
+
+// Called for every soinfo freed, so it mustn't cost more than the table is
+// worth: starting a new generation empties every entry at once.
+void symbol_cache_invalidate() {
+  g_symbol_cache_used = 0;
+  if (++g_symbol_cache_generation == 0) {
+    // After 2^32 generations an entry could look live again.
+    if (g_symbol_cache != nullptr) {
+      memset(g_symbol_cache, 0, g_symbol_cache_size * sizeof(SymbolCacheEntry));
+    }
+    g_symbol_cache_generation = 1;
+  }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LINKER_SYMBOL_CACHE_H
+#define __LINKER_SYMBOL_CACHE_H
+
+#include <link.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct android_namespace_t;
+struct soinfo;
+struct version_info;
+
+// Symbol lookups made while relocating one object, by symbol index. GLOB_DAT
+// and JUMP_SLOT relocations, and the groups in packed relocations, tend to
+// reference the same symbol several times in a row or close together.
+class RelocationSymbolCache {
+ public:
+  RelocationSymbolCache() : entries_() {}
+
+  // A cached lookup that found nothing (a weak reference) has *si and *sym set
+  // to nullptr.
+  bool find(ElfW(Word) sym_index, soinfo** si, const ElfW(Sym)** sym) const {
+    const Entry& entry = entries_[sym_index % kSize];
+    if (entry.sym_index != sym_index) {
+      return false;
+    }
+    *si = entry.si;
+    *sym = entry.sym;
+    return true;
+  }
+
+  void insert(ElfW(Word) sym_index, soinfo* si, const ElfW(Sym)* sym) {
+    Entry& entry = entries_[sym_index % kSize];
+    entry.sym_index = sym_index;
+    entry.si = si;
+    entry.sym = sym;
+  }
+
+ private:
+  // Direct-mapped, which is all the locality above needs. Index 0 is never a
+  // symbol, so it marks an empty entry.
+  static constexpr size_t kSize = 64;
+
+  struct Entry {
+    ElfW(Word) sym_index;
+    soinfo* si;
+    const ElfW(Sym)* sym;
+  };
+
+  Entry entries_[kSize];
+};
+
+// Symbols that lookups from a namespace found in its global group (the main
+// executable, the LD_PRELOADs and the DF_1_GLOBAL libraries), so that the
+// many libraries referring to, say, operator new don't each walk it again.
+//
+// Only those lookups are cached because the global group only ever grows at
+// the end while its members are loaded: the first definition found in it
+// stays the first. Anything that breaks that must call
+// symbol_cache_invalidate(), as freeing a soinfo does.
+bool symbol_cache_find(const android_namespace_t* ns, uint32_t gnu_hash, const char* name,
+                       const version_info* vi, soinfo** si, const ElfW(Sym)** sym);
+void symbol_cache_insert(const android_namespace_t* ns, uint32_t gnu_hash, const char* name,
+                         const version_info* vi, soinfo* si, const ElfW(Sym)* sym);
+void symbol_cache_invalidate();
+
+#endif
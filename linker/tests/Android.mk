@@ -44,11 +44,14 @@ LOCAL_SRC_FILES := \
   linker_globals.cpp \
   linked_list_test.cpp \
   linker_memory_allocator_test.cpp \
+  linker_relr_test.cpp \
   linker_sleb128_test.cpp \
+  linker_symbol_cache_test.cpp \
   linker_utils_test.cpp \
   ../linker_allocator.cpp \
   ../linker_block_allocator.cpp \
   ../linker_config.cpp \
+  ../linker_symbol_cache.cpp \
   ../linker_utils.cpp \
 
 LOCAL_STATIC_LIBRARIES += libasync_safe libbase
@@ -28,7 +28,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <gtest/gtest.h>
 
@@ -82,7 +84,7 @@ static std::vector<std::string> resolve_paths(std::vector<std::string> paths) {
   return resolved_paths;
 }
 
-static void run_linker_config_smoke_test(bool is_asan) {
+static void run_linker_config_smoke_test(bool is_asan, bool is_compiled) {
   const std::vector<std::string> kExpectedDefaultSearchPath =
       resolve_paths(is_asan ? std::vector<std::string>({ "/data", "/vendor/lib" ARCH_SUFFIX }) :
                               std::vector<std::string>({ "/vendor/lib" ARCH_SUFFIX }));
@@ -105,6 +107,17 @@ static void run_linker_config_smoke_test(bool is_asan) {
 
   android::base::WriteStringToFile(config_str, tmp_file.path);
 
+  std::string compiled_path = std::string(tmp_file.path) + ".bin";
+  auto compiled_guard =
+      android::base::make_scope_guard([&compiled_path] { unlink(compiled_path.c_str()); });
+
+  if (is_compiled) {
+    std::string error_msg;
+    ASSERT_TRUE(Config::write_compiled_config(tmp_file.path,
+                                              compiled_path.c_str(),
+                                              &error_msg)) << error_msg;
+  }
+
   TemporaryDir tmp_dir;
 
   std::string executable_path = std::string(tmp_dir.path) + "/some-binary";
@@ -138,8 +151,8 @@ static void run_linker_config_smoke_test(bool is_asan) {
 
   const auto& default_ns_links = default_ns_config->links();
   ASSERT_EQ(1U, default_ns_links.size());
-  ASSERT_EQ("system", default_ns_links[0].ns_name());
-  ASSERT_EQ("libc.so:libm.so:libdl.so:libstdc++.so", default_ns_links[0].shared_libs());
+  ASSERT_STREQ("system", default_ns_links[0].ns_name());
+  ASSERT_STREQ("libc.so:libm.so:libdl.so:libstdc++.so", default_ns_links[0].shared_libs());
 
   auto& ns_configs = config->namespace_configs();
   ASSERT_EQ(2U, ns_configs.size());
@@ -165,9 +178,129 @@ static void run_linker_config_smoke_test(bool is_asan) {
 }
 
 TEST(linker_config, smoke) {
-  run_linker_config_smoke_test(false);
+  run_linker_config_smoke_test(false, false);
 }
 
 TEST(linker_config, asan_smoke) {
-  run_linker_config_smoke_test(true);
+  run_linker_config_smoke_test(true, false);
+}
+
+TEST(linker_config, compiled_smoke) {
+  run_linker_config_smoke_test(false, true);
+}
+
+TEST(linker_config, compiled_asan_smoke) {
+  run_linker_config_smoke_test(true, true);
+}
+
+static bool is_system_visible(const char* config_path, const std::string& executable_path) {
+  const Config* config = nullptr;
+  std::string error_msg;
+  if (!Config::read_binary_config(config_path, executable_path.c_str(), false,
+                                  &config, &error_msg)) {
+    return false;
+  }
+
+  for (auto& ns : config->namespace_configs()) {
+    if (strcmp(ns->name(), "system") == 0) {
+      return ns->visible();
+    }
+  }
+  return false;
+}
+
+TEST(linker_config, compiled_validation) {
+  TemporaryFile tmp_file;
+  close(tmp_file.fd);
+  tmp_file.fd = -1;
+
+  TemporaryDir tmp_dir;
+  std::string executable_path = std::string(tmp_dir.path) + "/some-binary";
+  std::string config = config_str;
+  config.replace(config.find("/data/local/tmp"), 15, "/nonexistent");
+  config += std::string("dir.test = ") + tmp_dir.path + "\n";
+  std::string other_config = config;
+  other_config.replace(other_config.find("visible = true"), 14, "visible = nope");
+
+  std::string compiled_path = std::string(tmp_file.path) + ".bin";
+  auto compiled_guard =
+      android::base::make_scope_guard([&compiled_path] { unlink(compiled_path.c_str()); });
+
+  // A dir.<section> property after the first section doesn't select it.
+  ASSERT_TRUE(android::base::WriteStringToFile(config, tmp_file.path));
+  std::string error_msg;
+  ASSERT_TRUE(Config::write_compiled_config(tmp_file.path, compiled_path.c_str(), &error_msg))
+      << error_msg;
+  ASSERT_FALSE(is_system_visible(tmp_file.path, executable_path));
+
+  config.insert(0, std::string("dir.test = ") + tmp_dir.path + "\n");
+  other_config.insert(0, std::string("dir.test = ") + tmp_dir.path + "\n");
+  ASSERT_TRUE(android::base::WriteStringToFile(config, tmp_file.path));
+  ASSERT_TRUE(Config::write_compiled_config(tmp_file.path, compiled_path.c_str(), &error_msg))
+      << error_msg;
+  ASSERT_TRUE(is_system_visible(tmp_file.path, executable_path));
+
+  struct stat st;
+  ASSERT_EQ(0, stat(tmp_file.path, &st));
+
+  // Same size, and no newer than the compiled form: the compiled form is
+  // trusted without reading the text file.
+  ASSERT_TRUE(android::base::WriteStringToFile(other_config, tmp_file.path));
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+  ASSERT_EQ(0, utimensat(AT_FDCWD, tmp_file.path, times, 0));
+  ASSERT_TRUE(is_system_visible(tmp_file.path, executable_path));
+
+  // A newer text file is compiled instead.
+  times[1].tv_sec += 10;
+  ASSERT_EQ(0, utimensat(AT_FDCWD, tmp_file.path, times, 0));
+  ASSERT_FALSE(is_system_visible(tmp_file.path, executable_path));
+
+  // So is one of another size, however old.
+  ASSERT_TRUE(android::base::WriteStringToFile(other_config + "\n", tmp_file.path));
+  times[1].tv_sec -= 20;
+  ASSERT_EQ(0, utimensat(AT_FDCWD, tmp_file.path, times, 0));
+  ASSERT_FALSE(is_system_visible(tmp_file.path, executable_path));
+
+  ASSERT_TRUE(android::base::WriteStringToFile(config, tmp_file.path));
+  ASSERT_TRUE(is_system_visible(tmp_file.path, executable_path));
+
+  // A truncated compiled file is ignored.
+  ASSERT_EQ(0, truncate(compiled_path.c_str(), 64));
+  ASSERT_TRUE(is_system_visible(tmp_file.path, executable_path));
+}
+
+static void run_linker_config_error_test(bool is_compiled) {
+  TemporaryFile tmp_file;
+  close(tmp_file.fd);
+  tmp_file.fd = -1;
+
+  TemporaryDir tmp_dir;
+  std::string executable_path = std::string(tmp_dir.path) + "/some-binary";
+  std::string config = std::string("dir.test = ") + tmp_dir.path + "\n" + config_str;
+  config.replace(config.find("links = system"), 14, "links = vendor");
+  ASSERT_TRUE(android::base::WriteStringToFile(config, tmp_file.path));
+
+  std::string compiled_path = std::string(tmp_file.path) + ".bin";
+  auto compiled_guard =
+      android::base::make_scope_guard([&compiled_path] { unlink(compiled_path.c_str()); });
+
+  std::string error_msg;
+  if (is_compiled) {
+    ASSERT_TRUE(Config::write_compiled_config(tmp_file.path, compiled_path.c_str(), &error_msg))
+        << error_msg;
+  }
+
+  // An error is reported for the section of the binary, with its line.
+  const Config* config_ptr = nullptr;
+  ASSERT_FALSE(Config::read_binary_config(tmp_file.path, executable_path.c_str(), false,
+                                          &config_ptr, &error_msg));
+  ASSERT_EQ(std::string(tmp_file.path) + ":14: error: undefined namespace: vendor", error_msg);
+}
+
+TEST(linker_config, error) {
+  run_linker_config_error_test(false);
+}
+
+TEST(linker_config, compiled_error) {
+  run_linker_config_error_test(true);
 }
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <link.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../linker_relr.h"
+
+static constexpr size_t kBitmapWords = 8 * sizeof(ElfW(Addr)) - 1;
+
+// Words holding their own index, as addends, with the load bias pointing at
+// the first so that table entries are byte offsets into them.
+class RelrTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < words_.size(); ++i) words_[i] = i;
+  }
+
+  ElfW(Addr) bias() { return reinterpret_cast<ElfW(Addr)>(words_.data()); }
+
+  static ElfW(Relr) address(size_t i) { return i * sizeof(ElfW(Addr)); }
+
+  // Checks that exactly the words at 'relocated' have had the bias added.
+  void ExpectRelocated(const std::vector<size_t>& relocated) {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      bool expected = std::find(relocated.begin(), relocated.end(), i) != relocated.end();
+      EXPECT_EQ(expected ? i + bias() : i, words_[i]) << "word " << i;
+    }
+  }
+
+  std::vector<ElfW(Addr)> words_ = std::vector<ElfW(Addr)>(3 * kBitmapWords);
+};
+
+TEST_F(RelrTest, empty) {
+  ASSERT_TRUE(relocate_relr(nullptr, nullptr, bias()));
+  ExpectRelocated({});
+}
+
+TEST_F(RelrTest, addresses) {
+  const ElfW(Relr) relr[] = { address(0), address(2), address(5), address(kBitmapWords + 7) };
+  ASSERT_TRUE(relocate_relr(relr, relr + 4, bias()));
+  ExpectRelocated({ 0, 2, 5, kBitmapWords + 7 });
+}
+
+TEST_F(RelrTest, bitmaps) {
+  // Bit 0 marks a bitmap; bit n > 0 covers the n-th word after the address.
+  ElfW(Relr) last = static_cast<ElfW(Relr)>(1) << kBitmapWords;
+  const ElfW(Relr) relr[] = {
+    address(4),
+    (1 << 1) | (1 << 3) | last | 1,         // Words 5, 7 and 4 + kBitmapWords.
+    (1 << 1) | 1,                           // Word 5 + kBitmapWords.
+    address(2 * kBitmapWords + 8),
+    (1 << 2) | 1,                           // Word 2 * kBitmapWords + 10.
+  };
+  ASSERT_TRUE(relocate_relr(relr, relr + 5, bias()));
+  ExpectRelocated({ 4, 5, 7, 4 + kBitmapWords, 5 + kBitmapWords,
+                    2 * kBitmapWords + 8, 2 * kBitmapWords + 10 });
+}
+
+TEST_F(RelrTest, leading_bitmap) {
+  const ElfW(Relr) relr[] = { (1 << 1) | 1, address(3) };
+  ASSERT_FALSE(relocate_relr(relr, relr + 2, bias()));
+  ExpectRelocated({});
+}
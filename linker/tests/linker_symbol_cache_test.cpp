@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "../linker_soinfo.h"
+#include "../linker_symbol_cache.h"
+
+// The caches never look inside these, so fake ones will do.
+static soinfo* fake_soinfo(uintptr_t i) {
+  return reinterpret_cast<soinfo*>(0x1000 * i);
+}
+
+static const ElfW(Sym)* fake_sym(uintptr_t i) {
+  return reinterpret_cast<const ElfW(Sym)*>(0x10 * i);
+}
+
+static const android_namespace_t* fake_ns(uintptr_t i) {
+  return reinterpret_cast<const android_namespace_t*>(0x100 * i);
+}
+
+TEST(linker_symbol_cache, relocation_cache) {
+  RelocationSymbolCache cache;
+  soinfo* si;
+  const ElfW(Sym)* sym;
+
+  ASSERT_FALSE(cache.find(1, &si, &sym));
+
+  cache.insert(1, fake_soinfo(1), fake_sym(1));
+  ASSERT_TRUE(cache.find(1, &si, &sym));
+  ASSERT_EQ(fake_soinfo(1), si);
+  ASSERT_EQ(fake_sym(1), sym);
+
+  // Unresolved weak references are cached too.
+  cache.insert(2, nullptr, nullptr);
+  ASSERT_TRUE(cache.find(2, &si, &sym));
+  ASSERT_EQ(nullptr, si);
+  ASSERT_EQ(nullptr, sym);
+
+  // A colliding index replaces the entry.
+  cache.insert(65, fake_soinfo(3), fake_sym(3));
+  ASSERT_FALSE(cache.find(1, &si, &sym));
+  ASSERT_TRUE(cache.find(65, &si, &sym));
+  ASSERT_EQ(fake_soinfo(3), si);
+}
+
+TEST(linker_symbol_cache, global_cache) {
+  soinfo* si;
+  const ElfW(Sym)* sym;
+
+  version_info v1;
+  v1.elf_hash = 1;
+  v1.name = "V1";
+  version_info v2;
+  v2.elf_hash = 2;
+  v2.name = "V2";
+
+  symbol_cache_invalidate();
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 42, "foo", nullptr, &si, &sym));
+
+  symbol_cache_insert(fake_ns(1), 42, "foo", nullptr, fake_soinfo(1), fake_sym(1));
+  symbol_cache_insert(fake_ns(1), 43, "bar", &v1, fake_soinfo(2), fake_sym(2));
+
+  ASSERT_TRUE(symbol_cache_find(fake_ns(1), 42, "foo", nullptr, &si, &sym));
+  ASSERT_EQ(fake_soinfo(1), si);
+  ASSERT_EQ(fake_sym(1), sym);
+  ASSERT_TRUE(symbol_cache_find(fake_ns(1), 43, "bar", &v1, &si, &sym));
+  ASSERT_EQ(fake_soinfo(2), si);
+
+  // Everything in the key has to match.
+  ASSERT_FALSE(symbol_cache_find(fake_ns(2), 42, "foo", nullptr, &si, &sym));
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 42, "fox", nullptr, &si, &sym));
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 42, "foo", &v1, &si, &sym));
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 43, "bar", nullptr, &si, &sym));
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 43, "bar", &v2, &si, &sym));
+
+  symbol_cache_invalidate();
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 42, "foo", nullptr, &si, &sym));
+  ASSERT_FALSE(symbol_cache_find(fake_ns(1), 43, "bar", &v1, &si, &sym));
+}
+
+TEST(linker_symbol_cache, global_cache_grows) {
+  soinfo* si;
+  const ElfW(Sym)* sym;
+
+  // Enough distinct hashes to make the table grow several times over, none
+  // of which may lose an entry that didn't collide.
+  symbol_cache_invalidate();
+  for (uint32_t hash = 1; hash <= 1000; ++hash) {
+    symbol_cache_insert(fake_ns(1), hash, "foo", nullptr, fake_soinfo(hash), fake_sym(hash));
+  }
+  for (uint32_t hash = 1; hash <= 1000; ++hash) {
+    ASSERT_TRUE(symbol_cache_find(fake_ns(1), hash, "foo", nullptr, &si, &sym)) << hash;
+    ASSERT_EQ(fake_soinfo(hash), si);
+  }
+
+  symbol_cache_invalidate();
+  for (uint32_t hash = 1; hash <= 1000; ++hash) {
+    ASSERT_FALSE(symbol_cache_find(fake_ns(1), hash, "foo", nullptr, &si, &sym)) << hash;
+  }
+}
@@ -20,17 +20,25 @@
 #include <android-base/properties.h>
 #endif
 
+#include <dirent.h>
 #include <dlfcn.h>
 #include <libgen.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
 
+#include <android-base/file.h>
+
 #include "gtest_globals.h"
+#include "TemporaryFile.h"
 #include "utils.h"
 
 extern "C" int main_global_default_serial() {
@@ -145,6 +153,146 @@ TEST(dl, exec_with_ld_preload) {
 #endif
 }
 
+TEST(dl, exec_with_ld_profile_file) {
+#if defined(__BIONIC__)
+  std::string helper = get_testlib_root() +
+      "/ld_preload_test_helper/ld_preload_test_helper";
+  TemporaryFile tf;
+  std::string env = std::string("LD_PROFILE_FILE=") + tf.filename;
+  chmod(helper.c_str(), 0755);
+  ExecTestHelper eth;
+  eth.SetArgs({ helper.c_str(), nullptr });
+  eth.SetEnv({ env.c_str(), nullptr });
+  eth.Run([&]() { execve(helper.c_str(), eth.GetArgs(), eth.GetEnv()); }, 0, "12345");
+
+  // One line for the event, then one per library, ending with its path.
+  std::string report;
+  ASSERT_TRUE(android::base::ReadFileToString(tf.filename, &report));
+  ASSERT_EQ(0U, report.find("event=startup ")) << report;
+  ASSERT_NE(std::string::npos, report.find("\nlibrary open_ns=")) << report;
+  ASSERT_NE(std::string::npos, report.find("/ld_preload_test_helper_lib1.so\n")) << report;
+  ASSERT_NE(std::string::npos, report.find(" link_count=1 ")) << report;
+
+  // A dlopen() is reported when it returns, with the libraries it loaded,
+  // including for a dlopen() from one of their constructors, which is no
+  // event of its own. Spaces in the name are escaped.
+  TemporaryDir td;
+  std::string lib = std::string(td.dirname) + "/lib with space.so";
+  ASSERT_EQ(0, symlink((get_testlib_root() + "/libtest_dlopen_from_ctor_main.so").c_str(),
+                       lib.c_str())) << strerror(errno);
+  std::string dlopen_helper = get_testlib_root() +
+      "/ld_profile_test_helper/ld_profile_test_helper";
+  chmod(dlopen_helper.c_str(), 0755);
+  TemporaryFile dlopen_tf;
+  std::string dlopen_env = std::string("LD_PROFILE_FILE=") + dlopen_tf.filename;
+  eth.SetArgs({ dlopen_helper.c_str(), lib.c_str(), nullptr });
+  eth.SetEnv({ dlopen_env.c_str(), nullptr });
+  eth.Run([&]() { execve(dlopen_helper.c_str(), eth.GetArgs(), eth.GetEnv()); }, 0, "");
+  unlink(lib.c_str());
+
+  ASSERT_TRUE(android::base::ReadFileToString(dlopen_tf.filename, &report));
+  size_t event = report.find("\nevent=dlopen ");
+  ASSERT_NE(std::string::npos, event) << report;
+  ASSERT_EQ(std::string::npos, report.find("\nevent=dlopen ", event + 1)) << report;
+  std::string event_line = report.substr(event + 1, report.find('\n', event + 1) - event - 1);
+  ASSERT_NE(std::string::npos,
+            event_line.find(std::string(" name=") + td.dirname + "/lib%20with%20space.so"))
+      << event_line;
+  ASSERT_NE(std::string::npos, report.find("/libtest_dlopen_from_ctor_main.so\n", event)) << report;
+  ASSERT_NE(std::string::npos, report.find("/libtest_dlopen_from_ctor.so\n", event)) << report;
+#endif
+}
+
+#if defined(__BIONIC__)
+// Returns the names of the files in dir, removing them so that the
+// TemporaryDir can go.
+static std::vector<std::string> take_relro_cache_files(const char* dir) {
+  std::vector<std::string> names;
+  DIR* d = opendir(dir);
+  while (dirent* e = (d != nullptr) ? readdir(d) : nullptr) {
+    if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+      names.push_back(e->d_name);
+      unlinkat(dirfd(d), e->d_name, 0);
+    }
+  }
+  if (d != nullptr) closedir(d);
+  return names;
+}
+#endif
+
+TEST(dl, exec_with_ld_relro_cache_randomized_address) {
+#if defined(__BIONIC__)
+  std::string helper = get_testlib_root() +
+      "/ld_preload_test_helper/ld_preload_test_helper";
+  TemporaryDir td;
+  std::string env = std::string("LD_RELRO_CACHE=") + td.dirname;
+  chmod(helper.c_str(), 0755);
+  ExecTestHelper eth;
+  eth.SetArgs({ helper.c_str(), nullptr });
+  eth.SetEnv({ env.c_str(), nullptr });
+  eth.Run([&]() { execve(helper.c_str(), eth.GetArgs(), eth.GetEnv()); }, 0, "12345");
+
+  // Nothing here is at a fixed address, so nothing is worth keeping.
+  std::vector<std::string> names = take_relro_cache_files(td.dirname);
+  ASSERT_TRUE(names.empty()) << names[0];
+#endif
+}
+
+#if defined(__BIONIC__)
+static void run_relro_cache_test_helper(const char* dir, const char* mode) {
+  std::string helper = get_testlib_root() +
+      "/relro_cache_test_helper/relro_cache_test_helper";
+  std::string env = std::string("LD_RELRO_CACHE=") + dir;
+  chmod(helper.c_str(), 0755);
+  ExecTestHelper eth;
+  eth.SetArgs({ helper.c_str(), mode, nullptr });
+  eth.SetEnv({ env.c_str(), nullptr });
+  eth.Run([&]() { execve(helper.c_str(), eth.GetArgs(), eth.GetEnv()); }, 0, "");
+}
+#endif
+
+TEST(dl, exec_with_ld_relro_cache_reserved_address) {
+#if defined(__BIONIC__)
+  // Reserved space is still at a random address.
+  TemporaryDir td;
+  run_relro_cache_test_helper(td.dirname, "reserved");
+  std::vector<std::string> names = take_relro_cache_files(td.dirname);
+  ASSERT_TRUE(names.empty()) << names[0];
+#endif
+}
+
+TEST(dl, exec_with_ld_relro_cache_fixed_address) {
+#if defined(__BIONIC__)
+  // Only the library loaded at the fixed address gets a file, and the second
+  // run uses the first run's.
+  TemporaryDir td;
+  run_relro_cache_test_helper(td.dirname, "fixed");
+  run_relro_cache_test_helper(td.dirname, "fixed");
+  std::vector<std::string> names = take_relro_cache_files(td.dirname);
+  ASSERT_EQ(1U, names.size());
+  ASSERT_EQ(0U, names[0].find("ld_preload_test_helper_lib2.so-")) << names[0];
+  ASSERT_EQ(names[0].size() - strlen(".relro"), names[0].rfind(".relro")) << names[0];
+#endif
+}
+
+TEST(dl, exec_with_ld_relro_cache_full) {
+#if defined(__BIONIC__)
+  // A full cache makes room by removing its least recently used file.
+  static const size_t kMaxFiles = 128;
+  TemporaryDir td;
+  for (size_t i = 0; i < kMaxFiles; ++i) {
+    std::string path = std::string(td.dirname) + "/old" + std::to_string(i) + ".relro";
+    ASSERT_TRUE(android::base::WriteStringToFile("", path)) << path;
+    timespec times[2] = { { static_cast<time_t>(1000 + i), 0 }, { static_cast<time_t>(1000 + i), 0 } };
+    ASSERT_EQ(0, utimensat(AT_FDCWD, path.c_str(), times, 0)) << path;
+  }
+  run_relro_cache_test_helper(td.dirname, "fixed");
+  std::vector<std::string> names = take_relro_cache_files(td.dirname);
+  ASSERT_EQ(kMaxFiles, names.size());
+  ASSERT_EQ(names.end(), std::find(names.begin(), names.end(), "old0.relro"));
+  ASSERT_NE(names.end(), std::find(names.begin(), names.end(), "old1.relro"));
+#endif
+}
 
 // ld_config_test_helper must fail because it is depending on a lib which is not
 // in the search path
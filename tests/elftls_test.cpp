@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <string.h>
+
+// Built with -fno-emulated-tls, so these go through native ELF TLS: static
+// TLS for the executable and dynamic TLS for the dlopen()ed library.
+
+static thread_local int tls_initialized = 1234;
+static thread_local int tls_zeroed;
+
+static void* ReadStaticTls(void*) {
+  EXPECT_EQ(1234, tls_initialized);
+  EXPECT_EQ(0, tls_zeroed);
+  tls_initialized = 1;
+  tls_zeroed = 2;
+  return &tls_initialized;
+}
+
+TEST(elftls, static_tls_per_thread) {
+  tls_initialized = 5;
+  tls_zeroed = 6;
+
+  pthread_t t;
+  ASSERT_EQ(0, pthread_create(&t, nullptr, ReadStaticTls, nullptr));
+  void* other_address;
+  ASSERT_EQ(0, pthread_join(t, &other_address));
+
+  ASSERT_NE(&tls_initialized, other_address);
+  ASSERT_EQ(5, tls_initialized);
+  ASSERT_EQ(6, tls_zeroed);
+}
+
+static int* (*g_dynamic_get)();
+
+static void* ReadDynamicTls(void*) {
+  int* p = g_dynamic_get();
+  EXPECT_EQ(42, *p);
+  *p = 1;
+  return p;
+}
+
+TEST(elftls, dynamic_tls_per_thread) {
+  void* handle = dlopen("libtest_elftls_dynamic.so", RTLD_NOW);
+  ASSERT_TRUE(handle != nullptr) << dlerror();
+  g_dynamic_get = reinterpret_cast<int* (*)()>(dlsym(handle, "elftls_dynamic_get"));
+  ASSERT_TRUE(g_dynamic_get != nullptr) << dlerror();
+
+  int* mine = g_dynamic_get();
+  ASSERT_EQ(42, *mine);
+  *mine = 7;
+  ASSERT_EQ(mine, g_dynamic_get());
+
+  // dlsym() returns the calling thread's copy of a TLS variable.
+  ASSERT_EQ(mine, dlsym(handle, "elftls_dynamic_var"));
+
+  pthread_t t;
+  ASSERT_EQ(0, pthread_create(&t, nullptr, ReadDynamicTls, nullptr));
+  void* other;
+  ASSERT_EQ(0, pthread_join(t, &other));
+  ASSERT_NE(mine, other);
+  ASSERT_EQ(7, *mine);
+
+  dlclose(handle);
+}
+
+static int FindTlsModuleId(dl_phdr_info* info, size_t, void* data) {
+  const char* name = info->dlpi_name;
+  if (name != nullptr && strstr(name, "libtest_elftls_dynamic.so") != nullptr) {
+    *static_cast<size_t*>(data) = info->dlpi_tls_modid;
+  }
+  return 0;
+}
+
+TEST(elftls, dlopen_dlclose_reuses_module_id) {
+  size_t first_id = 0;
+  for (int i = 0; i < 100; ++i) {
+    void* handle = dlopen("libtest_elftls_dynamic.so", RTLD_NOW);
+    ASSERT_TRUE(handle != nullptr) << dlerror();
+    auto get = reinterpret_cast<int* (*)()>(dlsym(handle, "elftls_dynamic_get"));
+    ASSERT_TRUE(get != nullptr) << dlerror();
+
+    size_t id = 0;
+    dl_iterate_phdr(FindTlsModuleId, &id);
+    ASSERT_NE(0U, id);
+    if (i == 0) first_id = id;
+    // The id of the previous copy is reused, so the module table and the
+    // DTV don't grow.
+    ASSERT_EQ(first_id, id);
+
+    // Each copy gets a fresh block, not the previous copy's.
+    int* p = get();
+    ASSERT_EQ(42, *p);
+    *p = i;
+
+    dlclose(handle);
+  }
+}
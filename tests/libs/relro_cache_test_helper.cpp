@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android/dlext.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Loads a library into address space it reserved itself. With "fixed", the
+// space is at the same address every run and the linker is told to use it
+// as is, which is what lets it keep the library's RELRO pages in the
+// LD_RELRO_CACHE directory. Otherwise the space is wherever mmap put it.
+int main(int argc, char** argv) {
+  bool fixed = argc > 1 && strcmp(argv[1], "fixed") == 0;
+  size_t reserved_size = 16 * 1024 * 1024;
+#if defined(__LP64__)
+  void* hint = fixed ? reinterpret_cast<void*>(UINT64_C(0x4000000000)) : nullptr;
+#else
+  void* hint = fixed ? reinterpret_cast<void*>(0x30000000) : nullptr;
+#endif
+  void* reserved_addr = mmap(hint, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved_addr == MAP_FAILED || (fixed && reserved_addr != hint)) {
+    fprintf(stderr, "couldn't reserve %p\n", hint);
+    return 1;
+  }
+
+  android_dlextinfo extinfo = {};
+  extinfo.flags = ANDROID_DLEXT_RESERVED_ADDRESS;
+  if (fixed) extinfo.flags |= ANDROID_DLEXT_LOAD_AT_FIXED_ADDRESS;
+  extinfo.reserved_addr = reserved_addr;
+  extinfo.reserved_size = reserved_size;
+  void* handle = android_dlopen_ext("ld_preload_test_helper_lib2.so", RTLD_NOW, &extinfo);
+  if (handle == nullptr) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  return 0;
+}
@@ -28,7 +28,14 @@
 
 #include <gtest/gtest.h>
 
+#include <dlfcn.h>
 #include <link.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
 
 TEST(link, dl_iterate_phdr_early_exit) {
   static size_t call_count = 0;
@@ -67,6 +74,119 @@ TEST(link, dl_iterate_phdr) {
   ASSERT_EQ(0, dl_iterate_phdr(Functor::Callback, &f));
 }
 
+struct ProbeInfo {
+  const char* suffix;
+  bool found;
+  unsigned long long adds;
+  unsigned long long subs;
+  size_t tls_modid;
+  void* tls_data;
+};
+
+static int probe_callback(dl_phdr_info* info, size_t size, void* data) {
+  ProbeInfo* probe = reinterpret_cast<ProbeInfo*>(data);
+  if (size < offsetof(dl_phdr_info, dlpi_tls_data) + sizeof(info->dlpi_tls_data)) {
+    return 1;
+  }
+  probe->adds = info->dlpi_adds;
+  probe->subs = info->dlpi_subs;
+  std::string name(info->dlpi_name != nullptr ? info->dlpi_name : "");
+  std::string suffix(probe->suffix);
+  if (name.size() >= suffix.size() &&
+      name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+    probe->found = true;
+    probe->tls_modid = info->dlpi_tls_modid;
+    probe->tls_data = info->dlpi_tls_data;
+  }
+  return 0;
+}
+
+TEST(link, dl_iterate_phdr_adds_subs) {
+  ProbeInfo before = { "/libtest_empty.so" };
+  ASSERT_EQ(0, dl_iterate_phdr(probe_callback, &before));
+  ASSERT_FALSE(before.found);
+
+  void* handle = dlopen("libtest_empty.so", RTLD_NOW);
+  ASSERT_TRUE(handle != nullptr) << dlerror();
+  ProbeInfo loaded = { "/libtest_empty.so" };
+  ASSERT_EQ(0, dl_iterate_phdr(probe_callback, &loaded));
+  ASSERT_TRUE(loaded.found);
+  ASSERT_GT(loaded.adds, before.adds);
+  ASSERT_EQ(before.subs, loaded.subs);
+
+  ASSERT_EQ(0, dlclose(handle));
+  ProbeInfo unloaded = { "/libtest_empty.so" };
+  ASSERT_EQ(0, dl_iterate_phdr(probe_callback, &unloaded));
+  ASSERT_FALSE(unloaded.found);
+  ASSERT_EQ(loaded.adds, unloaded.adds);
+  ASSERT_GT(unloaded.subs, loaded.subs);
+}
+
+TEST(link, dl_iterate_phdr_tls) {
+  void* handle = dlopen("libtest_elftls_dynamic.so", RTLD_NOW);
+  ASSERT_TRUE(handle != nullptr) << dlerror();
+  auto get = reinterpret_cast<int* (*)()>(dlsym(handle, "elftls_dynamic_get"));
+  ASSERT_TRUE(get != nullptr) << dlerror();
+
+  // A new thread hasn't allocated its block yet.
+  std::thread([&] {
+    ProbeInfo probe = { "/libtest_elftls_dynamic.so" };
+    ASSERT_EQ(0, dl_iterate_phdr(probe_callback, &probe));
+    ASSERT_TRUE(probe.found);
+    ASSERT_NE(0u, probe.tls_modid);
+    ASSERT_EQ(nullptr, probe.tls_data);
+
+    int* var = get();
+    ASSERT_EQ(0, dl_iterate_phdr(probe_callback, &probe));
+    ASSERT_EQ(var, probe.tls_data);
+  }).join();
+
+  dlclose(handle);
+}
+
+TEST(link, dl_iterate_phdr_dlopen_from_callback) {
+  // dl_iterate_phdr() must not hold anything that dlopen() or dlclose() need.
+  auto callback = [](dl_phdr_info*, size_t, void*) {
+    void* handle = dlopen("libtest_empty.so", RTLD_NOW);
+    if (handle == nullptr) return -1;
+    return dlclose(handle) == 0 ? 1 : -1;
+  };
+  ASSERT_EQ(1, dl_iterate_phdr(callback, nullptr));
+}
+
+TEST(link, dl_iterate_phdr_concurrent_dlclose) {
+  std::atomic<bool> done(false);
+  std::thread loader([&] {
+    for (size_t i = 0; i < 200; ++i) {
+      void* handle = dlopen("libtest_empty.so", RTLD_NOW);
+      ASSERT_TRUE(handle != nullptr) << dlerror();
+      ASSERT_EQ(0, dlclose(handle));
+    }
+    done = true;
+  });
+
+  // Every program header handed out must stay readable for the duration of
+  // the callback, even if the library is being unloaded.
+  auto callback = [](dl_phdr_info* info, size_t, void* data) {
+    size_t* loads = reinterpret_cast<size_t*>(data);
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+      if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+        const char* start = reinterpret_cast<const char*>(info->dlpi_addr +
+                                                          info->dlpi_phdr[i].p_vaddr);
+        if (memcmp(start, ELFMAG, SELFMAG) == 0) ++*loads;
+        break;
+      }
+    }
+    return 0;
+  };
+  size_t loads = 0;
+  while (!done) {
+    ASSERT_EQ(0, dl_iterate_phdr(callback, &loads));
+  }
+  loader.join();
+  ASSERT_GT(loads, 0u);
+}
+
 #if __arm__
 static uintptr_t read_exidx_func(uintptr_t* entry) {
   int32_t offset = *entry;
@@ -22,7 +22,28 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <net/if.h>
+#include <net/route.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TemporaryFile.h"
+
+#if defined(__BIONIC__)
+#include <arpa/nameser.h>
+#include "dns/include/resolv_netid.h"
+#endif
 
 // https://code.google.com/p/android/issues/detail?id=13228
 TEST(netdb, freeaddrinfo_NULL) {
@@ -187,6 +208,50 @@ TEST(netdb, gethostbyname) {
   VerifyLocalhost(hp);
 }
 
+TEST(netdb, gethostbyname_case_insensitive) {
+  // /etc/hosts lookups ignore case, and so must the index over the file.
+  hostent* hp = gethostbyname("LocalHost");
+  VerifyLocalhost(hp);
+}
+
+// Runs 'fn' in a child process, which it must exit() from with 0. These
+// tests change namespaces, mounts, or the resolver's configuration and port
+// 53, which only root may do, so they do nothing otherwise.
+static void RunAsRootInChild(const std::function<void()>& fn) {
+  if (geteuid() != 0) {
+    GTEST_LOG_(INFO) << "This test must be run as root.\n";
+    return;
+  }
+  ASSERT_EXIT(fn(), testing::ExitedWithCode(0), "");
+}
+
+static void GetaddrinfoScopedHostsLine(const char* hosts) {
+  // Put our own hosts file in place of the system one, in a mount namespace
+  // of our own, and resolve locally rather than through the proxy.
+  if (unshare(CLONE_NEWNS) != 0) exit(1);
+  if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0) exit(2);
+  if (mount(hosts, _PATH_HOSTS, nullptr, MS_BIND, nullptr) != 0) exit(3);
+  setenv("ANDROID_DNS_MODE", "local", 1);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET6;
+  addrinfo* ai = nullptr;
+  if (getaddrinfo("scoped-host", nullptr, &hints, &ai) != 0) exit(4);
+  const sockaddr_in6* sin6 = reinterpret_cast<const sockaddr_in6*>(ai->ai_addr);
+  if (sin6->sin6_scope_id != if_nametoindex("lo")) exit(5);
+  freeaddrinfo(ai);
+  exit(0);
+}
+
+TEST(netdb, getaddrinfo_hosts_scoped_address) {
+  // A scoped address can't be indexed by address, but the names on its line
+  // must still be found.
+  TemporaryFile tf;
+  static const char kHosts[] = "fe80::1%lo scoped-host\n";
+  ASSERT_EQ(static_cast<ssize_t>(strlen(kHosts)), write(tf.fd, kHosts, strlen(kHosts)));
+  RunAsRootInChild([&tf]() { GetaddrinfoScopedHostsLine(tf.filename); });
+}
+
 TEST(netdb, gethostbyname2) {
   hostent* hp = gethostbyname2("localhost", AF_INET);
   VerifyLocalhost(hp);
@@ -319,3 +384,449 @@ TEST(netdb, getservbyname) {
   ASSERT_EQ(7, ntohs(s->s_port));
   ASSERT_STREQ("udp", s->s_proto);
 }
+
+#if defined(__BIONIC__)
+static int AsyncGetaddrinfo(const char* host, const char* serv, const addrinfo* hints,
+                            addrinfo** ai) {
+  android_net_context netcontext = {};
+  netcontext.uid = NET_CONTEXT_INVALID_UID;
+  android_getaddrinfo_request* request;
+  int error = android_getaddrinfo_async(host, serv, hints, &netcontext, &request);
+  if (error != 0) return error;
+  while (android_getaddrinfo_async_fd(request) != -1) {
+    pollfd pfd = { android_getaddrinfo_async_fd(request), POLLIN, 0 };
+    poll(&pfd, 1, android_getaddrinfo_async_timeout(request));
+    if (android_getaddrinfo_async_process(request) == 0) break;
+  }
+  return android_getaddrinfo_async_finish(request, ai);
+}
+#endif
+
+TEST(netdb, android_getaddrinfo_async) {
+#if defined(__BIONIC__)
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* ai = NULL;
+  ASSERT_EQ(0, AsyncGetaddrinfo("localhost", "smtp", &hints, &ai));
+  ASSERT_TRUE(ai != NULL);
+  ASSERT_EQ(AF_INET, ai->ai_family);
+  sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+  ASSERT_EQ(htonl(INADDR_LOOPBACK), sin->sin_addr.s_addr);
+  ASSERT_EQ(25U, ntohs(sin->sin_port));
+  freeaddrinfo(ai);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+TEST(netdb, android_getaddrinfo_async_numeric) {
+#if defined(__BIONIC__)
+  // Numeric hosts never need the network, so the request is complete at once.
+  android_net_context netcontext = {};
+  netcontext.uid = NET_CONTEXT_INVALID_UID;
+  android_getaddrinfo_request* request;
+  ASSERT_EQ(0, android_getaddrinfo_async("::1", NULL, NULL, &netcontext, &request));
+  ASSERT_EQ(-1, android_getaddrinfo_async_fd(request));
+  ASSERT_EQ(0, android_getaddrinfo_async_process(request));
+  addrinfo* ai = NULL;
+  ASSERT_EQ(0, android_getaddrinfo_async_finish(request, &ai));
+  ASSERT_TRUE(ai != NULL);
+  ASSERT_EQ(AF_INET6, ai->ai_family);
+  freeaddrinfo(ai);
+
+  // So are bad arguments.
+  ASSERT_EQ(0, android_getaddrinfo_async(NULL, NULL, NULL, &netcontext, &request));
+  ASSERT_EQ(-1, android_getaddrinfo_async_fd(request));
+  ASSERT_EQ(EAI_NONAME, android_getaddrinfo_async_finish(request, &ai));
+  ASSERT_TRUE(ai == NULL);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+#if defined(__BIONIC__)
+// Turns the query of 'n' bytes in 'buf' into an answer with the A record
+// 192.0.2.1, or just the header and question with TC set if 'truncate'.
+// Returns its length, or 0 if the query is malformed.
+static size_t MakeFakeDnsAnswer(u_char* buf, size_t n, bool truncate) {
+  if (n < HFIXEDSZ) return 0;
+  // Keep the question, drop anything after it (such as an EDNS0 OPT record).
+  size_t pos = HFIXEDSZ;
+  while (pos < n && buf[pos] != 0) pos += buf[pos] + 1;
+  pos += 1 + QFIXEDSZ;
+  if (pos + 16 > PACKETSZ) return 0;
+  HEADER* hp = reinterpret_cast<HEADER*>(buf);
+  hp->qr = 1;
+  hp->ra = 1;
+  hp->tc = truncate;
+  hp->ancount = htons(truncate ? 0 : 1);
+  hp->nscount = 0;
+  hp->arcount = 0;
+  if (truncate) return pos;
+  static const u_char kAnswer[] = {
+    0xc0, HFIXEDSZ,          // The name in the question.
+    0, ns_t_a, 0, ns_c_in,
+    0, 0, 0x0e, 0x10,        // TTL of one hour.
+    0, 4, 192, 0, 2, 1,
+  };
+  memcpy(buf + pos, kAnswer, sizeof(kAnswer));
+  return pos + sizeof(kAnswer);
+}
+
+// Turns the query of 'n' bytes in 'buf' into an answer in place, returning
+// its length, or 0 to ignore the query.
+typedef std::function<size_t(u_char* buf, size_t n)> FakeDnsAnswerer;
+
+// Answers every query on 'fd', counting them.
+static void ServeFakeDns(int fd, std::atomic<int>* queries, FakeDnsAnswerer answer) {
+  u_char buf[PACKETSZ];
+  while (true) {
+    sockaddr_storage from;
+    socklen_t fromlen = sizeof(from);
+    ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &fromlen);
+    if (n < 0) continue;
+    size_t len = answer(buf, n);
+    if (len == 0) continue;
+    ++*queries;
+    sendto(fd, buf, len, 0, reinterpret_cast<sockaddr*>(&from), fromlen);
+  }
+}
+
+// Answers one query on each connection to 'fd', counting them.
+static void ServeFakeDnsTcp(int fd, std::atomic<int>* queries) {
+  while (true) {
+    int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn == -1) continue;
+    u_char buf[INT16SZ + PACKETSZ];
+    size_t got = 0;
+    while (got < INT16SZ || got < INT16SZ + ns_get16(buf)) {
+      ssize_t n = recv(conn, buf + got, sizeof(buf) - got, 0);
+      if (n <= 0) break;
+      got += n;
+    }
+    size_t len = (got >= INT16SZ) ? MakeFakeDnsAnswer(buf + INT16SZ, got - INT16SZ, false) : 0;
+    if (len != 0) {
+      ++*queries;
+      ns_put16(len, buf);
+      send(conn, buf, INT16SZ + len, MSG_NOSIGNAL);
+    }
+    close(conn);
+  }
+}
+
+// Resolves in-process, on network 'net_id' of our own with ServeFakeDns()
+// as its only server, answering with 'answer' over UDP. If 'tcp', the
+// server also answers over TCP, with MakeFakeDnsAnswer(). Exits with 1 or 2
+// on failure.
+static android_net_context UseFakeDnsNetwork(unsigned net_id, std::atomic<int>* queries,
+                                             const FakeDnsAnswerer& answer, bool tcp) {
+  // The resolver always talks to port 53, on an address of our own in 127/8.
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sockaddr_in sin = {};
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(NAMESERVER_PORT);
+  inet_pton(AF_INET, "127.0.0.9", &sin.sin_addr);
+  if (fd == -1 || bind(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) == -1) exit(1);
+  std::thread(ServeFakeDns, fd, queries, answer).detach();
+  if (tcp) {
+    int tcp = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (tcp == -1 || setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        bind(tcp, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) == -1 || listen(tcp, 4) == -1) {
+      exit(1);
+    }
+    std::thread(ServeFakeDnsTcp, tcp, queries).detach();
+  }
+
+  setenv("ANDROID_DNS_MODE", "local", 1);
+  const char* servers[] = { "127.0.0.9" };
+  if (_resolv_set_nameservers_for_net(net_id, servers, 1, "", nullptr) != 0) exit(2);
+  android_net_context netcontext = {};
+  netcontext.app_netid = netcontext.dns_netid = net_id;
+  netcontext.uid = NET_CONTEXT_INVALID_UID;
+  return netcontext;
+}
+
+// As above, answering with MakeFakeDnsAnswer(). If 'truncate', the server
+// truncates every answer over UDP, and answers in full over TCP.
+static android_net_context UseFakeDnsNetwork(unsigned net_id, std::atomic<int>* queries,
+                                             bool truncate = false) {
+  auto answer = [truncate](u_char* buf, size_t n) { return MakeFakeDnsAnswer(buf, n, truncate); };
+  return UseFakeDnsNetwork(net_id, queries, answer, truncate);
+}
+
+static void AsyncGetaddrinfoFromFakeServer() {
+  std::atomic<int> queries(0);
+  android_net_context netcontext = UseFakeDnsNetwork(30110, &queries);
+
+  // Two lookups of the same name on one thread: the second waits for the
+  // first's answer rather than for a pending request, or the network.
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  android_getaddrinfo_request* requests[2];
+  for (auto& request : requests) {
+    if (android_getaddrinfo_async("async.example", nullptr, &hints, &netcontext, &request) != 0) {
+      exit(3);
+    }
+  }
+  if (android_getaddrinfo_async_fd(requests[0]) == -1) exit(4);
+  while (true) {
+    pollfd pfds[2];
+    int timeout = -1, busy = 0;
+    for (size_t i = 0; i < 2; ++i) {
+      pfds[i] = { android_getaddrinfo_async_fd(requests[i]), POLLIN, 0 };
+      int ms = android_getaddrinfo_async_timeout(requests[i]);
+      if (pfds[i].fd != -1 || ms != -1) ++busy;
+      if (ms != -1 && (timeout == -1 || ms < timeout)) timeout = ms;
+    }
+    if (busy == 0) break;
+    poll(pfds, 2, timeout);
+    for (auto request : requests) android_getaddrinfo_async_process(request);
+  }
+
+  for (auto request : requests) {
+    addrinfo* ai = nullptr;
+    if (android_getaddrinfo_async_finish(request, &ai) != 0 || ai == nullptr) exit(5);
+    sockaddr_in* result = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+    if (ai->ai_family != AF_INET || result->sin_addr.s_addr != htonl(0xc0000201)) exit(6);
+    freeaddrinfo(ai);
+  }
+  if (queries != 1) exit(7);
+  exit(0);
+}
+
+static void AsyncGetaddrinfoOverTcp() {
+  std::atomic<int> queries(0);
+  android_net_context netcontext = UseFakeDnsNetwork(30112, &queries, true);
+
+  // The truncated answer is asked for again over TCP, without a worker.
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  android_getaddrinfo_request* request;
+  if (android_getaddrinfo_async("tcp.example", nullptr, &hints, &netcontext, &request) != 0) {
+    exit(3);
+  }
+  while (android_getaddrinfo_async_fd(request) != -1 ||
+         android_getaddrinfo_async_timeout(request) != -1) {
+    pollfd pfd = { android_getaddrinfo_async_fd(request), POLLIN, 0 };
+    poll(&pfd, 1, android_getaddrinfo_async_timeout(request));
+    if (android_getaddrinfo_async_process(request) == 0) break;
+  }
+  addrinfo* ai = nullptr;
+  if (android_getaddrinfo_async_finish(request, &ai) != 0 || ai == nullptr) exit(4);
+  sockaddr_in* result = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+  if (ai->ai_family != AF_INET || result->sin_addr.s_addr != htonl(0xc0000201)) exit(5);
+  freeaddrinfo(ai);
+  // Once over UDP, once over TCP; the replay finds the answer in the cache.
+  if (queries != 2) exit(6);
+  exit(0);
+}
+#endif
+
+TEST(netdb, android_getaddrinfo_async_network) {
+#if defined(__BIONIC__)
+  RunAsRootInChild(AsyncGetaddrinfoFromFakeServer);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+TEST(netdb, android_getaddrinfo_async_tcp) {
+#if defined(__BIONIC__)
+  RunAsRootInChild(AsyncGetaddrinfoOverTcp);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+#if defined(__BIONIC__)
+static void SetUpLoopbackOnlyNetwork() {
+  // A network namespace of our own, where nothing but loopback is up.
+  if (unshare(CLONE_NEWNET) != 0) exit(10);
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  ifreq ifr = {};
+  strcpy(ifr.ifr_name, "lo");
+  ifr.ifr_flags = IFF_UP;
+  if (fd == -1 || ioctl(fd, SIOCSIFFLAGS, &ifr) != 0) exit(11);
+  close(fd);
+}
+
+static void AddDefaultRouteViaLoopback() {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  rtentry rt = {};
+  reinterpret_cast<sockaddr_in*>(&rt.rt_dst)->sin_family = AF_INET;
+  reinterpret_cast<sockaddr_in*>(&rt.rt_genmask)->sin_family = AF_INET;
+  rt.rt_flags = RTF_UP;
+  char dev[] = "lo";
+  rt.rt_dev = dev;
+  if (fd == -1 || ioctl(fd, SIOCADDRT, &rt) != 0) exit(12);
+  close(fd);
+}
+
+static void GetaddrinfoSeesRouteChange() {
+  SetUpLoopbackOnlyNetwork();
+  std::atomic<int> queries(0);
+  android_net_context netcontext = UseFakeDnsNetwork(30111, &queries);
+  addrinfo hints = {};
+  hints.ai_flags = AI_ADDRCONFIG;
+  addrinfo* ai = nullptr;
+
+  // With no route to anywhere, AI_ADDRCONFIG finds no usable address family
+  // and nothing is asked. getaddrinfo remembers that, until the routes change.
+  if (android_getaddrinfofornetcontext("route.example", nullptr, &hints, &netcontext, &ai) == 0) {
+    exit(3);
+  }
+  if (queries != 0) exit(4);
+
+  // Once there is a route, the very next lookup knows.
+  AddDefaultRouteViaLoopback();
+  if (android_getaddrinfofornetcontext("route.example", nullptr, &hints, &netcontext, &ai) != 0) {
+    exit(5);
+  }
+  sockaddr_in* result = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+  if (ai->ai_family != AF_INET || result->sin_addr.s_addr != htonl(0xc0000201)) exit(6);
+  freeaddrinfo(ai);
+  exit(0);
+}
+#endif
+
+TEST(netdb, getaddrinfo_route_change_seen_at_once) {
+#if defined(__BIONIC__)
+  RunAsRootInChild(GetaddrinfoSeesRouteChange);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+#if defined(__BIONIC__)
+// Answers the query of 'n' bytes in 'buf' according to the first label of
+// its name, with records that are cut short, miscounted or not ours.
+static size_t MakeOddDnsAnswer(u_char* buf, size_t n) {
+  if (n < HFIXEDSZ || buf[HFIXEDSZ] == 0) return 0;
+  std::string label(reinterpret_cast<char*>(buf + HFIXEDSZ + 1), buf[HFIXEDSZ]);
+  size_t pos = HFIXEDSZ;
+  while (pos < n && buf[pos] != 0) pos += buf[pos] + 1;
+  pos += 1 + QFIXEDSZ;
+  if (pos + 128 > PACKETSZ) return 0;
+  HEADER* hp = reinterpret_cast<HEADER*>(buf);
+  hp->qr = 1;
+  hp->ra = 1;
+  hp->nscount = 0;
+  hp->arcount = 0;
+
+  // An A record for 'owner' (the offset of a name), or a CNAME to 'target'.
+  auto add = [&](u_char owner, uint16_t type, const u_char* rdata, size_t rdlen) {
+    const u_char rr[] = { 0xc0, owner, 0, static_cast<u_char>(type), 0, ns_c_in,
+                          0, 0, 0x0e, 0x10, 0, static_cast<u_char>(rdlen) };
+    memcpy(buf + pos, rr, sizeof(rr));
+    memcpy(buf + pos + sizeof(rr), rdata, rdlen);
+    pos += sizeof(rr) + rdlen;
+  };
+  auto add_a = [&](u_char owner, u_char last) {
+    const u_char addr[] = { 192, 0, 2, last };
+    add(owner, ns_t_a, addr, sizeof(addr));
+  };
+
+  if (label == "trailing") {
+    // An address, then an authority record that runs off the end.
+    add_a(HFIXEDSZ, 1);
+    hp->ancount = htons(1);
+    hp->nscount = htons(1);
+    buf[pos++] = 0xc0;
+    buf[pos++] = HFIXEDSZ;
+    buf[pos++] = 0;
+  } else if (label == "cut") {
+    // Two addresses, then a third cut short in its address.
+    add_a(HFIXEDSZ, 1);
+    add_a(HFIXEDSZ, 2);
+    add_a(HFIXEDSZ, 3);
+    pos -= 2;
+    hp->ancount = htons(3);
+  } else if (label == "overcount") {
+    // One address, in an answer that claims many more.
+    add_a(HFIXEDSZ, 1);
+    hp->ancount = htons(0xffff);
+  } else if (label == "cname") {
+    // A CNAME, an address for the name asked (no longer ours), then an
+    // address for the canonical name.
+    static const u_char kTarget[] = "\x06target\x07" "example";
+    u_char target = static_cast<u_char>(pos + RRFIXEDSZ + 2);
+    add(HFIXEDSZ, ns_t_cname, kTarget, sizeof(kTarget));
+    add_a(HFIXEDSZ, 4);
+    add_a(target, 3);
+    hp->ancount = htons(3);
+  } else {
+    return 0;
+  }
+  return pos;
+}
+
+// Returns the IPv4 addresses in 'ai', as their last bytes.
+static std::vector<int> LastBytes(const addrinfo* ai) {
+  std::vector<int> result;
+  for (; ai != nullptr; ai = ai->ai_next) {
+    const sockaddr_in* sin = reinterpret_cast<const sockaddr_in*>(ai->ai_addr);
+    result.push_back(ntohl(sin->sin_addr.s_addr) & 0xff);
+  }
+  return result;
+}
+
+static void GetaddrinfoOddAnswers() {
+  std::atomic<int> queries(0);
+  android_net_context netcontext = UseFakeDnsNetwork(30113, &queries, MakeOddDnsAnswer, false);
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_CANONNAME;
+
+  // Whatever was parsed before a malformed record is still an answer.
+  struct {
+    const char* name;
+    std::vector<int> expected;
+  } cases[] = {
+    { "trailing.example", { 1 } },
+    { "cut.example", { 1, 2 } },
+    { "overcount.example", { 1 } },
+    { "cname.example", { 3 } },
+  };
+  addrinfo* results[4];
+  for (size_t i = 0; i < 4; ++i) {
+    if (android_getaddrinfofornetcontext(cases[i].name, nullptr, &hints, &netcontext,
+                                         &results[i]) != 0) {
+      exit(3);
+    }
+    if (LastBytes(results[i]) != cases[i].expected) exit(4);
+  }
+  if (results[3]->ai_canonname == nullptr ||
+      strcmp(results[3]->ai_canonname, "target.example") != 0) {
+    exit(5);
+  }
+
+  // The nodes of a list may be freed in any company: interleave the two
+  // nodes of one answer with a numeric result and the node of another.
+  addrinfo* numeric;
+  hints.ai_flags = AI_NUMERICHOST;
+  if (android_getaddrinfofornetcontext("192.0.2.9", nullptr, &hints, &netcontext,
+                                       &numeric) != 0) {
+    exit(6);
+  }
+  addrinfo* second = results[1]->ai_next;
+  results[1]->ai_next = numeric;
+  numeric->ai_next = results[2];
+  results[2]->ai_next = second;
+  if (LastBytes(results[1]) != std::vector<int>({ 1, 9, 1, 2 })) exit(7);
+  freeaddrinfo(results[1]);
+  freeaddrinfo(results[0]);
+  freeaddrinfo(results[3]);
+  exit(0);
+}
+#endif
+
+TEST(netdb, getaddrinfo_odd_answers) {
+#if defined(__BIONIC__)
+  RunAsRootInChild(GetaddrinfoOddAnswers);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
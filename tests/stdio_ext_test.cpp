@@ -162,3 +162,32 @@ TEST(stdio_ext, __fsetlocking_BYCALLER) {
   ASSERT_EQ(0, pthread_join(thread, nullptr));
   __fsetlocking(stdout, old_state);
 }
+
+static void ReadSequentially(FILE* fp) {
+  while (fgetc(fp) != EOF) {
+  }
+}
+
+TEST(stdio_ext, __fbufsize_grows_for_sequential_reads) {
+#if defined(__BIONIC__)
+  TemporaryFile tf;
+  char buf[64 * 1024] = {};
+  for (size_t i = 0; i < 16; ++i) ASSERT_EQ(static_cast<ssize_t>(sizeof(buf)), write(tf.fd, buf, sizeof(buf)));
+
+  FILE* fp = fopen(tf.filename, "r");
+  ASSERT_EQ('\0', fgetc(fp));
+  size_t initial_size = __fbufsize(fp);
+  ReadSequentially(fp);
+  ASSERT_GT(__fbufsize(fp), initial_size);
+  fclose(fp);
+
+  // An explicit setvbuf size is left alone.
+  fp = fopen(tf.filename, "r");
+  ASSERT_EQ(0, setvbuf(fp, nullptr, _IOFBF, 1024));
+  ReadSequentially(fp);
+  ASSERT_EQ(1024U, __fbufsize(fp));
+  fclose(fp);
+#else
+  GTEST_LOG_(INFO) << "This test checks bionic's adaptive buffer sizing.\n";
+#endif
+}
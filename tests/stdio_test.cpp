@@ -21,14 +21,18 @@
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <locale.h>
 
+#include <string>
 #include <vector>
 
+#include <android-base/file.h>
+
 #include "BionicDeathTest.h"
 #include "TemporaryFile.h"
 #include "utils.h"
@@ -974,6 +978,83 @@ TEST(STDIO_TEST, open_memstream) {
   free(p);
 }
 
+TEST(STDIO_TEST, open_memstream_large) {
+  char* p = nullptr;
+  size_t size = 0;
+  FILE* fp = open_memstream(&p, &size);
+  std::string expected;
+  for (size_t i = 0; i < 100000; ++i) {
+    ASSERT_GT(fprintf(fp, "%zu,", i), 0);
+    expected += std::to_string(i) + ",";
+  }
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_EQ(expected.size(), size);
+  ASSERT_EQ(expected, p);
+  fclose(fp);
+  free(p);
+}
+
+TEST(STDIO_TEST, open_memstream_seek) {
+  char* p = nullptr;
+  size_t size = 0;
+  FILE* fp = open_memstream(&p, &size);
+  ASSERT_NE(EOF, fputs("hello, world!", fp));
+
+  // Overwrite in the middle.
+  ASSERT_EQ(0, fseek(fp, 0, SEEK_SET));
+  ASSERT_NE(EOF, fputs("J", fp));
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_STREQ("Jello, world!", p);
+  ASSERT_EQ(1U, size);
+
+  // Seeking past the end and writing leaves a gap of NULs.
+  ASSERT_EQ(0, fseek(fp, 16, SEEK_SET));
+  ASSERT_NE(EOF, fputs("xyz", fp));
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_EQ(19U, size);
+  ASSERT_EQ(0, memcmp("Jello, world!\0\0\0xyz", p, 20));
+  ASSERT_EQ(19, ftell(fp));
+
+  fclose(fp);
+  free(p);
+}
+
+TEST(STDIO_TEST, open_memstream_fpurge) {
+#if defined(__BIONIC__)
+  char* p = nullptr;
+  size_t size = 0;
+  FILE* fp = open_memstream(&p, &size);
+  ASSERT_NE(EOF, fputs("hello", fp));
+  ASSERT_EQ(0, fflush(fp));
+
+  // Purged output past the end never shows, and the string stays terminated.
+  ASSERT_GT(fprintf(fp, ", world! %d", 123), 0);
+  __fpurge(fp);
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_STREQ("hello", p);
+  ASSERT_EQ(5U, size);
+
+  // Nor does purged output over what was already written.
+  ASSERT_EQ(0, fseek(fp, 0, SEEK_SET));
+  ASSERT_GT(fprintf(fp, "J%s", "ELLO"), 0);
+  __fpurge(fp);
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_STREQ("hello", p);
+
+  // And writing carries on normally afterwards.
+  ASSERT_EQ(0, fseek(fp, 0, SEEK_END));
+  ASSERT_GT(fprintf(fp, ", %s!", "world"), 0);
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_STREQ("hello, world!", p);
+  ASSERT_EQ(13U, size);
+
+  fclose(fp);
+  free(p);
+#else
+  GTEST_LOG_(INFO) << "glibc's string shows purged output.\n";
+#endif
+}
+
 TEST(STDIO_TEST, open_memstream_EINVAL) {
 #if defined(__BIONIC__)
   char* p;
@@ -1465,3 +1546,193 @@ TEST(STDIO_TEST, sprintf_30445072) {
   sprintf(&buf[0], "hello");
   ASSERT_EQ(buf, "hello");
 }
+
+static void AssertFdContains(int fd, const char* expected) {
+  char buf[BUFSIZ];
+  ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+  ASSERT_NE(-1, n);
+  buf[n] = '\0';
+  ASSERT_STREQ(expected, buf);
+}
+
+TEST(STDIO_TEST, fflush_NULL_flushes_all_writers) {
+  // Lots of idle readers and a few writers that reach write mode in different ways.
+  std::vector<FILE*> readers;
+  for (size_t i = 0; i < 128; ++i) {
+    FILE* fp = fopen("/proc/version", "r");
+    ASSERT_TRUE(fp != nullptr);
+    readers.push_back(fp);
+  }
+
+  TemporaryFile tf1;
+  FILE* fp1 = fdopen(dup(tf1.fd), "w");
+  ASSERT_EQ(1, fputs("a", fp1));
+
+  TemporaryFile tf2;
+  FILE* fp2 = fdopen(dup(tf2.fd), "w");
+  ASSERT_EQ(0, fseek(fp2, 0, SEEK_SET));
+  ASSERT_EQ('b', putc('b', fp2));
+
+  TemporaryFile tf3;
+  FILE* fp3 = fdopen(dup(tf3.fd), "w");
+  char buf3[BUFSIZ];
+  ASSERT_EQ(0, setvbuf(fp3, buf3, _IOFBF, sizeof(buf3)));
+  ASSERT_EQ('c', putc('c', fp3));
+
+  AssertFdContains(tf1.fd, "");
+  AssertFdContains(tf2.fd, "");
+  AssertFdContains(tf3.fd, "");
+
+  ASSERT_EQ(0, fflush(nullptr));
+
+  AssertFdContains(tf1.fd, "a");
+  AssertFdContains(tf2.fd, "b");
+  AssertFdContains(tf3.fd, "c");
+
+  ASSERT_EQ(0, fclose(fp1));
+  ASSERT_EQ(0, fclose(fp2));
+  ASSERT_EQ(0, fclose(fp3));
+  for (FILE* fp : readers) ASSERT_EQ(0, fclose(fp));
+}
+
+TEST(STDIO_TEST, fclose_fopen_reuses_slots) {
+  // Closed FILEs should be handed out again rather than growing the pool.
+  for (size_t i = 0; i < 1024; ++i) {
+    FILE* fp = fopen("/proc/version", "r");
+    ASSERT_TRUE(fp != nullptr);
+    FILE* fp2 = fopen("/proc/version", "r");
+    ASSERT_TRUE(fp2 != nullptr);
+    ASSERT_NE(fp, fp2);
+    ASSERT_EQ(0, fclose(fp));
+    ASSERT_EQ(0, fclose(fp2));
+  }
+
+#if defined(__BIONIC__)
+  // The most recently released slot is the next one handed out.
+  FILE* fp = fopen("/proc/version", "r");
+  ASSERT_TRUE(fp != nullptr);
+  for (size_t i = 0; i < 1024; ++i) {
+    ASSERT_EQ(0, fclose(fp));
+    FILE* fp2 = fopen("/proc/version", "r");
+    ASSERT_EQ(fp, fp2);
+  }
+  ASSERT_EQ(0, fclose(fp));
+#endif
+}
+
+TEST(STDIO_TEST, fopen_m_mode) {
+  TemporaryFile tf;
+  std::string expected;
+  for (size_t i = 0; i < 4096; ++i) expected += "line " + std::to_string(i) + "\n";
+  ASSERT_TRUE(android::base::WriteStringToFd(expected, tf.fd));
+
+  FILE* fp = fopen(tf.filename, "rme");
+  ASSERT_TRUE(fp != nullptr);
+
+  // fgets and getline see the same lines as a normal stream.
+  char line[64];
+  ASSERT_EQ(line, fgets(line, sizeof(line), fp));
+  ASSERT_STREQ("line 0\n", line);
+  char* buf = nullptr;
+  size_t len = 0;
+  ASSERT_EQ(7, getline(&buf, &len, fp));
+  ASSERT_STREQ("line 1\n", buf);
+  free(buf);
+  ASSERT_EQ(14, ftell(fp));
+
+  // Seeking to an unaligned offset and reading with fread.
+  ASSERT_EQ(0, fseek(fp, 4103, SEEK_SET));
+  char chunk[16];
+  ASSERT_EQ(sizeof(chunk), fread(chunk, 1, sizeof(chunk), fp));
+  ASSERT_EQ(0, memcmp(expected.data() + 4103, chunk, sizeof(chunk)));
+  ASSERT_EQ(4103 + static_cast<long>(sizeof(chunk)), ftell(fp));
+
+  // A large fread reads through to EOF.
+  std::vector<char> rest(expected.size());
+  size_t n = fread(rest.data(), 1, rest.size(), fp);
+  ASSERT_EQ(expected.size() - 4103 - sizeof(chunk), n);
+  ASSERT_EQ(0, memcmp(expected.data() + 4103 + sizeof(chunk), rest.data(), n));
+  ASSERT_TRUE(feof(fp));
+
+  // ...but ungetc still works.
+  ASSERT_EQ('x', ungetc('x', fp));
+  ASSERT_EQ('x', fgetc(fp));
+  ASSERT_EQ(EOF, fgetc(fp));
+
+  ASSERT_EQ(0, fclose(fp));
+}
+
+TEST(STDIO_TEST, fdopen_m_mode_pipe_fallback) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ(6, write(fds[1], "hello\n", 6));
+  close(fds[1]);
+
+  FILE* fp = fdopen(fds[0], "rm");
+  ASSERT_TRUE(fp != nullptr);
+  char line[16];
+  ASSERT_EQ(line, fgets(line, sizeof(line), fp));
+  ASSERT_STREQ("hello\n", line);
+  ASSERT_EQ(nullptr, fgets(line, sizeof(line), fp));
+  ASSERT_TRUE(feof(fp));
+  ASSERT_EQ(0, fclose(fp));
+}
+
+TEST(STDIO_TEST, sscanf_d_u_s) {
+  int i1, i2;
+  unsigned u;
+  long long ll;
+  char s1[32], s2[32];
+
+  ASSERT_EQ(4, sscanf("  -123\t+45 678 foo", "%d%d%u%31s", &i1, &i2, &u, s1));
+  ASSERT_EQ(-123, i1);
+  ASSERT_EQ(45, i2);
+  ASSERT_EQ(678U, u);
+  ASSERT_STREQ("foo", s1);
+
+  // Field widths.
+  ASSERT_EQ(3, sscanf("12345abcdef", "%3d%2d%3s", &i1, &i2, s1));
+  ASSERT_EQ(123, i1);
+  ASSERT_EQ(45, i2);
+  ASSERT_STREQ("abc", s1);
+
+  // Too many digits for the fast path, and overflow.
+  ASSERT_EQ(1, sscanf("1234567890123456789", "%lld", &ll));
+  ASSERT_EQ(1234567890123456789LL, ll);
+  ASSERT_EQ(1, sscanf("-99999999999999999999", "%lld", &ll));
+  ASSERT_EQ(LLONG_MIN, ll);
+
+  // Negative numbers with %u wrap like strtoul.
+  ASSERT_EQ(1, sscanf("-1", "%u", &u));
+  ASSERT_EQ(UINT_MAX, u);
+
+  // Signs without digits don't match.
+  ASSERT_EQ(0, sscanf("- 1", "%d", &i1));
+  ASSERT_EQ(0, sscanf("+x", "%d", &i1));
+
+  // %*s and %n.
+  int n;
+  ASSERT_EQ(1, sscanf("skip me", "%*s %31s%n", s2, &n));
+  ASSERT_STREQ("me", s2);
+  ASSERT_EQ(7, n);
+}
+
+TEST(STDIO_TEST, fscanf_across_buffer_boundaries) {
+  TemporaryFile tf;
+  FILE* fp = fdopen(tf.fd, "w+");
+  ASSERT_TRUE(fp != nullptr);
+  // A tiny buffer makes every token straddle a refill.
+  char buf[4];
+  ASSERT_EQ(0, setvbuf(fp, buf, _IOFBF, sizeof(buf)));
+  ASSERT_GT(fprintf(fp, "   1234567 -89 hello,world\n"), 0);
+  rewind(fp);
+
+  int i1, i2;
+  char s[32];
+  ASSERT_EQ(3, fscanf(fp, "%d%d%31s", &i1, &i2, s));
+  ASSERT_EQ(1234567, i1);
+  ASSERT_EQ(-89, i2);
+  ASSERT_STREQ("hello,world", s);
+  ASSERT_EQ(EOF, fscanf(fp, "%d", &i1));
+  fclose(fp);
+}